@@ -0,0 +1,151 @@
+#include "anillo.h"
+#include <limits.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define ANILLO_MAGICO 0x414e4c4fu // "ANLO"
+
+static size_t tamano_anillo(uint32_t num_ranuras) {
+    return sizeof(anillo_t) + (size_t)num_ranuras * sizeof(ranura_anillo_t);
+}
+
+static long futex(uint32_t* direccion, int operacion, uint32_t valor, const struct timespec* plazo) {
+    // Sin FUTEX_PRIVATE_FLAG: el futex se comparte entre procesos
+    return syscall(SYS_futex, direccion, operacion, valor, plazo, NULL, 0);
+}
+
+anillo_escritor_t* anillo_crear(int num_ranuras) {
+    uint32_t ranuras = 1;
+    while (ranuras < (uint32_t)num_ranuras) ranuras <<= 1;
+
+    anillo_escritor_t* escritor = malloc(sizeof(anillo_escritor_t));
+    if (escritor == NULL) {
+        perror("malloc anillo");
+        return NULL;
+    }
+    int id = shmget(IPC_PRIVATE, tamano_anillo(ranuras), IPC_CREAT | 0666);
+    if (id == -1) {
+        perror("shmget anillo");
+        free(escritor);
+        return NULL;
+    }
+    anillo_t* anillo = shmat(id, NULL, 0);
+    // En Linux un segmento marcado sigue admitiendo shmat hasta que nadie lo usa
+    shmctl(id, IPC_RMID, NULL);
+    if (anillo == (void*)-1) {
+        perror("shmat anillo");
+        free(escritor);
+        return NULL;
+    }
+
+    // El segmento llega a cero: solo hace falta la cabecera
+    anillo->num_ranuras = ranuras;
+    __atomic_store_n(&anillo->magico, ANILLO_MAGICO, __ATOMIC_RELEASE);
+    escritor->compartido = anillo;
+    escritor->id_shm = id;
+    escritor->num_ranuras = ranuras;
+    escritor->publicados = 0;
+    return escritor;
+}
+
+void anillo_destruir(anillo_escritor_t* escritor) {
+    if (escritor == NULL) return;
+    shmdt(escritor->compartido);
+    free(escritor);
+}
+
+anillo_t* anillo_conectar(int id_shm) {
+    struct shmid_ds info;
+    if (shmctl(id_shm, IPC_STAT, &info) == -1) return NULL;
+
+    anillo_t* anillo = shmat(id_shm, NULL, 0);
+    if (anillo == (void*)-1) return NULL;
+
+    uint32_t ranuras = anillo->num_ranuras;
+    if (__atomic_load_n(&anillo->magico, __ATOMIC_ACQUIRE) != ANILLO_MAGICO || ranuras == 0 ||
+        (ranuras & (ranuras - 1)) != 0 || info.shm_segsz < tamano_anillo(ranuras)) {
+        shmdt(anillo);
+        return NULL;
+    }
+    return anillo;
+}
+
+void anillo_desconectar(anillo_t* anillo) {
+    if (anillo != NULL) shmdt(anillo);
+}
+
+void anillo_publicar(anillo_escritor_t* escritor, const char* texto, size_t longitud, int id_cola_excluida) {
+    // Posición y tamaño salen de la copia privada; la cabecera compartida solo se escribe
+    anillo_t* anillo = escritor->compartido;
+    uint64_t n = escritor->publicados;
+    ranura_anillo_t* ranura = &anillo->ranuras[n & (escritor->num_ranuras - 1)];
+    if (longitud > ANILLO_MAX_TEXTO) longitud = ANILLO_MAX_TEXTO;
+
+    // Quien lea la ranura a medias verá un número distinto al que buscaba
+    __atomic_store_n(&ranura->numero, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ranura->id_cola_excluida = id_cola_excluida;
+    ranura->longitud = (uint16_t)longitud;
+    memcpy(ranura->texto, texto, longitud);
+    __atomic_store_n(&ranura->numero, n + 1, __ATOMIC_RELEASE);
+
+    escritor->publicados = n + 1;
+    __atomic_store_n(&anillo->publicados, n + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&anillo->futex, (uint32_t)(n + 1), __ATOMIC_SEQ_CST);
+    // Si un lector se apuntó después de esta carga, el futex ya no vale su cursor y no dormirá
+    if (__atomic_load_n(&anillo->esperando, __ATOMIC_SEQ_CST) > 0) {
+        futex(&anillo->futex, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+/**
+ * @brief Salta el cursor al mensaje más antiguo que aún no se ha pisado.
+ */
+static resultado_anillo_t saltar(const anillo_t* anillo, uint64_t* cursor, uint64_t* perdidos) {
+    uint64_t publicados = anillo_publicados(anillo);
+    // La ranura del más antiguo puede estar reescribiéndose: se deja una de margen
+    uint64_t mas_antiguo = publicados + 1 > anillo->num_ranuras ? publicados + 1 - anillo->num_ranuras : 0;
+    if (mas_antiguo <= *cursor) mas_antiguo = *cursor + 1;
+    *perdidos = mas_antiguo - *cursor;
+    *cursor = mas_antiguo;
+    return ANILLO_DESBORDADO;
+}
+
+resultado_anillo_t anillo_leer(const anillo_t* anillo, uint64_t* cursor, char* texto, size_t* longitud,
+                               int* id_cola_excluida, uint64_t* perdidos) {
+    uint64_t publicados = anillo_publicados(anillo);
+    if (*cursor >= publicados) return ANILLO_VACIO;
+    if (publicados - *cursor > anillo->num_ranuras) return saltar(anillo, cursor, perdidos);
+
+    const ranura_anillo_t* ranura = &anillo->ranuras[*cursor & (anillo->num_ranuras - 1)];
+    if (__atomic_load_n(&ranura->numero, __ATOMIC_ACQUIRE) != *cursor + 1) return saltar(anillo, cursor, perdidos);
+
+    size_t leido = ranura->longitud;
+    if (leido > ANILLO_MAX_TEXTO) leido = ANILLO_MAX_TEXTO;
+    *id_cola_excluida = ranura->id_cola_excluida;
+    memcpy(texto, ranura->texto, leido);
+
+    // Si el escritor tocó la ranura durante la copia, lo copiado no vale
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&ranura->numero, __ATOMIC_RELAXED) != *cursor + 1) return saltar(anillo, cursor, perdidos);
+
+    *longitud = leido;
+    (*cursor)++;
+    return ANILLO_MENSAJE;
+}
+
+void anillo_esperar(anillo_t* anillo, uint64_t cursor, int plazo_ms) {
+    struct timespec plazo = { plazo_ms / 1000, (long)(plazo_ms % 1000) * 1000000L };
+
+    __atomic_add_fetch(&anillo->esperando, 1, __ATOMIC_SEQ_CST);
+    // El núcleo compara el futex con el cursor: si ya se publicó algo, vuelve en el acto
+    if (anillo_publicados(anillo) == cursor) {
+        futex(&anillo->futex, FUTEX_WAIT, (uint32_t)cursor, &plazo);
+    }
+    __atomic_sub_fetch(&anillo->esperando, 1, __ATOMIC_SEQ_CST);
+}
+
+void anillo_despertar(anillo_t* anillo) {
+    futex(&anillo->futex, FUTEX_WAKE, INT_MAX, NULL);
+}
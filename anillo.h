@@ -0,0 +1,103 @@
+#ifndef ANILLO_H
+#define ANILLO_H
+
+#include "common.h"
+
+/*
+ * Anillo de difusión en memoria compartida (modo "-m anillo" del servidor).
+ *
+ * Cada sala tiene un segmento System V con un anillo de ranuras de tamaño
+ * fijo. El trabajador dueño de la sala es el único escritor: publica cada
+ * notificación una sola vez y los clientes de la sala la leen desde su propio
+ * cursor, sin pasar por el núcleo. Los lectores dormidos esperan en un futex
+ * compartido que el escritor solo despierta si hay alguien esperando.
+ *
+ * Cada ranura lleva el número del mensaje que contiene (a modo de seqlock):
+ * un lector que se queda más de una vuelta atrás lo detecta y recibe
+ * ANILLO_DESBORDADO con el número de mensajes perdidos.
+ *
+ * Los clientes conectan el segmento con permiso de escritura (para apuntarse en
+ * el futex), así que pueden pisar la cabecera. El servidor no lee de ella nada
+ * que use para escribir: su cursor y el número de ranuras viven en un
+ * anillo_escritor_t privado, y la cabecera solo es salida para los lectores.
+ */
+
+#define ANILLO_MAX_TEXTO (MAX_TEXTO + MAX_NOMBRE + 8) // Cabe "[usuario]: texto"
+
+typedef struct {
+    uint64_t numero;             // Mensaje n publicado aquí como n+1; 0 mientras se escribe
+    int32_t id_cola_excluida;    // Cliente que no debe mostrarlo (el autor), -1 si nadie
+    uint16_t longitud;
+    char texto[ANILLO_MAX_TEXTO];
+} ranura_anillo_t;
+
+typedef struct {
+    uint32_t magico;
+    uint32_t num_ranuras;        // Potencia de dos
+    uint32_t futex;              // 32 bits bajos de publicados: aquí duermen los lectores
+    uint32_t esperando;          // Lectores dormidos en el futex
+    uint64_t publicados;         // Mensajes publicados desde la creación
+    ranura_anillo_t ranuras[];
+} anillo_t;
+
+// Lado del servidor: lo que necesita para publicar, fuera del alcance de los clientes
+typedef struct {
+    anillo_t* compartido;        // El segmento que leen los clientes
+    int id_shm;                  // Lo que se les indica para conectarse
+    uint32_t num_ranuras;
+    uint64_t publicados;
+} anillo_escritor_t;
+
+typedef enum {
+    ANILLO_VACIO = 0,            // El cursor está al día
+    ANILLO_MENSAJE,              // Se leyó un mensaje y el cursor avanzó
+    ANILLO_DESBORDADO,           // El escritor dio la vuelta: el cursor saltó al más antiguo disponible
+} resultado_anillo_t;
+
+/**
+ * @brief Crea el segmento de una sala y lo deja conectado al servidor.
+ * El segmento queda marcado para borrado: desaparece cuando se desconecta el
+ * último proceso, aunque el servidor termine de forma abrupta.
+ * @return El escritor del anillo, o NULL en caso de error.
+ */
+anillo_escritor_t* anillo_crear(int num_ranuras);
+
+/**
+ * @brief Desconecta al servidor del segmento y libera el escritor (NULL no hace nada).
+ */
+void anillo_destruir(anillo_escritor_t* escritor);
+
+/**
+ * @brief Conecta un cliente al anillo de su sala y comprueba que es válido.
+ * @return El anillo o NULL.
+ */
+anillo_t* anillo_conectar(int id_shm);
+void anillo_desconectar(anillo_t* anillo);
+
+static inline uint64_t anillo_publicados(const anillo_t* anillo) {
+    return __atomic_load_n(&anillo->publicados, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Publica un mensaje (solo desde el hilo dueño de la sala).
+ */
+void anillo_publicar(anillo_escritor_t* escritor, const char* texto, size_t longitud, int id_cola_excluida);
+
+/**
+ * @brief Lee el mensaje del cursor. texto debe tener ANILLO_MAX_TEXTO bytes.
+ * En ANILLO_DESBORDADO, perdidos indica cuántos mensajes se saltaron.
+ */
+resultado_anillo_t anillo_leer(const anillo_t* anillo, uint64_t* cursor, char* texto, size_t* longitud,
+                               int* id_cola_excluida, uint64_t* perdidos);
+
+/**
+ * @brief Duerme hasta que haya algo después del cursor o pase el plazo.
+ */
+void anillo_esperar(anillo_t* anillo, uint64_t cursor, int plazo_ms);
+
+/**
+ * @brief Despierta a todos los lectores dormidos en el anillo.
+ */
+void anillo_despertar(anillo_t* anillo);
+
+#endif // ANILLO_H
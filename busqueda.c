@@ -0,0 +1,565 @@
+#include "busqueda.h"
+#include "estadisticas.h"
+#include "segmentos.h"
+#include "tablas.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define MAGIA_INDICE 0x53554243u   // "CBUS"
+#define VERSION_INDICE 1
+#define BUSQUEDA_MAX_SALAS 65536
+
+typedef struct {
+    char texto[BUSQUEDA_MAX_TERMINO];
+    uint32_t* documentos;    // Crecientes: el último es el más reciente
+    uint32_t num_documentos;
+    uint32_t capacidad;
+} termino_t;
+
+typedef struct {
+    char nombre[MAX_NOMBRE];
+    uint64_t siguiente;      // Primera secuencia aún sin indexar
+} sala_indexada_t;
+
+typedef struct {
+    uint32_t magia;
+    uint32_t version;
+    uint32_t num_salas;
+    uint32_t num_documentos;
+    uint32_t num_terminos;
+} cabecera_indice_t;
+
+// Todo lo protege el cerrojo: escribe el hilo de historial, leen los trabajadores
+static pthread_rwlock_t cerrojo = PTHREAD_RWLOCK_INITIALIZER;
+static almacen_t terminos;
+static tabla_hash_t indice_terminos;
+static almacen_t salas;
+static tabla_hash_t indice_salas;
+static uint32_t* sala_de_documento = NULL;
+static uint64_t* secuencia_de_documento = NULL;
+static uint32_t num_documentos = 0;
+static uint32_t capacidad_documentos = 0;
+static busqueda_estadisticas_t estadisticas;
+static char ruta_indice[64] = RUTA_INDICE_BUSQUEDA;
+static int particion_propia = 0, num_particiones = 1;
+
+#define TERMINO(manejador) ((termino_t*)almacen_obtener(&terminos, (manejador)))
+#define SALA_INDEXADA(manejador) ((sala_indexada_t*)almacen_obtener(&salas, (manejador)))
+
+static int coincide_termino(int manejador, const void* clave, void* contexto) {
+    (void)contexto;
+    return strcmp(TERMINO(manejador)->texto, (const char*)clave) == 0;
+}
+
+static int coincide_sala(int manejador, const void* clave, void* contexto) {
+    (void)contexto;
+    return strcmp(SALA_INDEXADA(manejador)->nombre, (const char*)clave) == 0;
+}
+
+// Letras y dígitos ASCII, y los bytes de caracteres UTF-8 (no se distinguen mayúsculas fuera de ASCII)
+static int es_de_termino(unsigned char c) {
+    return isalnum(c) || c >= 0x80;
+}
+
+/**
+ * @brief Extrae el siguiente término de *texto, en minúsculas, y avanza el puntero.
+ * @return 1 si encontró uno, 0 si se acabó el texto.
+ */
+static int siguiente_termino(const char** texto, char* termino) {
+    const char* p = *texto;
+    while (*p) {
+        while (*p && !es_de_termino((unsigned char)*p)) p++;
+        size_t longitud = 0;
+        while (es_de_termino((unsigned char)*p)) {
+            if (longitud < BUSQUEDA_MAX_TERMINO - 1) termino[longitud++] = (char)tolower((unsigned char)*p);
+            p++;
+        }
+        termino[longitud] = '\0';
+        if (longitud >= BUSQUEDA_MIN_TERMINO) {
+            *texto = p;
+            return 1;
+        }
+    }
+    *texto = p;
+    return 0;
+}
+
+// "@usuario" en minúsculas, recortado
+static void termino_de_autor(const char* usuario, char* termino) {
+    size_t longitud = 0;
+    termino[longitud++] = '@';
+    for (const char* p = usuario; *p && longitud < BUSQUEDA_MAX_TERMINO - 1; p++) {
+        termino[longitud++] = (char)tolower((unsigned char)*p);
+    }
+    termino[longitud] = '\0';
+}
+
+/**
+ * @brief Manejador de la sala en el índice, dándola de alta si es nueva.
+ * @return El manejador, o -1 si no cabe.
+ */
+static int obtener_sala(const char* nombre) {
+    unsigned int hash = tabla_hash_cadena(nombre);
+    int manejador = tabla_buscar(&indice_salas, hash, nombre);
+    if (manejador != -1) return manejador;
+    manejador = almacen_reservar(&salas);
+    if (manejador == -1) return -1;
+    strncpy(SALA_INDEXADA(manejador)->nombre, nombre, MAX_NOMBRE - 1);
+    if (tabla_insertar(&indice_salas, hash, manejador) == -1) {
+        almacen_liberar(&salas, manejador);
+        return -1;
+    }
+    return manejador;
+}
+
+/**
+ * @brief Añade el documento a la lista del término (una sola vez aunque se repita en el mensaje).
+ */
+static void anadir_documento(const char* texto, uint32_t documento) {
+    unsigned int hash = tabla_hash_cadena(texto);
+    int manejador = tabla_buscar(&indice_terminos, hash, texto);
+    if (manejador == -1) {
+        manejador = almacen_reservar(&terminos);
+        if (manejador == -1) {
+            CONTADOR_SUMAR(estadisticas.terminos_descartados, 1);
+            return;
+        }
+        memcpy(TERMINO(manejador)->texto, texto, BUSQUEDA_MAX_TERMINO);
+        if (tabla_insertar(&indice_terminos, hash, manejador) == -1) {
+            almacen_liberar(&terminos, manejador);
+            CONTADOR_SUMAR(estadisticas.terminos_descartados, 1);
+            return;
+        }
+        CONTADOR_SUMAR(estadisticas.terminos, 1);
+    }
+
+    termino_t* termino = TERMINO(manejador);
+    if (termino->num_documentos > 0 && termino->documentos[termino->num_documentos - 1] == documento) return;
+    if (termino->num_documentos == termino->capacidad) {
+        uint32_t nueva = termino->capacidad ? termino->capacidad * 2 : 4;
+        uint32_t* ampliado = realloc(termino->documentos, (size_t)nueva * sizeof(uint32_t));
+        if (ampliado == NULL) return;
+        termino->documentos = ampliado;
+        termino->capacidad = nueva;
+    }
+    termino->documentos[termino->num_documentos++] = documento;
+}
+
+/**
+ * @brief Reserva el siguiente número de documento.
+ * @return 0 si todo fue bien, -1 si no hay memoria.
+ */
+static int nuevo_documento(uint32_t sala, uint64_t secuencia) {
+    if (num_documentos == capacidad_documentos) {
+        if (capacidad_documentos >= UINT32_MAX / 2) return -1;
+        uint32_t nueva = capacidad_documentos ? capacidad_documentos * 2 : 1024;
+        uint32_t* salas_ampliadas = realloc(sala_de_documento, (size_t)nueva * sizeof(uint32_t));
+        if (salas_ampliadas == NULL) return -1;
+        sala_de_documento = salas_ampliadas;
+        uint64_t* secuencias_ampliadas = realloc(secuencia_de_documento, (size_t)nueva * sizeof(uint64_t));
+        if (secuencias_ampliadas == NULL) return -1;
+        secuencia_de_documento = secuencias_ampliadas;
+        capacidad_documentos = nueva;
+    }
+    sala_de_documento[num_documentos] = sala;
+    secuencia_de_documento[num_documentos] = secuencia;
+    num_documentos++;
+    CONTADOR_SUMAR(estadisticas.documentos, 1);
+    return 0;
+}
+
+// Cuerpo de busqueda_indexar, con el cerrojo de escritura tomado (o al arrancar)
+static void indexar(const char* sala, uint64_t secuencia, const char* usuario, size_t longitud_usuario,
+                    const char* texto) {
+    int indice_sala = obtener_sala(sala);
+    if (indice_sala == -1) return;
+    sala_indexada_t* indexada = SALA_INDEXADA(indice_sala);
+    if (secuencia < indexada->siguiente) return; // Ya estaba
+    indexada->siguiente = secuencia + 1;
+
+    // Los avisos de entrada y salida no se buscan: solo ensuciarían los resultados
+    char usuario_terminado[MAX_NOMBRE];
+    snprintf(usuario_terminado, sizeof(usuario_terminado), "%.*s", (int)longitud_usuario, usuario);
+    if (strcmp(usuario_terminado, "SISTEMA") == 0) return;
+
+    uint32_t documento = num_documentos;
+    if (nuevo_documento((uint32_t)indice_sala, secuencia) == -1) return;
+
+    char termino[BUSQUEDA_MAX_TERMINO];
+    termino_de_autor(usuario_terminado, termino);
+    anadir_documento(termino, documento);
+    while (siguiente_termino(&texto, termino)) anadir_documento(termino, documento);
+}
+
+void busqueda_indexar(const char* sala, uint64_t secuencia, const char* usuario, const char* texto) {
+    pthread_rwlock_wrlock(&cerrojo);
+    indexar(sala, secuencia, usuario, strlen(usuario), texto);
+    pthread_rwlock_unlock(&cerrojo);
+}
+
+// Puesta al día desde los segmentos: el texto de la proyección no termina en '\0'
+typedef struct {
+    const char* sala;
+    int indexados;
+} puesta_al_dia_t;
+
+static void indexar_registro(const registro_segmento_t* registro, const char* usuario, const char* texto,
+                             void* contexto) {
+    puesta_al_dia_t* puesta = contexto;
+    char texto_terminado[MAX_TEXTO];
+    snprintf(texto_terminado, sizeof(texto_terminado), "%.*s", (int)registro->longitud_texto, texto);
+    indexar(puesta->sala, registro->secuencia, usuario, registro->longitud_usuario, texto_terminado);
+    puesta->indexados++;
+}
+
+/**
+ * @brief Indexa lo que cada sala de RUTA_PERSISTENCIA tenga más allá de lo ya indexado.
+ * @return Cuántos mensajes se añadieron.
+ */
+static int poner_al_dia(void) {
+    DIR* dir = opendir(RUTA_PERSISTENCIA);
+    if (dir == NULL) return 0;
+    int total = 0;
+    struct dirent* entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        if (entrada->d_name[0] == '.' || strlen(entrada->d_name) >= MAX_NOMBRE) continue;
+        char directorio[SEGMENTOS_MAX_RUTA];
+        segmentos_directorio_sala(directorio, sizeof(directorio), entrada->d_name);
+        struct stat info;
+        if (stat(directorio, &info) == -1 || !S_ISDIR(info.st_mode)) continue; // indice.bin, estado.bin...
+        if (particion_de_sala(entrada->d_name, num_particiones) != particion_propia) continue;
+
+        int indice_sala = obtener_sala(entrada->d_name);
+        if (indice_sala == -1) continue;
+        puesta_al_dia_t puesta = { SALA_INDEXADA(indice_sala)->nombre, 0 };
+        segmentos_recorrer(directorio, SALA_INDEXADA(indice_sala)->siguiente, UINT64_MAX, indexar_registro, &puesta);
+        total += puesta.indexados;
+    }
+    closedir(dir);
+    return total;
+}
+
+static int escribir_varint(FILE* archivo, uint64_t valor) {
+    unsigned char bytes[10];
+    int n = 0;
+    do {
+        bytes[n] = (unsigned char)(valor & 0x7F);
+        valor >>= 7;
+        if (valor) bytes[n] |= 0x80;
+        n++;
+    } while (valor);
+    return fwrite(bytes, 1, (size_t)n, archivo) == (size_t)n ? 0 : -1;
+}
+
+static int leer_varint(FILE* archivo, uint64_t* valor) {
+    uint64_t resultado = 0;
+    for (int desplazamiento = 0; desplazamiento < 64; desplazamiento += 7) {
+        int c = getc(archivo);
+        if (c == EOF) return -1;
+        resultado |= (uint64_t)(c & 0x7F) << desplazamiento;
+        if (!(c & 0x80)) {
+            *valor = resultado;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int escribir_cadena(FILE* archivo, const char* cadena) {
+    uint8_t longitud = (uint8_t)strlen(cadena);
+    return fwrite(&longitud, 1, 1, archivo) == 1 && fwrite(cadena, 1, longitud, archivo) == longitud ? 0 : -1;
+}
+
+static int leer_cadena(FILE* archivo, char* cadena, size_t tamano) {
+    uint8_t longitud;
+    if (fread(&longitud, 1, 1, archivo) != 1 || longitud >= tamano) return -1;
+    if (fread(cadena, 1, longitud, archivo) != longitud) return -1;
+    cadena[longitud] = '\0';
+    return 0;
+}
+
+/**
+ * @brief Escribe el índice: salas, documentos (secuencia como delta sobre el anterior
+ * de su sala) y, por término, sus documentos como deltas sobre el anterior.
+ */
+static int escribir_indice(FILE* archivo) {
+    cabecera_indice_t cabecera = { MAGIA_INDICE, VERSION_INDICE, (uint32_t)salas.num_reservados, num_documentos,
+                                   (uint32_t)terminos.num_en_uso };
+    if (fwrite(&cabecera, sizeof(cabecera), 1, archivo) != 1) return -1;
+    for (int i = 0; i < salas.num_reservados; i++) {
+        if (escribir_cadena(archivo, SALA_INDEXADA(i)->nombre) == -1 ||
+            escribir_varint(archivo, SALA_INDEXADA(i)->siguiente) == -1) {
+            return -1;
+        }
+    }
+
+    uint64_t* anterior = calloc((size_t)salas.num_reservados + 1, sizeof(uint64_t));
+    if (anterior == NULL) return -1;
+    int resultado = 0;
+    for (uint32_t d = 0; d < num_documentos && resultado == 0; d++) {
+        uint32_t sala = sala_de_documento[d];
+        resultado = escribir_varint(archivo, sala) == 0 &&
+                    escribir_varint(archivo, secuencia_de_documento[d] - anterior[sala]) == 0 ? 0 : -1;
+        anterior[sala] = secuencia_de_documento[d];
+    }
+    free(anterior);
+    if (resultado == -1) return -1;
+
+    for (int i = 0; i < terminos.num_reservados; i++) {
+        termino_t* termino = TERMINO(i);
+        if (termino->num_documentos == 0) continue;
+        if (escribir_cadena(archivo, termino->texto) == -1 || escribir_varint(archivo, termino->num_documentos) == -1) {
+            return -1;
+        }
+        uint32_t previo = 0;
+        for (uint32_t j = 0; j < termino->num_documentos; j++) {
+            if (escribir_varint(archivo, termino->documentos[j] - previo) == -1) return -1;
+            previo = termino->documentos[j];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Lee lo que escribió escribir_indice, comprobando cada dato.
+ * @return 0 si es válido, -1 si no (lo leído hasta entonces queda a medias).
+ */
+static int leer_indice(FILE* archivo) {
+    cabecera_indice_t cabecera;
+    if (fread(&cabecera, sizeof(cabecera), 1, archivo) != 1 || cabecera.magia != MAGIA_INDICE ||
+        cabecera.version != VERSION_INDICE || cabecera.num_salas > BUSQUEDA_MAX_SALAS ||
+        cabecera.num_terminos > ALMACEN_MAX_ELEMENTOS) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < cabecera.num_salas; i++) {
+        char nombre[MAX_NOMBRE];
+        uint64_t siguiente;
+        if (leer_cadena(archivo, nombre, sizeof(nombre)) == -1 || leer_varint(archivo, &siguiente) == -1) return -1;
+        if (obtener_sala(nombre) != (int)i) return -1;
+        SALA_INDEXADA(i)->siguiente = siguiente;
+    }
+
+    uint64_t* anterior = calloc((size_t)cabecera.num_salas + 1, sizeof(uint64_t));
+    if (anterior == NULL) return -1;
+    int resultado = 0;
+    for (uint32_t d = 0; d < cabecera.num_documentos && resultado == 0; d++) {
+        uint64_t sala, delta;
+        if (leer_varint(archivo, &sala) == -1 || leer_varint(archivo, &delta) == -1 || sala >= cabecera.num_salas ||
+            nuevo_documento((uint32_t)sala, anterior[sala] + delta) == -1) {
+            resultado = -1;
+            break;
+        }
+        anterior[sala] += delta;
+    }
+    free(anterior);
+    if (resultado == -1) return -1;
+
+    for (uint32_t i = 0; i < cabecera.num_terminos; i++) {
+        char texto[BUSQUEDA_MAX_TERMINO];
+        uint64_t cuantos;
+        memset(texto, 0, sizeof(texto));
+        if (leer_cadena(archivo, texto, sizeof(texto)) == -1 || leer_varint(archivo, &cuantos) == -1 ||
+            cuantos == 0 || cuantos > num_documentos) {
+            return -1;
+        }
+        int manejador = almacen_reservar(&terminos);
+        if (manejador == -1) return -1;
+        termino_t* termino = TERMINO(manejador);
+        memcpy(termino->texto, texto, sizeof(texto));
+        if (tabla_insertar(&indice_terminos, tabla_hash_cadena(texto), manejador) == -1) return -1;
+        termino->documentos = malloc((size_t)cuantos * sizeof(uint32_t));
+        if (termino->documentos == NULL) return -1;
+        termino->capacidad = (uint32_t)cuantos;
+
+        uint64_t documento = 0;
+        for (uint64_t j = 0; j < cuantos; j++) {
+            uint64_t delta;
+            if (leer_varint(archivo, &delta) == -1 || (j > 0 && delta == 0)) return -1;
+            documento += delta;
+            if (documento >= num_documentos) return -1;
+            termino->documentos[termino->num_documentos++] = (uint32_t)documento;
+        }
+    }
+    CONTADOR_SUMAR(estadisticas.terminos, cabecera.num_terminos);
+    return 0;
+}
+
+static int preparar_tablas(void) {
+    return almacen_iniciar(&terminos, sizeof(termino_t), ALMACEN_MAX_ELEMENTOS) == -1 ||
+           tabla_iniciar(&indice_terminos, 1024, coincide_termino, NULL) == -1 ||
+           almacen_iniciar(&salas, sizeof(sala_indexada_t), BUSQUEDA_MAX_SALAS) == -1 ||
+           tabla_iniciar(&indice_salas, 64, coincide_sala, NULL) == -1 ? -1 : 0;
+}
+
+static void liberar_tablas(void) {
+    for (int i = 0; i < terminos.num_reservados; i++) free(TERMINO(i)->documentos);
+    almacen_liberar_todo(&terminos);
+    tabla_liberar(&indice_terminos);
+    almacen_liberar_todo(&salas);
+    tabla_liberar(&indice_salas);
+    free(sala_de_documento);
+    free(secuencia_de_documento);
+    sala_de_documento = NULL;
+    secuencia_de_documento = NULL;
+    num_documentos = capacidad_documentos = 0;
+    memset(&estadisticas, 0, sizeof(estadisticas));
+}
+
+int busqueda_iniciar(int particion, int particiones) {
+    particion_propia = particion;
+    num_particiones = particiones > 0 ? particiones : 1;
+    if (num_particiones > 1) snprintf(ruta_indice, sizeof(ruta_indice), RUTA_PERSISTENCIA "indice.%d.bin", particion);
+
+    struct timespec inicio, fin;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+    if (preparar_tablas() == -1) {
+        perror("iniciar índice de búsqueda");
+        return -1;
+    }
+
+    FILE* archivo = fopen(ruta_indice, "rb");
+    if (archivo != NULL) {
+        int valido = leer_indice(archivo) == 0;
+        fclose(archivo);
+        if (!valido) {
+            // Se rehace entero desde los segmentos
+            fprintf(stderr, " El índice de búsqueda %s no es válido: se reconstruye.\n", ruta_indice);
+            liberar_tablas();
+            if (preparar_tablas() == -1) {
+                perror("iniciar índice de búsqueda");
+                return -1;
+            }
+        }
+    }
+
+    int anadidos = poner_al_dia();
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    printf(" Índice de búsqueda: %u mensajes (%d leídos del historial) en %.1f ms.\n", num_documentos, anadidos,
+           (double)(fin.tv_sec - inicio.tv_sec) * 1e3 + (double)(fin.tv_nsec - inicio.tv_nsec) / 1e6);
+    return 0;
+}
+
+void busqueda_finalizar(void) {
+    // Temporal y rename: un cierre a medias no deja un índice truncado
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.tmp", ruta_indice);
+    FILE* archivo = fopen(temporal, "wb");
+    if (archivo == NULL) {
+        perror(temporal);
+    } else {
+        int resultado = escribir_indice(archivo);
+        if (fclose(archivo) != 0) resultado = -1;
+        if (resultado == 0 && rename(temporal, ruta_indice) == -1) resultado = -1;
+        if (resultado == -1) {
+            perror("guardar índice de búsqueda");
+            unlink(temporal);
+        }
+    }
+    liberar_tablas();
+}
+
+int busqueda_analizar(const char* texto, consulta_t* consulta) {
+    memset(consulta, 0, sizeof(*consulta));
+    char copia[MAX_TEXTO];
+    snprintf(copia, sizeof(copia), "%s", texto);
+    char* contexto = NULL;
+    for (char* palabra = strtok_r(copia, " \t", &contexto); palabra != NULL; palabra = strtok_r(NULL, " \t", &contexto)) {
+        if (palabra[0] == '#' && palabra[1] != '\0') {
+            snprintf(consulta->sala, sizeof(consulta->sala), "%s", palabra + 1);
+        } else if (strncmp(palabra, "antes:", 6) == 0) {
+            consulta->antes = (uint32_t)strtoul(palabra + 6, NULL, 10);
+        } else if (palabra[0] == '@' && palabra[1] != '\0') {
+            if (consulta->num_terminos < BUSQUEDA_MAX_TERMINOS_CONSULTA) {
+                termino_de_autor(palabra + 1, consulta->terminos[consulta->num_terminos++]);
+            }
+        } else {
+            // Se parte igual que al indexar: "¿qué-tal?" busca "qué" y "tal"
+            const char* resto = palabra;
+            char termino[BUSQUEDA_MAX_TERMINO];
+            while (consulta->num_terminos < BUSQUEDA_MAX_TERMINOS_CONSULTA && siguiente_termino(&resto, termino)) {
+                memcpy(consulta->terminos[consulta->num_terminos++], termino, sizeof(termino));
+            }
+        }
+    }
+    return consulta->num_terminos > 0 ? 0 : -1;
+}
+
+void busqueda_describir(const consulta_t* consulta, char* texto, size_t tamano) {
+    size_t usado = 0;
+    texto[0] = '\0';
+    for (int i = 0; i < consulta->num_terminos && usado < tamano; i++) {
+        usado += (size_t)snprintf(texto + usado, tamano - usado, "%s%s", i ? " " : "", consulta->terminos[i]);
+    }
+    if (consulta->sala[0] != '\0' && usado < tamano) snprintf(texto + usado, tamano - usado, " #%s", consulta->sala);
+}
+
+/**
+ * @brief Primera posición de la lista [0, fin) con un documento >= documento.
+ */
+static uint32_t buscar_posicion(const termino_t* termino, uint32_t fin, uint32_t documento) {
+    uint32_t inicio = 0;
+    while (inicio < fin) {
+        uint32_t medio = inicio + (fin - inicio) / 2;
+        if (termino->documentos[medio] < documento) inicio = medio + 1;
+        else fin = medio;
+    }
+    return inicio;
+}
+
+// Cuerpo de busqueda_consultar, con el cerrojo de lectura tomado
+static int consultar(const consulta_t* consulta, resultado_busqueda_t* resultados, int max, int* hay_mas) {
+    const termino_t* listas[BUSQUEDA_MAX_TERMINOS_CONSULTA];
+    uint32_t fines[BUSQUEDA_MAX_TERMINOS_CONSULTA]; // Lo que queda por mirar de cada lista (documentos menores)
+    int guia = 0; // La lista más corta marca los candidatos; en las demás se busca cada uno
+    for (int i = 0; i < consulta->num_terminos; i++) {
+        int manejador = tabla_buscar(&indice_terminos, tabla_hash_cadena(consulta->terminos[i]), consulta->terminos[i]);
+        if (manejador == -1) return 0;
+        listas[i] = TERMINO(manejador);
+        fines[i] = consulta->antes ? buscar_posicion(listas[i], listas[i]->num_documentos, consulta->antes)
+                                   : listas[i]->num_documentos;
+        if (fines[i] < fines[guia]) guia = i;
+    }
+    int sala = -1;
+    if (consulta->sala[0] != '\0') {
+        sala = tabla_buscar(&indice_salas, tabla_hash_cadena(consulta->sala), consulta->sala);
+        if (sala == -1) return 0;
+    }
+
+    // Del más reciente hacia atrás: se para en cuanto la página está llena
+    int encontrados = 0;
+    while (fines[guia] > 0) {
+        uint32_t documento = listas[guia]->documentos[--fines[guia]];
+        if (sala != -1 && sala_de_documento[documento] != (uint32_t)sala) continue;
+        int en_todas = 1;
+        for (int i = 0; i < consulta->num_terminos && en_todas; i++) {
+            if (i == guia) continue;
+            fines[i] = buscar_posicion(listas[i], fines[i], documento);
+            en_todas = fines[i] < listas[i]->num_documentos && listas[i]->documentos[fines[i]] == documento;
+        }
+        if (!en_todas) continue;
+        if (encontrados == max) {
+            *hay_mas = 1;
+            break;
+        }
+        resultado_busqueda_t* resultado = &resultados[encontrados++];
+        memcpy(resultado->sala, SALA_INDEXADA(sala_de_documento[documento])->nombre, MAX_NOMBRE);
+        resultado->secuencia = secuencia_de_documento[documento];
+        resultado->documento = documento;
+    }
+    return encontrados;
+}
+
+int busqueda_consultar(const consulta_t* consulta, resultado_busqueda_t* resultados, int max, int* hay_mas) {
+    *hay_mas = 0;
+    pthread_rwlock_rdlock(&cerrojo);
+    int encontrados = consultar(consulta, resultados, max, hay_mas);
+    pthread_rwlock_unlock(&cerrojo);
+    return encontrados;
+}
+
+const busqueda_estadisticas_t* busqueda_estadisticas(void) {
+    return &estadisticas;
+}
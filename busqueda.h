@@ -0,0 +1,99 @@
+#ifndef BUSQUEDA_H
+#define BUSQUEDA_H
+
+#include "common.h"
+
+/*
+ * Índice invertido del historial de todas las salas, para /search.
+ *
+ * Cada mensaje escrito es un documento, numerado en el orden en que se indexa:
+ * un número mayor es un mensaje más reciente. Cada término guarda la lista
+ * creciente de documentos en que aparece, y cada documento su sala y su
+ * secuencia, con las que el texto se lee de los segmentos (segmentos.h).
+ * Términos: las palabras del texto en minúsculas (letras y dígitos ASCII; los
+ * bytes UTF-8 se conservan tal cual) de al menos BUSQUEDA_MIN_TERMINO bytes,
+ * y "@usuario" para el autor.
+ *
+ * Solo el hilo escritor de historial (registro.c) añade documentos, después de
+ * escribir el lote: lo que el índice devuelve ya está en los segmentos. Las
+ * consultas se hacen desde los trabajadores con un cerrojo de lectura y se
+ * recorren del documento más reciente hacia atrás, así que una página cuesta
+ * lo mismo con mil mensajes que con millones.
+ *
+ * Al cerrar se guarda en RUTA_INDICE_BUSQUEDA, con las listas codificadas como
+ * deltas en varint. Al arrancar se carga y se completa leyendo de los segmentos
+ * lo que aún no tenía (tras una caída, o todo el historial la primera vez).
+ * Con particiones, cada servidor indexa solo sus salas y guarda su índice en
+ * "indice.<partición>.bin".
+ */
+
+#define RUTA_INDICE_BUSQUEDA RUTA_PERSISTENCIA "indice.bin"
+#define BUSQUEDA_MIN_TERMINO 2
+#define BUSQUEDA_MAX_TERMINO 32           // Bytes de un término, con el '\0'; los más largos se recortan
+#define BUSQUEDA_MAX_TERMINOS_CONSULTA 8
+#define BUSQUEDA_POR_PAGINA 10
+
+// Consulta ya analizada: todos los términos deben aparecer en el mensaje
+typedef struct {
+    char terminos[BUSQUEDA_MAX_TERMINOS_CONSULTA][BUSQUEDA_MAX_TERMINO];
+    int num_terminos;
+    char sala[MAX_NOMBRE];   // "#sala": solo esa sala ("" = todas)
+    uint32_t antes;          // "antes:N": solo documentos anteriores a N (0 = desde el más reciente)
+} consulta_t;
+
+typedef struct {
+    char sala[MAX_NOMBRE];
+    uint64_t secuencia;
+    uint32_t documento;      // Para pedir la página siguiente con "antes:"
+} resultado_busqueda_t;
+
+// Contadores del índice (solo los escribe el hilo escritor de historial)
+typedef struct {
+    uint64_t documentos;
+    uint64_t terminos;
+    uint64_t terminos_descartados; // Vocabulario lleno: la palabra no se indexa
+} busqueda_estadisticas_t;
+
+/**
+ * @brief Carga el índice guardado y añade lo que los segmentos tengan de más.
+ * Se llama antes de arrancar el hilo escritor.
+ * @param particion, particiones Salas que indexa este servidor (0 y 1 sin particiones).
+ * @return 0 si todo fue bien, -1 si no hay memoria.
+ */
+int busqueda_iniciar(int particion, int particiones);
+
+/**
+ * @brief Indexa un mensaje ya escrito en los segmentos de su sala. Lo que ya
+ * estaba indexado (secuencia anterior a la última de la sala) se ignora.
+ */
+void busqueda_indexar(const char* sala, uint64_t secuencia, const char* usuario, const char* texto);
+
+/**
+ * @brief Analiza "términos [#sala] [@usuario] [antes:N]".
+ * @return 0 si hay al menos un término, -1 si no.
+ */
+int busqueda_analizar(const char* texto, consulta_t* consulta);
+
+/**
+ * @brief Escribe la consulta normalizada, sin "antes:" (para mostrarla y para pedir la página siguiente).
+ */
+void busqueda_describir(const consulta_t* consulta, char* texto, size_t tamano);
+
+/**
+ * @brief Devuelve los documentos más recientes que cumplen la consulta.
+ * @param hay_mas Queda a 1 si hay más resultados tras los devueltos.
+ * @return Cuántos resultados se escribieron (como mucho max).
+ */
+int busqueda_consultar(const consulta_t* consulta, resultado_busqueda_t* resultados, int max, int* hay_mas);
+
+/**
+ * @brief Guarda el índice y libera su memoria. Se llama con el hilo escritor ya detenido.
+ */
+void busqueda_finalizar(void);
+
+/**
+ * @brief Contadores del índice, para leer con CONTADOR_LEER.
+ */
+const busqueda_estadisticas_t* busqueda_estadisticas(void);
+
+#endif // BUSQUEDA_H
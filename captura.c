@@ -0,0 +1,75 @@
+#include "captura.h"
+
+#define BUFFER_CAPTURA (1 << 20)
+
+static FILE* archivo_captura = NULL;
+static char* buffer_captura = NULL;
+static struct timespec inicio_captura;
+static uint64_t tramas_capturadas = 0;
+
+int captura_abrir(const char* ruta) {
+    archivo_captura = fopen(ruta, "wb");
+    if (archivo_captura == NULL) {
+        perror("fopen captura");
+        return -1;
+    }
+    // Sin buffer propio no se pierde nada, solo se escribe más a menudo
+    buffer_captura = malloc(BUFFER_CAPTURA);
+    if (buffer_captura != NULL) setvbuf(archivo_captura, buffer_captura, _IOFBF, BUFFER_CAPTURA);
+
+    cabecera_captura_t cabecera = { MAGIA_CAPTURA, VERSION_CAPTURA, (int64_t)time(NULL) };
+    if (fwrite(&cabecera, sizeof(cabecera), 1, archivo_captura) != 1) {
+        perror("fwrite captura");
+        captura_cerrar();
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &inicio_captura);
+    tramas_capturadas = 0;
+    return 0;
+}
+
+void captura_registrar(const trama_t* trama, size_t tamano, const struct timespec* instante) {
+    if (archivo_captura == NULL) return;
+
+    registro_captura_t registro;
+    registro.instante_ns = (uint64_t)((instante->tv_sec - inicio_captura.tv_sec) * 1000000000LL +
+                                      (instante->tv_nsec - inicio_captura.tv_nsec));
+    registro.id_cola = trama->cabecera.id_cola_cliente;
+    registro.longitud = (uint16_t)tamano;
+    registro.prioridad = (uint8_t)trama->mtype;
+    registro.reservado = 0;
+    if (fwrite(&registro, sizeof(registro), 1, archivo_captura) != 1 ||
+        fwrite(&trama->cabecera, tamano, 1, archivo_captura) != 1) {
+        perror(" Captura interrumpida");
+        fclose(archivo_captura);
+        archivo_captura = NULL;
+        return;
+    }
+    tramas_capturadas++;
+}
+
+uint64_t captura_cerrar(void) {
+    if (archivo_captura != NULL) {
+        if (fclose(archivo_captura) != 0) perror("fclose captura");
+        archivo_captura = NULL;
+    }
+    free(buffer_captura);
+    buffer_captura = NULL;
+    return tramas_capturadas;
+}
+
+int captura_leer_cabecera(FILE* archivo, cabecera_captura_t* cabecera) {
+    if (fread(cabecera, sizeof(*cabecera), 1, archivo) != 1) return -1;
+    return cabecera->magia == MAGIA_CAPTURA && cabecera->version == VERSION_CAPTURA ? 0 : -1;
+}
+
+int captura_leer(FILE* archivo, registro_captura_t* registro, trama_t* trama) {
+    size_t leido = fread(registro, 1, sizeof(*registro), archivo);
+    if (leido == 0 && feof(archivo)) return 0;
+    if (leido != sizeof(*registro) || registro->longitud < sizeof(cabecera_trama_t) || registro->longitud > MAX_TRAMA) {
+        return -1;
+    }
+    if (fread(&trama->cabecera, registro->longitud, 1, archivo) != 1) return -1;
+    trama->mtype = registro->prioridad;
+    return 1;
+}
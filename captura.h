@@ -0,0 +1,68 @@
+#ifndef CAPTURA_H
+#define CAPTURA_H
+
+#include "common.h"
+
+/*
+ * Captura del tráfico de entrada del servidor, para reproducirlo con ./reproducir.
+ *
+ * Con -C RUTA el despachador anota cada solicitud válida que recibe, tal como
+ * llegó (cabecera y datos de la trama, sin el mtype), precedida de un registro
+ * fijo con el instante de CLOCK_MONOTONIC desde el arranque de la captura, la
+ * cola o conexión de origen y la prioridad. Las tramas son las mismas que viajan
+ * por el transporte, así que un mensaje de chat ocupa 28 bytes más su texto.
+ * Se escribe con un buffer grande de stdio: anotar una trama es una copia.
+ */
+
+#define MAGIA_CAPTURA 0x50414343u // "CCAP"
+#define VERSION_CAPTURA 1
+
+typedef struct {
+    uint32_t magia;
+    uint32_t version;
+    int64_t inicio;          // time(NULL) al abrir la captura
+} cabecera_captura_t;
+
+typedef struct {
+    uint64_t instante_ns;    // CLOCK_MONOTONIC desde que se abrió la captura
+    int32_t id_cola;         // Cola privada o conexión del cliente que la envió
+    uint16_t longitud;       // Bytes de trama que siguen (cabecera_trama_t + datos)
+    uint8_t prioridad;       // mtype en la entrada del servidor
+    uint8_t reservado;
+} registro_captura_t;
+
+// Escritura (despachador del servidor)
+
+/**
+ * @brief Crea (o vacía) el archivo de captura y escribe su cabecera.
+ * @return 0 si todo fue bien, -1 en caso de error (ya informado).
+ */
+int captura_abrir(const char* ruta);
+
+/**
+ * @brief Anota una trama recibida (tamano = valor devuelto por transporte_recibir).
+ * No hace nada si la captura no está abierta; tras un error de escritura se desactiva.
+ */
+void captura_registrar(const trama_t* trama, size_t tamano, const struct timespec* instante);
+
+/**
+ * @brief Vacía el buffer y cierra el archivo.
+ * @return Tramas anotadas.
+ */
+uint64_t captura_cerrar(void);
+
+// Lectura (reproducir)
+
+/**
+ * @brief Lee y comprueba la cabecera de una captura.
+ * @return 0 si es válida, -1 si no.
+ */
+int captura_leer_cabecera(FILE* archivo, cabecera_captura_t* cabecera);
+
+/**
+ * @brief Lee el siguiente registro y su trama (trama->mtype = prioridad).
+ * @return 1 si leyó uno, 0 al final del archivo, -1 si está truncado o mal formado.
+ */
+int captura_leer(FILE* archivo, registro_captura_t* registro, trama_t* trama);
+
+#endif // CAPTURA_H
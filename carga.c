@@ -0,0 +1,629 @@
+#include "common.h"
+#include "anillo.h"
+#include "transporte.h"
+#include "latencia.h"
+#include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+ * Generador de carga y banco de pruebas (make bench).
+ *
+ * Lanza el servidor (o usa uno ya arrancado con -x), crea N bots sin terminal
+ * repartidos en R salas y hace que cada uno envíe a un ritmo fijo o tan rápido
+ * como pueda. Cada mensaje lleva su instante de envío (CLOCK_MONOTONIC), de
+ * modo que los receptores miden la latencia de extremo a extremo. Al terminar
+ * imprime una línea JSON con el rendimiento, los percentiles de latencia y los
+ * envíos fallidos o perdidos; el progreso va a stderr.
+ *
+ * Con -p K lanza K servidores, uno por partición, y cada bot se conecta al de
+ * su sala, como haría el cliente.
+ *
+ * Con -f MB el bot 0 envía además, una tras otra, transferencias de ese tamaño a
+ * su sala mientras dura la prueba, para ver cuánto estorban al chat.
+ */
+
+#define BOTS_DEFECTO 32
+#define SALAS_DEFECTO 4
+#define DURACION_DEFECTO_S 5
+#define DRENAJE_DEFECTO_MS 1000
+#define LONGITUD_DEFECTO 32
+#define ESPERA_UNION_S 10
+#define MAX_ARGS_SERVIDOR 32
+
+typedef struct {
+    int numero;
+    int particion;           // Servidor de su sala (particion_de_sala)
+    int sala;
+    transporte_cliente_t conexion;
+    int id_cola;             // Id con el que lo conoce el servidor (conexion.id_propio)
+    uint32_t id_sesion;      // Identificadores para el chat (TIPO_SESION_SALA); los escribe
+    uint32_t id_sala;        // el receptor antes de la confirmación de la unión
+    char nombre[MAX_NOMBRE];
+    pthread_t hilo_envio;
+    pthread_t hilo_recepcion;
+    pthread_t hilo_transferencia;
+    int unido;
+
+    // Modo anillo: lo conecta el propio hilo receptor
+    anillo_t* anillo;
+    uint64_t cursor;
+
+    // Cada contador lo escribe un solo hilo; se suman al final
+    uint64_t enviados;
+    uint64_t errores_envio;
+    uint64_t rechazados;    // Avisos de rechazo: el servidor envía uno por racha, no por mensaje
+    uint64_t recibidos;
+    uint64_t perdidos_anillo;
+    latencias_t latencias;
+} bot_t;
+
+typedef struct {
+    int num_bots;
+    int num_salas;
+    int ritmo;              // Mensajes/s por bot; 0 = tan rápido como se pueda
+    int duracion_s;
+    int drenaje_ms;         // Espera tras el último envío para recibir lo que queda en vuelo
+    int longitud;           // Bytes de texto por mensaje
+    int externo;            // No lanzar el servidor
+    int num_particiones;    // Servidores entre los que se reparten las salas
+    int transferencia_mb;   // Tamaño de las transferencias del bot 0; 0 = ninguna
+    tipo_transporte_t transporte;
+    const char* ruta_servidor;
+    char* args_servidor[MAX_ARGS_SERVIDOR + 6];
+    char particion_servidor[24]; // "-x I/K" de cada servidor que se lanza
+} config_carga_t;
+
+static config_carga_t config;
+static bot_t* bots;
+static volatile int fin_envio = 0;
+static volatile int fin_recepcion = 0;
+static pthread_mutex_t mutex_union = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_union = PTHREAD_COND_INITIALIZER;
+static int num_unidos = 0;
+
+// Transferencia en curso del bot 0: su receptor anota las confirmaciones
+static pthread_mutex_t mutex_transferencia = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_transferencia = PTHREAD_COND_INITIALIZER;
+static uint32_t transferencia_actual = 0;
+static uint64_t transferencia_confirmada = 0;
+static int transferencia_rechazada = 0;
+static uint64_t bytes_transferidos = 0;    // Confirmados en total
+static int transferencias_completas = 0;
+
+static void procesar_argumentos(int argc, char* argv[]);
+static pid_t lanzar_servidor(int particion);
+static int esperar_cola_servidor(pid_t servidor, int particion);
+static void* bucle_envio(void* arg);
+static void* bucle_recepcion(void* arg);
+static void* bucle_transferencia(void* arg);
+static void imprimir_resultados(double segundos);
+
+static uint64_t ahora_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void enviar_al_servidor(bot_t* bot, tipo_mensaje_t tipo, const char* sala, const char* texto) {
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, tipo, bot->id_cola, bot->nombre, sala, texto);
+    if (transporte_cliente_enviar(&bot->conexion, &trama, tamano, 1) == -1) bot->errores_envio++;
+}
+
+static void enviar_chat(bot_t* bot, const char* texto) {
+    trama_t trama;
+    size_t tamano = trama_construir_chat(&trama, bot->id_cola, bot->id_sesion, bot->id_sala, texto);
+    if (transporte_cliente_enviar(&bot->conexion, &trama, tamano, 1) == -1) bot->errores_envio++;
+}
+
+/**
+ * @brief Función principal del generador de carga.
+ */
+int main(int argc, char* argv[]) {
+    procesar_argumentos(argc, argv);
+
+    pid_t servidores[MAX_PARTICIONES];
+    for (int i = 0; i < config.num_particiones; i++) {
+        servidores[i] = config.externo ? -1 : lanzar_servidor(i);
+        if ((!config.externo && servidores[i] == -1) || esperar_cola_servidor(servidores[i], i) == -1) {
+            fprintf(stderr, "No se encontró el servidor de la partición %d (%s).\n", i, transporte_nombre(config.transporte));
+            for (int j = 0; j <= i; j++) {
+                if (servidores[j] > 0) kill(servidores[j], SIGINT);
+            }
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    bots = calloc((size_t)config.num_bots, sizeof(bot_t));
+    if (bots == NULL) {
+        perror("calloc bots");
+        exit(EXIT_FAILURE);
+    }
+
+    // Cada bot tiene su propia conexión (cola privada o socket), como un cliente real
+    for (int i = 0; i < config.num_bots; i++) {
+        bot_t* bot = &bots[i];
+        bot->numero = i;
+        bot->sala = i % config.num_salas;
+        snprintf(bot->nombre, sizeof(bot->nombre), "bot%d", i);
+        char sala[MAX_NOMBRE];
+        snprintf(sala, sizeof(sala), "bench-%d", bot->sala);
+        bot->particion = particion_de_sala(sala, config.num_particiones);
+        if (transporte_conectar(&bot->conexion, config.transporte, bot->particion) == -1 ||
+            pthread_create(&bot->hilo_recepcion, NULL, bucle_recepcion, bot) != 0) {
+            perror("crear bot");
+            exit(EXIT_FAILURE);
+        }
+        bot->id_cola = bot->conexion.id_propio;
+        enviar_al_servidor(bot, TIPO_UNION_SALA, sala, "");
+    }
+
+    // No se mide nada hasta que todos están dentro
+    struct timespec limite;
+    clock_gettime(CLOCK_REALTIME, &limite);
+    limite.tv_sec += ESPERA_UNION_S;
+    pthread_mutex_lock(&mutex_union);
+    while (num_unidos < config.num_bots) {
+        if (pthread_cond_timedwait(&cond_union, &mutex_union, &limite) == ETIMEDOUT) break;
+    }
+    int unidos = num_unidos;
+    pthread_mutex_unlock(&mutex_union);
+    if (unidos < config.num_bots) {
+        fprintf(stderr, "Solo %d de %d bots pudieron unirse a su sala.\n", unidos, config.num_bots);
+    }
+    fprintf(stderr, "%d bots en %d salas; enviando durante %d s...\n", unidos, config.num_salas, config.duracion_s);
+
+    uint64_t inicio = ahora_ns();
+    for (int i = 0; i < config.num_bots; i++) {
+        if (pthread_create(&bots[i].hilo_envio, NULL, bucle_envio, &bots[i]) != 0) {
+            perror("pthread_create envío");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (config.transferencia_mb > 0 && pthread_create(&bots[0].hilo_transferencia, NULL, bucle_transferencia, &bots[0]) != 0) {
+        perror("pthread_create transferencia");
+        exit(EXIT_FAILURE);
+    }
+    struct timespec duracion = { config.duracion_s, 0 };
+    nanosleep(&duracion, NULL);
+    fin_envio = 1;
+    for (int i = 0; i < config.num_bots; i++) pthread_join(bots[i].hilo_envio, NULL);
+    if (config.transferencia_mb > 0) {
+        pthread_mutex_lock(&mutex_transferencia);
+        pthread_cond_signal(&cond_transferencia);
+        pthread_mutex_unlock(&mutex_transferencia);
+        pthread_join(bots[0].hilo_transferencia, NULL);
+    }
+    double segundos = (double)(ahora_ns() - inicio) / 1e9;
+
+    struct timespec drenaje = { config.drenaje_ms / 1000, (long)(config.drenaje_ms % 1000) * 1000000L };
+    nanosleep(&drenaje, NULL);
+    fin_recepcion = 1;
+
+    // Despedida y limpieza: se da margen al servidor para procesar los cierres antes de
+    // cortar las conexiones; al cortarlas, el receptor vuelve con EIDRM
+    for (int i = 0; i < config.num_bots; i++) enviar_al_servidor(&bots[i], TIPO_CIERRE_CLIENTE, "", "");
+    struct timespec margen = { 0, 100000000L };
+    nanosleep(&margen, NULL);
+    for (int i = 0; i < config.num_bots; i++) transporte_cliente_cerrar(&bots[i].conexion);
+    for (int i = 0; i < config.num_bots; i++) {
+        pthread_join(bots[i].hilo_recepcion, NULL);
+        transporte_cliente_liberar(&bots[i].conexion);
+        anillo_desconectar(bots[i].anillo);
+    }
+
+    imprimir_resultados(segundos);
+
+    for (int i = 0; i < config.num_particiones; i++) {
+        if (servidores[i] > 0) kill(servidores[i], SIGINT);
+    }
+    for (int i = 0; i < config.num_particiones; i++) {
+        if (servidores[i] > 0) waitpid(servidores[i], NULL, 0);
+    }
+    free(bots);
+    return 0;
+}
+
+
+/**
+ * @brief Lee las opciones; lo que sigue a "--" se pasa al servidor.
+ */
+static void procesar_argumentos(int argc, char* argv[]) {
+    static const struct option opciones[] = {
+        {"bots",     required_argument, NULL, 'n'},
+        {"salas",    required_argument, NULL, 's'},
+        {"ritmo",    required_argument, NULL, 't'},
+        {"duracion", required_argument, NULL, 'd'},
+        {"drenaje",  required_argument, NULL, 'e'},
+        {"longitud", required_argument, NULL, 'l'},
+        {"externo",  no_argument,       NULL, 'x'},
+        {"servidor", required_argument, NULL, 'S'},
+        {"transporte", required_argument, NULL, 'u'},
+        {"particiones", required_argument, NULL, 'p'},
+        {"transferencia", required_argument, NULL, 'f'},
+        {"ayuda",    no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    config.num_bots = BOTS_DEFECTO;
+    config.num_salas = SALAS_DEFECTO;
+    config.duracion_s = DURACION_DEFECTO_S;
+    config.drenaje_ms = DRENAJE_DEFECTO_MS;
+    config.longitud = LONGITUD_DEFECTO;
+    config.ruta_servidor = "./servidor";
+    config.num_particiones = 1;
+
+    int opcion;
+    while ((opcion = getopt_long(argc, argv, "n:s:t:d:e:l:xS:u:p:f:h", opciones, NULL)) != -1) {
+        switch (opcion) {
+            case 'n': config.num_bots = atoi(optarg);   break;
+            case 's': config.num_salas = atoi(optarg);  break;
+            case 't': config.ritmo = atoi(optarg);      break;
+            case 'd': config.duracion_s = atoi(optarg); break;
+            case 'e': config.drenaje_ms = atoi(optarg); break;
+            case 'l': config.longitud = atoi(optarg);   break;
+            case 'x': config.externo = 1;               break;
+            case 'S': config.ruta_servidor = optarg;    break;
+            case 'p': config.num_particiones = atoi(optarg); break;
+            case 'f': config.transferencia_mb = atoi(optarg); break;
+            case 'u':
+                if (transporte_analizar(optarg, &config.transporte) == -1) {
+                    fprintf(stderr, "Transporte desconocido: %s (use sysv o unix)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+            default:
+                fprintf(stderr,
+                        "Uso: %s [opciones] [-- opciones del servidor]\n"
+                        "  -n, --bots N          Clientes simulados (defecto %d)\n"
+                        "  -s, --salas N         Salas entre las que se reparten (defecto %d)\n"
+                        "  -t, --ritmo N         Mensajes/s por bot; 0 = sin límite (defecto 0)\n"
+                        "  -d, --duracion S      Segundos enviando (defecto %d)\n"
+                        "  -e, --drenaje MS      Espera final para recibir lo pendiente (defecto %d)\n"
+                        "  -l, --longitud N      Bytes de texto por mensaje (defecto %d)\n"
+                        "  -x, --externo         Usar un servidor ya arrancado\n"
+                        "  -S, --servidor RUTA   Ejecutable del servidor (defecto ./servidor)\n"
+                        "  -u, --transporte MODO sysv | unix; se pasa también al servidor (defecto sysv)\n"
+                        "  -p, --particiones K   Servidores entre los que se reparten las salas (defecto 1)\n"
+                        "  -f, --transferencia MB El bot 0 envía sin parar transferencias de MB a su sala\n",
+                        argv[0], BOTS_DEFECTO, SALAS_DEFECTO, DURACION_DEFECTO_S, DRENAJE_DEFECTO_MS, LONGITUD_DEFECTO);
+                exit(opcion == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (config.num_bots < 1 || config.num_salas < 1 || config.ritmo < 0 || config.duracion_s < 1 ||
+        config.drenaje_ms < 0 || config.longitud < 24 || config.longitud > MAX_TEXTO - 1 ||
+        config.num_particiones < 1 || config.num_particiones > MAX_PARTICIONES || config.transferencia_mb < 0 ||
+        (uint64_t)config.transferencia_mb << 20 > MAX_TRANSFERENCIA) {
+        fprintf(stderr, "Parámetros fuera de rango (la longitud va de 24 a %d y las particiones de 1 a %d).\n",
+                MAX_TEXTO - 1, MAX_PARTICIONES);
+        exit(EXIT_FAILURE);
+    }
+
+    int n = 0;
+    config.args_servidor[n++] = (char*)config.ruta_servidor;
+    config.args_servidor[n++] = "-u";
+    config.args_servidor[n++] = (char*)transporte_nombre(config.transporte);
+    if (config.num_particiones > 1) {
+        config.args_servidor[n++] = "-x";
+        config.args_servidor[n++] = config.particion_servidor; // Lo rellena lanzar_servidor
+    }
+    for (int i = optind; i < argc && n < MAX_ARGS_SERVIDOR; i++) config.args_servidor[n++] = argv[i];
+    config.args_servidor[n] = NULL;
+}
+
+/**
+ * @brief Intenta conectar con el servidor de una partición y suelta la conexión enseguida.
+ * @return 0 si hay un servidor escuchando, -1 si no.
+ */
+static int probar_servidor(int particion) {
+    transporte_cliente_t prueba;
+    int resultado = transporte_conectar(&prueba, config.transporte, particion);
+    transporte_cliente_cerrar(&prueba);
+    transporte_cliente_liberar(&prueba);
+    return resultado;
+}
+
+/**
+ * @brief Arranca el servidor con su salida descartada (escribe una línea por unión).
+ * @return Su pid o -1.
+ */
+static pid_t lanzar_servidor(int particion) {
+    if (probar_servidor(particion) == 0) {
+        fprintf(stderr, "Ya hay un servidor escuchando: deténgalo o use -x para medirlo.\n");
+        return -1;
+    }
+    snprintf(config.particion_servidor, sizeof(config.particion_servidor), "%d/%d", particion, config.num_particiones);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int nulo = open("/dev/null", O_WRONLY);
+        if (nulo != -1) dup2(nulo, STDOUT_FILENO);
+        execv(config.ruta_servidor, config.args_servidor);
+        perror("execv servidor");
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * @brief Espera a que el servidor acepte conexiones (hasta 5 s).
+ */
+static int esperar_cola_servidor(pid_t servidor, int particion) {
+    for (int intento = 0; intento < 500; intento++) {
+        if (probar_servidor(particion) == 0) return 0;
+        if (servidor > 0 && waitpid(servidor, NULL, WNOHANG) == servidor) return -1;
+        struct timespec pausa = { 0, 10000000L };
+        nanosleep(&pausa, NULL);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Envía mensajes con marca de tiempo hasta fin_envio, al ritmo configurado.
+ */
+static void* bucle_envio(void* arg) {
+    bot_t* bot = arg;
+    char texto[MAX_TEXTO];
+    uint64_t intervalo = config.ritmo > 0 ? 1000000000ULL / (uint64_t)config.ritmo : 0;
+
+    // Los bots no arrancan en fase para no enviar todos en el mismo instante
+    uint64_t siguiente = ahora_ns() + (intervalo > 0 ? intervalo * (uint64_t)bot->numero / (uint64_t)config.num_bots : 0);
+    while (!fin_envio) {
+        if (intervalo > 0) {
+            struct timespec t = { (time_t)(siguiente / 1000000000ULL), (long)(siguiente % 1000000000ULL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+            siguiente += intervalo;
+            if (fin_envio) break;
+        }
+        int n = snprintf(texto, sizeof(texto), "B %llu ", (unsigned long long)ahora_ns());
+        if (n < config.longitud) {
+            memset(texto + n, 'x', (size_t)(config.longitud - n));
+            n = config.longitud;
+        }
+        texto[n] = '\0';
+
+        uint64_t errores = bot->errores_envio;
+        enviar_chat(bot, texto);
+        if (bot->errores_envio == errores) bot->enviados++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Envía transferencias de config.transferencia_mb a la sala del bot, una
+ * tras otra, con la misma ventana que el cliente, hasta fin_envio.
+ */
+static void* bucle_transferencia(void* arg) {
+    bot_t* bot = arg;
+    static char datos[FRAGMENTO_MAX_DATOS]; // El contenido da igual
+    const uint64_t total = (uint64_t)config.transferencia_mb << 20;
+    const uint64_t ventana = (uint64_t)VENTANA_FRAGMENTOS * FRAGMENTO_MAX_DATOS;
+
+    pthread_mutex_lock(&mutex_transferencia);
+    while (!fin_envio && !transferencia_rechazada) {
+        transferencia_actual++;
+        transferencia_confirmada = 0;
+        uint64_t enviado = 0;
+        while (!fin_envio && !transferencia_rechazada && transferencia_confirmada < total) {
+            if (enviado == total || enviado - transferencia_confirmada >= ventana) {
+                struct timespec limite;
+                clock_gettime(CLOCK_REALTIME, &limite);
+                limite.tv_sec++;
+                pthread_cond_timedwait(&cond_transferencia, &mutex_transferencia, &limite);
+                continue;
+            }
+            cabecera_fragmento_t fragmento = { bot->id_sesion, bot->id_sala, transferencia_actual, 0, total, enviado };
+            size_t longitud = total - enviado < FRAGMENTO_MAX_DATOS ? (size_t)(total - enviado) : FRAGMENTO_MAX_DATOS;
+            trama_t trama;
+            size_t tamano = trama_construir_fragmento(&trama, TIPO_FRAGMENTO, bot->id_cola, &fragmento, "", "carga", datos, longitud);
+            enviado += longitud;
+            pthread_mutex_unlock(&mutex_transferencia);
+            if (transporte_cliente_enviar(&bot->conexion, &trama, tamano, 1) == -1) bot->errores_envio++;
+            pthread_mutex_lock(&mutex_transferencia);
+        }
+        if (transferencia_confirmada == total) transferencias_completas++;
+    }
+    if (transferencia_rechazada) fprintf(stderr, "El servidor rechazó la transferencia del bot %d.\n", bot->numero);
+    pthread_mutex_unlock(&mutex_transferencia);
+    return NULL;
+}
+
+/**
+ * @brief Anota una confirmación o un rechazo de la transferencia del bot 0.
+ */
+static void anotar_confirmacion(const trama_t* trama, size_t recibido) {
+    mensaje_t msg;
+    unsigned int numero;
+    unsigned long long confirmado = 0;
+    if (trama_leer(trama, recibido, &msg) == -1 || sscanf(msg.texto, "%u %llu", &numero, &confirmado) < 1) return;
+    pthread_mutex_lock(&mutex_transferencia);
+    if (numero == transferencia_actual) {
+        if (trama->mtype == TIPO_FRAGMENTO_RECHAZADO) {
+            transferencia_rechazada = 1;
+        } else if (confirmado > transferencia_confirmada) {
+            bytes_transferidos += confirmado - transferencia_confirmada;
+            transferencia_confirmada = confirmado;
+        }
+        pthread_cond_signal(&cond_transferencia);
+    }
+    pthread_mutex_unlock(&mutex_transferencia);
+}
+
+/**
+ * @brief Mide una notificación "[botN]: B <ns> ..." (las demás se ignoran).
+ */
+static void medir_notificacion(bot_t* bot, const char* texto, size_t longitud, uint64_t ahora) {
+    char copia[ANILLO_MAX_TEXTO + 1];
+    if (longitud > ANILLO_MAX_TEXTO) longitud = ANILLO_MAX_TEXTO;
+    memcpy(copia, texto, longitud);
+    copia[longitud] = '\0';
+
+    const char* marca = strstr(copia, "]: B ");
+    if (marca == NULL) return;
+    uint64_t enviado = strtoull(marca + 5, NULL, 10);
+    bot->recibidos++;
+    if (enviado > 0 && enviado <= ahora) latencia_registrar(&bot->latencias, ahora - enviado);
+}
+
+static void procesar_trama(bot_t* bot, const trama_t* trama, size_t recibido) {
+    uint64_t ahora = ahora_ns();
+    switch (trama->mtype) {
+        case TIPO_NOTIFICACION:
+            medir_notificacion(bot, trama_texto(trama), trama->cabecera.longitud_texto, ahora);
+            break;
+        case TIPO_NOTIFICACION_LOTE: {
+            const char* datos = trama_texto(trama);
+            const char* fin = datos + trama->cabecera.longitud_texto;
+            while (datos + sizeof(longitud_registro_lote_t) <= fin) {
+                longitud_registro_lote_t longitud;
+                memcpy(&longitud, datos, sizeof(longitud));
+                datos += sizeof(longitud);
+                if (datos + longitud > fin) break;
+                medir_notificacion(bot, datos, longitud, ahora);
+                datos += longitud;
+            }
+            break;
+        }
+        case TIPO_ANILLO_SALA: {
+            mensaje_t msg;
+            if (trama_leer(trama, recibido, &msg) == -1) break;
+            anillo_desconectar(bot->anillo);
+            bot->anillo = msg.id_cola_cliente != -1 ? anillo_conectar(msg.id_cola_cliente) : NULL;
+            bot->cursor = strtoull(msg.texto, NULL, 10);
+            break;
+        }
+        case TIPO_SESION_SALA: {
+            mensaje_t msg;
+            unsigned int sesion, sala;
+            if (trama_leer(trama, recibido, &msg) == -1 || sscanf(msg.texto, "%u %u", &sesion, &sala) != 2) break;
+            bot->id_sesion = sesion;
+            bot->id_sala = sala;
+            break;
+        }
+        case TIPO_FRAGMENTO_CONFIRMADO:
+        case TIPO_FRAGMENTO_RECHAZADO:
+            anotar_confirmacion(trama, recibido);
+            break;
+        case TIPO_RESPUESTA_ERROR:
+        case TIPO_RESPUESTA_CADUCADA:
+            bot->rechazados++;
+            break;
+        case TIPO_RESPUESTA_EXITO:
+            if (!bot->unido) {
+                bot->unido = 1;
+                pthread_mutex_lock(&mutex_union);
+                num_unidos++;
+                pthread_cond_signal(&cond_union);
+                pthread_mutex_unlock(&mutex_union);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Lee lo publicado en el anillo del bot.
+ * @return Cuántos mensajes se consumieron.
+ */
+static int leer_anillo(bot_t* bot) {
+    char texto[ANILLO_MAX_TEXTO];
+    size_t longitud;
+    int id_cola_excluida, leidos = 0;
+    uint64_t perdidos;
+    resultado_anillo_t resultado;
+    while ((resultado = anillo_leer(bot->anillo, &bot->cursor, texto, &longitud, &id_cola_excluida, &perdidos)) != ANILLO_VACIO) {
+        leidos++;
+        if (resultado == ANILLO_DESBORDADO) {
+            bot->perdidos_anillo += perdidos;
+        } else if (id_cola_excluida != bot->id_cola) {
+            medir_notificacion(bot, texto, longitud, ahora_ns());
+        }
+    }
+    return leidos;
+}
+
+/**
+ * @brief Recibe por su conexión y, en modo anillo, también del anillo de la sala.
+ */
+static void* bucle_recepcion(void* arg) {
+    bot_t* bot = arg;
+    trama_t trama;
+    while (!fin_recepcion) {
+        int bloquear = 1;
+        if (bot->anillo != NULL) {
+            // Sin bloquear en la cola: el anillo es por donde llega el tráfico
+            if (leer_anillo(bot) > 0) continue;
+            bloquear = 0;
+        }
+        ssize_t recibido = transporte_cliente_recibir(&bot->conexion, &trama, bloquear);
+        if (recibido == -1) {
+            if (errno == ENOMSG) {
+                anillo_esperar(bot->anillo, bot->cursor, 1);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            break; // EIDRM: la conexión se cortó al terminar
+        }
+        if ((size_t)recibido >= sizeof(cabecera_trama_t)) procesar_trama(bot, &trama, (size_t)recibido);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Suma los contadores de todos los bots e imprime el resultado en JSON.
+ */
+static void imprimir_resultados(double segundos) {
+    static latencias_t total;
+    uint64_t enviados = 0, errores = 0, rechazados = 0, recibidos = 0, perdidos_anillo = 0, esperados = 0;
+
+    int* miembros = calloc((size_t)config.num_salas, sizeof(int));
+    if (miembros == NULL) return;
+    for (int i = 0; i < config.num_bots; i++) miembros[bots[i].sala] += bots[i].unido;
+
+    for (int i = 0; i < config.num_bots; i++) {
+        const bot_t* bot = &bots[i];
+        enviados += bot->enviados;
+        errores += bot->errores_envio;
+        rechazados += bot->rechazados;
+        recibidos += bot->recibidos;
+        perdidos_anillo += bot->perdidos_anillo;
+        // Cada mensaje admitido debe llegar a todos los demás miembros de su sala
+        uint64_t admitidos = bot->enviados > bot->rechazados ? bot->enviados - bot->rechazados : 0;
+        if (bot->unido) esperados += admitidos * (uint64_t)(miembros[bot->sala] - 1);
+        latencia_acumular(&total, &bot->latencias);
+    }
+    free(miembros);
+
+    uint64_t perdidos = esperados > recibidos ? esperados - recibidos : 0;
+    fprintf(stderr, "%llu enviados (%llu rechazados), %llu entregas de %llu esperadas; p50 %.1f us, p99 %.1f us\n",
+            (unsigned long long)enviados, (unsigned long long)rechazados, (unsigned long long)recibidos,
+            (unsigned long long)esperados,
+            latencia_percentil_us(&total, 0.50), latencia_percentil_us(&total, 0.99));
+    if (rechazados > 0) {
+        fprintf(stderr, "Con rechazos, las entregas esperadas son una cota superior: el servidor avisa una vez por racha "
+                        "(el total está en chat_rechazado de /stats).\n");
+    }
+    printf("{\"bots\":%d,\"salas\":%d,\"particiones\":%d,\"ritmo\":%d,\"longitud\":%d,\"segundos\":%.3f,"
+           "\"enviados\":%llu,\"errores_envio\":%llu,\"rechazados\":%llu,\"entregas_esperadas\":%llu,\"entregas\":%llu,"
+           "\"entregas_perdidas\":%llu,\"perdidos_anillo\":%llu,"
+           "\"envios_por_s\":%.1f,\"entregas_por_s\":%.1f,"
+           "\"transferencia_mb\":%d,\"transferencias\":%d,\"transferencia_mb_por_s\":%.1f,"
+           "\"latencia_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+           config.num_bots, config.num_salas, config.num_particiones, config.ritmo, config.longitud, segundos,
+           (unsigned long long)enviados, (unsigned long long)errores, (unsigned long long)rechazados,
+           (unsigned long long)esperados, (unsigned long long)recibidos, (unsigned long long)perdidos, (unsigned long long)perdidos_anillo,
+           (double)enviados / segundos, (double)recibidos / segundos,
+           config.transferencia_mb, transferencias_completas, (double)bytes_transferidos / (1 << 20) / segundos,
+           latencia_percentil_us(&total, 0.50), latencia_percentil_us(&total, 0.99), latencia_percentil_us(&total, 0.999),
+           (double)total.maximo / 1000.0);
+}
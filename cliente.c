@@ -1,53 +1,162 @@
 #include "common.h"
+#include "anillo.h"
+#include "transporte.h"
+#include "traza.h"
+#include "latencia.h"
 #include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 // Variables Globales del Cliente 
-static int id_cola_servidor = -1;
-static int id_cola_privada = -1;
+// Una conexión por partición; cada una tiene su id (cola privada o conexión) en id_propio
+static transporte_cliente_t conexiones[MAX_PARTICIONES];
+static int num_particiones = 1;
+static int conectado = 0;
 static char mi_nombre[MAX_NOMBRE];
 static char sala_actual[MAX_NOMBRE] = "";
+// Identificadores que da el servidor al unirse: el chat viaja solo con ellos y el texto.
+// Solo valen los de la partición de la sala actual, que decide el hilo de entrada.
+static pthread_mutex_t mutex_sesion = PTHREAD_MUTEX_INITIALIZER;
+static int particion_actual = 0;
+static uint32_t id_sesion = 0;
+static uint32_t id_sala = 0;
 static volatile int seguir_corriendo = 1;
 
+// Modo anillo: el hilo receptor pide el cambio de anillo y el hilo lector lo aplica
+#define PLAZO_ESPERA_ANILLO_MS 200
+static pthread_mutex_t mutex_anillo = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cambio_anillo = PTHREAD_COND_INITIALIZER;
+static anillo_t* anillo_actual = NULL; // Solo el hilo lector lo conecta y desconecta
+static int id_anillo_pedido = -1;
+static int id_propio_anillo = -1;     // Nuestro id en el servidor del anillo, para saltar lo propio
+static uint64_t cursor_pedido = 0;
+static int hay_cambio_anillo = 0;
+
+// Latidos: el hilo duerme en la condición para poder despertarlo al salir
+static pthread_mutex_t mutex_latido = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fin_latido = PTHREAD_COND_INITIALIZER;
+static char mi_pid[16];
+
+// /list con varias particiones: se juntan las respuestas de todas antes de mostrarlas
+static pthread_mutex_t mutex_listado = PTHREAD_MUTEX_INITIALIZER;
+static int listados_pendientes = 0;
+static char listado[MAX_PARTICIONES * MAX_TEXTO * 2];
+static size_t longitud_listado = 0;
+
+// Transferencia saliente (una a la vez): el hilo de entrada la prepara y el hilo
+// emisor la envía por trozos, sin más de VENTANA_FRAGMENTOS sin confirmar
+#define DIRECTORIO_RECIBIDOS "recibidos"
+#define PLAZO_CONFIRMACION_S 30 // Sin confirmaciones durante este tiempo se cancela
+static pthread_mutex_t mutex_envio = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cambio_envio = PTHREAD_COND_INITIALIZER;
+static struct {
+    int activa;
+    uint32_t numero;           // Identifica la transferencia ante el servidor
+    char nombre[MAX_NOMBRE];   // Archivo ("" = texto largo)
+    char* datos;
+    uint64_t total;
+    uint64_t enviado;          // Bytes ya puestos en la cola del servidor
+    uint64_t confirmado;       // Bytes que el servidor ya repartió
+    int decimas_mostradas;     // Progreso ya mostrado, en décimas del total
+    time_t ultimo_avance;
+} envio;
+
+// Transferencias entrantes, por autor (su sesión) y número; solo las de la sala actual
+#define MAX_RECEPCIONES 8
+typedef struct {
+    int en_uso;
+    uint32_t autor;
+    uint32_t numero;
+    char usuario[MAX_NOMBRE];
+    char ruta[MAX_NOMBRE * 2 + sizeof(DIRECTORIO_RECIBIDOS) + 8]; // Vacía = texto largo
+    FILE* archivo;
+    char* texto;
+    uint64_t total;
+    uint64_t recibido;
+    int decimas_mostradas;
+} recepcion_t;
+static pthread_mutex_t mutex_recepciones = PTHREAD_MUTEX_INITIALIZER;
+static recepcion_t recepciones[MAX_RECEPCIONES];
+
+// Modo traza: uno de cada muestreo_traza mensajes propios viaja trazado (solo lo toca
+// el hilo de entrada); de los trazados que llegan se mide cada etapa
+static int muestreo_traza = 0;         // 0 = no se traza ninguno
+static uint32_t mensajes_chat = 0;
+static uint32_t trazas_enviadas = 0;
+static const char* ruta_traza = NULL;  // Archivo de eventos de Chrome (NULL = solo el resumen)
+static pthread_mutex_t mutex_trazas = PTHREAD_MUTEX_INITIALIZER;
+static latencias_t latencias_etapa[NUM_ETAPAS_TRAZA];
+static latencias_t latencias_total;
+
 // Prototipos 
 void finalizar_cliente(int signum);
 void* hilo_receptor_mensajes(void* arg);
+void* hilo_lector_anillo(void* arg);
+void* hilo_latido(void* arg);
+void* hilo_emisor(void* arg);
 void procesar_entrada_usuario();
-void enviar_comando_al_servidor(tipo_mensaje_t tipo, const char* sala, const char* texto);
+void enviar_comando_al_servidor(int particion, tipo_mensaje_t tipo, const char* sala, const char* texto);
+void enviar_comando_a_todos(tipo_mensaje_t tipo, const char* texto);
+void enviar_chat_al_servidor(const char* texto);
+static void pedir_anillo(int id_anillo, uint64_t cursor, int id_propio);
+static void iniciar_envio(char* datos, size_t total, const char* nombre);
+static void enviar_archivo(const char* ruta);
+static void cancelar_envio(const char* motivo);
+static void cancelar_recepciones(void);
+static void anotar_traza(const trama_t* trama, size_t recibido);
+static void mostrar_resumen_trazas(void);
 
 
 /**
  * @brief Función principal del cliente.
  */
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Uso: %s <nombre_usuario>\n", argv[0]);
+    tipo_transporte_t transporte = TRANSPORTE_SYSV;
+    int opcion, uso_valido = 1;
+    while ((opcion = getopt(argc, argv, "u:p:t:m:")) != -1) {
+        if (opcion == 'u') uso_valido &= transporte_analizar(optarg, &transporte) == 0;
+        else if (opcion == 'p') num_particiones = atoi(optarg);
+        else if (opcion == 't') ruta_traza = optarg;
+        else if (opcion == 'm') muestreo_traza = atoi(optarg);
+        else uso_valido = 0;
+    }
+    if (!uso_valido || argc - optind != 1 || num_particiones < 1 || num_particiones > MAX_PARTICIONES ||
+        muestreo_traza < 0) {
+        fprintf(stderr, "Uso: %s [-u sysv|unix] [-p particiones] [-t traza.json] [-m 1 de cada N trazado] <nombre_usuario>\n",
+                argv[0]);
         exit(EXIT_FAILURE);
     }
-    strncpy(mi_nombre, argv[1], MAX_NOMBRE - 1);
+    if (ruta_traza != NULL && traza_abrir(ruta_traza) == -1) exit(EXIT_FAILURE);
+    strncpy(mi_nombre, argv[optind], MAX_NOMBRE - 1);
+    snprintf(mi_pid, sizeof(mi_pid), "%d", (int)getpid());
 
     signal(SIGINT, finalizar_cliente);
 
-    key_t clave_servidor = ftok(RUTA_CLAVE_SERVIDOR, ID_PROYECTO);
-    if (clave_servidor == -1) {
-        perror("ftok servidor"); exit(EXIT_FAILURE);
-    }
-    id_cola_servidor = msgget(clave_servidor, 0);
-    if (id_cola_servidor == -1) {
-        perror("msgget servidor - ¿Está el servidor corriendo?");
-        exit(EXIT_FAILURE);
-    }
-
-    id_cola_privada = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
-    if (id_cola_privada == -1) {
-        perror("msgget cliente privado");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < num_particiones; i++) {
+        if (transporte_conectar(&conexiones[i], transporte, i) == -1) {
+            fprintf(stderr, "Partición %d: ", i);
+            perror("conectar con el servidor - ¿Está el servidor corriendo?");
+            for (int j = 0; j <= i; j++) transporte_cliente_cerrar(&conexiones[j]);
+            exit(EXIT_FAILURE);
+        }
     }
+    conectado = 1;
 
-    printf(" ¡Bienvenido al chat, %s! (ID Cola: %d)\n", mi_nombre, id_cola_privada);
-    printf("Comandos: /join <sala>, /leave, /list, /users, /exit\n");
+    printf(" ¡Bienvenido al chat, %s! (ID Cola: %d)\n", mi_nombre, conexiones[0].id_propio);
+    if (num_particiones > 1) printf(" Salas repartidas entre %d servidores.\n", num_particiones);
+    printf("Comandos: /join <sala>, /leave, /list, /users, /history [N], /search <términos> [#sala] [@usuario], /send <archivo>, /stats, /exit\n");
 
-    pthread_t id_hilo_receptor;
-    if (pthread_create(&id_hilo_receptor, NULL, hilo_receptor_mensajes, NULL) != 0) {
+    // Un hilo receptor por partición: cada conexión se escucha por separado
+    pthread_t id_hilos_receptores[MAX_PARTICIONES], id_hilo_anillo, id_hilo_latido, id_hilo_emisor;
+    int creados = 0;
+    while (creados < num_particiones &&
+           pthread_create(&id_hilos_receptores[creados], NULL, hilo_receptor_mensajes, (void*)(intptr_t)creados) == 0) {
+        creados++;
+    }
+    if (creados < num_particiones ||
+        pthread_create(&id_hilo_anillo, NULL, hilo_lector_anillo, NULL) != 0 ||
+        pthread_create(&id_hilo_latido, NULL, hilo_latido, NULL) != 0 ||
+        pthread_create(&id_hilo_emisor, NULL, hilo_emisor, NULL) != 0) {
         perror("pthread_create");
         finalizar_cliente(0);
         exit(EXIT_FAILURE);
@@ -58,7 +167,12 @@ int main(int argc, char* argv[]) {
     // Secuencia de Cierre Controlado
     // Cuando el bucle de entrada termina (por /exit o Ctrl+D)
     finalizar_cliente(0); 
-    pthread_join(id_hilo_receptor, NULL);
+    for (int i = 0; i < num_particiones; i++) pthread_join(id_hilos_receptores[i], NULL);
+    pthread_join(id_hilo_anillo, NULL);
+    pthread_join(id_hilo_latido, NULL);
+    pthread_join(id_hilo_emisor, NULL);
+    for (int i = 0; i < num_particiones; i++) transporte_cliente_liberar(&conexiones[i]);
+    mostrar_resumen_trazas();
     
     printf("Cliente desconectado.\n");
     return 0;
@@ -66,70 +180,466 @@ int main(int argc, char* argv[]) {
 
 
 /**
- * @brief Hilo que lee la entrada del usuario y la procesa.
+ * @brief Une al cliente a una sala en el servidor de su partición. Si la sala
+ * anterior era de otra partición, se abandona allí primero: cada servidor solo
+ * ve las salas que atiende y no sabría sacarnos de una ajena.
+ */
+static void cambiar_de_sala(const char* nombre_sala) {
+    // Las transferencias son de la sala: ni las propias ni las ajenas sobreviven al cambio
+    cancelar_envio("has cambiado de sala");
+    cancelar_recepciones();
+    int particion = particion_de_sala(nombre_sala, num_particiones);
+    if (particion != particion_actual) {
+        if (strlen(sala_actual) > 0) enviar_comando_al_servidor(particion_actual, TIPO_ABANDONAR_SALA, sala_actual, "");
+        // Lo que aún llegue de la partición anterior (su sesión, soltar su anillo) ya no cuenta
+        pthread_mutex_lock(&mutex_sesion);
+        particion_actual = particion;
+        id_sesion = id_sala = 0;
+        pthread_mutex_unlock(&mutex_sesion);
+        pedir_anillo(-1, 0, -1);
+    }
+    strncpy(sala_actual, nombre_sala, MAX_NOMBRE - 1);
+    // El pid permite al servidor detectar que el proceso murió sin despedirse
+    enviar_comando_al_servidor(particion, TIPO_UNION_SALA, sala_actual, mi_pid);
+}
+
+
+/**
+ * @brief Hilo que lee la entrada del usuario y la procesa. Las líneas que no
+ * caben en un mensaje de chat se envían como transferencia de texto.
  */
 void procesar_entrada_usuario() {
-    char buffer[MAX_TEXTO + 20];
+    char* buffer = NULL;
+    size_t capacidad = 0;
     while (seguir_corriendo) {
         printf("> ");
         fflush(stdout);
 
-        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
+        ssize_t longitud = getline(&buffer, &capacidad, stdin);
+        if (longitud == -1) {
             break; // Ctrl+D
         }
-        buffer[strcspn(buffer, "\n")] = '\0';
+        if (longitud > 0 && buffer[longitud - 1] == '\n') buffer[--longitud] = '\0';
 
-        if (strlen(buffer) == 0) continue;
+        if (longitud == 0) continue;
 
         if (strncmp(buffer, "/join ", 6) == 0) {
             char nombre_sala[MAX_NOMBRE];
-            sscanf(buffer + 6, "%s", nombre_sala);
-            strncpy(sala_actual, nombre_sala, MAX_NOMBRE);
-            enviar_comando_al_servidor(TIPO_UNION_SALA, sala_actual, "");
+            if (sscanf(buffer + 6, "%49s", nombre_sala) != 1) continue;
+            cambiar_de_sala(nombre_sala);
         } else if (strcmp(buffer, "/leave") == 0) {
             if (strlen(sala_actual) > 0) {
-                enviar_comando_al_servidor(TIPO_ABANDONAR_SALA, sala_actual, "");
+                cancelar_envio("has salido de la sala");
+                cancelar_recepciones();
+                enviar_comando_al_servidor(particion_actual, TIPO_ABANDONAR_SALA, sala_actual, "");
                 strcpy(sala_actual, "");
             } else {
                 printf("No estás en ninguna sala.\n");
             }
         } else if (strcmp(buffer, "/list") == 0) {
-            enviar_comando_al_servidor(TIPO_LISTAR_SALAS, "", "");
+            if (num_particiones > 1) {
+                pthread_mutex_lock(&mutex_listado);
+                listados_pendientes = num_particiones;
+                longitud_listado = 0;
+                pthread_mutex_unlock(&mutex_listado);
+            }
+            enviar_comando_a_todos(TIPO_LISTAR_SALAS, "");
         } else if (strcmp(buffer, "/users") == 0) {
             if (strlen(sala_actual) > 0) {
-                enviar_comando_al_servidor(TIPO_LISTAR_USUARIOS, sala_actual, "");
+                enviar_comando_al_servidor(particion_actual, TIPO_LISTAR_USUARIOS, sala_actual, "");
+            } else {
+                printf("No estás en ninguna sala.\n");
+            }
+        } else if (strcmp(buffer, "/history") == 0 || strncmp(buffer, "/history ", 9) == 0) {
+            if (strlen(sala_actual) > 0) {
+                enviar_comando_al_servidor(particion_actual, TIPO_HISTORIAL, sala_actual, buffer[8] == ' ' ? buffer + 9 : "");
+            } else {
+                printf("No estás en ninguna sala.\n");
+            }
+        } else if (strncmp(buffer, "/search ", 8) == 0) {
+            if (strlen(sala_actual) > 0) {
+                enviar_comando_al_servidor(particion_actual, TIPO_BUSCAR, sala_actual, buffer + 8);
             } else {
                 printf("No estás en ninguna sala.\n");
             }
+        } else if (strncmp(buffer, "/send ", 6) == 0) {
+            if (strlen(sala_actual) > 0) {
+                enviar_archivo(buffer + 6);
+            } else {
+                printf("No estás en ninguna sala.\n");
+            }
+        } else if (strcmp(buffer, "/stats") == 0) {
+            enviar_comando_a_todos(TIPO_ESTADISTICAS, "");
         } else if (strcmp(buffer, "/exit") == 0) {
             break; // Romper el bucle para iniciar el cierre
         } else if (buffer[0] == '/') {
             printf("Comando desconocido.\n");
         } else {
-            if (strlen(sala_actual) > 0) {
-                enviar_comando_al_servidor(TIPO_MENSAJE, sala_actual, buffer);
-            } else {
+            if (strlen(sala_actual) == 0) {
                 printf("No estás en una sala. Usa /join <sala>.\n");
+            } else if ((size_t)longitud < MAX_TEXTO) {
+                enviar_chat_al_servidor(buffer);
+            } else {
+                char* copia = malloc((size_t)longitud);
+                if (copia != NULL) {
+                    memcpy(copia, buffer, (size_t)longitud);
+                    iniciar_envio(copia, (size_t)longitud, "");
+                } else {
+                    perror("malloc texto largo");
+                }
             }
         }
     }
+    free(buffer);
 }
 
 
 /**
- * @brief Hilo que escucha mensajes del servidor en la cola privada.
+ * @brief Muestra todas las notificaciones de una trama agrupada y repinta el prompt una sola vez.
  */
-void* hilo_receptor_mensajes(void* arg) {
-    (void)arg; // Parámetro no usado
+static void mostrar_lote(const trama_t* trama, size_t recibido) {
+    const char* datos = trama_texto(trama);
+    const char* fin = datos + trama->cabecera.longitud_texto;
+    if (fin > (const char*)trama + sizeof(long) + recibido) return; // Trama truncada
+
+    printf("\r\033[K");
+    while (datos + sizeof(longitud_registro_lote_t) <= fin) {
+        longitud_registro_lote_t longitud;
+        memcpy(&longitud, datos, sizeof(longitud));
+        datos += sizeof(longitud);
+        if (datos + longitud > fin) break;
+        printf("%.*s\n", (int)longitud, datos);
+        datos += longitud;
+    }
+    printf("> ");
+    fflush(stdout);
+}
+
+
+/**
+ * @brief Pasa al hilo lector el anillo indicado (-1 = que suelte el actual).
+ */
+static void pedir_anillo(int id_anillo, uint64_t cursor, int id_propio) {
+    pthread_mutex_lock(&mutex_anillo);
+    id_anillo_pedido = id_anillo;
+    cursor_pedido = cursor;
+    id_propio_anillo = id_propio;
+    hay_cambio_anillo = 1;
+    pthread_cond_signal(&cambio_anillo);
+    if (anillo_actual != NULL) anillo_despertar(anillo_actual); // Puede estar dormido en el futex
+    pthread_mutex_unlock(&mutex_anillo);
+}
+
+/**
+ * @brief Atiende el anillo o los identificadores de sala que envía el servidor al
+ * unirse, si vienen de la partición de la sala actual (las demás llegan tarde).
+ */
+static void guardar_sesion(int particion, const trama_t* trama, size_t recibido) {
+    mensaje_t msg;
+    if (trama_leer(trama, recibido, &msg) == -1) return;
+    pthread_mutex_lock(&mutex_sesion);
+    int vigente = particion == particion_actual;
+    unsigned int sesion, sala;
+    if (vigente && trama->mtype == TIPO_SESION_SALA && sscanf(msg.texto, "%u %u", &sesion, &sala) == 2) {
+        id_sesion = sesion;
+        id_sala = sala;
+    }
+    pthread_mutex_unlock(&mutex_sesion);
+    if (vigente && trama->mtype == TIPO_ANILLO_SALA) {
+        pedir_anillo(msg.id_cola_cliente, strtoull(msg.texto, NULL, 10), conexiones[particion].id_propio);
+    }
+}
+
+/**
+ * @brief Junta una respuesta a /list de una partición con las demás y, con la
+ * última, muestra la lista completa.
+ * @return 1 si la trama era parte de un /list pendiente, 0 si hay que mostrarla tal cual.
+ */
+static int acumular_listado(const trama_t* trama) {
+    static const char cabecera[] = "Salas disponibles:\n";
+    static const char vacia[] = " - No hay salas activas.";
+    const char* texto = trama_texto(trama);
+    const char* fin = texto + trama->cabecera.longitud_texto;
+    if (trama->mtype != TIPO_RESPUESTA_EXITO || (size_t)(fin - texto) < sizeof(cabecera) - 1 ||
+        memcmp(texto, cabecera, sizeof(cabecera) - 1) != 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&mutex_listado);
+    if (listados_pendientes == 0) {
+        pthread_mutex_unlock(&mutex_listado);
+        return 0;
+    }
+    // Solo las líneas de salas: cada partición vacía añadiría su propio "No hay salas activas"
+    for (const char* linea = texto + sizeof(cabecera) - 1; linea < fin;) {
+        const char* salto = memchr(linea, '\n', (size_t)(fin - linea));
+        size_t longitud = salto != NULL ? (size_t)(salto + 1 - linea) : (size_t)(fin - linea);
+        if (strncmp(linea, vacia, sizeof(vacia) - 1) != 0 && longitud_listado + longitud <= sizeof(listado)) {
+            memcpy(listado + longitud_listado, linea, longitud);
+            longitud_listado += longitud;
+        }
+        linea += longitud;
+    }
+    if (--listados_pendientes == 0) {
+        printf("\r\033[K%s%.*s%s\n> ", cabecera, (int)longitud_listado, listado, longitud_listado == 0 ? vacia : "");
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&mutex_listado);
+    return 1;
+}
+
+/**
+ * @brief Suelta una transferencia entrante; si estaba a medias, borra el archivo
+ * parcial (con mutex_recepciones tomado).
+ */
+static void liberar_recepcion(recepcion_t* r) {
+    if (r->archivo != NULL) {
+        fclose(r->archivo);
+        if (r->recibido < r->total) unlink(r->ruta);
+    }
+    free(r->texto);
+    memset(r, 0, sizeof(*r));
+}
+
+/**
+ * @brief Descarta las transferencias entrantes a medias (al cambiar de sala).
+ */
+static void cancelar_recepciones(void) {
+    pthread_mutex_lock(&mutex_recepciones);
+    for (int i = 0; i < MAX_RECEPCIONES; i++) {
+        if (recepciones[i].en_uso) liberar_recepcion(&recepciones[i]);
+    }
+    pthread_mutex_unlock(&mutex_recepciones);
+}
+
+/**
+ * @brief Copia en destino un nombre que llega de otro cliente como componente
+ * segura de una ruta: cada '/' pasa a ser '_' y "", "." y ".." se cambian por defecto.
+ */
+static void limpiar_componente(char* destino, size_t capacidad, const char* origen, const char* defecto) {
+    size_t n = 0;
+    for (; origen[n] != '\0' && n + 1 < capacidad; n++) destino[n] = origen[n] == '/' ? '_' : origen[n];
+    destino[n] = '\0';
+    if (strcmp(destino, "") == 0 || strcmp(destino, ".") == 0 || strcmp(destino, "..") == 0) {
+        snprintf(destino, capacidad, "%s", defecto);
+    }
+}
+
+/**
+ * @brief Crea el archivo de una recepción sin pisar ninguno que ya exista: si
+ * la ruta está ocupada prueba con ".1", ".2"... (ruta queda con la elegida).
+ * @return El archivo abierto para escribir, o NULL (errno indica el motivo).
+ */
+static FILE* crear_archivo_nuevo(char* ruta, size_t capacidad, const char* base) {
+    for (int intento = 0; intento < 100; intento++) {
+        if (intento == 0) snprintf(ruta, capacidad, "%s", base);
+        else snprintf(ruta, capacidad, "%s.%d", base, intento);
+        int fd = open(ruta, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd != -1) {
+            FILE* archivo = fdopen(fd, "wb");
+            if (archivo == NULL) {
+                close(fd);
+                unlink(ruta);
+            }
+            return archivo;
+        }
+        if (errno != EEXIST) return NULL;
+    }
+    errno = EEXIST;
+    return NULL;
+}
+
+/**
+ * @brief Prepara la recepción de una transferencia nueva a partir de su primer
+ * trozo. Los archivos se escriben en DIRECTORIO_RECIBIDOS como "<autor>-<nombre>",
+ * sin sobrescribir ninguno; autor y nombre vienen del emisor, así que se limpian
+ * para que la ruta no salga nunca del directorio.
+ * @return La recepción, o NULL si no se puede (se avisa al usuario).
+ */
+static recepcion_t* abrir_recepcion(const cabecera_fragmento_t* fragmento, const mensaje_t* msg) {
+    recepcion_t* r = NULL;
+    for (int i = 0; i < MAX_RECEPCIONES && r == NULL; i++) {
+        if (!recepciones[i].en_uso) r = &recepciones[i];
+    }
+    if (r == NULL || fragmento->total > MAX_TRANSFERENCIA) {
+        printf("\r\033[K[AVISO] Transferencia de %s ignorada: %s.\n> ", msg->nombre_usuario,
+               r == NULL ? "hay demasiadas en curso" : "demasiado grande");
+        fflush(stdout);
+        return NULL;
+    }
+    r->en_uso = 1;
+    r->autor = fragmento->id_sesion;
+    r->numero = fragmento->transferencia;
+    r->total = fragmento->total;
+    strcpy(r->usuario, msg->nombre_usuario);
+
+    if (msg->nombre_sala[0] == '\0') {
+        r->texto = malloc(r->total);
+        if (r->texto == NULL) {
+            perror("malloc texto largo");
+            liberar_recepcion(r);
+            return NULL;
+        }
+        return r;
+    }
+    const char* barra = strrchr(msg->nombre_sala, '/');
+    char nombre[MAX_NOMBRE], autor[MAX_NOMBRE], base[sizeof(r->ruta)];
+    limpiar_componente(nombre, sizeof(nombre), barra != NULL ? barra + 1 : msg->nombre_sala, "archivo");
+    limpiar_componente(autor, sizeof(autor), r->usuario, "anonimo");
+    snprintf(base, sizeof(base), "%s/%s-%s", DIRECTORIO_RECIBIDOS, autor, nombre);
+    if ((mkdir(DIRECTORIO_RECIBIDOS, 0755) == -1 && errno != EEXIST) ||
+        (r->archivo = crear_archivo_nuevo(r->ruta, sizeof(r->ruta), base)) == NULL) {
+        perror(base);
+        liberar_recepcion(r);
+        return NULL;
+    }
+    printf("\r\033[K%s envía %s (%llu bytes) -> %s\n> ", r->usuario, nombre, (unsigned long long)r->total, r->ruta);
+    fflush(stdout);
+    return r;
+}
+
+/**
+ * @brief Añade un trozo de otro miembro a su transferencia y, con el último,
+ * muestra el texto o avisa de dónde quedó el archivo. Los trozos de una
+ * transferencia llegan en orden; un hueco (trozos descartados por ir lento) la
+ * invalida entera.
+ */
+static void recibir_fragmento(int particion, const trama_t* trama, size_t recibido) {
+    mensaje_t msg;
+    if (trama_leer(trama, recibido, &msg) == -1) return;
+    pthread_mutex_lock(&mutex_sesion);
+    int vigente = particion == particion_actual;
+    pthread_mutex_unlock(&mutex_sesion);
+    if (!vigente) return;
+    cabecera_fragmento_t fragmento;
+    const char* datos = fragmento_datos(trama, &fragmento);
+    size_t longitud = trama->cabecera.longitud_texto;
+
+    pthread_mutex_lock(&mutex_recepciones);
+    recepcion_t* r = NULL;
+    for (int i = 0; i < MAX_RECEPCIONES && r == NULL; i++) {
+        if (recepciones[i].en_uso && recepciones[i].autor == fragmento.id_sesion &&
+            recepciones[i].numero == fragmento.transferencia) {
+            r = &recepciones[i];
+        }
+    }
+    // Sin recepción abierta solo vale el primer trozo: lo demás es de antes de unirnos
+    if (r == NULL && fragmento.desplazamiento == 0) r = abrir_recepcion(&fragmento, &msg);
+    if (r == NULL) {
+        pthread_mutex_unlock(&mutex_recepciones);
+        return;
+    }
+    if (fragmento.desplazamiento != r->recibido || fragmento.total != r->total || longitud > r->total - r->recibido) {
+        printf("\r\033[K[AVISO] Se perdieron trozos de la transferencia de %s: descartada.\n> ", r->usuario);
+        fflush(stdout);
+        liberar_recepcion(r);
+        pthread_mutex_unlock(&mutex_recepciones);
+        return;
+    }
+    if (r->archivo != NULL) {
+        if (fwrite(datos, 1, longitud, r->archivo) != longitud) {
+            perror(r->ruta);
+            liberar_recepcion(r);
+            pthread_mutex_unlock(&mutex_recepciones);
+            return;
+        }
+    } else {
+        memcpy(r->texto + r->recibido, datos, longitud);
+    }
+    r->recibido += longitud;
+
+    if (r->recibido == r->total) {
+        if (r->archivo != NULL) printf("\r\033[KRecibido de %s: %s\n> ", r->usuario, r->ruta);
+        else printf("\r\033[K[%s]: %.*s\n> ", r->usuario, (int)r->total, r->texto);
+        fflush(stdout);
+        liberar_recepcion(r);
+    } else if (r->archivo != NULL && (int)(r->recibido * 10 / r->total) > r->decimas_mostradas) {
+        r->decimas_mostradas = (int)(r->recibido * 10 / r->total);
+        printf("\r\033[K%s: %d%%\n> ", r->ruta, r->decimas_mostradas * 10);
+        fflush(stdout);
+    }
+    pthread_mutex_unlock(&mutex_recepciones);
+}
+
+/**
+ * @brief Atiende la confirmación o el rechazo de un trozo de la transferencia
+ * propia: la confirmación abre hueco en la ventana del hilo emisor.
+ */
+static void atender_confirmacion(const trama_t* trama, size_t recibido) {
     mensaje_t msg;
+    unsigned int numero;
+    int leidos = 0;
+    if (trama_leer(trama, recibido, &msg) == -1 || sscanf(msg.texto, "%u %n", &numero, &leidos) != 1) return;
+
+    pthread_mutex_lock(&mutex_envio);
+    if (envio.activa && numero == envio.numero) {
+        if (trama->mtype == TIPO_FRAGMENTO_RECHAZADO) {
+            printf("\r\033[K[AVISO] Transferencia cancelada por el servidor: %s\n> ", msg.texto + leidos);
+            fflush(stdout);
+            free(envio.datos);
+            envio.datos = NULL;
+            envio.activa = 0;
+        } else {
+            uint64_t confirmado = strtoull(msg.texto + leidos, NULL, 10);
+            if (confirmado > envio.confirmado && confirmado <= envio.enviado) {
+                envio.confirmado = confirmado;
+                envio.ultimo_avance = time(NULL);
+            }
+            int decimas = (int)(envio.confirmado * 10 / envio.total);
+            if (envio.confirmado == envio.total) {
+                printf("\r\033[KTransferencia completada: %s (%llu bytes)\n> ",
+                       envio.nombre[0] != '\0' ? envio.nombre : "texto", (unsigned long long)envio.total);
+                free(envio.datos);
+                envio.datos = NULL;
+                envio.activa = 0;
+            } else if (envio.nombre[0] != '\0' && decimas > envio.decimas_mostradas) {
+                envio.decimas_mostradas = decimas;
+                printf("\r\033[KEnviando %s: %d%%\n> ", envio.nombre, decimas * 10);
+            }
+            fflush(stdout);
+        }
+        pthread_cond_signal(&cambio_envio);
+    }
+    pthread_mutex_unlock(&mutex_envio);
+}
+
+/**
+ * @brief Hilo que escucha los mensajes de un servidor (arg = su partición).
+ */
+void* hilo_receptor_mensajes(void* arg) {
+    int particion = (int)(intptr_t)arg;
+    transporte_cliente_t* conexion = &conexiones[particion];
+    trama_t trama;
     while (seguir_corriendo) {
-        if (msgrcv(id_cola_privada, &msg, TAMANO_MENSAJE, 0, 0) == -1) {
+        ssize_t recibido = transporte_cliente_recibir(conexion, &trama, 1);
+        if (recibido == -1) {
+            if (errno == EINTR) continue;
             if (seguir_corriendo) { // Solo mostrar error si no estamos saliendo
-                 perror("msgrcv cliente");
+                 perror("recibir del servidor");
             }
             break;
         }
-        printf("\r\033[K%s\n> ", msg.texto);
+        if ((size_t)recibido < sizeof(cabecera_trama_t)) continue;
+        if (trama.mtype == TIPO_NOTIFICACION_LOTE) {
+            mostrar_lote(&trama, (size_t)recibido);
+            continue;
+        }
+        if (trama.mtype == TIPO_ANILLO_SALA || trama.mtype == TIPO_SESION_SALA) {
+            guardar_sesion(particion, &trama, (size_t)recibido);
+            continue;
+        }
+        if (trama.mtype == TIPO_FRAGMENTO_SALA) {
+            recibir_fragmento(particion, &trama, (size_t)recibido);
+            continue;
+        }
+        if (trama.mtype == TIPO_FRAGMENTO_CONFIRMADO || trama.mtype == TIPO_FRAGMENTO_RECHAZADO) {
+            atender_confirmacion(&trama, (size_t)recibido);
+            continue;
+        }
+        if (trama.cabecera.banderas & TRAMA_TRAZADA) anotar_traza(&trama, (size_t)recibido);
+        if (num_particiones > 1 && acumular_listado(&trama)) continue;
+        // El texto llega sin '\0': se imprime con su longitud, directamente desde la trama
+        printf("\r\033[K%.*s\n> ", (int)trama.cabecera.longitud_texto, trama_texto(&trama));
         fflush(stdout);
     }
     return NULL;
@@ -137,24 +647,318 @@ void* hilo_receptor_mensajes(void* arg) {
 
 
 /**
- * @brief Construye y envía un mensaje al servidor.
+ * @brief Muestra lo publicado en el anillo desde el cursor, repintando el prompt una vez.
+ * @return Cuántos mensajes se consumieron (incluidos los propios, que no se muestran).
  */
-void enviar_comando_al_servidor(tipo_mensaje_t tipo, const char* sala, const char* texto) {
-    if (id_cola_servidor == -1) return; // No enviar si ya nos estamos cerrando
+static int mostrar_anillo(anillo_t* anillo, uint64_t* cursor, int id_propio) {
+    char texto[ANILLO_MAX_TEXTO];
+    size_t longitud;
+    int id_cola_excluida, consumidos = 0, mostrados = 0;
+    uint64_t perdidos;
 
-    mensaje_t msg;
-    msg.mtype = tipo;
-    msg.id_cola_cliente = id_cola_privada;
-    strncpy(msg.nombre_usuario, mi_nombre, MAX_NOMBRE);
-    strncpy(msg.nombre_sala, sala, MAX_NOMBRE);
-    strncpy(msg.texto, texto, MAX_TEXTO);
+    resultado_anillo_t resultado;
+    while (consumidos < 64 &&
+           (resultado = anillo_leer(anillo, cursor, texto, &longitud, &id_cola_excluida, &perdidos)) != ANILLO_VACIO) {
+        consumidos++;
+        if (resultado == ANILLO_MENSAJE && id_cola_excluida == id_propio) continue;
+        if (mostrados++ == 0) printf("\r\033[K");
+        if (resultado == ANILLO_DESBORDADO) {
+            printf("[AVISO] Te has perdido %llu mensajes de la sala.\n", (unsigned long long)perdidos);
+        } else {
+            printf("%.*s\n", (int)longitud, texto);
+        }
+    }
+    if (mostrados > 0) {
+        printf("> ");
+        fflush(stdout);
+    }
+    return consumidos;
+}
+
+/**
+ * @brief Hilo que lee el anillo de la sala actual cuando el servidor difunde por memoria compartida.
+ */
+void* hilo_lector_anillo(void* arg) {
+    (void)arg;
+    uint64_t cursor = 0;
+    int id_propio = -1;
+    while (seguir_corriendo) {
+        pthread_mutex_lock(&mutex_anillo);
+        if (hay_cambio_anillo) {
+            hay_cambio_anillo = 0;
+            anillo_desconectar(anillo_actual);
+            anillo_actual = NULL;
+            if (id_anillo_pedido != -1) {
+                anillo_actual = anillo_conectar(id_anillo_pedido);
+                if (anillo_actual == NULL) fprintf(stderr, "No se pudo conectar al anillo de la sala.\n");
+                cursor = cursor_pedido;
+                id_propio = id_propio_anillo;
+            }
+        }
+        anillo_t* anillo = anillo_actual;
+        if (anillo == NULL) {
+            // Modo colas o fuera de sala: se espera un cambio con plazo para ver seguir_corriendo
+            struct timespec limite;
+            clock_gettime(CLOCK_REALTIME, &limite);
+            limite.tv_nsec += PLAZO_ESPERA_ANILLO_MS * 1000000L;
+            if (limite.tv_nsec >= 1000000000L) {
+                limite.tv_sec++;
+                limite.tv_nsec -= 1000000000L;
+            }
+            if (!hay_cambio_anillo) pthread_cond_timedwait(&cambio_anillo, &mutex_anillo, &limite);
+            pthread_mutex_unlock(&mutex_anillo);
+            continue;
+        }
+        pthread_mutex_unlock(&mutex_anillo);
+
+        if (mostrar_anillo(anillo, &cursor, id_propio) == 0) anillo_esperar(anillo, cursor, PLAZO_ESPERA_ANILLO_MS);
+    }
+
+    pthread_mutex_lock(&mutex_anillo);
+    anillo_desconectar(anillo_actual);
+    anillo_actual = NULL;
+    pthread_mutex_unlock(&mutex_anillo);
+    return NULL;
+}
+
+
+/**
+ * @brief Envía una trama ya construida al servidor de una partición.
+ */
+static void enviar_trama_al_servidor(int particion, const trama_t* trama, size_t tamano, tipo_mensaje_t tipo) {
+    if (!conectado) return; // No enviar si ya nos estamos cerrando
+
+    // El chat y los latidos no esperan si la cola del servidor está llena; el control sí, porque no debe perderse
+    int bloquear = tipo != TIPO_MENSAJE && tipo != TIPO_LATIDO;
+    if (transporte_cliente_enviar(&conexiones[particion], trama, tamano, bloquear) == -1) {
+        if (errno == EAGAIN) {
+            if (tipo == TIPO_MENSAJE) printf("[AVISO] El servidor está saturado: mensaje no enviado.\n");
+        } else if (errno != EIDRM) {
+            // Ignorar el error "Identifier removed" que puede ocurrir si el servidor se cierra primero
+            perror("enviar al servidor");
+        }
+    }
+}
+
+
+/**
+ * @brief Construye y envía un comando al servidor de una partición.
+ */
+void enviar_comando_al_servidor(int particion, tipo_mensaje_t tipo, const char* sala, const char* texto) {
+    // Solo viajan los bytes usados: un "/list" ocupa poco más que la cabecera
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, tipo, conexiones[particion].id_propio, mi_nombre, sala, texto);
+    enviar_trama_al_servidor(particion, &trama, tamano, tipo);
+}
+
+
+/**
+ * @brief Envía un comando sin sala a los servidores de todas las particiones.
+ */
+void enviar_comando_a_todos(tipo_mensaje_t tipo, const char* texto) {
+    for (int i = 0; i < num_particiones; i++) enviar_comando_al_servidor(i, tipo, "", texto);
+}
 
-    if (msgsnd(id_cola_servidor, &msg, TAMANO_MENSAJE, 0) == -1) {
-        // Ignorar el error "Identifier removed" que puede ocurrir si el servidor se cierra primero
-        if (errno != EIDRM) {
-            perror("msgsnd al servidor");
+
+/**
+ * @brief Envía un mensaje de chat: solo los identificadores de la sesión y el texto.
+ * Si aún no llegaron los de la sala nueva, el servidor lo descarta y avisa.
+ */
+void enviar_chat_al_servidor(const char* texto) {
+    pthread_mutex_lock(&mutex_sesion);
+    uint32_t sesion = id_sesion, sala = id_sala;
+    int particion = particion_actual;
+    pthread_mutex_unlock(&mutex_sesion);
+
+    trama_t trama;
+    size_t tamano = trama_construir_chat(&trama, conexiones[particion].id_propio, sesion, sala, texto);
+    if (muestreo_traza > 0 && mensajes_chat++ % (uint32_t)muestreo_traza == 0) {
+        traza_t traza;
+        memset(&traza, 0, sizeof(traza));
+        traza.id = (uint64_t)getpid() << 32 | ++trazas_enviadas;
+        traza.marcas_ns[TRAZA_CLIENTE_ENVIO] = traza_ahora_ns();
+        tamano = trama_trazar(&trama, tamano, &traza);
+    }
+    enviar_trama_al_servidor(particion, &trama, tamano, TIPO_MENSAJE);
+}
+
+
+/**
+ * @brief Mide las etapas de un mensaje trazado recibido y, con -t, las escribe en la traza.
+ */
+static void anotar_traza(const trama_t* trama, size_t recibido) {
+    uint64_t recibido_ns = traza_ahora_ns();
+    if (trama->cabecera.tipo != TIPO_NOTIFICACION || recibido < sizeof(cabecera_trama_t) + sizeof(traza_t)) return;
+    traza_t traza;
+    memcpy(&traza, trama->datos + trama_posicion_traza(&trama->cabecera), sizeof(traza));
+
+    pthread_mutex_lock(&mutex_trazas);
+    for (int etapa = ETAPA_COLA_SERVIDOR; etapa <= ETAPA_ENTREGA; etapa++) {
+        uint64_t inicio, duracion;
+        if (traza_etapa(&traza, (etapa_traza_t)etapa, recibido_ns, &inicio, &duracion) == 0) {
+            latencia_registrar(&latencias_etapa[etapa], duracion);
         }
     }
+    uint64_t enviado_ns = traza.marcas_ns[TRAZA_CLIENTE_ENVIO];
+    if (enviado_ns != 0 && enviado_ns <= recibido_ns) latencia_registrar(&latencias_total, recibido_ns - enviado_ns);
+    pthread_mutex_unlock(&mutex_trazas);
+    traza_etapas(&traza, ETAPA_ENTREGA, recibido_ns);
+}
+
+
+/**
+ * @brief Imprime, al salir, el desglose por etapas de los mensajes trazados recibidos.
+ */
+static void mostrar_resumen_trazas(void) {
+    if (ruta_traza != NULL) printf(" Traza cerrada: %llu etapas en %s.\n", (unsigned long long)traza_cerrar(), ruta_traza);
+    if (muestreo_traza > 0) printf(" Mensajes trazados enviados: %u.\n", trazas_enviadas);
+    if (latencias_total.total == 0) return;
+    printf(" Mensajes trazados recibidos: %llu (p50 / p99 / máx en µs)\n", (unsigned long long)latencias_total.total);
+    for (int etapa = ETAPA_COLA_SERVIDOR; etapa <= ETAPA_ENTREGA; etapa++) {
+        const latencias_t* h = &latencias_etapa[etapa];
+        if (h->total == 0) continue;
+        printf("   %-16s %9.1f %9.1f %9.1f\n", traza_nombre_etapa((etapa_traza_t)etapa), latencia_percentil_us(h, 0.50),
+               latencia_percentil_us(h, 0.99), (double)h->maximo / 1e3);
+    }
+    printf("   %-16s %9.1f %9.1f %9.1f\n", "total", latencia_percentil_us(&latencias_total, 0.50),
+           latencia_percentil_us(&latencias_total, 0.99), (double)latencias_total.maximo / 1e3);
+}
+
+
+/**
+ * @brief Entrega al hilo emisor una transferencia (se queda con datos, reservado con malloc).
+ */
+static void iniciar_envio(char* datos, size_t total, const char* nombre) {
+    pthread_mutex_lock(&mutex_envio);
+    if (envio.activa) {
+        pthread_mutex_unlock(&mutex_envio);
+        free(datos);
+        printf("Ya hay una transferencia en curso.\n");
+        return;
+    }
+    envio.activa = 1;
+    envio.numero++;
+    strncpy(envio.nombre, nombre, MAX_NOMBRE - 1);
+    envio.nombre[MAX_NOMBRE - 1] = '\0';
+    envio.datos = datos;
+    envio.total = total;
+    envio.enviado = envio.confirmado = 0;
+    envio.decimas_mostradas = 0;
+    envio.ultimo_avance = time(NULL);
+    pthread_cond_signal(&cambio_envio);
+    pthread_mutex_unlock(&mutex_envio);
+}
+
+/**
+ * @brief /send: lee el archivo entero y lo entrega al hilo emisor con su nombre
+ * sin directorios.
+ */
+static void enviar_archivo(const char* ruta) {
+    FILE* archivo = fopen(ruta, "rb");
+    if (archivo == NULL) {
+        perror(ruta);
+        return;
+    }
+    char* datos = NULL;
+    long total = fseek(archivo, 0, SEEK_END) == 0 ? ftell(archivo) : -1;
+    if (total <= 0 || (uint64_t)total > MAX_TRANSFERENCIA) {
+        printf("%s: %s.\n", ruta, total == 0 ? "el archivo está vacío" : total < 0 ? "no se puede leer" : "demasiado grande");
+    } else if ((datos = malloc((size_t)total)) == NULL) {
+        perror("malloc archivo");
+    } else {
+        rewind(archivo);
+        if (fread(datos, 1, (size_t)total, archivo) == (size_t)total) {
+            const char* barra = strrchr(ruta, '/');
+            iniciar_envio(datos, (size_t)total, barra != NULL ? barra + 1 : ruta);
+            datos = NULL;
+        } else {
+            perror(ruta);
+        }
+    }
+    free(datos);
+    fclose(archivo);
+}
+
+/**
+ * @brief Abandona la transferencia en curso, si la hay, avisando del motivo.
+ */
+static void cancelar_envio(const char* motivo) {
+    pthread_mutex_lock(&mutex_envio);
+    if (envio.activa) {
+        printf("[AVISO] Transferencia cancelada: %s.\n", motivo);
+        free(envio.datos);
+        envio.datos = NULL;
+        envio.activa = 0;
+    }
+    pthread_mutex_unlock(&mutex_envio);
+}
+
+/**
+ * @brief Hilo que envía la transferencia en curso por trozos. Nunca deja más de
+ * VENTANA_FRAGMENTOS sin confirmar: la cola del servidor apenas nota la
+ * transferencia y el chat de todos sigue pasando por delante.
+ */
+void* hilo_emisor(void* arg) {
+    (void)arg;
+    const uint64_t ventana = (uint64_t)VENTANA_FRAGMENTOS * FRAGMENTO_MAX_DATOS;
+    pthread_mutex_lock(&mutex_envio);
+    while (seguir_corriendo) {
+        if (!envio.activa || envio.enviado == envio.total || envio.enviado - envio.confirmado >= ventana) {
+            // Espera a una transferencia nueva o a una confirmación, con plazo para ver seguir_corriendo
+            struct timespec limite;
+            clock_gettime(CLOCK_REALTIME, &limite);
+            limite.tv_nsec += PLAZO_ESPERA_ANILLO_MS * 1000000L;
+            if (limite.tv_nsec >= 1000000000L) {
+                limite.tv_sec++;
+                limite.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&cambio_envio, &mutex_envio, &limite);
+            if (envio.activa && time(NULL) - envio.ultimo_avance > PLAZO_CONFIRMACION_S) {
+                printf("\r\033[K[AVISO] Transferencia cancelada: el servidor no confirma los trozos.\n> ");
+                fflush(stdout);
+                free(envio.datos);
+                envio.datos = NULL;
+                envio.activa = 0;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&mutex_sesion);
+        int particion = particion_actual;
+        cabecera_fragmento_t fragmento = { id_sesion, id_sala, envio.numero, 0, envio.total, envio.enviado };
+        pthread_mutex_unlock(&mutex_sesion);
+        size_t longitud = envio.total - envio.enviado < FRAGMENTO_MAX_DATOS ? (size_t)(envio.total - envio.enviado)
+                                                                            : FRAGMENTO_MAX_DATOS;
+        trama_t trama;
+        size_t tamano = trama_construir_fragmento(&trama, TIPO_FRAGMENTO, conexiones[particion].id_propio, &fragmento,
+                                                  "", envio.nombre, envio.datos + envio.enviado, longitud);
+        envio.enviado += longitud;
+        // El envío puede bloquear si la cola del servidor está llena: sin el mutex, para no frenar al receptor
+        pthread_mutex_unlock(&mutex_envio);
+        enviar_trama_al_servidor(particion, &trama, tamano, TIPO_FRAGMENTO);
+        pthread_mutex_lock(&mutex_envio);
+    }
+    pthread_mutex_unlock(&mutex_envio);
+    return NULL;
+}
+
+
+/**
+ * @brief Hilo que envía un latido cada LATIDO_INTERVALO_S para que el servidor
+ * sepa que la sesión sigue viva aunque no se escriba nada.
+ */
+void* hilo_latido(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&mutex_latido);
+    while (seguir_corriendo) {
+        struct timespec limite;
+        clock_gettime(CLOCK_REALTIME, &limite);
+        limite.tv_sec += LATIDO_INTERVALO_S;
+        pthread_cond_timedwait(&fin_latido, &mutex_latido, &limite);
+        if (seguir_corriendo) enviar_comando_a_todos(TIPO_LATIDO, mi_pid);
+    }
+    pthread_mutex_unlock(&mutex_latido);
+    return NULL;
 }
 
 
@@ -170,15 +974,16 @@ void finalizar_cliente(int signum) {
     
     if (signum != 0) { // Si es llamado por una señal
         printf("\n Desconectando y limpiando recursos...\n");
+    } else { // Desde una señal no se toca el mutex: el proceso sale enseguida con exit()
+        pthread_mutex_lock(&mutex_latido);
+        pthread_cond_signal(&fin_latido);
+        pthread_mutex_unlock(&mutex_latido);
     }
 
-    if (id_cola_servidor != -1) {
-        enviar_comando_al_servidor(TIPO_CIERRE_CLIENTE, "", "");
-    }
-    
-    if (id_cola_privada != -1) {
-        // Esta llamada destruye la cola y desbloquea msgrcv en el hilo receptor
-        msgctl(id_cola_privada, IPC_RMID, NULL);
+    if (conectado) {
+        enviar_comando_a_todos(TIPO_CIERRE_CLIENTE, "");
+        // Destruye las colas privadas o corta los sockets: los hilos receptores se desbloquean
+        for (int i = 0; i < num_particiones; i++) transporte_cliente_cerrar(&conexiones[i]);
     }
 
     if (signum != 0) {
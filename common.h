@@ -11,46 +11,260 @@
 #include <signal.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
 
 // Constantes Clave
 #define RUTA_CLAVE_SERVIDOR "/tmp" // Ruta para generar la clave de la cola del servidor
 #define ID_PROYECTO 'C'          // Carácter para generar la clave
 
-// Límites del Sistema 
-#define MAX_CLIENTES 50
-#define MAX_SALAS 10
+// Límites del Sistema (el número de clientes y salas se fija al arrancar el servidor)
 #define MAX_NOMBRE 50
 #define MAX_TEXTO 256
 #define RUTA_PERSISTENCIA "./historial/"
+#define LATIDO_INTERVALO_S 5      // Cada cuánto envía el cliente TIPO_LATIDO
+#define MAX_PARTICIONES 64        // Procesos servidor que se reparten las salas (ver particion_de_sala)
 
 // Tipos de Mensajes (Enum en Español) 
 typedef enum {
     // Solicitudes del Cliente
     TIPO_UNION_SALA = 1,
     TIPO_ABANDONAR_SALA,
-    TIPO_MENSAJE,
+    TIPO_MENSAJE,           // Solo lleva los identificadores de sesión y sala y el texto (ver abajo)
     TIPO_LISTAR_SALAS,
     TIPO_LISTAR_USUARIOS,
     TIPO_CIERRE_CLIENTE,
+    TIPO_ESTADISTICAS,      // /stats: informe de contadores del servidor
+    TIPO_HISTORIAL,         // /history [N]: últimos mensajes de la sala (texto = N)
+    TIPO_LATIDO,            // Señal de vida periódica del cliente (texto = su pid, como en la unión)
+    TIPO_BUSCAR,            // /search: texto = "términos [#sala] [@usuario] [antes:N]"
+    TIPO_FRAGMENTO,         // Trozo de una transferencia a la sala (ver cabecera_fragmento_t)
 
     // Respuestas y Notificaciones del Servidor
     TIPO_RESPUESTA_EXITO = 101,
     TIPO_RESPUESTA_ERROR,
     TIPO_NOTIFICACION, // Para mensajes de chat y del sistema a la sala
+    TIPO_NOTIFICACION_LOTE, // Varias notificaciones en una trama (ver registros de lote abajo)
+    TIPO_ANILLO_SALA,  // Modo anillo: id_cola_cliente = id del segmento (-1 = soltarlo), texto = cursor inicial
+    TIPO_SESION_SALA,  // Al unirse: texto = "<id_sesion> <id_sala>" para los mensajes de chat
+    TIPO_RESPUESTA_CADUCADA, // Chat con un id de sesión o de sala que ya no es válido
+    TIPO_FRAGMENTO_SALA,     // Trozo de la transferencia de otro miembro (usuario = autor)
+    TIPO_FRAGMENTO_CONFIRMADO, // Trozo ya repartido: texto = "<transferencia> <bytes confirmados>"
+    TIPO_FRAGMENTO_RECHAZADO,  // Transferencia cancelada: texto = "<transferencia> <motivo>"
 } tipo_mensaje_t;
 
-// Estructura del Mensaje
+/*
+ * Trazas de latencia (modo traza del cliente): un mensaje de chat muestreado
+ * lleva un identificador y el instante (CLOCK_MONOTONIC, común a todos los
+ * procesos de la máquina) en que pasó por cada etapa. El cliente que lo recibe
+ * calcula cuánto duró cada tramo; ver traza.h.
+ */
+typedef enum {
+    TRAZA_CLIENTE_ENVIO = 0,   // El autor lo pone en la cola del servidor
+    TRAZA_SERVIDOR_RECIBIDO,   // El despachador lo saca de la cola
+    TRAZA_SERVIDOR_ENCARGADO,  // El despachador lo pasa al trabajador de la sala
+    TRAZA_TRABAJADOR,          // El trabajador empieza a repartirlo
+    TRAZA_DIFUSION,            // El trabajador lo pone en la cola de este destinatario
+    NUM_MARCAS_TRAZA,
+} marca_traza_t;
+
+typedef struct {
+    uint64_t id;               // pid del autor en los 32 bits altos, contador en los bajos
+    uint64_t marcas_ns[NUM_MARCAS_TRAZA]; // 0 = etapa no alcanzada (p. ej. difusión por anillo)
+} traza_t;
+
+// Estructura del Mensaje (representación en memoria, ya decodificada)
 typedef struct {
     long mtype; // Tipo de mensaje (DEBE ser el primer campo)
 
     // Contenido del Mensaje
     int id_cola_cliente; // ID de la cola privada del cliente para respuestas
+    uint32_t id_sesion;  // TIPO_MENSAJE: identificadores recibidos en TIPO_SESION_SALA
+    uint32_t id_sala;
     char nombre_usuario[MAX_NOMBRE];
     char nombre_sala[MAX_NOMBRE];
     char texto[MAX_TEXTO];
+    uint16_t banderas;   // Las de la cabecera de la trama (TRAMA_TRAZADA...)
+    traza_t traza;       // Solo si banderas lleva TRAMA_TRAZADA
 } mensaje_t;
 
-// Macro para calcular el tamaño útil del mensaje (sin mtype)
-#define TAMANO_MENSAJE (sizeof(mensaje_t) - sizeof(long))
+// Formato en la cola: cabecera fija + solo los bytes usados de cada campo,
+// en el orden usuario, sala, texto (sin '\0'). A msgsnd se le pasa la longitud real.
+#define MAX_TRAMA 4096 // Bytes útiles máximos de una trama (sin mtype)
+
+typedef struct {
+    int32_t id_cola_cliente;
+    uint16_t tipo;             // tipo_mensaje_t; en la cola del servidor el mtype es solo la prioridad
+    uint16_t longitud_texto;
+    uint8_t longitud_usuario;
+    uint8_t longitud_sala;
+    uint16_t banderas;         // TRAMA_TRAZADA; 0 en el resto
+} cabecera_trama_t;
+
+// La trama lleva un traza_t delante del texto (solo TIPO_MENSAJE y TIPO_NOTIFICACION)
+#define TRAMA_TRAZADA 0x1
+
+typedef struct {
+    long mtype; // Tipo de mensaje (DEBE ser el primer campo)
+    cabecera_trama_t cabecera;
+    char datos[MAX_TRAMA - sizeof(cabecera_trama_t)];
+} trama_t;
+
+#define MAX_DATOS_TRAMA (MAX_TRAMA - sizeof(cabecera_trama_t))
+
+/*
+ * Trama TIPO_MENSAJE: sin usuario ni sala; los datos empiezan por estos dos
+ * identificadores (índice + generación en el servidor, ver tablas.h) y siguen
+ * con el texto. El servidor los comprueba en O(1), sin buscar nombres.
+ */
+typedef struct {
+    uint32_t id_sesion;
+    uint32_t id_sala;
+} identificadores_chat_t;
+
+/*
+ * Prioridad de las solicitudes en la cola del servidor. Todas las de control
+ * viajan con el mismo mtype, así que entre ellas se conserva el orden de
+ * llegada; el despachador recibe el mtype más bajo primero y el chat solo
+ * sale cuando no hay control pendiente (o cuando le toca por turno).
+ * Las tramas hacia los clientes llevan como mtype su propio tipo.
+ */
+#define PRIORIDAD_CONTROL 1
+#define PRIORIDAD_DATOS 2
+
+/*
+ * Transferencias: un texto largo o un archivo viaja en trozos de hasta
+ * FRAGMENTO_MAX_DATOS bytes en tramas TIPO_FRAGMENTO, con la prioridad del chat
+ * y sus mismos identificadores de sesión y sala. Los datos empiezan por esta
+ * cabecera, siguen con el usuario (vacío) y el nombre del archivo en el campo
+ * de sala ("" = texto largo) y terminan con el trozo. El emisor no tiene más
+ * de VENTANA_FRAGMENTOS trozos sin confirmar: así una transferencia nunca ocupa
+ * más que unos pocos KB de la cola del servidor y el chat no espera detrás.
+ * Hacia los miembros viaja igual como TIPO_FRAGMENTO_SALA, con la sesión del
+ * autor en id_sesion para distinguir sus transferencias.
+ */
+#define FRAGMENTO_MAX_DATOS 2048
+#define VENTANA_FRAGMENTOS 2
+#define MAX_TRANSFERENCIA (64ULL << 20) // Bytes máximos de una transferencia
+
+typedef struct {
+    uint32_t id_sesion;       // Los dos primeros campos coinciden con identificadores_chat_t
+    uint32_t id_sala;
+    uint32_t transferencia;   // Número que elige el emisor para cada envío
+    uint32_t reservado;
+    uint64_t total;           // Bytes de toda la transferencia
+    uint64_t desplazamiento;  // Posición del trozo dentro de ella
+} cabecera_fragmento_t;
+
+/*
+ * Particiones: con K procesos servidor, cada uno atiende las salas cuyo nombre
+ * cae en su partición y escucha en su propia cola (clave ftok con ID_PROYECTO
+ * más el número de partición) o en su propio socket. El cliente elige el
+ * destino de /join y del chat con esta función, sin preguntar a nadie. Usa los
+ * bits altos del hash del nombre para que dentro de una partición las salas
+ * sigan repartiéndose por igual entre los trabajadores (que usan los bajos).
+ */
+static inline int particion_de_sala(const char* nombre, int num_particiones) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*nombre) {
+        h ^= (unsigned char)*nombre++;
+        h *= 16777619u;
+    }
+    return (int)(((uint64_t)h * (uint64_t)num_particiones) >> 32);
+}
+
+// Funciones del Protocolo (protocolo.c)
+
+/**
+ * @brief Construye una trama con los campos dados (NULL equivale a vacío).
+ * Los nombres se recortan a MAX_NOMBRE - 1 y el texto a lo que quepa en la trama.
+ * Las solicitudes llevan como mtype su prioridad; las respuestas, su tipo.
+ * No sirve para TIPO_MENSAJE, que usa trama_construir_chat.
+ * @return Bytes a pasar a msgsnd (cabecera + datos, sin mtype).
+ */
+size_t trama_construir(trama_t* trama, long tipo, int id_cola_cliente,
+                       const char* usuario, const char* sala, const char* texto);
+
+/**
+ * @brief Construye una trama TIPO_MENSAJE con los identificadores de sesión y sala.
+ * @return Bytes a pasar a msgsnd.
+ */
+size_t trama_construir_chat(trama_t* trama, int id_cola_cliente, uint32_t id_sesion, uint32_t id_sala,
+                            const char* texto);
+
+/**
+ * @brief Construye una trama TIPO_FRAGMENTO (hacia el servidor) o TIPO_FRAGMENTO_SALA
+ * (hacia los miembros). El trozo se recorta a FRAGMENTO_MAX_DATOS.
+ * @return Bytes a pasar a msgsnd.
+ */
+size_t trama_construir_fragmento(trama_t* trama, long tipo, int id_cola_cliente, const cabecera_fragmento_t* fragmento,
+                                 const char* usuario, const char* nombre, const void* datos, size_t longitud);
+
+/**
+ * @brief Marca una trama TIPO_MENSAJE o TIPO_NOTIFICACION ya construida como
+ * trazada, metiendo la traza delante del texto.
+ * @return El nuevo tamaño, o el mismo si no era de esos tipos o no cabía.
+ */
+size_t trama_trazar(trama_t* trama, size_t tamano, const traza_t* traza);
+
+/**
+ * @brief Decodifica una trama recibida (tamano = valor devuelto por msgrcv).
+ * El texto se recorta a MAX_TEXTO - 1 y todos los campos quedan terminados en '\0'.
+ * @return 0 si la trama es coherente, -1 si está mal formada.
+ */
+int trama_leer(const trama_t* trama, size_t tamano, mensaje_t* msg);
+
+/*
+ * Trama TIPO_NOTIFICACION_LOTE: el texto es una secuencia de registros
+ * [uint16_t longitud][longitud bytes], cada uno equivalente a una TIPO_NOTIFICACION.
+ */
+typedef uint16_t longitud_registro_lote_t;
+
+/**
+ * @brief Posición de la traza en los datos: tras los identificadores en el chat,
+ * al principio en las notificaciones.
+ */
+static inline size_t trama_posicion_traza(const cabecera_trama_t* c) {
+    return c->tipo == TIPO_MENSAJE ? sizeof(identificadores_chat_t) : 0;
+}
+
+/**
+ * @brief Bytes de los datos que preceden a usuario, sala y texto.
+ */
+static inline size_t trama_prefijo(const cabecera_trama_t* c) {
+    size_t prefijo = 0;
+    if (c->tipo == TIPO_MENSAJE) prefijo = sizeof(identificadores_chat_t);
+    else if (c->tipo == TIPO_FRAGMENTO || c->tipo == TIPO_FRAGMENTO_SALA) prefijo = sizeof(cabecera_fragmento_t);
+    if ((c->banderas & TRAMA_TRAZADA) && (c->tipo == TIPO_MENSAJE || c->tipo == TIPO_NOTIFICACION)) {
+        prefijo += sizeof(traza_t);
+    }
+    return prefijo;
+}
+
+/**
+ * @brief Acceso directo al texto de una trama recibida, sin copiarlo.
+ */
+static inline const char* trama_texto(const trama_t* trama) {
+    return trama->datos + trama_prefijo(&trama->cabecera) + trama->cabecera.longitud_usuario +
+           trama->cabecera.longitud_sala;
+}
+
+/**
+ * @brief Anota el instante de una etapa en una trama trazada (la traza puede no
+ * estar alineada: se escribe con memcpy).
+ */
+static inline void trama_marcar_traza(trama_t* trama, marca_traza_t marca, uint64_t ns) {
+    memcpy(trama->datos + trama_posicion_traza(&trama->cabecera) + offsetof(traza_t, marcas_ns) +
+           (size_t)marca * sizeof(uint64_t), &ns, sizeof(ns));
+}
+
+/**
+ * @brief Trozo de una trama de fragmento ya validada con trama_leer (su longitud
+ * es cabecera.longitud_texto); la cabecera del fragmento se copia en *fragmento.
+ */
+static inline const char* fragmento_datos(const trama_t* trama, cabecera_fragmento_t* fragmento) {
+    memcpy(fragmento, trama->datos, sizeof(*fragmento));
+    return trama->datos + sizeof(*fragmento) + trama->cabecera.longitud_usuario + trama->cabecera.longitud_sala;
+}
 
 #endif // COMMON_H
\ No newline at end of file
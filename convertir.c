@@ -0,0 +1,152 @@
+#include "segmentos.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <limits.h>
+
+/*
+ * Conversor del historial antiguo al almacén de segmentos (segmentos.h).
+ *
+ * Cada historial/<sala>.log, con líneas "[AAAA-MM-DD HH:MM:SS] usuario: texto",
+ * pasa a historial/<sala>/ numerado desde 0, y el .log se renombra a
+ * .log.convertido para no convertirlo dos veces. Una sala que ya tiene
+ * segmentos se deja como está. Las líneas que no siguen el formato se
+ * conservan enteras como texto, sin usuario, con la fecha de la anterior.
+ */
+
+#define SUFIJO_LOG ".log"
+
+/**
+ * @brief Separa una línea del .log en marca, usuario y texto.
+ * @return 0 si tenía el formato esperado, -1 si no.
+ */
+static int analizar_linea(char* linea, time_t* marca, char** usuario, char** texto) {
+    if (linea[0] != '[') return -1;
+    struct tm desglose;
+    memset(&desglose, 0, sizeof(desglose));
+    char* resto = strptime(linea + 1, "%Y-%m-%d %H:%M:%S", &desglose);
+    if (resto == NULL || strncmp(resto, "] ", 2) != 0) return -1;
+    char* separador = strstr(resto + 2, ": ");
+    if (separador == NULL) return -1;
+
+    desglose.tm_isdst = -1; // Las marcas se escribieron en hora local
+    *marca = mktime(&desglose);
+    *usuario = resto + 2;
+    *separador = '\0';
+    *texto = separador + 2;
+    return 0;
+}
+
+static int convertir_log(const char* ruta_log, const segmentos_config_t* config) {
+    // historial/<sala>.log -> <sala>
+    const char* base = strrchr(ruta_log, '/');
+    base = base ? base + 1 : ruta_log;
+    size_t longitud = strlen(base);
+    if (longitud <= strlen(SUFIJO_LOG) || strcmp(base + longitud - strlen(SUFIJO_LOG), SUFIJO_LOG) != 0 ||
+        longitud - strlen(SUFIJO_LOG) >= MAX_NOMBRE) {
+        fprintf(stderr, "%s: no es un historial <sala>.log\n", ruta_log);
+        return -1;
+    }
+    char sala[MAX_NOMBRE];
+    snprintf(sala, sizeof(sala), "%.*s", (int)(longitud - strlen(SUFIJO_LOG)), base);
+
+    char directorio[SEGMENTOS_MAX_RUTA];
+    segmentos_directorio_sala(directorio, sizeof(directorio), sala);
+    if (segmentos_siguiente(directorio) > 0) {
+        fprintf(stderr, "%s: la sala '%s' ya tiene segmentos, se deja como está\n", ruta_log, sala);
+        return -1;
+    }
+
+    FILE* archivo = fopen(ruta_log, "r");
+    if (archivo == NULL) {
+        perror(ruta_log);
+        return -1;
+    }
+    segmento_escritor_t* escritor = malloc(sizeof(segmento_escritor_t));
+    if (escritor == NULL || segmentos_abrir(escritor, directorio) == -1) {
+        perror(directorio);
+        free(escritor);
+        fclose(archivo);
+        return -1;
+    }
+
+    char* linea = NULL;
+    size_t capacidad = 0;
+    ssize_t leidos;
+    uint64_t secuencia = 0;
+    unsigned long sin_formato = 0;
+    time_t marca = 0;
+    int resultado = 0;
+    while ((leidos = getline(&linea, &capacidad, archivo)) > 0) {
+        if (linea[leidos - 1] == '\n') linea[leidos - 1] = '\0';
+        char* usuario = "";
+        char* texto = linea;
+        if (analizar_linea(linea, &marca, &usuario, &texto) == -1) sin_formato++;
+        if (segmentos_anadir(escritor, config, marca, secuencia, usuario, texto) == -1) {
+            resultado = -1;
+            break;
+        }
+        secuencia++;
+    }
+    free(linea);
+    fclose(archivo);
+    segmentos_cerrar(escritor, 1);
+    free(escritor);
+    if (resultado == -1) return -1;
+
+    char convertido[PATH_MAX];
+    snprintf(convertido, sizeof(convertido), "%s.convertido", ruta_log);
+    if (rename(ruta_log, convertido) == -1) perror("rename");
+    printf("%s: %llu mensajes -> %s/ (%lu sin formato, guardados como texto)\n", ruta_log,
+           (unsigned long long)secuencia, directorio, sin_formato);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    segmentos_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.max_segmento = SEGMENTOS_TAMANO_DEFECTO;
+
+    int opcion;
+    while ((opcion = getopt(argc, argv, "g:h")) != -1) {
+        switch (opcion) {
+            case 'g': config.max_segmento = (size_t)atol(optarg) * 1024; break;
+            case 'h':
+            default:
+                fprintf(stderr,
+                        "Uso: %s [-g KB] [historial/<sala>.log ...]\n"
+                        "  Convierte el historial en texto al formato de segmentos.\n"
+                        "  Sin archivos, convierte todos los .log de %s\n"
+                        "  -g KB  Tamaño a partir del cual se rota cada segmento (defecto %d)\n",
+                        argv[0], RUTA_PERSISTENCIA, SEGMENTOS_TAMANO_DEFECTO / 1024);
+                return opcion == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (config.max_segmento < 4096) {
+        fprintf(stderr, "Los segmentos deben ser de al menos 4 KB.\n");
+        return EXIT_FAILURE;
+    }
+
+    int errores = 0;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) errores += convertir_log(argv[i], &config) == -1;
+        return errores ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    DIR* dir = opendir(RUTA_PERSISTENCIA);
+    if (dir == NULL) {
+        perror(RUTA_PERSISTENCIA);
+        return EXIT_FAILURE;
+    }
+    struct dirent* entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        size_t longitud = strlen(entrada->d_name);
+        if (longitud <= strlen(SUFIJO_LOG) || strcmp(entrada->d_name + longitud - strlen(SUFIJO_LOG), SUFIJO_LOG) != 0) {
+            continue;
+        }
+        char ruta[sizeof(RUTA_PERSISTENCIA) + sizeof(entrada->d_name)];
+        snprintf(ruta, sizeof(ruta), "%s%s", RUTA_PERSISTENCIA, entrada->d_name);
+        errores += convertir_log(ruta, &config) == -1;
+    }
+    closedir(dir);
+    return errores ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+#include "servidor.h"
+#include <pthread.h>
+
+static struct timespec arranque;
+static const char* ruta_volcado = NULL;
+static int intervalo_volcado_s;
+static pthread_t hilo_volcado;
+static pthread_mutex_t mutex_volcado = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_volcado;
+static int volcado_activo = 0;
+static int cerrando = 0;
+
+static void* bucle_volcado(void* arg);
+static void volcar(void);
+
+void histograma_acumular(histograma_t* destino, const histograma_t* origen) {
+    for (int i = 0; i < HISTOGRAMA_CUBETAS; i++) destino->cubetas[i] += CONTADOR_LEER(origen->cubetas[i]);
+    destino->suma += CONTADOR_LEER(origen->suma);
+    uint64_t maximo = CONTADOR_LEER(origen->maximo);
+    if (maximo > destino->maximo) destino->maximo = maximo;
+}
+
+uint64_t histograma_total(const histograma_t* h) {
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAMA_CUBETAS; i++) total += h->cubetas[i];
+    return total;
+}
+
+uint64_t histograma_percentil(const histograma_t* h, double p) {
+    uint64_t total = histograma_total(h);
+    if (total == 0) return 0;
+    uint64_t objetivo = (uint64_t)(p * (double)total);
+    if (objetivo >= total) objetivo = total - 1;
+    uint64_t acumulado = 0;
+    for (int i = 0; i < HISTOGRAMA_CUBETAS; i++) {
+        acumulado += h->cubetas[i];
+        if (acumulado > objetivo) {
+            uint64_t techo = i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (1ULL << i) - 1);
+            return techo < h->maximo ? techo : h->maximo;
+        }
+    }
+    return h->maximo;
+}
+
+/**
+ * @brief Añade "nombre valor\n" al informe si cabe.
+ */
+static void linea(char** p, size_t* libre, const char* nombre, uint64_t valor) {
+    int escrito = snprintf(*p, *libre, "%s %llu\n", nombre, (unsigned long long)valor);
+    if (escrito < 0 || (size_t)escrito >= *libre) return;
+    *p += escrito;
+    *libre -= (size_t)escrito;
+}
+
+/**
+ * @brief Añade total, media, p50, p99, p999 y máximo de un histograma.
+ */
+static void lineas_histograma(char** p, size_t* libre, const char* nombre, const histograma_t* h) {
+    char clave[64];
+    uint64_t total = histograma_total(h);
+    snprintf(clave, sizeof(clave), "%s_total", nombre);
+    linea(p, libre, clave, total);
+    snprintf(clave, sizeof(clave), "%s_media", nombre);
+    linea(p, libre, clave, total > 0 ? h->suma / total : 0);
+    snprintf(clave, sizeof(clave), "%s_p50", nombre);
+    linea(p, libre, clave, histograma_percentil(h, 0.50));
+    snprintf(clave, sizeof(clave), "%s_p99", nombre);
+    linea(p, libre, clave, histograma_percentil(h, 0.99));
+    snprintf(clave, sizeof(clave), "%s_p999", nombre);
+    linea(p, libre, clave, histograma_percentil(h, 0.999));
+    snprintf(clave, sizeof(clave), "%s_max", nombre);
+    linea(p, libre, clave, h->maximo);
+}
+
+size_t estadisticas_informe(char* buffer, size_t tamano) {
+    static const char* nombres_solicitud[NUM_TIPOS_SOLICITUD] = {
+        [0] = "solicitudes_desconocidas",
+        [TIPO_UNION_SALA] = "solicitudes_union",
+        [TIPO_ABANDONAR_SALA] = "solicitudes_abandonar",
+        [TIPO_MENSAJE] = "solicitudes_mensaje",
+        [TIPO_LISTAR_SALAS] = "solicitudes_listar_salas",
+        [TIPO_LISTAR_USUARIOS] = "solicitudes_listar_usuarios",
+        [TIPO_CIERRE_CLIENTE] = "solicitudes_cierre",
+        [TIPO_ESTADISTICAS] = "solicitudes_estadisticas",
+        [TIPO_HISTORIAL] = "solicitudes_historial",
+        [TIPO_LATIDO] = "solicitudes_latido",
+        [TIPO_BUSCAR] = "solicitudes_busqueda",
+        [TIPO_FRAGMENTO] = "solicitudes_fragmento",
+    };
+    char* p = buffer;
+    size_t libre = tamano;
+    if (tamano == 0) return 0;
+    buffer[0] = '\0';
+
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    linea(&p, &libre, "segundos_activo", (uint64_t)(ahora.tv_sec - arranque.tv_sec));
+    if (config.num_particiones > 1) {
+        linea(&p, &libre, "particion", (uint64_t)config.particion);
+        linea(&p, &libre, "particiones", (uint64_t)config.num_particiones);
+    }
+
+    // Profundidad de la entrada del servidor: con sockets, lo leído y aún sin despachar
+    transporte_ocupacion_t ocupacion;
+    if (transporte_ocupacion(&ocupacion) == 0) {
+        linea(&p, &libre, "cola_servidor_mensajes", ocupacion.mensajes);
+        linea(&p, &libre, "cola_servidor_bytes", ocupacion.bytes);
+        linea(&p, &libre, "cola_servidor_capacidad_bytes", ocupacion.capacidad_bytes);
+    }
+
+    // Despachador
+    const estadisticas_despachador_t* d = &estadisticas_despachador;
+    for (int i = 0; i < NUM_TIPOS_SOLICITUD; i++) {
+        if (nombres_solicitud[i] != NULL) linea(&p, &libre, nombres_solicitud[i], CONTADOR_LEER(d->solicitudes[i]));
+    }
+    linea(&p, &libre, "tramas_invalidas", CONTADOR_LEER(d->tramas_invalidas));
+    histograma_t solicitud;
+    memset(&solicitud, 0, sizeof(solicitud));
+    histograma_acumular(&solicitud, &d->solicitud_ns);
+    lineas_histograma(&p, &libre, "solicitud_ns", &solicitud);
+    linea(&p, &libre, "respuestas", CONTADOR_LEER(d->respuestas));
+    linea(&p, &libre, "respuestas_diferidas", CONTADOR_LEER(d->respuestas_diferidas));
+    linea(&p, &libre, "respuestas_perdidas", CONTADOR_LEER(d->respuestas_perdidas));
+    linea(&p, &libre, "respuestas_fallidas", CONTADOR_LEER(d->respuestas_fallidas));
+    linea(&p, &libre, "chat_por_turno", CONTADOR_LEER(d->chat_por_turno));
+    linea(&p, &libre, "chat_rechazado", CONTADOR_LEER(d->chat_rechazado));
+    linea(&p, &libre, "chat_caducado", CONTADOR_LEER(d->chat_caducado));
+    linea(&p, &libre, "chat_limitado_cliente", CONTADOR_LEER(d->chat_limitado_cliente));
+    linea(&p, &libre, "chat_limitado_sala", CONTADOR_LEER(d->chat_limitado_sala));
+    linea(&p, &libre, "fragmentos_rechazados", CONTADOR_LEER(d->fragmentos_rechazados));
+    linea(&p, &libre, "bytes_transferidos", CONTADOR_LEER(d->bytes_transferidos));
+    linea(&p, &libre, "barridos", CONTADOR_LEER(d->barridos));
+    linea(&p, &libre, "sesiones_caidas", CONTADOR_LEER(d->sesiones_caidas));
+    linea(&p, &libre, "colas_eliminadas", CONTADOR_LEER(d->colas_eliminadas));
+    linea(&p, &libre, "salas_creadas", CONTADOR_LEER(d->salas_creadas));
+    linea(&p, &libre, "salas_eliminadas", CONTADOR_LEER(d->salas_eliminadas));
+
+    // Trabajadores: se suman los de todos los hilos
+    estadisticas_trabajador_t suma;
+    memset(&suma, 0, sizeof(suma));
+    for (int i = 0; i < config.num_trabajadores; i++) {
+        const estadisticas_trabajador_t* t = trabajadores_estadisticas(i);
+        suma.tareas += CONTADOR_LEER(t->tareas);
+        suma.difusiones += CONTADOR_LEER(t->difusiones);
+        suma.envios += CONTADOR_LEER(t->envios);
+        suma.envios_diferidos += CONTADOR_LEER(t->envios_diferidos);
+        suma.envios_fallidos += CONTADOR_LEER(t->envios_fallidos);
+        suma.envios_descartados += CONTADOR_LEER(t->envios_descartados);
+        suma.expulsiones += CONTADOR_LEER(t->expulsiones);
+        suma.tramas_lote += CONTADOR_LEER(t->tramas_lote);
+        suma.busqueda_sin_texto += CONTADOR_LEER(t->busqueda_sin_texto);
+        suma.fragmentos += CONTADOR_LEER(t->fragmentos);
+        suma.fragmentos_retenidos += CONTADOR_LEER(t->fragmentos_retenidos);
+        histograma_acumular(&suma.destinatarios, &t->destinatarios);
+        histograma_acumular(&suma.busqueda_ns, &t->busqueda_ns);
+    }
+    linea(&p, &libre, "tareas", suma.tareas);
+    linea(&p, &libre, "difusiones", suma.difusiones);
+    lineas_histograma(&p, &libre, "destinatarios", &suma.destinatarios);
+    linea(&p, &libre, "envios", suma.envios);
+    linea(&p, &libre, "envios_diferidos", suma.envios_diferidos);
+    linea(&p, &libre, "envios_fallidos", suma.envios_fallidos);
+    linea(&p, &libre, "envios_descartados", suma.envios_descartados);
+    linea(&p, &libre, "expulsiones", suma.expulsiones);
+    linea(&p, &libre, "tramas_lote", suma.tramas_lote);
+    linea(&p, &libre, "fragmentos", suma.fragmentos);
+    linea(&p, &libre, "fragmentos_retenidos", suma.fragmentos_retenidos);
+    lineas_histograma(&p, &libre, "busqueda_ns", &suma.busqueda_ns);
+    linea(&p, &libre, "busqueda_sin_texto", suma.busqueda_sin_texto);
+
+    // Historial
+    const registro_estadisticas_t* r = registro_estadisticas();
+    linea(&p, &libre, "historial_lotes", CONTADOR_LEER(r->lotes));
+    linea(&p, &libre, "historial_lineas", CONTADOR_LEER(r->lineas));
+    linea(&p, &libre, "historial_rotaciones", CONTADOR_LEER(r->rotaciones));
+    linea(&p, &libre, "historial_segmentos_borrados", CONTADOR_LEER(r->segmentos_borrados));
+    histograma_t escritura;
+    memset(&escritura, 0, sizeof(escritura));
+    histograma_acumular(&escritura, &r->escritura_ns);
+    lineas_histograma(&p, &libre, "historial_escritura_ns", &escritura);
+
+    // Índice de búsqueda
+    const busqueda_estadisticas_t* b = busqueda_estadisticas();
+    linea(&p, &libre, "indice_documentos", CONTADOR_LEER(b->documentos));
+    linea(&p, &libre, "indice_terminos", CONTADOR_LEER(b->terminos));
+    linea(&p, &libre, "indice_terminos_descartados", CONTADOR_LEER(b->terminos_descartados));
+
+    return (size_t)(p - buffer);
+}
+
+int estadisticas_iniciar(const char* ruta, int intervalo_s) {
+    clock_gettime(CLOCK_MONOTONIC, &arranque);
+    if (ruta == NULL) return 0;
+
+    ruta_volcado = ruta;
+    intervalo_volcado_s = intervalo_s;
+    pthread_condattr_t atributos;
+    pthread_condattr_init(&atributos);
+    pthread_condattr_setclock(&atributos, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_volcado, &atributos);
+    pthread_condattr_destroy(&atributos);
+
+    // Como los demás hilos auxiliares, no atiende señales
+    sigset_t todas, anteriores;
+    sigfillset(&todas);
+    pthread_sigmask(SIG_BLOCK, &todas, &anteriores);
+    int error = pthread_create(&hilo_volcado, NULL, bucle_volcado, NULL);
+    pthread_sigmask(SIG_SETMASK, &anteriores, NULL);
+    if (error != 0) {
+        errno = error;
+        perror("pthread_create estadísticas");
+        return -1;
+    }
+    volcado_activo = 1;
+    return 0;
+}
+
+void estadisticas_finalizar_volcado(void) {
+    if (!volcado_activo) return;
+    pthread_mutex_lock(&mutex_volcado);
+    cerrando = 1;
+    pthread_cond_signal(&cond_volcado);
+    pthread_mutex_unlock(&mutex_volcado);
+    pthread_join(hilo_volcado, NULL);
+    volcado_activo = 0;
+}
+
+static void* bucle_volcado(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&mutex_volcado);
+    while (!cerrando) {
+        struct timespec limite;
+        clock_gettime(CLOCK_MONOTONIC, &limite);
+        limite.tv_sec += intervalo_volcado_s;
+        while (!cerrando) {
+            if (pthread_cond_timedwait(&cond_volcado, &mutex_volcado, &limite) == ETIMEDOUT) break;
+        }
+        pthread_mutex_unlock(&mutex_volcado);
+        volcar();
+        pthread_mutex_lock(&mutex_volcado);
+    }
+    pthread_mutex_unlock(&mutex_volcado);
+    return NULL;
+}
+
+/**
+ * @brief Escribe el informe en un temporal y lo renombra: quien lea el archivo nunca lo ve a medias.
+ */
+static void volcar(void) {
+    char informe[8192];
+    size_t longitud = estadisticas_informe(informe, sizeof(informe));
+
+    char temporal[512];
+    snprintf(temporal, sizeof(temporal), "%s.tmp", ruta_volcado);
+    FILE* archivo = fopen(temporal, "w");
+    if (archivo == NULL) {
+        perror("fopen estadísticas");
+        return;
+    }
+    fwrite(informe, 1, longitud, archivo);
+    if (fclose(archivo) != 0 || rename(temporal, ruta_volcado) == -1) perror("volcar estadísticas");
+}
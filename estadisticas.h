@@ -0,0 +1,68 @@
+#ifndef ESTADISTICAS_H
+#define ESTADISTICAS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Instrumentación del servidor, siempre activa.
+ *
+ * Cada contador tiene un único hilo escritor (el despachador, un trabajador o
+ * el escritor de historial), así que se actualiza sin cerrojos ni operaciones
+ * atómicas de lectura-modificación-escritura: basta una carga y un almacenado
+ * relajados. Quien genera el informe lee los contadores de los demás hilos con
+ * cargas relajadas; los valores de un informe pueden estar desfasados entre sí
+ * en unos pocos eventos, pero nunca a medio escribir.
+ */
+
+#define CONTADOR_SUMAR(contador, n) \
+    __atomic_store_n(&(contador), (contador) + (uint64_t)(n), __ATOMIC_RELAXED)
+#define CONTADOR_LEER(contador) __atomic_load_n(&(contador), __ATOMIC_RELAXED)
+
+// Histograma por potencias de dos: la cubeta i cuenta los valores de [2^(i-1), 2^i)
+#define HISTOGRAMA_CUBETAS 48
+
+typedef struct {
+    uint64_t cubetas[HISTOGRAMA_CUBETAS];
+    uint64_t suma;
+    uint64_t maximo;
+} histograma_t;
+
+static inline void histograma_registrar(histograma_t* h, uint64_t valor) {
+    int cubeta = valor == 0 ? 0 : 64 - __builtin_clzll(valor);
+    if (cubeta >= HISTOGRAMA_CUBETAS) cubeta = HISTOGRAMA_CUBETAS - 1;
+    CONTADOR_SUMAR(h->cubetas[cubeta], 1);
+    CONTADOR_SUMAR(h->suma, valor);
+    if (valor > h->maximo) __atomic_store_n(&h->maximo, valor, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Acumula en destino una copia de origen (leída con cargas relajadas).
+ */
+void histograma_acumular(histograma_t* destino, const histograma_t* origen);
+uint64_t histograma_total(const histograma_t* h);
+
+/**
+ * @brief Límite superior de la cubeta que contiene el percentil p (0..1).
+ */
+uint64_t histograma_percentil(const histograma_t* h, double p);
+
+/**
+ * @brief Escribe el informe de estadísticas (una línea "nombre valor" por dato).
+ * @return Bytes escritos (sin contar el '\0').
+ */
+size_t estadisticas_informe(char* buffer, size_t tamano);
+
+/**
+ * @brief Fija el instante de arranque y, si hay ruta, arranca el volcado
+ * periódico del informe a ese archivo (reescrito de forma atómica).
+ * @return 0 si todo arrancó, -1 en caso de error.
+ */
+int estadisticas_iniciar(const char* ruta, int intervalo_s);
+
+/**
+ * @brief Hace un último volcado y detiene el hilo, si estaba activo.
+ */
+void estadisticas_finalizar_volcado(void);
+
+#endif // ESTADISTICAS_H
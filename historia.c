@@ -0,0 +1,83 @@
+#include "historia.h"
+
+size_t historia_formatear(char* buffer, size_t tamano, time_t marca, const char* usuario, size_t longitud_usuario,
+                          const char* texto, size_t longitud_texto) {
+    char fecha[32];
+    struct tm desglose;
+    localtime_r(&marca, &desglose);
+    strftime(fecha, sizeof(fecha), "%Y-%m-%d %H:%M:%S", &desglose);
+    int escrito = snprintf(buffer, tamano, "[%s] %.*s: %.*s", fecha, (int)longitud_usuario, usuario,
+                           (int)longitud_texto, texto);
+    if (escrito < 0) return 0;
+    return (size_t)escrito < tamano ? (size_t)escrito : tamano - 1;
+}
+
+int historia_iniciar(historia_t* historia, const char* directorio, int capacidad) {
+    memset(historia, 0, sizeof(*historia));
+    snprintf(historia->directorio, sizeof(historia->directorio), "%s", directorio);
+    historia->siguiente = segmentos_siguiente(directorio);
+    historia->secuencia_fria = historia->siguiente;
+    historia->cargada = 1;
+
+    historia->entradas = malloc((size_t)capacidad * sizeof(entrada_historia_t));
+    if (historia->entradas == NULL) return -1;
+    historia->capacidad = capacidad;
+    return 0;
+}
+
+void historia_liberar(historia_t* historia) {
+    free(historia->entradas);
+    memset(historia, 0, sizeof(*historia));
+}
+
+uint64_t historia_anadir(historia_t* historia, time_t marca, const char* usuario, const char* texto) {
+    uint64_t secuencia = historia->siguiente++;
+    if (historia->entradas == NULL) return secuencia;
+    entrada_historia_t* entrada = &historia->entradas[secuencia % (uint64_t)historia->capacidad];
+    entrada->secuencia = secuencia;
+    entrada->longitud = (uint16_t)historia_formatear(entrada->texto, sizeof(entrada->texto), marca, usuario,
+                                                     strlen(usuario), texto, strlen(texto));
+    return secuencia;
+}
+
+// Adapta los registros de los segmentos al formato de las entradas del anillo
+typedef struct {
+    historia_visita_fn visita;
+    void* contexto;
+} lectura_fria_t;
+
+static void visitar_registro(const registro_segmento_t* registro, const char* usuario, const char* texto,
+                             void* contexto) {
+    lectura_fria_t* lectura = contexto;
+    char linea[HISTORIA_MAX_TEXTO];
+    size_t longitud = historia_formatear(linea, sizeof(linea), (time_t)registro->marca, usuario,
+                                         registro->longitud_usuario, texto, registro->longitud_texto);
+    lectura->visita(registro->secuencia, linea, longitud, lectura->contexto);
+}
+
+int historia_recorrer(const historia_t* historia, int n, historia_visita_fn visita, void* contexto) {
+    if (n <= 0 || !historia->cargada) return 0;
+
+    uint64_t capacidad = (uint64_t)historia->capacidad;
+    uint64_t en_vivo = historia->siguiente - historia->secuencia_fria;
+    uint64_t en_anillo = en_vivo < capacidad ? en_vivo : capacidad;
+    // Si el anillo ya perdió mensajes de esta ejecución, los segmentos no enlazan con él
+    uint64_t disponibles = en_anillo + (en_vivo <= capacidad ? historia->secuencia_fria : 0);
+    if ((uint64_t)n > disponibles) n = (int)disponibles;
+
+    uint64_t desde = historia->siguiente - (uint64_t)n;
+    uint64_t primera_en_anillo = historia->siguiente - en_anillo;
+    int visitados = 0;
+    if (desde < primera_en_anillo) {
+        // La retención puede haber borrado parte: se devuelve lo que quede
+        lectura_fria_t lectura = { visita, contexto };
+        visitados += segmentos_recorrer(historia->directorio, desde, primera_en_anillo, visitar_registro, &lectura);
+        desde = primera_en_anillo;
+    }
+    for (uint64_t s = desde; s < historia->siguiente; s++) {
+        const entrada_historia_t* entrada = &historia->entradas[s % capacidad];
+        visita(entrada->secuencia, entrada->texto, entrada->longitud, contexto);
+        visitados++;
+    }
+    return visitados;
+}
@@ -0,0 +1,72 @@
+#ifndef HISTORIA_H
+#define HISTORIA_H
+
+#include "common.h"
+#include "segmentos.h"
+
+/*
+ * Historia reciente de una sala, para /history y para ponerse al día al unirse.
+ *
+ * Los mensajes registrados en esta ejecución viven en un anillo en memoria de
+ * capacidad fija, numerados con una secuencia creciente que continúa la del
+ * almacén de segmentos de la sala (segmentos.h): lo que ya estaba guardado al
+ * cargarse la historia son las secuencias anteriores a secuencia_fria.
+ * Mientras el anillo no haya perdido mensajes de esta ejecución, lo que falte
+ * para completar una petición se lee de los segmentos, proyectados con mmap.
+ *
+ * El escritor de historial guarda cada mensaje con la secuencia que le asignó
+ * la historia, así que memoria y disco nunca se desfasan.
+ *
+ * Cada historia pertenece al trabajador dueño de su sala: no lleva cerrojos.
+ */
+
+#define HISTORIA_MAX_TEXTO (MAX_TEXTO + MAX_NOMBRE + 32) // Cabe una línea "[fecha] usuario: texto"
+
+typedef struct {
+    uint64_t secuencia;
+    uint16_t longitud;
+    char texto[HISTORIA_MAX_TEXTO];
+} entrada_historia_t;
+
+typedef struct {
+    int cargada;
+    entrada_historia_t* entradas; // Anillo: la secuencia s ocupa entradas[s % capacidad] (NULL sin memoria)
+    int capacidad;
+    uint64_t siguiente;           // Secuencia que recibirá el próximo mensaje
+
+    // Parte fría: los segmentos tal como estaban al cargar la historia
+    char directorio[SEGMENTOS_MAX_RUTA];
+    uint64_t secuencia_fria;      // Primera secuencia de esta ejecución
+} historia_t;
+
+// Recibe cada mensaje ya formateado, del más antiguo al más reciente
+typedef void (*historia_visita_fn)(uint64_t secuencia, const char* texto, size_t longitud, void* contexto);
+
+/**
+ * @brief Prepara la historia de una sala y retoma la secuencia de sus segmentos.
+ * Aunque no haya memoria para el anillo la historia queda cargada (y numera).
+ * @return 0 si se pudo reservar el anillo, -1 en caso contrario.
+ */
+int historia_iniciar(historia_t* historia, const char* directorio, int capacidad);
+void historia_liberar(historia_t* historia);
+
+/**
+ * @brief Numera un mensaje y lo guarda en el anillo (pisa el más antiguo si está lleno).
+ * @return La secuencia asignada.
+ */
+uint64_t historia_anadir(historia_t* historia, time_t marca, const char* usuario, const char* texto);
+
+/**
+ * @brief Recorre los últimos n mensajes disponibles, del más antiguo al más reciente.
+ * @return Cuántos se visitaron.
+ */
+int historia_recorrer(const historia_t* historia, int n, historia_visita_fn visita, void* contexto);
+
+/**
+ * @brief Escribe "[fecha] usuario: texto" (sin salto de línea), como el antiguo .log.
+ * @return Bytes escritos (truncado a tamano - 1).
+ */
+size_t historia_formatear(char* buffer, size_t tamano, time_t marca, const char* usuario, size_t longitud_usuario,
+                          const char* texto, size_t longitud_texto);
+
+#endif // HISTORIA_H
@@ -0,0 +1,46 @@
+#include "latencia.h"
+
+void latencia_registrar(latencias_t* h, uint64_t ns) {
+    int indice;
+    if (ns < CUBETAS_POR_OCTAVA) {
+        indice = (int)ns;
+    } else {
+        int exponente = 63 - __builtin_clzll(ns);
+        indice = (exponente - 3) * CUBETAS_POR_OCTAVA + (int)((ns >> (exponente - 4)) & (CUBETAS_POR_OCTAVA - 1));
+        if (indice >= NUM_CUBETAS_LATENCIA) indice = NUM_CUBETAS_LATENCIA - 1;
+    }
+    h->cubetas[indice]++;
+    h->total++;
+    if (ns > h->maximo) h->maximo = ns;
+}
+
+void latencia_acumular(latencias_t* destino, const latencias_t* origen) {
+    for (int i = 0; i < NUM_CUBETAS_LATENCIA; i++) destino->cubetas[i] += origen->cubetas[i];
+    destino->total += origen->total;
+    if (origen->maximo > destino->maximo) destino->maximo = origen->maximo;
+}
+
+/**
+ * @brief Límite superior (en ns) de los valores que caen en una cubeta.
+ */
+static uint64_t techo_cubeta(int indice) {
+    if (indice < CUBETAS_POR_OCTAVA) return (uint64_t)indice;
+    int exponente = indice / CUBETAS_POR_OCTAVA + 3;
+    uint64_t base = (uint64_t)(CUBETAS_POR_OCTAVA + indice % CUBETAS_POR_OCTAVA) << (exponente - 4);
+    return base + (1ULL << (exponente - 4)) - 1;
+}
+
+double latencia_percentil_us(const latencias_t* h, double p) {
+    if (h->total == 0) return 0.0;
+    uint64_t objetivo = (uint64_t)(p * (double)h->total);
+    if (objetivo >= h->total) objetivo = h->total - 1;
+    uint64_t acumulado = 0;
+    for (int i = 0; i < NUM_CUBETAS_LATENCIA; i++) {
+        acumulado += h->cubetas[i];
+        if (acumulado > objetivo) {
+            uint64_t techo = techo_cubeta(i);
+            return (double)(techo < h->maximo ? techo : h->maximo) / 1000.0;
+        }
+    }
+    return (double)h->maximo / 1000.0;
+}
@@ -0,0 +1,35 @@
+#ifndef LATENCIA_H
+#define LATENCIA_H
+
+#include <stdint.h>
+
+/*
+ * Histograma de latencias de las herramientas de medida (carga, reproducir).
+ *
+ * Log-lineal: 16 cubetas por potencia de dos, así que el error relativo de un
+ * percentil es menor del 6,25 %. Cada histograma lo escribe un solo hilo; para
+ * el informe se suman con latencia_acumular.
+ */
+
+#define CUBETAS_POR_OCTAVA 16
+#define NUM_CUBETAS_LATENCIA (61 * CUBETAS_POR_OCTAVA)
+
+typedef struct {
+    uint64_t cubetas[NUM_CUBETAS_LATENCIA];
+    uint64_t total;
+    uint64_t maximo;
+} latencias_t;
+
+void latencia_registrar(latencias_t* h, uint64_t ns);
+
+/**
+ * @brief Suma origen a destino.
+ */
+void latencia_acumular(latencias_t* destino, const latencias_t* origen);
+
+/**
+ * @brief Límite superior, en microsegundos, de la cubeta que contiene el percentil p (0..1).
+ */
+double latencia_percentil_us(const latencias_t* h, double p);
+
+#endif // LATENCIA_H
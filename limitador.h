@@ -0,0 +1,53 @@
+#ifndef LIMITADOR_H
+#define LIMITADOR_H
+
+#include <stdint.h>
+
+/*
+ * Cubetas de fichas para limitar el chat de cada cliente y de cada sala.
+ *
+ * Una cubeta de capacidad "ráfaga" que se rellena a "ritmo" fichas por segundo
+ * se guarda como un solo instante: el momento en que volvería a estar llena
+ * (algoritmo GCRA). Un mensaje cabe si ese instante no queda más de
+ * (ráfaga - 1) intervalos por delante de ahora, y gastar una ficha lo adelanta
+ * un intervalo. Así no hay que rellenar nada con el paso del tiempo ni guardar
+ * fracciones de ficha: comprobar y gastar son una comparación y una suma.
+ *
+ * Los instantes son de CLOCK_MONOTONIC, común a todo el sistema, así que una
+ * cubeta sigue siendo válida tras un reinicio en caliente.
+ */
+
+typedef struct {
+    int64_t intervalo_ns;   // 1 s / ritmo (0 = sin límite)
+    int64_t tolerancia_ns;  // (ráfaga - 1) intervalos
+} limite_t;
+
+typedef struct {
+    int64_t llena_ns;       // Instante en que la cubeta vuelve a tener todas sus fichas
+} cubeta_t;
+
+/**
+ * @brief Prepara un límite de ritmo mensajes por segundo con ráfagas de hasta rafaga.
+ * Con ritmo 0 no limita nada.
+ */
+static inline void limite_iniciar(limite_t* limite, int ritmo, int rafaga) {
+    limite->intervalo_ns = ritmo > 0 ? 1000000000LL / ritmo : 0;
+    limite->tolerancia_ns = rafaga > 1 ? (int64_t)(rafaga - 1) * limite->intervalo_ns : 0;
+}
+
+/**
+ * @brief Indica si a la cubeta le queda una ficha en el instante ahora_ns.
+ */
+static inline int cubeta_cabe(const cubeta_t* cubeta, const limite_t* limite, int64_t ahora_ns) {
+    return limite->intervalo_ns == 0 || cubeta->llena_ns - ahora_ns <= limite->tolerancia_ns;
+}
+
+/**
+ * @brief Gasta una ficha (después de comprobar con cubeta_cabe).
+ */
+static inline void cubeta_gastar(cubeta_t* cubeta, const limite_t* limite, int64_t ahora_ns) {
+    if (limite->intervalo_ns == 0) return;
+    cubeta->llena_ns = (cubeta->llena_ns > ahora_ns ? cubeta->llena_ns : ahora_ns) + limite->intervalo_ns;
+}
+
+#endif // LIMITADOR_H
@@ -0,0 +1,222 @@
+#include "common.h"
+#include "tablas.h"
+#include "miembros.h"
+#include <getopt.h>
+
+/*
+ * Microbanco de la difusión (make micro).
+ *
+ * Mide lo que cuesta, por destinatario, recorrer la pertenencia de una sala para
+ * repartir un mensaje excluyendo al autor, con salas de distintos tamaños:
+ *  - contiguo: los destinos seguidos de miembros_sala_t, como hace el trabajador;
+ *  - indirecto: un array de manejadores y, por cada uno, la ficha del miembro en
+ *    el almacén (con su nombre al lado del id de cola), como antes de separar
+ *    los destinos.
+ * Las salas se llenan intercaladas con otras del mismo trabajador y después se
+ * baraja la pertenencia con altas y bajas, de modo que los miembros de una sala
+ * quedan repartidos por el almacén como en un servidor con tiempo encima. Tras
+ * las bajas se comprueba que cada miembro sigue en la posición que tiene anotada.
+ *
+ * Imprime una línea JSON por tamaño; el progreso va a stderr.
+ */
+
+#define SALAS_DEFECTO 8
+#define BAJAS_POR_MIEMBRO 2      // Rondas de bajas y altas por miembro al barajar
+#define NS_POR_MEDIDA 200000000ULL // Tiempo mínimo de cada medida
+
+// Ficha de un miembro tal como la ve el trabajador: el id de cola junto a datos fríos
+typedef struct {
+    int id_cola;
+    char nombre_usuario[MAX_NOMBRE];
+    int sala;
+    int posicion_en_sala;
+    char resto[64];          // Lote, envíos diferidos, contadores...
+} ficha_t;
+
+static uint64_t ahora_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t semilla = 88172645463325252ULL;
+static uint32_t aleatorio(uint32_t n) {
+    semilla ^= semilla << 13; // xorshift64
+    semilla ^= semilla >> 7;
+    semilla ^= semilla << 17;
+    return (uint32_t)(semilla % n);
+}
+
+/**
+ * @brief Recorrido de la difusión sobre los destinos seguidos.
+ * @return Una mezcla de los destinos, para que el compilador no quite el bucle.
+ */
+static unsigned int recorrer_contiguo(const miembros_sala_t* miembros, int excluido, int* entregas) {
+    unsigned int mezcla = 0;
+    int n = 0;
+    for (int i = 0; i < miembros->num; i++) {
+        if (miembros->destinos[i] != excluido) {
+            mezcla ^= (unsigned int)miembros->destinos[i];
+            n++;
+        }
+    }
+    *entregas = n;
+    return mezcla;
+}
+
+/**
+ * @brief El mismo recorrido cargando la ficha de cada miembro para leer su destino.
+ */
+static unsigned int recorrer_indirecto(const almacen_t* fichas, const miembros_sala_t* miembros, int excluido,
+                                       int* entregas) {
+    unsigned int mezcla = 0;
+    int n = 0;
+    for (int i = 0; i < miembros->num; i++) {
+        const ficha_t* ficha = almacen_obtener(fichas, miembros->manejadores[i]);
+        if (ficha->id_cola != excluido) {
+            mezcla ^= (unsigned int)ficha->id_cola;
+            n++;
+        }
+    }
+    *entregas = n;
+    return mezcla;
+}
+
+/**
+ * @brief Da de alta una ficha en una sala.
+ * @return 0 si todo fue bien, -1 si no hay memoria.
+ */
+static int alta(almacen_t* fichas, miembros_sala_t* salas, int sala, int* proximo_id) {
+    int manejador = almacen_reservar(fichas);
+    if (manejador == -1) return -1;
+    ficha_t* ficha = almacen_obtener(fichas, manejador);
+    ficha->id_cola = (*proximo_id)++;
+    snprintf(ficha->nombre_usuario, sizeof(ficha->nombre_usuario), "usuario%d", ficha->id_cola);
+    ficha->sala = sala;
+    ficha->posicion_en_sala = miembros_anadir(&salas[sala], ficha->id_cola, manejador);
+    if (ficha->posicion_en_sala == -1) return -1;
+    return 0;
+}
+
+/**
+ * @brief Da de baja al miembro de una posición, como tarea_abandonar.
+ */
+static void baja(almacen_t* fichas, miembros_sala_t* salas, int sala, int posicion) {
+    int manejador = salas[sala].manejadores[posicion];
+    int movido = miembros_quitar(&salas[sala], posicion);
+    if (movido != -1) ((ficha_t*)almacen_obtener(fichas, movido))->posicion_en_sala = posicion;
+    almacen_liberar(fichas, manejador);
+}
+
+/**
+ * @brief Comprueba que destinos, manejadores y posiciones anotadas coinciden.
+ */
+static int pertenencia_coherente(const almacen_t* fichas, const miembros_sala_t* salas, int num_salas) {
+    for (int s = 0; s < num_salas; s++) {
+        for (int i = 0; i < salas[s].num; i++) {
+            const ficha_t* ficha = almacen_obtener(fichas, salas[s].manejadores[i]);
+            if (ficha->sala != s || ficha->posicion_en_sala != i || ficha->id_cola != salas[s].destinos[i]) return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Mide una de las dos variantes sobre la sala 0 hasta juntar NS_POR_MEDIDA.
+ * @return Nanosegundos por destinatario.
+ */
+static double medir(const almacen_t* fichas, const miembros_sala_t* sala, int indirecto, unsigned int* mezcla) {
+    uint64_t destinatarios = 0, inicio = ahora_ns(), transcurrido;
+    int vuelta = 0;
+    do {
+        for (int r = 0; r < 16; r++, vuelta++) {
+            int excluido = sala->destinos[vuelta % sala->num]; // Cada vez escribe otro miembro
+            int entregas;
+            *mezcla ^= indirecto ? recorrer_indirecto(fichas, sala, excluido, &entregas)
+                                 : recorrer_contiguo(sala, excluido, &entregas);
+            destinatarios += (uint64_t)entregas + 1;
+        }
+        transcurrido = ahora_ns() - inicio;
+    } while (transcurrido < NS_POR_MEDIDA);
+    return (double)transcurrido / (double)destinatarios;
+}
+
+/**
+ * @brief Prepara un trabajador con num_salas salas de n miembros y mide la sala 0.
+ * @return 0 si todo fue bien, -1 si falló (ya informado).
+ */
+static int medir_tamano(int n, int num_salas) {
+    almacen_t fichas;
+    miembros_sala_t* salas = calloc((size_t)num_salas, sizeof(miembros_sala_t));
+    if (salas == NULL || almacen_iniciar(&fichas, sizeof(ficha_t), n * num_salas) == -1) {
+        perror("preparar salas");
+        free(salas);
+        return -1;
+    }
+
+    // Altas intercaladas y luego bajas y altas al azar: los manejadores de una sala se dispersan
+    int proximo_id = 1, resultado = 0;
+    for (int i = 0; i < n * num_salas && resultado == 0; i++) resultado = alta(&fichas, salas, i % num_salas, &proximo_id);
+    for (long k = 0; k < (long)BAJAS_POR_MIEMBRO * n * num_salas && resultado == 0; k++) {
+        int sala = (int)aleatorio((uint32_t)num_salas);
+        baja(&fichas, salas, sala, (int)aleatorio((uint32_t)salas[sala].num));
+        resultado = alta(&fichas, salas, sala, &proximo_id);
+    }
+    if (resultado == -1) {
+        perror("alta de miembro");
+    } else if (!pertenencia_coherente(&fichas, salas, num_salas)) {
+        fprintf(stderr, "La pertenencia quedó incoherente tras las bajas.\n");
+        resultado = -1;
+    } else {
+        unsigned int mezcla = 0;
+        double contiguo = medir(&fichas, &salas[0], 0, &mezcla);
+        double indirecto = medir(&fichas, &salas[0], 1, &mezcla);
+        fprintf(stderr, "%7d miembros: contiguo %.2f ns, indirecto %.2f ns por destinatario (x%.1f)\n",
+                n, contiguo, indirecto, indirecto / contiguo);
+        printf("{\"miembros\":%d,\"salas\":%d,\"contiguo_ns\":%.3f,\"indirecto_ns\":%.3f,\"mezcla\":%u}\n",
+               n, num_salas, contiguo, indirecto, mezcla);
+    }
+
+    for (int s = 0; s < num_salas; s++) miembros_liberar(&salas[s]);
+    free(salas);
+    almacen_liberar_todo(&fichas);
+    return resultado;
+}
+
+/**
+ * @brief Función principal del microbanco.
+ */
+int main(int argc, char* argv[]) {
+    static const int tamanos_defecto[] = { 16, 256, 4096, 65536 };
+    int num_salas = SALAS_DEFECTO;
+    int opcion;
+    while ((opcion = getopt(argc, argv, "s:h")) != -1) {
+        if (opcion == 's') {
+            num_salas = atoi(optarg);
+        } else {
+            fprintf(stderr, "Uso: %s [-s salas por trabajador] [miembros...]\n", argv[0]);
+            exit(opcion == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (num_salas < 1) {
+        fprintf(stderr, "Hace falta al menos una sala.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int resultado = 0;
+    if (optind == argc) {
+        for (size_t i = 0; i < sizeof(tamanos_defecto) / sizeof(tamanos_defecto[0]) && resultado == 0; i++) {
+            resultado = medir_tamano(tamanos_defecto[i], num_salas);
+        }
+    }
+    for (int i = optind; i < argc && resultado == 0; i++) {
+        int n = atoi(argv[i]);
+        if (n < 2 || (long)n * num_salas > ALMACEN_MAX_ELEMENTOS) {
+            fprintf(stderr, "Tamaño fuera de rango: %s (de 2 a %d miembros en total).\n", argv[i], ALMACEN_MAX_ELEMENTOS);
+            resultado = -1;
+        } else {
+            resultado = medir_tamano(n, num_salas);
+        }
+    }
+    return resultado == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
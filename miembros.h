@@ -0,0 +1,71 @@
+#ifndef MIEMBROS_H
+#define MIEMBROS_H
+
+#include <stdlib.h>
+
+/*
+ * Pertenencia a una sala, ordenada para la difusión: las colas de destino de
+ * todos los miembros van seguidas en un array, así que repartir un mensaje es
+ * un recorrido lineal y saber si un destino es el excluido es comparar enteros
+ * consecutivos, sin cargar la ficha de cada miembro. En la misma posición del
+ * otro array está su manejador en el almacén del trabajador, para lo que no es
+ * solo el destino (lote, envíos diferidos, nombre).
+ *
+ * Las altas van al final y una baja mueve el último a su hueco, de modo que
+ * las dos son O(1) si se conoce la posición. Solo lo toca el trabajador dueño
+ * de la sala.
+ */
+
+typedef struct {
+    int* destinos;      // id_cola de cada miembro
+    int* manejadores;   // Su miembro en el almacén del trabajador, en la misma posición
+    int num;
+    int capacidad;
+} miembros_sala_t;
+
+/**
+ * @brief Añade un miembro al final, ampliando los arrays si hace falta.
+ * @return Su posición, o -1 si no hay memoria.
+ */
+static inline int miembros_anadir(miembros_sala_t* miembros, int destino, int manejador) {
+    if (miembros->num == miembros->capacidad) {
+        int nueva = miembros->capacidad ? miembros->capacidad * 2 : 8;
+        int* destinos = realloc(miembros->destinos, (size_t)nueva * sizeof(int));
+        if (destinos == NULL) return -1;
+        miembros->destinos = destinos;
+        int* manejadores = realloc(miembros->manejadores, (size_t)nueva * sizeof(int));
+        if (manejadores == NULL) return -1;
+        miembros->manejadores = manejadores;
+        miembros->capacidad = nueva;
+    }
+    miembros->destinos[miembros->num] = destino;
+    miembros->manejadores[miembros->num] = manejador;
+    return miembros->num++;
+}
+
+/**
+ * @brief Quita el miembro de una posición: el último pasa a ocupar su hueco.
+ * @return El manejador del miembro que cambió de posición (y debe anotarla), o
+ * -1 si el quitado era el último.
+ */
+static inline int miembros_quitar(miembros_sala_t* miembros, int posicion) {
+    int ultimo = --miembros->num;
+    if (posicion == ultimo) return -1;
+    miembros->destinos[posicion] = miembros->destinos[ultimo];
+    miembros->manejadores[posicion] = miembros->manejadores[ultimo];
+    return miembros->manejadores[posicion];
+}
+
+/**
+ * @brief Libera los arrays y deja la pertenencia vacía.
+ */
+static inline void miembros_liberar(miembros_sala_t* miembros) {
+    free(miembros->destinos);
+    free(miembros->manejadores);
+    miembros->destinos = NULL;
+    miembros->manejadores = NULL;
+    miembros->num = 0;
+    miembros->capacidad = 0;
+}
+
+#endif // MIEMBROS_H
@@ -0,0 +1,131 @@
+#include "common.h"
+
+/**
+ * @brief Longitud de una cadena limitada a un máximo (NULL cuenta como vacía).
+ */
+static size_t longitud_acotada(const char* s, size_t maximo) {
+    if (s == NULL) return 0;
+    size_t n = 0;
+    while (n < maximo && s[n] != '\0') n++;
+    return n;
+}
+
+size_t trama_construir(trama_t* trama, long tipo, int id_cola_cliente,
+                       const char* usuario, const char* sala, const char* texto) {
+    size_t len_usuario = longitud_acotada(usuario, MAX_NOMBRE - 1);
+    size_t len_sala = longitud_acotada(sala, MAX_NOMBRE - 1);
+    size_t len_texto = longitud_acotada(texto, MAX_DATOS_TRAMA - len_usuario - len_sala);
+
+    if (tipo >= TIPO_RESPUESTA_EXITO) trama->mtype = tipo;
+    else trama->mtype = PRIORIDAD_CONTROL; // El chat se construye con trama_construir_chat
+    trama->cabecera.id_cola_cliente = id_cola_cliente;
+    trama->cabecera.tipo = (uint16_t)tipo;
+    trama->cabecera.banderas = 0;
+    trama->cabecera.longitud_usuario = (uint8_t)len_usuario;
+    trama->cabecera.longitud_sala = (uint8_t)len_sala;
+    trama->cabecera.longitud_texto = (uint16_t)len_texto;
+
+    char* p = trama->datos;
+    if (len_usuario > 0) memcpy(p, usuario, len_usuario);
+    p += len_usuario;
+    if (len_sala > 0) memcpy(p, sala, len_sala);
+    p += len_sala;
+    if (len_texto > 0) memcpy(p, texto, len_texto);
+    return sizeof(cabecera_trama_t) + len_usuario + len_sala + len_texto;
+}
+
+size_t trama_construir_chat(trama_t* trama, int id_cola_cliente, uint32_t id_sesion, uint32_t id_sala,
+                            const char* texto) {
+    identificadores_chat_t ids = { id_sesion, id_sala };
+    size_t len_texto = longitud_acotada(texto, MAX_DATOS_TRAMA - sizeof(ids));
+
+    trama->mtype = PRIORIDAD_DATOS;
+    trama->cabecera.id_cola_cliente = id_cola_cliente;
+    trama->cabecera.tipo = TIPO_MENSAJE;
+    trama->cabecera.banderas = 0;
+    trama->cabecera.longitud_usuario = 0;
+    trama->cabecera.longitud_sala = 0;
+    trama->cabecera.longitud_texto = (uint16_t)len_texto;
+    memcpy(trama->datos, &ids, sizeof(ids));
+    if (len_texto > 0) memcpy(trama->datos + sizeof(ids), texto, len_texto);
+    return sizeof(cabecera_trama_t) + sizeof(ids) + len_texto;
+}
+
+size_t trama_construir_fragmento(trama_t* trama, long tipo, int id_cola_cliente, const cabecera_fragmento_t* fragmento,
+                                 const char* usuario, const char* nombre, const void* datos, size_t longitud) {
+    size_t len_usuario = longitud_acotada(usuario, MAX_NOMBRE - 1);
+    size_t len_nombre = longitud_acotada(nombre, MAX_NOMBRE - 1);
+    if (longitud > FRAGMENTO_MAX_DATOS) longitud = FRAGMENTO_MAX_DATOS;
+
+    trama->mtype = tipo == TIPO_FRAGMENTO ? PRIORIDAD_DATOS : tipo;
+    trama->cabecera.id_cola_cliente = id_cola_cliente;
+    trama->cabecera.tipo = (uint16_t)tipo;
+    trama->cabecera.banderas = 0;
+    trama->cabecera.longitud_usuario = (uint8_t)len_usuario;
+    trama->cabecera.longitud_sala = (uint8_t)len_nombre;
+    trama->cabecera.longitud_texto = (uint16_t)longitud;
+
+    char* p = trama->datos;
+    memcpy(p, fragmento, sizeof(*fragmento));
+    p += sizeof(*fragmento);
+    if (len_usuario > 0) memcpy(p, usuario, len_usuario);
+    p += len_usuario;
+    if (len_nombre > 0) memcpy(p, nombre, len_nombre);
+    p += len_nombre;
+    if (longitud > 0) memcpy(p, datos, longitud);
+    return sizeof(cabecera_trama_t) + sizeof(*fragmento) + len_usuario + len_nombre + longitud;
+}
+
+size_t trama_trazar(trama_t* trama, size_t tamano, const traza_t* traza) {
+    cabecera_trama_t* c = &trama->cabecera;
+    if ((c->tipo != TIPO_MENSAJE && c->tipo != TIPO_NOTIFICACION) || (c->banderas & TRAMA_TRAZADA) ||
+        tamano + sizeof(traza_t) > sizeof(cabecera_trama_t) + MAX_DATOS_TRAMA) {
+        return tamano;
+    }
+    size_t posicion = trama_posicion_traza(c);
+    char* p = trama->datos + posicion;
+    memmove(p + sizeof(traza_t), p, tamano - sizeof(cabecera_trama_t) - posicion);
+    memcpy(p, traza, sizeof(traza_t));
+    c->banderas |= TRAMA_TRAZADA;
+    return tamano + sizeof(traza_t);
+}
+
+int trama_leer(const trama_t* trama, size_t tamano, mensaje_t* msg) {
+    const cabecera_trama_t* c = &trama->cabecera;
+    if (tamano < sizeof(cabecera_trama_t)) return -1;
+    // El chat lleva delante del texto sus identificadores en lugar de los nombres; los
+    // fragmentos, su cabecera, que empieza por los mismos identificadores
+    size_t prefijo = trama_prefijo(c);
+    size_t datos = prefijo + c->longitud_usuario + c->longitud_sala + c->longitud_texto;
+    if (c->longitud_usuario >= MAX_NOMBRE || c->longitud_sala >= MAX_NOMBRE ||
+        datos != tamano - sizeof(cabecera_trama_t)) {
+        return -1;
+    }
+
+    msg->mtype = c->tipo;
+    msg->id_cola_cliente = c->id_cola_cliente;
+    identificadores_chat_t ids = { 0, 0 };
+    if (c->tipo == TIPO_MENSAJE || c->tipo == TIPO_FRAGMENTO || c->tipo == TIPO_FRAGMENTO_SALA) {
+        memcpy(&ids, trama->datos, sizeof(ids));
+    }
+    msg->id_sesion = ids.id_sesion;
+    msg->id_sala = ids.id_sala;
+    // Solo las tramas trazadas pagan la copia de la traza
+    msg->banderas = c->banderas;
+    if ((c->banderas & TRAMA_TRAZADA) && (c->tipo == TIPO_MENSAJE || c->tipo == TIPO_NOTIFICACION)) {
+        memcpy(&msg->traza, trama->datos + trama_posicion_traza(c), sizeof(traza_t));
+    }
+
+    const char* p = trama->datos + prefijo;
+    memcpy(msg->nombre_usuario, p, c->longitud_usuario);
+    msg->nombre_usuario[c->longitud_usuario] = '\0';
+    p += c->longitud_usuario;
+    memcpy(msg->nombre_sala, p, c->longitud_sala);
+    msg->nombre_sala[c->longitud_sala] = '\0';
+    p += c->longitud_sala;
+
+    size_t len_texto = c->longitud_texto < MAX_TEXTO - 1 ? c->longitud_texto : MAX_TEXTO - 1;
+    memcpy(msg->texto, p, len_texto);
+    msg->texto[len_texto] = '\0';
+    return 0;
+}
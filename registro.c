@@ -0,0 +1,497 @@
+#include "registro.h"
+#include "busqueda.h"
+#include "traza.h"
+#include <pthread.h>
+#include <dirent.h>
+
+// Límites Internos del Escritor
+#define REGISTRO_MAX_PENDIENTES 65536   // Tope de registros en memoria antes de frenar al productor
+#define REGISTRO_MAX_ARCHIVOS 256       // Salas con su segmento activo abierto simultáneamente
+
+// Un mensaje de historial pendiente de escribir, o la orden de cerrar una sala
+typedef struct {
+    int cerrar;             // Cerrar el segmento activo de la sala: ya no tiene actividad
+    time_t marca;
+    uint64_t secuencia;
+    uint64_t traza;         // Mensaje trazado (0 = no) y cuándo se encoló
+    uint64_t encolado_ns;
+    char sala[MAX_NOMBRE];
+    char usuario[MAX_NOMBRE];
+    char texto[MAX_TEXTO];
+} registro_entrada_t;
+
+// Sala abierta por el escritor: su segmento activo, con su buffer de salida
+typedef struct {
+    char sala[MAX_NOMBRE];
+    int abierto;            // 0 si la ranura está libre
+    segmento_escritor_t escritor;
+} registro_archivo_t;
+
+// Estado compartido entre el servidor (productor) y el hilo escritor (consumidor)
+static pthread_mutex_t mutex_registro = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_pendientes;  // El escritor espera registros
+static pthread_cond_t cond_espacio;     // El productor espera hueco
+static registro_entrada_t* pendientes = NULL;
+static int num_pendientes = 0;
+static int capacidad_pendientes = 0;
+static int cerrando = 0;
+static int hilo_activo = 0;
+static pthread_cond_t cond_escritos;    // Quien espera a que lo encolado llegue al disco
+static uint64_t num_encolados = 0;      // Entradas encoladas desde el arranque
+static uint64_t num_escritos = 0;       // Entradas ya escritas
+static int num_en_escritura = 0;        // Entradas del lote que el escritor tiene entre manos
+static int urgente = 0;                 // Alguien espera: el lote sale sin agotar el intervalo
+static pthread_t hilo_escritor;
+static registro_config_t configuracion;
+
+// Estado privado del hilo escritor
+static registro_entrada_t* lote = NULL;
+static int capacidad_lote = 0;
+static registro_archivo_t* archivos = NULL; // Tabla hash abierta indexada por nombre de sala
+static int num_archivos = 0;
+static struct timespec ultimo_fsync;
+static struct timespec proxima_retencion;
+static registro_estadisticas_t estadisticas;
+
+static void* bucle_escritor(void* arg);
+static void escribir_lote(registro_entrada_t* entradas, int n);
+static registro_archivo_t* buscar_archivo(const char* nombre_sala);
+static registro_archivo_t* obtener_archivo(const char* nombre_sala);
+static void cerrar_archivo(registro_archivo_t* archivo);
+static void vaciar_archivo(registro_archivo_t* archivo);
+static void cerrar_archivos(void);
+static void sincronizar_archivos(void);
+static int retencion_activa(void);
+static void barrer_retencion(void);
+
+/**
+ * @brief Hash FNV-1a del nombre de sala para la tabla de archivos abiertos.
+ */
+static unsigned int hash_nombre(const char* s) {
+    unsigned int h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Suma milisegundos a un instante de CLOCK_MONOTONIC.
+ */
+static struct timespec sumar_ms(struct timespec t, int ms) {
+    t.tv_sec += ms / 1000;
+    t.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    }
+    return t;
+}
+
+int registro_parsear_fsync(const char* nombre, registro_fsync_t* fsync) {
+    if (strcmp(nombre, "nunca") == 0)   { *fsync = REGISTRO_FSYNC_NUNCA;   return 0; }
+    if (strcmp(nombre, "lote") == 0)    { *fsync = REGISTRO_FSYNC_LOTE;    return 0; }
+    if (strcmp(nombre, "segundo") == 0) { *fsync = REGISTRO_FSYNC_SEGUNDO; return 0; }
+    return -1;
+}
+
+int registro_iniciar(const registro_config_t* config) {
+    configuracion = *config;
+    if (configuracion.lote_max <= 0) configuracion.lote_max = REGISTRO_LOTE_DEFECTO;
+    if (configuracion.lote_max > REGISTRO_MAX_PENDIENTES) configuracion.lote_max = REGISTRO_MAX_PENDIENTES;
+    if (configuracion.intervalo_ms < 0) configuracion.intervalo_ms = 0;
+
+    archivos = calloc(REGISTRO_MAX_ARCHIVOS * 2, sizeof(registro_archivo_t));
+    if (archivos == NULL) {
+        perror("calloc archivos de historial");
+        return -1;
+    }
+    // El índice de búsqueda se pone al día antes de que llegue nada nuevo
+    if (busqueda_iniciar(configuracion.particion, configuracion.num_particiones) == -1) return -1;
+
+    // Las esperas con tiempo usan el reloj monótono para no depender de la hora del sistema
+    pthread_condattr_t atributos;
+    pthread_condattr_init(&atributos);
+    pthread_condattr_setclock(&atributos, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond_pendientes, &atributos);
+    pthread_condattr_destroy(&atributos);
+    pthread_cond_init(&cond_espacio, NULL);
+    pthread_cond_init(&cond_escritos, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ultimo_fsync);
+    proxima_retencion = ultimo_fsync; // La primera revisión es al arrancar
+
+    // El hilo escritor no atiende señales: Ctrl+C debe interrumpir la espera del hilo principal
+    sigset_t todas, anteriores;
+    sigfillset(&todas);
+    pthread_sigmask(SIG_BLOCK, &todas, &anteriores);
+    int error = pthread_create(&hilo_escritor, NULL, bucle_escritor, NULL);
+    pthread_sigmask(SIG_SETMASK, &anteriores, NULL);
+    if (error != 0) {
+        errno = error;
+        perror("pthread_create escritor de historial");
+        return -1;
+    }
+    hilo_activo = 1;
+    return 0;
+}
+
+/**
+ * @brief Reserva la siguiente entrada pendiente. Se llama con mutex_registro tomado.
+ * @return La entrada (sin rellenar) o NULL si el escritor no está activo o no hay memoria.
+ */
+static registro_entrada_t* nueva_entrada(void) {
+    if (!hilo_activo || cerrando) return NULL;
+    // Si el disco no da abasto se frena al productor en lugar de perder líneas
+    while (num_pendientes >= REGISTRO_MAX_PENDIENTES && !cerrando) {
+        pthread_cond_wait(&cond_espacio, &mutex_registro);
+    }
+    if (num_pendientes == capacidad_pendientes) {
+        int nueva = capacidad_pendientes ? capacidad_pendientes * 2 : configuracion.lote_max;
+        registro_entrada_t* ampliado = realloc(pendientes, (size_t)nueva * sizeof(registro_entrada_t));
+        if (ampliado == NULL) {
+            perror("realloc cola de historial");
+            return NULL;
+        }
+        pendientes = ampliado;
+        capacidad_pendientes = nueva;
+    }
+    num_encolados++;
+    // Solo se despierta al escritor al arrancar un lote (para iniciar el temporizador) o al llenarlo
+    if (num_pendientes + 1 == 1 || num_pendientes + 1 == configuracion.lote_max) {
+        pthread_cond_signal(&cond_pendientes);
+    }
+    return &pendientes[num_pendientes++];
+}
+
+void registro_encolar(const char* nombre_sala, uint64_t secuencia, time_t marca, const char* nombre_usuario,
+                      const char* texto, uint64_t traza) {
+    uint64_t encolado_ns = traza != 0 ? traza_ahora_ns() : 0;
+    pthread_mutex_lock(&mutex_registro);
+    registro_entrada_t* entrada = nueva_entrada();
+    if (entrada == NULL) {
+        pthread_mutex_unlock(&mutex_registro);
+        return;
+    }
+    entrada->cerrar = 0;
+    entrada->marca = marca;
+    entrada->secuencia = secuencia;
+    entrada->traza = traza;
+    entrada->encolado_ns = encolado_ns;
+    strncpy(entrada->sala, nombre_sala, MAX_NOMBRE - 1);
+    entrada->sala[MAX_NOMBRE - 1] = '\0';
+    strncpy(entrada->usuario, nombre_usuario, MAX_NOMBRE - 1);
+    entrada->usuario[MAX_NOMBRE - 1] = '\0';
+    strncpy(entrada->texto, texto, MAX_TEXTO - 1);
+    entrada->texto[MAX_TEXTO - 1] = '\0';
+    pthread_mutex_unlock(&mutex_registro);
+}
+
+void registro_cerrar_sala(const char* nombre_sala) {
+    pthread_mutex_lock(&mutex_registro);
+    registro_entrada_t* entrada = nueva_entrada();
+    if (entrada != NULL) {
+        memset(entrada, 0, sizeof(*entrada));
+        entrada->cerrar = 1;
+        strncpy(entrada->sala, nombre_sala, MAX_NOMBRE - 1);
+    }
+    pthread_mutex_unlock(&mutex_registro);
+}
+
+/**
+ * @brief Número (desde el arranque) de la última entrada de la sala que aún no está
+ * escrita, o 0 si no queda ninguna. El lote en escritura va por delante de los
+ * pendientes; el escritor solo lee sus entradas, así que se pueden recorrer aquí.
+ */
+static uint64_t ultima_entrada_sin_escribir(const char* nombre_sala) {
+    for (int i = num_pendientes - 1; i >= 0; i--) {
+        if (strcmp(pendientes[i].sala, nombre_sala) == 0) {
+            return num_escritos + (uint64_t)num_en_escritura + (uint64_t)i + 1;
+        }
+    }
+    for (int i = num_en_escritura - 1; i >= 0; i--) {
+        if (strcmp(lote[i].sala, nombre_sala) == 0) return num_escritos + (uint64_t)i + 1;
+    }
+    return 0;
+}
+
+void registro_esperar_sala(const char* nombre_sala) {
+    pthread_mutex_lock(&mutex_registro);
+    uint64_t objetivo = ultima_entrada_sin_escribir(nombre_sala);
+    if (num_escritos < objetivo) {
+        urgente = 1;
+        pthread_cond_signal(&cond_pendientes);
+        while (num_escritos < objetivo && hilo_activo) pthread_cond_wait(&cond_escritos, &mutex_registro);
+    }
+    pthread_mutex_unlock(&mutex_registro);
+}
+
+void registro_finalizar(void) {
+    pthread_mutex_lock(&mutex_registro);
+    if (!hilo_activo) {
+        pthread_mutex_unlock(&mutex_registro);
+        return;
+    }
+    cerrando = 1;
+    pthread_cond_broadcast(&cond_pendientes);
+    pthread_cond_broadcast(&cond_espacio);
+    pthread_mutex_unlock(&mutex_registro);
+
+    // El escritor vacía todo lo pendiente antes de terminar
+    pthread_join(hilo_escritor, NULL);
+    pthread_mutex_lock(&mutex_registro);
+    hilo_activo = 0;
+    pthread_cond_broadcast(&cond_escritos);
+    pthread_mutex_unlock(&mutex_registro);
+
+    busqueda_finalizar();
+
+    free(pendientes);
+    free(lote);
+    free(archivos);
+    pendientes = NULL;
+    lote = NULL;
+    archivos = NULL;
+}
+
+const registro_estadisticas_t* registro_estadisticas(void) {
+    return &estadisticas;
+}
+
+/**
+ * @brief Hilo escritor: acumula registros y los vuelca por lotes (group commit).
+ */
+static void* bucle_escritor(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&mutex_registro);
+        while (num_pendientes == 0 && !cerrando) {
+            if (!retencion_activa()) {
+                pthread_cond_wait(&cond_pendientes, &mutex_registro);
+            } else if (pthread_cond_timedwait(&cond_pendientes, &mutex_registro, &proxima_retencion) == ETIMEDOUT) {
+                break;
+            }
+        }
+        if (num_pendientes == 0 && !cerrando) {
+            // Sin registros, pero toca revisar la retención
+            pthread_mutex_unlock(&mutex_registro);
+            barrer_retencion();
+            continue;
+        }
+        // Hay al menos un registro: esperar a que se llene el lote o venza el intervalo
+        if (!cerrando && !urgente && configuracion.intervalo_ms > 0 && num_pendientes < configuracion.lote_max) {
+            struct timespec limite;
+            clock_gettime(CLOCK_MONOTONIC, &limite);
+            limite = sumar_ms(limite, configuracion.intervalo_ms);
+            while (!cerrando && !urgente && num_pendientes < configuracion.lote_max) {
+                if (pthread_cond_timedwait(&cond_pendientes, &mutex_registro, &limite) == ETIMEDOUT) break;
+            }
+        }
+        if (num_pendientes == 0 && cerrando) {
+            pthread_mutex_unlock(&mutex_registro);
+            break;
+        }
+
+        // Intercambio de buffers: el productor sigue encolando mientras se escribe a disco
+        registro_entrada_t* entradas = pendientes;
+        int n = num_pendientes;
+        int capacidad = capacidad_pendientes;
+        pendientes = lote;
+        capacidad_pendientes = capacidad_lote;
+        num_pendientes = 0;
+        lote = entradas;
+        capacidad_lote = capacidad;
+        num_en_escritura = n;
+        urgente = 0;
+        pthread_cond_broadcast(&cond_espacio);
+        pthread_mutex_unlock(&mutex_registro);
+
+        struct timespec antes, despues;
+        clock_gettime(CLOCK_MONOTONIC, &antes);
+        escribir_lote(entradas, n);
+        clock_gettime(CLOCK_MONOTONIC, &despues);
+        pthread_mutex_lock(&mutex_registro);
+        num_escritos += (uint64_t)n;
+        num_en_escritura = 0;
+        pthread_cond_broadcast(&cond_escritos);
+        pthread_mutex_unlock(&mutex_registro);
+        CONTADOR_SUMAR(estadisticas.lotes, 1);
+        CONTADOR_SUMAR(estadisticas.lineas, n);
+        histograma_registrar(&estadisticas.escritura_ns, (uint64_t)((despues.tv_sec - antes.tv_sec) * 1000000000LL +
+                                                                    (despues.tv_nsec - antes.tv_nsec)));
+        if (traza_activa()) {
+            uint64_t escrito_ns = (uint64_t)despues.tv_sec * 1000000000ULL + (uint64_t)despues.tv_nsec;
+            for (int i = 0; i < n; i++) {
+                if (entradas[i].traza != 0) traza_evento(ETAPA_REGISTRO, entradas[i].traza, entradas[i].encolado_ns, escrito_ns);
+            }
+        }
+        if (retencion_activa() && (despues.tv_sec > proxima_retencion.tv_sec ||
+                                   (despues.tv_sec == proxima_retencion.tv_sec && despues.tv_nsec >= proxima_retencion.tv_nsec))) {
+            barrer_retencion();
+        }
+    }
+
+    cerrar_archivos();
+    return NULL;
+}
+
+/**
+ * @brief Codifica y escribe un lote completo, una llamada a write() por sala y buffer.
+ */
+static void escribir_lote(registro_entrada_t* entradas, int n) {
+    for (int i = 0; i < n; i++) {
+        registro_entrada_t* e = &entradas[i];
+        if (e->cerrar) {
+            registro_archivo_t* archivo = buscar_archivo(e->sala);
+            if (archivo != NULL) cerrar_archivo(archivo);
+            continue;
+        }
+        registro_archivo_t* archivo = obtener_archivo(e->sala);
+        if (archivo == NULL) continue;
+
+        int rotado = segmentos_anadir(&archivo->escritor, &configuracion.segmentos, e->marca, e->secuencia,
+                                      e->usuario, e->texto);
+        if (rotado == 1) {
+            CONTADOR_SUMAR(estadisticas.rotaciones, 1);
+            // Un segmento nuevo puede dejar a la sala por encima de su límite de bytes
+            int borrados = segmentos_retener(archivo->escritor.directorio, &configuracion.segmentos);
+            CONTADOR_SUMAR(estadisticas.segmentos_borrados, borrados);
+        }
+    }
+
+    for (int i = 0; i < REGISTRO_MAX_ARCHIVOS * 2; i++) {
+        if (archivos[i].abierto) vaciar_archivo(&archivos[i]);
+    }
+
+    // Ya está en los segmentos: la búsqueda puede devolverlo
+    for (int i = 0; i < n; i++) {
+        if (!entradas[i].cerrar) busqueda_indexar(entradas[i].sala, entradas[i].secuencia, entradas[i].usuario, entradas[i].texto);
+    }
+
+    if (configuracion.fsync == REGISTRO_FSYNC_LOTE) {
+        sincronizar_archivos();
+    } else if (configuracion.fsync == REGISTRO_FSYNC_SEGUNDO) {
+        struct timespec ahora;
+        clock_gettime(CLOCK_MONOTONIC, &ahora);
+        if (ahora.tv_sec > ultimo_fsync.tv_sec) {
+            sincronizar_archivos();
+            ultimo_fsync = ahora;
+        }
+    }
+}
+
+/**
+ * @brief Devuelve la sala si tiene su segmento abierto, o NULL.
+ */
+static registro_archivo_t* buscar_archivo(const char* nombre_sala) {
+    int capacidad = REGISTRO_MAX_ARCHIVOS * 2;
+    unsigned int pos = hash_nombre(nombre_sala) & (unsigned int)(capacidad - 1);
+    for (int intento = 0; intento < capacidad; intento++) {
+        registro_archivo_t* archivo = &archivos[(pos + (unsigned int)intento) & (unsigned int)(capacidad - 1)];
+        if (!archivo->abierto) break;
+        if (strcmp(archivo->sala, nombre_sala) == 0) return archivo;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Devuelve la sala abierta, retomando su segmento activo si hace falta.
+ */
+static registro_archivo_t* obtener_archivo(const char* nombre_sala) {
+    int capacidad = REGISTRO_MAX_ARCHIVOS * 2;
+    unsigned int pos = hash_nombre(nombre_sala) & (unsigned int)(capacidad - 1);
+    registro_archivo_t* abierto = buscar_archivo(nombre_sala);
+    if (abierto != NULL) return abierto;
+
+    // Demasiadas salas abiertas: se cierran todas y se empieza de nuevo (caso poco frecuente)
+    if (num_archivos >= REGISTRO_MAX_ARCHIVOS) {
+        cerrar_archivos();
+    }
+
+    for (int intento = 0; intento < capacidad; intento++) {
+        registro_archivo_t* archivo = &archivos[(pos + (unsigned int)intento) & (unsigned int)(capacidad - 1)];
+        if (archivo->abierto) continue;
+        char directorio[SEGMENTOS_MAX_RUTA];
+        segmentos_directorio_sala(directorio, sizeof(directorio), nombre_sala);
+        if (segmentos_abrir(&archivo->escritor, directorio) == -1) {
+            perror("abrir segmentos de historial");
+            return NULL;
+        }
+        strncpy(archivo->sala, nombre_sala, MAX_NOMBRE - 1);
+        archivo->sala[MAX_NOMBRE - 1] = '\0';
+        archivo->abierto = 1;
+        num_archivos++;
+        return archivo;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Escribe el buffer pendiente de una sala a su segmento activo.
+ */
+static void vaciar_archivo(registro_archivo_t* archivo) {
+    segmentos_vaciar(&archivo->escritor);
+}
+
+static void sincronizar_archivos(void) {
+    for (int i = 0; i < REGISTRO_MAX_ARCHIVOS * 2; i++) {
+        if (archivos[i].abierto) segmentos_sincronizar(&archivos[i].escritor);
+    }
+}
+
+/**
+ * @brief Cierra el segmento de una sala y libera su ranura. Las siguientes de su
+ * racha se desplazan hacia atrás para que ninguna búsqueda se corte en el hueco.
+ */
+static void cerrar_archivo(registro_archivo_t* archivo) {
+    unsigned int mascara = REGISTRO_MAX_ARCHIVOS * 2 - 1;
+    segmentos_cerrar(&archivo->escritor, configuracion.fsync != REGISTRO_FSYNC_NUNCA);
+    archivo->abierto = 0;
+    num_archivos--;
+
+    unsigned int hueco = (unsigned int)(archivo - archivos);
+    for (unsigned int j = (hueco + 1) & mascara; archivos[j].abierto; j = (j + 1) & mascara) {
+        unsigned int inicio = hash_nombre(archivos[j].sala) & mascara;
+        // Se queda si su posición inicial está entre el hueco (excluido) y j
+        if (((j - inicio) & mascara) < ((j - hueco) & mascara)) continue;
+        archivos[hueco] = archivos[j];
+        archivos[j].abierto = 0;
+        hueco = j;
+    }
+}
+
+static void cerrar_archivos(void) {
+    for (int i = 0; i < REGISTRO_MAX_ARCHIVOS * 2; i++) {
+        if (!archivos[i].abierto) continue;
+        segmentos_cerrar(&archivos[i].escritor, configuracion.fsync != REGISTRO_FSYNC_NUNCA);
+        archivos[i].abierto = 0;
+    }
+    num_archivos = 0;
+}
+
+static int retencion_activa(void) {
+    return configuracion.segmentos.max_edad_s > 0 || configuracion.segmentos.max_bytes_sala > 0;
+}
+
+/**
+ * @brief Aplica la retención a todas las salas de RUTA_PERSISTENCIA, tengan o no
+ * actividad, y programa la próxima revisión.
+ */
+static void barrer_retencion(void) {
+    clock_gettime(CLOCK_MONOTONIC, &proxima_retencion);
+    proxima_retencion.tv_sec += REGISTRO_INTERVALO_RETENCION_S;
+
+    DIR* dir = opendir(RUTA_PERSISTENCIA);
+    if (dir == NULL) return;
+    struct dirent* entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        if (entrada->d_name[0] == '.') continue;
+        // Las salas de otras particiones las retiene su propio servidor
+        if (particion_de_sala(entrada->d_name, configuracion.num_particiones) != configuracion.particion) continue;
+        // Lo que no sea un directorio de segmentos no tiene nada que listar
+        char directorio[SEGMENTOS_MAX_RUTA];
+        segmentos_directorio_sala(directorio, sizeof(directorio), entrada->d_name);
+        CONTADOR_SUMAR(estadisticas.segmentos_borrados, segmentos_retener(directorio, &configuracion.segmentos));
+    }
+    closedir(dir);
+}
@@ -0,0 +1,81 @@
+#ifndef REGISTRO_H
+#define REGISTRO_H
+
+#include "common.h"
+#include "estadisticas.h"
+#include "segmentos.h"
+
+// Política de sincronización a disco del escritor de historial
+typedef enum {
+    REGISTRO_FSYNC_NUNCA = 0,  // Solo write(); el kernel decide cuándo persistir
+    REGISTRO_FSYNC_LOTE,       // fdatasync() tras cada lote escrito
+    REGISTRO_FSYNC_SEGUNDO,    // fdatasync() como máximo una vez por segundo
+} registro_fsync_t;
+
+// Configuración del escritor de historial (group commit)
+typedef struct {
+    int lote_max;              // Registros pendientes que fuerzan un vaciado inmediato
+    int intervalo_ms;          // Tiempo máximo que un registro espera en memoria
+    registro_fsync_t fsync;    // Política de sincronización a disco
+    segmentos_config_t segmentos; // Rotación y retención de los segmentos de cada sala
+    int particion, num_particiones; // Solo se indexan y retienen las salas de esta partición
+} registro_config_t;
+
+#define REGISTRO_LOTE_DEFECTO 256
+#define REGISTRO_INTERVALO_DEFECTO_MS 50
+#define REGISTRO_INTERVALO_RETENCION_S 60 // Cada cuánto se revisa la retención de todas las salas
+
+// Contadores del hilo escritor (solo él los escribe)
+typedef struct {
+    uint64_t lotes;
+    uint64_t lineas;
+    histograma_t escritura_ns; // Duración de cada lote: codificación, write() y fdatasync
+    uint64_t rotaciones;       // Segmentos cerrados por llegar a su tamaño máximo
+    uint64_t segmentos_borrados; // Por la retención
+} registro_estadisticas_t;
+
+/**
+ * @brief Arranca el hilo escritor de historial con la configuración dada.
+ * @return 0 si el hilo se creó correctamente, -1 en caso de error.
+ */
+int registro_iniciar(const registro_config_t* config);
+
+/**
+ * @brief Encola un mensaje del historial de la sala indicada, con la secuencia
+ * que le asignó su historia (historia.h). No toca disco.
+ * @param traza Identificador del mensaje trazado (0 = sin trazar): al escribirlo
+ * se anota su etapa ETAPA_REGISTRO (traza.h).
+ */
+void registro_encolar(const char* nombre_sala, uint64_t secuencia, time_t marca, const char* nombre_usuario,
+                      const char* texto, uint64_t traza);
+
+/**
+ * @brief Encola el cierre del segmento activo de una sala que se elimina: se escribe
+ * lo anterior, se cierra y su ranura queda libre. Si la sala vuelve, se reabre.
+ */
+void registro_cerrar_sala(const char* nombre_sala);
+
+/**
+ * @brief Espera a que lo encolado hasta ahora de una sala (mensajes y cierre de su
+ * segmento) esté escrito, sin agotar el intervalo del lote. Para retomar la
+ * secuencia de la sala desde sus segmentos; si no le queda nada, vuelve al momento.
+ */
+void registro_esperar_sala(const char* nombre_sala);
+
+/**
+ * @brief Vacía todo lo pendiente, cierra los segmentos y detiene el hilo escritor.
+ */
+void registro_finalizar(void);
+
+/**
+ * @brief Convierte el nombre de una política de fsync ("nunca", "lote", "segundo").
+ * @return 0 si el nombre es válido, -1 en caso contrario.
+ */
+int registro_parsear_fsync(const char* nombre, registro_fsync_t* fsync);
+
+/**
+ * @brief Contadores del escritor, para leer con CONTADOR_LEER.
+ */
+const registro_estadisticas_t* registro_estadisticas(void);
+
+#endif // REGISTRO_H
@@ -0,0 +1,786 @@
+#include "common.h"
+#include "anillo.h"
+#include "transporte.h"
+#include "captura.h"
+#include "latencia.h"
+#include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+/*
+ * Reproduce una captura del servidor (servidor -C) contra un servidor nuevo.
+ *
+ * Cada cola o conexión de origen de la captura pasa a ser una sesión con su
+ * propia conexión, y un solo hilo envía las tramas en el orden capturado y
+ * con sus mismos intervalos, divididos por la velocidad (-v 0: sin esperas).
+ * Antes de enviar cada trama se le pone el id de la nueva conexión; el chat
+ * y los trozos de transferencias llevan los identificadores de sesión y sala
+ * que el nuevo servidor entregó al unirse, y la unión y el latido llevan el
+ * pid de este proceso para que el barrido no dé por muertas las sesiones.
+ *
+ * Mide cuánto se retrasa el envío respecto de la línea de tiempo original, la
+ * profundidad de la cola del servidor (muestreando /stats desde una conexión
+ * aparte) y la latencia de entrega del chat: cada sesión recuerda sus últimos
+ * envíos y quien recibe "[usuario]: texto" busca su instante entre los de ese
+ * usuario. Al terminar imprime una línea JSON; el progreso va a stderr.
+ */
+
+#define VELOCIDAD_DEFECTO 1.0
+#define DRENAJE_DEFECTO_MS 1000
+#define MUESTREO_DEFECTO_MS 100
+#define ESPERA_UNION_MS 1000
+#define ESPERA_ESTADISTICAS_MS 1000
+#define MAX_ARGS_SERVIDOR 32
+#define ENVIOS_RECORDADOS 64     // Chat reciente de cada sesión, para emparejar las entregas
+#define BITS_INSTANTE_ENVIO 40   // Microsegundos desde el inicio (unos 12 días)
+
+typedef struct {
+    registro_captura_t registro;
+    size_t desplazamiento;       // Trama en tramas_capturadas
+    int sesion;
+} paso_t;
+
+typedef struct {
+    int id_original;             // Cola o conexión en la captura
+    char nombre[MAX_NOMBRE];     // Usuario de su primera unión ("" si la captura no la tiene)
+    transporte_cliente_t conexion;
+    int id_cola;
+    pthread_t hilo_recepcion;
+    int cerrada;                 // Su última trama fue TIPO_CIERRE_CLIENTE
+    int union_pendiente;         // Envió una unión y aún no ha visto su respuesta
+    uint32_t uniones_al_unirse;  // Valor de uniones cuando la envió
+
+    // Los escribe el receptor y los lee el emisor (cargas y almacenados atómicos)
+    uint32_t id_sesion;
+    uint32_t id_sala;
+    uint32_t uniones;            // TIPO_SESION_SALA o errores recibidos: el emisor espera uno tras cada unión
+
+    // Los escribe el emisor y los lee cualquier receptor: (hash << 40) | microsegundos
+    uint64_t envios[ENVIOS_RECORDADOS];
+    uint32_t proximo_envio;
+
+    // Modo anillo: lo conecta el propio hilo receptor
+    anillo_t* anillo;
+    uint64_t cursor;
+
+    // Cada contador lo escribe un solo hilo; se suman al final
+    uint64_t enviados;
+    uint64_t errores_envio;
+    uint64_t recibidos;
+    uint64_t rechazados;
+    uint64_t caducados;
+    uint64_t perdidos_anillo;
+    latencias_t latencias;
+} sesion_t;
+
+typedef struct {
+    const char* ruta_captura;
+    double velocidad;            // 1 = tiempo real; 0 = tan rápido como se pueda
+    int drenaje_ms;
+    int muestreo_ms;
+    int externo;
+    tipo_transporte_t transporte;
+    const char* ruta_servidor;
+    char* args_servidor[MAX_ARGS_SERVIDOR + 4];
+} config_reproducir_t;
+
+static config_reproducir_t config;
+static paso_t* pasos;
+static size_t num_pasos;
+static char* tramas_capturadas;
+static sesion_t* sesiones;
+static int num_sesiones;
+static int* sesiones_por_nombre;   // Índices de sesiones con nombre, ordenados por nombre
+static int num_con_nombre;
+static uint64_t inicio_ns;
+static volatile int fin_envio = 0;
+static volatile int fin_recepcion = 0;
+static pthread_mutex_t mutex_union = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_union = PTHREAD_COND_INITIALIZER;
+
+// Monitor: profundidad de la cola del servidor y latencia de /stats
+static transporte_cliente_t monitor;
+static pthread_t hilo_monitor;
+static uint64_t muestras_cola = 0, suma_cola = 0, maximo_cola = 0;
+static latencias_t latencias_control;
+
+static void procesar_argumentos(int argc, char* argv[]);
+static int cargar_captura(void);
+static pid_t lanzar_servidor(void);
+static int esperar_servidor(pid_t servidor);
+static void* bucle_recepcion(void* arg);
+static void* bucle_monitor(void* arg);
+static void reproducir(latencias_t* retrasos);
+static void imprimir_resultados(double segundos, double segundos_originales, const latencias_t* retrasos);
+
+static uint64_t ahora_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Resumen de 24 bits de "usuario\0texto" (FNV-1a), para reconocer una entrega.
+ */
+static uint32_t resumen_envio(const char* usuario, const char* texto, size_t longitud) {
+    uint32_t h = 2166136261u;
+    for (const char* p = usuario; *p != '\0'; p++) h = (h ^ (uint8_t)*p) * 16777619u;
+    h = (h ^ 0) * 16777619u;
+    for (size_t i = 0; i < longitud; i++) h = (h ^ (uint8_t)texto[i]) * 16777619u;
+    return h & 0xFFFFFFu;
+}
+
+/**
+ * @brief Función principal del reproductor.
+ */
+int main(int argc, char* argv[]) {
+    procesar_argumentos(argc, argv);
+    if (cargar_captura() == -1) exit(EXIT_FAILURE);
+    if (num_pasos == 0) {
+        fprintf(stderr, "La captura no tiene ninguna solicitud.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t servidor = -1;
+    if (!config.externo) {
+        servidor = lanzar_servidor();
+        if (servidor == -1) exit(EXIT_FAILURE);
+    }
+    if (esperar_servidor(servidor) == -1) {
+        fprintf(stderr, "No se encontró el servidor (%s).\n", transporte_nombre(config.transporte));
+        if (servidor > 0) kill(servidor, SIGINT);
+        exit(EXIT_FAILURE);
+    }
+
+    // Una conexión por sesión capturada, como los clientes originales
+    for (int i = 0; i < num_sesiones; i++) {
+        sesion_t* sesion = &sesiones[i];
+        if (transporte_conectar(&sesion->conexion, config.transporte, 0) == -1 ||
+            pthread_create(&sesion->hilo_recepcion, NULL, bucle_recepcion, sesion) != 0) {
+            perror("crear sesión");
+            exit(EXIT_FAILURE);
+        }
+        sesion->id_cola = sesion->conexion.id_propio;
+    }
+    if (transporte_conectar(&monitor, config.transporte, 0) == -1 ||
+        pthread_create(&hilo_monitor, NULL, bucle_monitor, NULL) != 0) {
+        perror("crear monitor");
+        exit(EXIT_FAILURE);
+    }
+
+    double segundos_originales = (double)(pasos[num_pasos - 1].registro.instante_ns - pasos[0].registro.instante_ns) / 1e9;
+    if (config.velocidad > 0) {
+        fprintf(stderr, "Reproduciendo %zu solicitudes de %d sesiones (%.1f s a %gx)...\n", num_pasos, num_sesiones,
+                segundos_originales, config.velocidad);
+    } else {
+        fprintf(stderr, "Reproduciendo %zu solicitudes de %d sesiones sin esperas...\n", num_pasos, num_sesiones);
+    }
+
+    static latencias_t retrasos;
+    inicio_ns = ahora_ns();
+    reproducir(&retrasos);
+    double segundos = (double)(ahora_ns() - inicio_ns) / 1e9;
+
+    struct timespec drenaje = { config.drenaje_ms / 1000, (long)(config.drenaje_ms % 1000) * 1000000L };
+    nanosleep(&drenaje, NULL);
+    fin_envio = 1;
+    pthread_join(hilo_monitor, NULL);
+    fin_recepcion = 1;
+
+    // Las sesiones que la captura dejó abiertas se despiden ahora; al cortar las
+    // conexiones, cada receptor vuelve con EIDRM
+    trama_t trama;
+    for (int i = 0; i < num_sesiones; i++) {
+        if (sesiones[i].cerrada) continue;
+        size_t tamano = trama_construir(&trama, TIPO_CIERRE_CLIENTE, sesiones[i].id_cola, sesiones[i].nombre, "", "");
+        transporte_cliente_enviar(&sesiones[i].conexion, &trama, tamano, 1);
+    }
+    struct timespec margen = { 0, 100000000L };
+    nanosleep(&margen, NULL);
+    for (int i = 0; i < num_sesiones; i++) transporte_cliente_cerrar(&sesiones[i].conexion);
+    transporte_cliente_cerrar(&monitor);
+    transporte_cliente_liberar(&monitor);
+    for (int i = 0; i < num_sesiones; i++) {
+        pthread_join(sesiones[i].hilo_recepcion, NULL);
+        transporte_cliente_liberar(&sesiones[i].conexion);
+        anillo_desconectar(sesiones[i].anillo);
+    }
+
+    imprimir_resultados(segundos, segundos_originales, &retrasos);
+
+    if (servidor > 0) {
+        kill(servidor, SIGINT);
+        waitpid(servidor, NULL, 0);
+    }
+    free(pasos);
+    free(tramas_capturadas);
+    free(sesiones);
+    free(sesiones_por_nombre);
+    return 0;
+}
+
+
+/**
+ * @brief Lee las opciones; lo que sigue a "--" se pasa al servidor.
+ */
+static void procesar_argumentos(int argc, char* argv[]) {
+    static const struct option opciones[] = {
+        {"velocidad",  required_argument, NULL, 'v'},
+        {"drenaje",    required_argument, NULL, 'e'},
+        {"muestreo",   required_argument, NULL, 'm'},
+        {"externo",    no_argument,       NULL, 'x'},
+        {"servidor",   required_argument, NULL, 'S'},
+        {"transporte", required_argument, NULL, 'u'},
+        {"ayuda",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    config.velocidad = VELOCIDAD_DEFECTO;
+    config.drenaje_ms = DRENAJE_DEFECTO_MS;
+    config.muestreo_ms = MUESTREO_DEFECTO_MS;
+    config.ruta_servidor = "./servidor";
+
+    int opcion;
+    while ((opcion = getopt_long(argc, argv, "v:e:m:xS:u:h", opciones, NULL)) != -1) {
+        switch (opcion) {
+            case 'v': config.velocidad = atof(optarg);   break;
+            case 'e': config.drenaje_ms = atoi(optarg);  break;
+            case 'm': config.muestreo_ms = atoi(optarg); break;
+            case 'x': config.externo = 1;                break;
+            case 'S': config.ruta_servidor = optarg;     break;
+            case 'u':
+                if (transporte_analizar(optarg, &config.transporte) == -1) {
+                    fprintf(stderr, "Transporte desconocido: %s (use sysv o unix)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'h':
+            default:
+                fprintf(stderr,
+                        "Uso: %s [opciones] CAPTURA [-- opciones del servidor]\n"
+                        "  -v, --velocidad X     Multiplica el ritmo original; 0 = sin esperas (defecto 1)\n"
+                        "  -e, --drenaje MS      Espera final para recibir lo pendiente (defecto %d)\n"
+                        "  -m, --muestreo MS     Intervalo entre lecturas de /stats (defecto %d)\n"
+                        "  -x, --externo         Usar un servidor ya arrancado\n"
+                        "  -S, --servidor RUTA   Ejecutable del servidor (defecto ./servidor)\n"
+                        "  -u, --transporte MODO sysv | unix; se pasa también al servidor (defecto sysv)\n",
+                        argv[0], DRENAJE_DEFECTO_MS, MUESTREO_DEFECTO_MS);
+                exit(opcion == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || config.velocidad < 0 || config.drenaje_ms < 0 || config.muestreo_ms < 1) {
+        fprintf(stderr, "Falta la captura o hay parámetros fuera de rango (use -h).\n");
+        exit(EXIT_FAILURE);
+    }
+    config.ruta_captura = argv[optind++];
+
+    int n = 0;
+    config.args_servidor[n++] = (char*)config.ruta_servidor;
+    config.args_servidor[n++] = "-u";
+    config.args_servidor[n++] = (char*)transporte_nombre(config.transporte);
+    for (int i = optind; i < argc && n < MAX_ARGS_SERVIDOR; i++) config.args_servidor[n++] = argv[i];
+    config.args_servidor[n] = NULL;
+}
+
+
+static int comparar_id_original(const void* a, const void* b) {
+    int x = ((const sesion_t*)a)->id_original, y = ((const sesion_t*)b)->id_original;
+    return (x > y) - (x < y);
+}
+
+static int comparar_nombre(const void* a, const void* b) {
+    return strcmp(sesiones[*(const int*)a].nombre, sesiones[*(const int*)b].nombre);
+}
+
+/**
+ * @brief Busca una sesión por su id en la captura (sesiones está ordenado por él).
+ */
+static int buscar_sesion(int id_original) {
+    int bajo = 0, alto = num_sesiones - 1;
+    while (bajo <= alto) {
+        int medio = bajo + (alto - bajo) / 2;
+        if (sesiones[medio].id_original == id_original) return medio;
+        if (sesiones[medio].id_original < id_original) bajo = medio + 1;
+        else alto = medio - 1;
+    }
+    return -1;
+}
+
+/**
+ * @brief Busca la sesión de un usuario por su nombre (la primera, si se repite).
+ */
+static sesion_t* buscar_por_nombre(const char* nombre) {
+    int bajo = 0, alto = num_con_nombre - 1;
+    while (bajo <= alto) {
+        int medio = bajo + (alto - bajo) / 2;
+        int orden = strcmp(sesiones[sesiones_por_nombre[medio]].nombre, nombre);
+        if (orden == 0) return &sesiones[sesiones_por_nombre[medio]];
+        if (orden < 0) bajo = medio + 1;
+        else alto = medio - 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Añade una sesión si aún no estaba (antes de ordenarlas).
+ */
+static int anadir_sesion(int id_original, int* capacidad) {
+    for (int i = num_sesiones - 1; i >= 0 && i >= num_sesiones - 8; i--) {
+        if (sesiones[i].id_original == id_original) return 0; // Lo habitual: la misma de hace poco
+    }
+    if (num_sesiones == *capacidad) {
+        int nueva = *capacidad * 2;
+        sesion_t* ampliadas = realloc(sesiones, (size_t)nueva * sizeof(sesion_t));
+        if (ampliadas == NULL) return -1;
+        sesiones = ampliadas;
+        *capacidad = nueva;
+    }
+    memset(&sesiones[num_sesiones], 0, sizeof(sesion_t));
+    sesiones[num_sesiones++].id_original = id_original;
+    return 0;
+}
+
+/**
+ * @brief Lee la captura entera: las tramas van seguidas en un solo buffer y cada
+ * paso apunta a la suya y a su sesión. Las sesiones repetidas se funden al ordenar.
+ * @return 0 si todo fue bien, -1 en caso de error (ya informado).
+ */
+static int cargar_captura(void) {
+    FILE* archivo = fopen(config.ruta_captura, "rb");
+    if (archivo == NULL) {
+        perror(config.ruta_captura);
+        return -1;
+    }
+    cabecera_captura_t cabecera;
+    if (captura_leer_cabecera(archivo, &cabecera) == -1) {
+        fprintf(stderr, "%s no es una captura del servidor (versión %d).\n", config.ruta_captura, VERSION_CAPTURA);
+        fclose(archivo);
+        return -1;
+    }
+
+    size_t capacidad_pasos = 1024, capacidad_tramas = 1 << 20, usado = 0;
+    int capacidad_sesiones = 64;
+    pasos = malloc(capacidad_pasos * sizeof(paso_t));
+    tramas_capturadas = malloc(capacidad_tramas);
+    sesiones = malloc((size_t)capacidad_sesiones * sizeof(sesion_t));
+    if (pasos == NULL || tramas_capturadas == NULL || sesiones == NULL) {
+        perror("malloc captura");
+        fclose(archivo);
+        return -1;
+    }
+
+    trama_t trama;
+    registro_captura_t registro;
+    int resultado;
+    while ((resultado = captura_leer(archivo, &registro, &trama)) == 1) {
+        if (num_pasos == capacidad_pasos) {
+            paso_t* ampliados = realloc(pasos, capacidad_pasos * 2 * sizeof(paso_t));
+            if (ampliados == NULL) break;
+            pasos = ampliados;
+            capacidad_pasos *= 2;
+        }
+        if (usado + registro.longitud > capacidad_tramas) {
+            char* ampliadas = realloc(tramas_capturadas, capacidad_tramas * 2);
+            if (ampliadas == NULL) break;
+            tramas_capturadas = ampliadas;
+            capacidad_tramas *= 2;
+        }
+        if (anadir_sesion(registro.id_cola, &capacidad_sesiones) == -1) break;
+        memcpy(tramas_capturadas + usado, &trama.cabecera, registro.longitud);
+        pasos[num_pasos].registro = registro;
+        pasos[num_pasos].desplazamiento = usado;
+        num_pasos++;
+        usado += registro.longitud;
+    }
+    fclose(archivo);
+    if (resultado == 1) {
+        perror("Sin memoria para la captura");
+        return -1;
+    }
+    if (resultado == -1) fprintf(stderr, "La captura termina a medias: se reproducen las %zu primeras solicitudes.\n", num_pasos);
+
+    // Sesiones únicas y ordenadas por id original; luego cada paso apunta a la suya
+    qsort(sesiones, (size_t)num_sesiones, sizeof(sesion_t), comparar_id_original);
+    int unicas = 0;
+    for (int i = 0; i < num_sesiones; i++) {
+        if (unicas == 0 || sesiones[unicas - 1].id_original != sesiones[i].id_original) sesiones[unicas++] = sesiones[i];
+    }
+    num_sesiones = unicas;
+    for (size_t i = 0; i < num_pasos; i++) {
+        sesion_t* sesion = &sesiones[buscar_sesion(pasos[i].registro.id_cola)];
+        pasos[i].sesion = (int)(sesion - sesiones);
+        const cabecera_trama_t* c = (const cabecera_trama_t*)(tramas_capturadas + pasos[i].desplazamiento);
+        if (sesion->nombre[0] == '\0' && c->tipo == TIPO_UNION_SALA && c->longitud_usuario > 0) {
+            memcpy(sesion->nombre, (const char*)(c + 1), c->longitud_usuario);
+            sesion->nombre[c->longitud_usuario] = '\0';
+        }
+    }
+
+    sesiones_por_nombre = malloc((size_t)num_sesiones * sizeof(int));
+    if (sesiones_por_nombre == NULL) {
+        perror("malloc sesiones");
+        return -1;
+    }
+    for (int i = 0; i < num_sesiones; i++) {
+        if (sesiones[i].nombre[0] != '\0') sesiones_por_nombre[num_con_nombre++] = i;
+    }
+    qsort(sesiones_por_nombre, (size_t)num_con_nombre, sizeof(int), comparar_nombre);
+    return 0;
+}
+
+
+/**
+ * @brief Intenta conectar con el servidor y suelta la conexión enseguida.
+ * @return 0 si hay un servidor escuchando, -1 si no.
+ */
+static int probar_servidor(void) {
+    transporte_cliente_t prueba;
+    int resultado = transporte_conectar(&prueba, config.transporte, 0);
+    transporte_cliente_cerrar(&prueba);
+    transporte_cliente_liberar(&prueba);
+    return resultado;
+}
+
+/**
+ * @brief Arranca el servidor con su salida descartada (escribe una línea por unión).
+ * @return Su pid o -1.
+ */
+static pid_t lanzar_servidor(void) {
+    if (probar_servidor() == 0) {
+        fprintf(stderr, "Ya hay un servidor escuchando: deténgalo o use -x para reproducir contra él.\n");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        int nulo = open("/dev/null", O_WRONLY);
+        if (nulo != -1) dup2(nulo, STDOUT_FILENO);
+        execv(config.ruta_servidor, config.args_servidor);
+        perror("execv servidor");
+        _exit(127);
+    }
+    return pid;
+}
+
+/**
+ * @brief Espera a que el servidor acepte conexiones (hasta 5 s).
+ */
+static int esperar_servidor(pid_t servidor) {
+    for (int intento = 0; intento < 500; intento++) {
+        if (probar_servidor() == 0) return 0;
+        if (servidor > 0 && waitpid(servidor, NULL, WNOHANG) == servidor) return -1;
+        struct timespec pausa = { 0, 10000000L };
+        nanosleep(&pausa, NULL);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Espera la respuesta a la última unión de la sesión (los identificadores o un
+ * error), como haría el cliente antes de escribir en la sala, para que su chat no
+ * llegue con los antiguos. Solo se espera al enviar chat de esa sesión: las demás
+ * siguen su línea de tiempo mientras tanto.
+ */
+static void esperar_union(sesion_t* sesion) {
+    uint32_t uniones = sesion->uniones_al_unirse;
+    sesion->union_pendiente = 0;
+    struct timespec limite;
+    clock_gettime(CLOCK_REALTIME, &limite);
+    limite.tv_nsec += (long)ESPERA_UNION_MS * 1000000L;
+    limite.tv_sec += limite.tv_nsec / 1000000000L;
+    limite.tv_nsec %= 1000000000L;
+    pthread_mutex_lock(&mutex_union);
+    while (__atomic_load_n(&sesion->uniones, __ATOMIC_ACQUIRE) == uniones) {
+        if (pthread_cond_timedwait(&cond_union, &mutex_union, &limite) == ETIMEDOUT) break;
+    }
+    pthread_mutex_unlock(&mutex_union);
+}
+
+/**
+ * @brief Envía los pasos de la captura siguiendo su línea de tiempo original.
+ * @param retrasos Cuánto tarde sale cada trama respecto de su instante previsto.
+ */
+static void reproducir(latencias_t* retrasos) {
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    uint64_t origen = pasos[0].registro.instante_ns;
+    trama_t trama;
+    mensaje_t msg;
+
+    for (size_t i = 0; i < num_pasos; i++) {
+        const paso_t* paso = &pasos[i];
+        sesion_t* sesion = &sesiones[paso->sesion];
+        if (config.velocidad > 0) {
+            uint64_t previsto = inicio_ns + (uint64_t)((double)(paso->registro.instante_ns - origen) / config.velocidad);
+            struct timespec t = { (time_t)(previsto / 1000000000ULL), (long)(previsto % 1000000000ULL) };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+            uint64_t ahora = ahora_ns();
+            latencia_registrar(retrasos, ahora > previsto ? ahora - previsto : 0);
+        }
+
+        trama.mtype = paso->registro.prioridad;
+        memcpy(&trama.cabecera, tramas_capturadas + paso->desplazamiento, paso->registro.longitud);
+        if (trama_leer(&trama, paso->registro.longitud, &msg) == -1) continue;
+
+        size_t tamano;
+        if (msg.mtype == TIPO_MENSAJE) {
+            if (sesion->union_pendiente) esperar_union(sesion);
+            // Fuera de una sala en la captura, también fuera aquí (el servidor responde igual)
+            uint32_t id_sesion = msg.id_sesion != 0 ? __atomic_load_n(&sesion->id_sesion, __ATOMIC_ACQUIRE) : 0;
+            uint32_t id_sala = __atomic_load_n(&sesion->id_sala, __ATOMIC_ACQUIRE);
+            tamano = trama_construir_chat(&trama, sesion->id_cola, id_sesion, id_sala, msg.texto);
+            if (sesion->nombre[0] != '\0') {
+                uint64_t enviado_us = (ahora_ns() - inicio_ns) / 1000;
+                uint64_t envio = (uint64_t)resumen_envio(sesion->nombre, msg.texto, strlen(msg.texto)) << BITS_INSTANTE_ENVIO |
+                                 (enviado_us & ((1ULL << BITS_INSTANTE_ENVIO) - 1));
+                __atomic_store_n(&sesion->envios[sesion->proximo_envio++ % ENVIOS_RECORDADOS], envio, __ATOMIC_RELAXED);
+            }
+        } else if (msg.mtype == TIPO_FRAGMENTO) {
+            if (sesion->union_pendiente) esperar_union(sesion);
+            // La trama capturada sale tal cual, con la conexión y los identificadores de ahora
+            cabecera_fragmento_t fragmento;
+            memcpy(&fragmento, trama.datos, sizeof(fragmento));
+            fragmento.id_sesion = msg.id_sesion != 0 ? __atomic_load_n(&sesion->id_sesion, __ATOMIC_ACQUIRE) : 0;
+            fragmento.id_sala = __atomic_load_n(&sesion->id_sala, __ATOMIC_ACQUIRE);
+            memcpy(trama.datos, &fragmento, sizeof(fragmento));
+            trama.cabecera.id_cola_cliente = sesion->id_cola;
+            tamano = paso->registro.longitud;
+        } else {
+            const char* texto = msg.mtype == TIPO_UNION_SALA || msg.mtype == TIPO_LATIDO ? pid : msg.texto;
+            tamano = trama_construir(&trama, msg.mtype, sesion->id_cola, msg.nombre_usuario, msg.nombre_sala, texto);
+        }
+        uint32_t uniones = __atomic_load_n(&sesion->uniones, __ATOMIC_ACQUIRE);
+        if (transporte_cliente_enviar(&sesion->conexion, &trama, tamano, 1) == -1) {
+            sesion->errores_envio++;
+            continue;
+        }
+        sesion->enviados++;
+        sesion->cerrada = msg.mtype == TIPO_CIERRE_CLIENTE;
+        if (msg.mtype == TIPO_UNION_SALA && !sesion->union_pendiente) {
+            sesion->union_pendiente = 1;
+            sesion->uniones_al_unirse = uniones;
+        }
+    }
+}
+
+
+/**
+ * @brief Mide una notificación "[usuario]: texto" buscando su envío entre los recientes del autor.
+ */
+static void medir_notificacion(sesion_t* sesion, const char* texto, size_t longitud) {
+    uint64_t ahora_us = (ahora_ns() - inicio_ns) / 1000;
+    sesion->recibidos++;
+    if (longitud < 4 || texto[0] != '[') return;
+    const char* fin_nombre = memchr(texto, ']', longitud < MAX_NOMBRE + 1 ? longitud : MAX_NOMBRE + 1);
+    if (fin_nombre == NULL || (size_t)(fin_nombre - texto) + 3 > longitud || fin_nombre[1] != ':' || fin_nombre[2] != ' ') return;
+
+    char nombre[MAX_NOMBRE];
+    size_t longitud_nombre = (size_t)(fin_nombre - texto - 1);
+    memcpy(nombre, texto + 1, longitud_nombre);
+    nombre[longitud_nombre] = '\0';
+    sesion_t* autor = buscar_por_nombre(nombre);
+    if (autor == NULL) return;
+
+    const char* cuerpo = fin_nombre + 3;
+    uint64_t resumen = resumen_envio(nombre, cuerpo, longitud - (size_t)(cuerpo - texto));
+    uint64_t mascara = (1ULL << BITS_INSTANTE_ENVIO) - 1, mejor = UINT64_MAX;
+    for (int i = 0; i < ENVIOS_RECORDADOS; i++) {
+        uint64_t envio = __atomic_load_n(&autor->envios[i], __ATOMIC_RELAXED);
+        if (envio == 0 || envio >> BITS_INSTANTE_ENVIO != resumen) continue;
+        uint64_t enviado_us = envio & mascara;
+        if (enviado_us <= ahora_us && ahora_us - enviado_us < mejor) mejor = ahora_us - enviado_us;
+    }
+    if (mejor != UINT64_MAX) latencia_registrar(&sesion->latencias, mejor * 1000);
+}
+
+static void procesar_trama(sesion_t* sesion, const trama_t* trama, size_t recibido) {
+    switch (trama->mtype) {
+        case TIPO_NOTIFICACION:
+            medir_notificacion(sesion, trama_texto(trama), trama->cabecera.longitud_texto);
+            break;
+        case TIPO_NOTIFICACION_LOTE: {
+            const char* datos = trama_texto(trama);
+            const char* fin = datos + trama->cabecera.longitud_texto;
+            while (datos + sizeof(longitud_registro_lote_t) <= fin) {
+                longitud_registro_lote_t longitud;
+                memcpy(&longitud, datos, sizeof(longitud));
+                datos += sizeof(longitud);
+                if (datos + longitud > fin) break;
+                medir_notificacion(sesion, datos, longitud);
+                datos += longitud;
+            }
+            break;
+        }
+        case TIPO_ANILLO_SALA: {
+            mensaje_t msg;
+            if (trama_leer(trama, recibido, &msg) == -1) break;
+            anillo_desconectar(sesion->anillo);
+            sesion->anillo = msg.id_cola_cliente != -1 ? anillo_conectar(msg.id_cola_cliente) : NULL;
+            sesion->cursor = strtoull(msg.texto, NULL, 10);
+            break;
+        }
+        case TIPO_SESION_SALA: {
+            mensaje_t msg;
+            unsigned int id_sesion, id_sala;
+            if (trama_leer(trama, recibido, &msg) == -1 || sscanf(msg.texto, "%u %u", &id_sesion, &id_sala) != 2) break;
+            __atomic_store_n(&sesion->id_sesion, id_sesion, __ATOMIC_RELEASE);
+            __atomic_store_n(&sesion->id_sala, id_sala, __ATOMIC_RELEASE);
+            pthread_mutex_lock(&mutex_union);
+            __atomic_add_fetch(&sesion->uniones, 1, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&cond_union);
+            pthread_mutex_unlock(&mutex_union);
+            break;
+        }
+        case TIPO_RESPUESTA_ERROR:
+            sesion->rechazados++;
+            pthread_mutex_lock(&mutex_union);
+            __atomic_add_fetch(&sesion->uniones, 1, __ATOMIC_RELEASE);
+            pthread_cond_broadcast(&cond_union);
+            pthread_mutex_unlock(&mutex_union);
+            break;
+        case TIPO_RESPUESTA_CADUCADA:
+            sesion->caducados++;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief Lee lo publicado en el anillo de la sala de la sesión.
+ * @return Cuántos mensajes se consumieron.
+ */
+static int leer_anillo(sesion_t* sesion) {
+    char texto[ANILLO_MAX_TEXTO];
+    size_t longitud;
+    int id_cola_excluida, leidos = 0;
+    uint64_t perdidos;
+    resultado_anillo_t resultado;
+    while ((resultado = anillo_leer(sesion->anillo, &sesion->cursor, texto, &longitud, &id_cola_excluida, &perdidos)) != ANILLO_VACIO) {
+        leidos++;
+        if (resultado == ANILLO_DESBORDADO) {
+            sesion->perdidos_anillo += perdidos;
+        } else if (id_cola_excluida != sesion->id_cola) {
+            medir_notificacion(sesion, texto, longitud);
+        }
+    }
+    return leidos;
+}
+
+/**
+ * @brief Recibe por la conexión de la sesión y, en modo anillo, también del anillo de la sala.
+ */
+static void* bucle_recepcion(void* arg) {
+    sesion_t* sesion = arg;
+    trama_t trama;
+    while (!fin_recepcion) {
+        int bloquear = 1;
+        if (sesion->anillo != NULL) {
+            if (leer_anillo(sesion) > 0) continue;
+            bloquear = 0;
+        }
+        ssize_t recibido = transporte_cliente_recibir(&sesion->conexion, &trama, bloquear);
+        if (recibido == -1) {
+            if (errno == ENOMSG) {
+                anillo_esperar(sesion->anillo, sesion->cursor, 1);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            break; // EIDRM: la conexión se cortó al terminar
+        }
+        if ((size_t)recibido >= sizeof(cabecera_trama_t)) procesar_trama(sesion, &trama, (size_t)recibido);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Pide /stats cada config.muestreo_ms hasta el final del drenaje y anota la
+ * ocupación de la cola del servidor y cuánto tarda la respuesta.
+ */
+static void* bucle_monitor(void* arg) {
+    (void)arg;
+    trama_t trama;
+    while (!fin_envio) {
+        size_t tamano = trama_construir(&trama, TIPO_ESTADISTICAS, monitor.id_propio, "", "", "");
+        uint64_t enviado = ahora_ns();
+        if (transporte_cliente_enviar(&monitor, &trama, tamano, 1) == 0) {
+            // Se espera la respuesta sin bloquear del todo, por si nunca llega
+            while (ahora_ns() - enviado < (uint64_t)ESPERA_ESTADISTICAS_MS * 1000000ULL) {
+                ssize_t recibido = transporte_cliente_recibir(&monitor, &trama, 0);
+                if (recibido == -1) {
+                    struct timespec pausa = { 0, 100000L };
+                    nanosleep(&pausa, NULL);
+                    continue;
+                }
+                if (trama.mtype != TIPO_RESPUESTA_EXITO) continue;
+                latencia_registrar(&latencias_control, ahora_ns() - enviado);
+                // El informe no cabe en un mensaje_t: se lee directamente de la trama
+                static const char clave[] = "\ncola_servidor_mensajes ";
+                const char* informe = trama_texto(&trama);
+                size_t longitud = trama.cabecera.longitud_texto;
+                const char* linea = memmem(informe, longitud, clave, sizeof(clave) - 1);
+                if (linea != NULL) {
+                    uint64_t profundidad = 0;
+                    const char* p = linea + sizeof(clave) - 1;
+                    while (p < informe + longitud && *p >= '0' && *p <= '9') profundidad = profundidad * 10 + (uint64_t)(*p++ - '0');
+                    muestras_cola++;
+                    suma_cola += profundidad;
+                    if (profundidad > maximo_cola) maximo_cola = profundidad;
+                }
+                break;
+            }
+        }
+        struct timespec pausa = { config.muestreo_ms / 1000, (long)(config.muestreo_ms % 1000) * 1000000L };
+        nanosleep(&pausa, NULL);
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Suma los contadores de todas las sesiones e imprime el resultado en JSON.
+ */
+static void imprimir_resultados(double segundos, double segundos_originales, const latencias_t* retrasos) {
+    static latencias_t total;
+    uint64_t enviados = 0, errores = 0, recibidos = 0, rechazados = 0, caducados = 0, perdidos_anillo = 0;
+    for (int i = 0; i < num_sesiones; i++) {
+        const sesion_t* sesion = &sesiones[i];
+        enviados += sesion->enviados;
+        errores += sesion->errores_envio;
+        recibidos += sesion->recibidos;
+        rechazados += sesion->rechazados;
+        caducados += sesion->caducados;
+        perdidos_anillo += sesion->perdidos_anillo;
+        latencia_acumular(&total, &sesion->latencias);
+    }
+    double cola_media = muestras_cola > 0 ? (double)suma_cola / (double)muestras_cola : 0.0;
+
+    fprintf(stderr, "%llu solicitudes en %.2f s (original %.2f s); retraso p99 %.1f ms; cola del servidor máx. %llu; "
+            "entrega p50 %.1f us, p99 %.1f us\n",
+            (unsigned long long)enviados, segundos, segundos_originales, latencia_percentil_us(retrasos, 0.99) / 1000.0,
+            (unsigned long long)maximo_cola, latencia_percentil_us(&total, 0.50), latencia_percentil_us(&total, 0.99));
+    printf("{\"solicitudes\":%zu,\"sesiones\":%d,\"velocidad\":%g,\"segundos_originales\":%.3f,\"segundos\":%.3f,"
+           "\"enviados\":%llu,\"errores_envio\":%llu,\"rechazados\":%llu,\"caducados\":%llu,"
+           "\"entregas\":%llu,\"perdidos_anillo\":%llu,\"solicitudes_por_s\":%.1f,"
+           "\"retraso_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+           "\"cola_servidor\":{\"muestras\":%llu,\"media\":%.1f,\"max\":%llu},"
+           "\"control_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+           "\"latencia_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+           num_pasos, num_sesiones, config.velocidad, segundos_originales, segundos,
+           (unsigned long long)enviados, (unsigned long long)errores, (unsigned long long)rechazados,
+           (unsigned long long)caducados, (unsigned long long)recibidos, (unsigned long long)perdidos_anillo,
+           (double)enviados / segundos,
+           latencia_percentil_us(retrasos, 0.50), latencia_percentil_us(retrasos, 0.99), (double)retrasos->maximo / 1000.0,
+           (unsigned long long)muestras_cola, cola_media, (unsigned long long)maximo_cola,
+           latencia_percentil_us(&latencias_control, 0.50), latencia_percentil_us(&latencias_control, 0.99),
+           (double)latencias_control.maximo / 1000.0,
+           latencia_percentil_us(&total, 0.50), latencia_percentil_us(&total, 0.99), latencia_percentil_us(&total, 0.999),
+           (double)total.maximo / 1000.0);
+}
@@ -0,0 +1,452 @@
+#include "segmentos.h"
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ALINEAR8(n) (((n) + 7) & ~(size_t)7)
+
+// Un archivo proyectado en memoria, solo lectura
+typedef struct {
+    const char* datos;
+    size_t tamano;
+} proyeccion_t;
+
+// Dónde termina lo válido de un segmento y qué le sigue
+typedef struct {
+    size_t fin;                 // Desplazamiento tras el último registro completo
+    uint64_t siguiente;         // Secuencia que seguiría al último registro
+    size_t entradas_indice;     // Entradas del índice que apuntan dentro de lo válido
+    off_t ultimo_indexado;
+} estado_segmento_t;
+
+void segmentos_directorio_sala(char* ruta, size_t tamano, const char* nombre_sala) {
+    snprintf(ruta, tamano, "%s%s", RUTA_PERSISTENCIA, nombre_sala);
+}
+
+static void ruta_archivo(char* ruta, size_t tamano, const char* directorio, uint64_t primera, const char* extension) {
+    snprintf(ruta, tamano, "%s/%020llu.%s", directorio, (unsigned long long)primera, extension);
+}
+
+static int comparar_secuencias(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Primeras secuencias de los segmentos del directorio, de menor a mayor.
+ * @return Cuántos hay (0 si el directorio no existe), -1 sin memoria.
+ */
+static int listar_segmentos(const char* directorio, uint64_t** primeras) {
+    *primeras = NULL;
+    DIR* dir = opendir(directorio);
+    if (dir == NULL) return 0;
+
+    int num = 0, capacidad = 0;
+    struct dirent* entrada;
+    while ((entrada = readdir(dir)) != NULL) {
+        char* fin;
+        unsigned long long primera = strtoull(entrada->d_name, &fin, 10);
+        if (fin == entrada->d_name || strcmp(fin, ".seg") != 0) continue;
+        if (num == capacidad) {
+            int nueva = capacidad ? capacidad * 2 : 16;
+            uint64_t* ampliado = realloc(*primeras, (size_t)nueva * sizeof(uint64_t));
+            if (ampliado == NULL) {
+                free(*primeras);
+                *primeras = NULL;
+                closedir(dir);
+                return -1;
+            }
+            *primeras = ampliado;
+            capacidad = nueva;
+        }
+        (*primeras)[num++] = primera;
+    }
+    closedir(dir);
+    qsort(*primeras, (size_t)num, sizeof(uint64_t), comparar_secuencias);
+    return num;
+}
+
+/**
+ * @brief Proyecta un archivo entero. Un archivo vacío da una proyección vacía.
+ */
+static int proyectar(const char* ruta, proyeccion_t* proyeccion) {
+    proyeccion->datos = NULL;
+    proyeccion->tamano = 0;
+    int fd = open(ruta, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    struct stat estado;
+    if (fstat(fd, &estado) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (estado.st_size > 0) {
+        void* datos = mmap(NULL, (size_t)estado.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (datos == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        proyeccion->datos = datos;
+        proyeccion->tamano = (size_t)estado.st_size;
+    }
+    close(fd); // La proyección sigue válida sin el descriptor
+    return 0;
+}
+
+static void liberar_proyeccion(proyeccion_t* proyeccion) {
+    if (proyeccion->datos != NULL) munmap((void*)proyeccion->datos, proyeccion->tamano);
+    proyeccion->datos = NULL;
+}
+
+static int cabecera_valida(const proyeccion_t* segmento, uint64_t primera) {
+    if (segmento->tamano < sizeof(cabecera_segmento_t)) return 0;
+    const cabecera_segmento_t* cabecera = (const cabecera_segmento_t*)segmento->datos;
+    return cabecera->magico == SEGMENTOS_MAGICO && cabecera->version == SEGMENTOS_VERSION &&
+           cabecera->primera_secuencia == primera;
+}
+
+/**
+ * @brief Registro completo y coherente en *desplazamiento (y avanza tras él), o NULL.
+ * Las secuencias de un segmento son crecientes: *minima es la menor aceptable.
+ */
+static const registro_segmento_t* siguiente_registro(const proyeccion_t* segmento, size_t* desplazamiento,
+                                                     uint64_t* minima) {
+    if (*desplazamiento + sizeof(registro_segmento_t) > segmento->tamano) return NULL;
+    const registro_segmento_t* registro = (const registro_segmento_t*)(segmento->datos + *desplazamiento);
+    size_t tamano = ALINEAR8(sizeof(registro_segmento_t) + registro->longitud_usuario + registro->longitud_texto);
+    if (registro->longitud_usuario >= MAX_NOMBRE || registro->longitud_texto >= MAX_TEXTO ||
+        registro->secuencia < *minima || *desplazamiento + tamano > segmento->tamano) {
+        return NULL;
+    }
+    *desplazamiento += tamano;
+    *minima = registro->secuencia + 1;
+    return registro;
+}
+
+/**
+ * @brief Desplazamiento desde el que buscar `secuencia`: la última entrada del
+ * índice que no la supera y que apunta dentro de los `limite` bytes válidos.
+ */
+static size_t buscar_en_indice(const char* directorio, uint64_t primera, uint64_t secuencia, size_t limite) {
+    char ruta[SEGMENTOS_MAX_RUTA];
+    ruta_archivo(ruta, sizeof(ruta), directorio, primera, "idx");
+    proyeccion_t indice;
+    size_t resultado = sizeof(cabecera_segmento_t);
+    if (proyectar(ruta, &indice) == -1) return resultado;
+
+    const entrada_indice_t* entradas = (const entrada_indice_t*)indice.datos;
+    size_t bajo = 0, alto = indice.tamano / sizeof(entrada_indice_t);
+    while (bajo < alto) {
+        size_t medio = bajo + (alto - bajo) / 2;
+        if (entradas[medio].secuencia <= secuencia && entradas[medio].desplazamiento < limite) {
+            resultado = (size_t)entradas[medio].desplazamiento;
+            bajo = medio + 1;
+        } else {
+            alto = medio;
+        }
+    }
+    liberar_proyeccion(&indice);
+    return resultado;
+}
+
+/**
+ * @brief Averigua hasta dónde es válido un segmento, empezando por su última entrada de índice.
+ */
+static int escanear_segmento(const char* directorio, uint64_t primera, estado_segmento_t* estado) {
+    char ruta[SEGMENTOS_MAX_RUTA];
+    ruta_archivo(ruta, sizeof(ruta), directorio, primera, "seg");
+    proyeccion_t segmento;
+    if (proyectar(ruta, &segmento) == -1) return -1;
+    if (!cabecera_valida(&segmento, primera)) {
+        liberar_proyeccion(&segmento);
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Entradas del índice que apuntan dentro del segmento (las demás se escribieron antes que sus datos)
+    estado->entradas_indice = 0;
+    estado->ultimo_indexado = 0;
+    ruta_archivo(ruta, sizeof(ruta), directorio, primera, "idx");
+    proyeccion_t indice;
+    if (proyectar(ruta, &indice) == 0) {
+        const entrada_indice_t* entradas = (const entrada_indice_t*)indice.datos;
+        size_t n = indice.tamano / sizeof(entrada_indice_t);
+        while (n > 0 && entradas[n - 1].desplazamiento >= segmento.tamano) n--;
+        estado->entradas_indice = n;
+        if (n > 0) estado->ultimo_indexado = (off_t)entradas[n - 1].desplazamiento;
+        liberar_proyeccion(&indice);
+    }
+
+    size_t desplazamiento = estado->ultimo_indexado > 0 ? (size_t)estado->ultimo_indexado : sizeof(cabecera_segmento_t);
+    uint64_t siguiente = primera;
+    while (siguiente_registro(&segmento, &desplazamiento, &siguiente) != NULL) {}
+    estado->fin = desplazamiento;
+    estado->siguiente = siguiente;
+    liberar_proyeccion(&segmento);
+    return 0;
+}
+
+static int escribir_todo(int fd, const void* datos, size_t tamano) {
+    size_t enviado = 0;
+    while (enviado < tamano) {
+        ssize_t n = write(fd, (const char*)datos + enviado, tamano - enviado);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        enviado += (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reabre el segmento más reciente para seguir escribiendo en él.
+ */
+static int retomar_segmento(segmento_escritor_t* escritor, uint64_t primera) {
+    estado_segmento_t estado;
+    if (escanear_segmento(escritor->directorio, primera, &estado) == -1) {
+        fprintf(stderr, " Segmento %llu de %s ilegible; se empezará uno nuevo.\n",
+                (unsigned long long)primera, escritor->directorio);
+        return 0;
+    }
+
+    char ruta[SEGMENTOS_MAX_RUTA];
+    ruta_archivo(ruta, sizeof(ruta), escritor->directorio, primera, "seg");
+    escritor->fd = open(ruta, O_WRONLY | O_APPEND | O_CLOEXEC);
+    ruta_archivo(ruta, sizeof(ruta), escritor->directorio, primera, "idx");
+    escritor->fd_indice = open(ruta, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (escritor->fd == -1 || escritor->fd_indice == -1) {
+        perror("open segmento");
+        segmentos_cerrar(escritor, 0);
+        return -1;
+    }
+
+    // Lo que siga a lo válido es una escritura cortada: fuera
+    struct stat datos;
+    if (fstat(escritor->fd, &datos) == 0 && (size_t)datos.st_size > estado.fin) {
+        fprintf(stderr, " Recortados %lld bytes incompletos de %s/%020llu.seg\n",
+                (long long)((size_t)datos.st_size - estado.fin), escritor->directorio, (unsigned long long)primera);
+        if (ftruncate(escritor->fd, (off_t)estado.fin) == -1) perror("ftruncate segmento");
+    }
+    if (ftruncate(escritor->fd_indice, (off_t)(estado.entradas_indice * sizeof(entrada_indice_t))) == -1) {
+        perror("ftruncate índice");
+    }
+    escritor->primera_secuencia = primera;
+    escritor->tamano = (off_t)estado.fin;
+    escritor->ultimo_indexado = estado.ultimo_indexado;
+    return 0;
+}
+
+int segmentos_abrir(segmento_escritor_t* escritor, const char* directorio) {
+    snprintf(escritor->directorio, sizeof(escritor->directorio), "%s", directorio);
+    escritor->fd = -1;
+    escritor->fd_indice = -1;
+    escritor->tamano = 0;
+    escritor->ultimo_indexado = 0;
+    escritor->sucio = 0;
+    escritor->usado = 0;
+    if (mkdir(directorio, 0777) == -1 && errno != EEXIST) return -1;
+
+    uint64_t* primeras;
+    int num = listar_segmentos(directorio, &primeras);
+    if (num <= 0) return num; // Sin segmentos: el primero se crea con el primer registro
+    uint64_t ultima = primeras[num - 1];
+    free(primeras);
+    return retomar_segmento(escritor, ultima);
+}
+
+/**
+ * @brief Crea un segmento vacío que empieza en `primera` y escribe su cabecera.
+ */
+static int crear_segmento(segmento_escritor_t* escritor, uint64_t primera) {
+    char ruta[SEGMENTOS_MAX_RUTA];
+    ruta_archivo(ruta, sizeof(ruta), escritor->directorio, primera, "seg");
+    escritor->fd = open(ruta, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0666);
+    ruta_archivo(ruta, sizeof(ruta), escritor->directorio, primera, "idx");
+    escritor->fd_indice = open(ruta, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+    if (escritor->fd == -1 || escritor->fd_indice == -1) {
+        perror("crear segmento");
+        segmentos_cerrar(escritor, 0);
+        return -1;
+    }
+
+    cabecera_segmento_t cabecera;
+    memset(&cabecera, 0, sizeof(cabecera));
+    cabecera.magico = SEGMENTOS_MAGICO;
+    cabecera.version = SEGMENTOS_VERSION;
+    cabecera.primera_secuencia = primera;
+    memcpy(escritor->buffer, &cabecera, sizeof(cabecera));
+    escritor->usado = sizeof(cabecera);
+    escritor->primera_secuencia = primera;
+    escritor->tamano = (off_t)sizeof(cabecera);
+    escritor->ultimo_indexado = 0;
+    return 0;
+}
+
+int segmentos_anadir(segmento_escritor_t* escritor, const segmentos_config_t* config, time_t marca,
+                     uint64_t secuencia, const char* usuario, const char* texto) {
+    size_t longitud_usuario = strnlen(usuario, MAX_NOMBRE - 1);
+    size_t longitud_texto = strnlen(texto, MAX_TEXTO - 1);
+    size_t tamano = ALINEAR8(sizeof(registro_segmento_t) + longitud_usuario + longitud_texto);
+
+    // Rotación: un segmento con al menos un registro no pasa de max_segmento
+    int rotado = 0;
+    if (escritor->fd != -1 && config->max_segmento > 0 && escritor->tamano > (off_t)sizeof(cabecera_segmento_t) &&
+        (size_t)escritor->tamano + tamano > config->max_segmento) {
+        segmentos_cerrar(escritor, 0);
+        rotado = 1;
+    }
+    if (escritor->fd == -1 && crear_segmento(escritor, secuencia) == -1) return -1;
+
+    if (escritor->usado + tamano > SEGMENTOS_TAMANO_BUFFER) segmentos_vaciar(escritor);
+    if (escritor->ultimo_indexado == 0 || escritor->tamano - escritor->ultimo_indexado >= SEGMENTOS_PASO_INDICE) {
+        entrada_indice_t entrada = { secuencia, (uint64_t)escritor->tamano };
+        if (escribir_todo(escritor->fd_indice, &entrada, sizeof(entrada)) == -1) perror("write índice");
+        escritor->ultimo_indexado = escritor->tamano;
+    }
+
+    registro_segmento_t registro;
+    memset(&registro, 0, sizeof(registro));
+    registro.marca = (int64_t)marca;
+    registro.secuencia = secuencia;
+    registro.longitud_usuario = (uint8_t)longitud_usuario;
+    registro.longitud_texto = (uint16_t)longitud_texto;
+    char* p = escritor->buffer + escritor->usado;
+    memcpy(p, &registro, sizeof(registro));
+    memcpy(p + sizeof(registro), usuario, longitud_usuario);
+    memcpy(p + sizeof(registro) + longitud_usuario, texto, longitud_texto);
+    size_t relleno = tamano - sizeof(registro) - longitud_usuario - longitud_texto;
+    memset(p + tamano - relleno, 0, relleno);
+    escritor->usado += tamano;
+    escritor->tamano += (off_t)tamano;
+    return rotado;
+}
+
+void segmentos_vaciar(segmento_escritor_t* escritor) {
+    if (escritor->fd == -1 || escritor->usado == 0) return;
+    if (escribir_todo(escritor->fd, escritor->buffer, escritor->usado) == -1) perror("write segmento");
+    escritor->usado = 0;
+    escritor->sucio = 1;
+}
+
+void segmentos_sincronizar(segmento_escritor_t* escritor) {
+    if (escritor->fd == -1 || !escritor->sucio) return;
+    fdatasync(escritor->fd);
+    fdatasync(escritor->fd_indice);
+    escritor->sucio = 0;
+}
+
+void segmentos_cerrar(segmento_escritor_t* escritor, int sincronizar) {
+    segmentos_vaciar(escritor);
+    if (sincronizar) segmentos_sincronizar(escritor);
+    if (escritor->fd != -1) close(escritor->fd);
+    if (escritor->fd_indice != -1) close(escritor->fd_indice);
+    escritor->fd = -1;
+    escritor->fd_indice = -1;
+    escritor->sucio = 0;
+}
+
+int segmentos_retener(const char* directorio, const segmentos_config_t* config) {
+    if (config->max_edad_s <= 0 && config->max_bytes_sala == 0) return 0;
+    uint64_t* primeras;
+    int num = listar_segmentos(directorio, &primeras);
+    if (num <= 1) {
+        free(primeras);
+        return 0;
+    }
+
+    // Tamaño y antigüedad (última escritura) de cada segmento con su índice
+    struct stat* estados = calloc((size_t)num, sizeof(struct stat));
+    if (estados == NULL) {
+        free(primeras);
+        return 0;
+    }
+    uint64_t total = 0;
+    char ruta[SEGMENTOS_MAX_RUTA];
+    for (int i = 0; i < num; i++) {
+        struct stat indice;
+        ruta_archivo(ruta, sizeof(ruta), directorio, primeras[i], "seg");
+        stat(ruta, &estados[i]);
+        ruta_archivo(ruta, sizeof(ruta), directorio, primeras[i], "idx");
+        if (stat(ruta, &indice) == 0) estados[i].st_size += indice.st_size;
+        total += (uint64_t)estados[i].st_size;
+    }
+
+    // Del más antiguo al más nuevo, sin tocar el activo; el primero que se queda corta el recorrido
+    time_t limite = time(NULL) - config->max_edad_s;
+    int borrados = 0;
+    for (int i = 0; i < num - 1; i++) {
+        int caducado = config->max_edad_s > 0 && estados[i].st_mtime < limite;
+        int sobra = config->max_bytes_sala > 0 && total > config->max_bytes_sala;
+        if (!caducado && !sobra) break;
+        ruta_archivo(ruta, sizeof(ruta), directorio, primeras[i], "seg");
+        unlink(ruta);
+        ruta_archivo(ruta, sizeof(ruta), directorio, primeras[i], "idx");
+        unlink(ruta);
+        total -= (uint64_t)estados[i].st_size;
+        borrados++;
+    }
+    free(estados);
+    free(primeras);
+    return borrados;
+}
+
+uint64_t segmentos_siguiente(const char* directorio) {
+    uint64_t* primeras;
+    int num = listar_segmentos(directorio, &primeras);
+    uint64_t siguiente = 0;
+    // Si el último está ilegible se prueba el anterior
+    for (int i = num - 1; i >= 0; i--) {
+        estado_segmento_t estado;
+        if (escanear_segmento(directorio, primeras[i], &estado) == 0) {
+            siguiente = estado.siguiente;
+            break;
+        }
+    }
+    free(primeras);
+    return siguiente;
+}
+
+/**
+ * @brief Visita los registros de un segmento con secuencia en [desde, hasta).
+ */
+static int recorrer_segmento(const char* directorio, uint64_t primera, uint64_t desde, uint64_t hasta,
+                             segmentos_visita_fn visita, void* contexto) {
+    char ruta[SEGMENTOS_MAX_RUTA];
+    ruta_archivo(ruta, sizeof(ruta), directorio, primera, "seg");
+    proyeccion_t segmento;
+    if (proyectar(ruta, &segmento) == -1) return 0; // Borrado por la retención entretanto
+    if (!cabecera_valida(&segmento, primera)) {
+        liberar_proyeccion(&segmento);
+        return 0;
+    }
+
+    int visitados = 0;
+    size_t desplazamiento = buscar_en_indice(directorio, primera, desde, segmento.tamano);
+    uint64_t minima = primera;
+    const registro_segmento_t* registro;
+    while ((registro = siguiente_registro(&segmento, &desplazamiento, &minima)) != NULL) {
+        if (registro->secuencia >= hasta) break;
+        if (registro->secuencia < desde) continue;
+        const char* usuario = (const char*)(registro + 1);
+        visita(registro, usuario, usuario + registro->longitud_usuario, contexto);
+        visitados++;
+    }
+    liberar_proyeccion(&segmento);
+    return visitados;
+}
+
+int segmentos_recorrer(const char* directorio, uint64_t desde, uint64_t hasta,
+                       segmentos_visita_fn visita, void* contexto) {
+    if (desde >= hasta) return 0;
+    uint64_t* primeras;
+    int num = listar_segmentos(directorio, &primeras);
+    int visitados = 0;
+    for (int i = 0; i < num; i++) {
+        if (i + 1 < num && primeras[i + 1] <= desde) continue; // Todo el segmento es anterior
+        if (primeras[i] >= hasta) break;
+        visitados += recorrer_segmento(directorio, primeras[i], desde, hasta, visita, contexto);
+    }
+    free(primeras);
+    return visitados;
+}
@@ -0,0 +1,119 @@
+#ifndef SEGMENTOS_H
+#define SEGMENTOS_H
+
+#include "common.h"
+
+/*
+ * Almacén binario del historial de una sala: historial/<sala>/ contiene
+ * segmentos de tamaño acotado, cada uno con su índice.
+ *
+ *   <primera secuencia, 20 dígitos>.seg  cabecera_segmento_t y después
+ *       registros [registro_segmento_t][usuario][texto], cada uno alineado a
+ *       8 bytes, en orden de secuencia.
+ *   <primera secuencia, 20 dígitos>.idx  pares (secuencia, desplazamiento)
+ *       de un registro cada SEGMENTOS_PASO_INDICE bytes, siempre el primero.
+ *
+ * Solo el hilo escritor de historial (registro.c) añade registros. Los lectores
+ * proyectan los archivos con mmap y recorren los registros sin copiarlos; lo
+ * que esté a medio escribir al final del segmento activo se ignora. Al reabrir
+ * un segmento, el escritor recorta la cola incompleta que dejara una caída.
+ */
+
+#define SEGMENTOS_MAGICO 0x47455348u      // "HSEG" en little-endian
+#define SEGMENTOS_VERSION 1
+#define SEGMENTOS_PASO_INDICE 4096        // Bytes de segmento entre entradas del índice
+#define SEGMENTOS_TAMANO_BUFFER 16384     // Buffer de salida del escritor
+#define SEGMENTOS_MAX_RUTA 160
+#define SEGMENTOS_TAMANO_DEFECTO (1024 * 1024)
+
+typedef struct {
+    uint32_t magico;
+    uint16_t version;
+    uint16_t reservado;
+    uint64_t primera_secuencia;
+} cabecera_segmento_t;
+
+typedef struct {
+    int64_t marca;              // time_t del mensaje
+    uint64_t secuencia;
+    uint16_t longitud_texto;
+    uint8_t longitud_usuario;
+    uint8_t reservado[5];
+} registro_segmento_t;
+
+typedef struct {
+    uint64_t secuencia;
+    uint64_t desplazamiento;
+} entrada_indice_t;
+
+// Rotación y retención (0 = sin límite)
+typedef struct {
+    size_t max_segmento;        // Bytes a partir de los cuales se abre un segmento nuevo
+    long max_edad_s;            // Se borran los segmentos cerrados más antiguos que esto
+    uint64_t max_bytes_sala;    // Se borran los más antiguos mientras la sala ocupe más
+} segmentos_config_t;
+
+// Segmento activo de una sala, visto por su único escritor
+typedef struct {
+    char directorio[SEGMENTOS_MAX_RUTA];
+    int fd;                     // -1 hasta el primer registro
+    int fd_indice;
+    uint64_t primera_secuencia;
+    off_t tamano;               // Incluye lo que aún está en el buffer
+    off_t ultimo_indexado;
+    int sucio;                  // Hay datos escritos sin fdatasync
+    size_t usado;
+    char buffer[SEGMENTOS_TAMANO_BUFFER];
+} segmento_escritor_t;
+
+// Recibe cada registro; usuario y texto apuntan a la proyección y no terminan en '\0'
+typedef void (*segmentos_visita_fn)(const registro_segmento_t* registro, const char* usuario,
+                                    const char* texto, void* contexto);
+
+/**
+ * @brief Crea el directorio si hace falta y retoma su segmento más reciente,
+ * recortando un registro final incompleto.
+ * @return 0 si todo fue bien, -1 en caso de error.
+ */
+int segmentos_abrir(segmento_escritor_t* escritor, const char* directorio);
+
+/**
+ * @brief Añade un registro (al buffer). Si el segmento activo supera
+ * max_segmento, lo cierra y empieza otro.
+ * @return 1 si hubo rotación, 0 si no, -1 en caso de error.
+ */
+int segmentos_anadir(segmento_escritor_t* escritor, const segmentos_config_t* config, time_t marca,
+                     uint64_t secuencia, const char* usuario, const char* texto);
+
+void segmentos_vaciar(segmento_escritor_t* escritor);
+void segmentos_sincronizar(segmento_escritor_t* escritor);
+
+/**
+ * @brief Vacía el buffer, sincroniza si se pide y cierra los descriptores.
+ */
+void segmentos_cerrar(segmento_escritor_t* escritor, int sincronizar);
+
+/**
+ * @brief Borra los segmentos cerrados que incumplen la retención (nunca el más reciente).
+ * @return Cuántos segmentos se borraron.
+ */
+int segmentos_retener(const char* directorio, const segmentos_config_t* config);
+
+/**
+ * @brief Secuencia que seguiría al último registro guardado (0 si no hay ninguno).
+ */
+uint64_t segmentos_siguiente(const char* directorio);
+
+/**
+ * @brief Recorre, proyectándolos con mmap, los registros con secuencia en [desde, hasta).
+ * @return Cuántos se visitaron.
+ */
+int segmentos_recorrer(const char* directorio, uint64_t desde, uint64_t hasta,
+                       segmentos_visita_fn visita, void* contexto);
+
+/**
+ * @brief Ruta del directorio de segmentos de una sala (historial/<sala>).
+ */
+void segmentos_directorio_sala(char* ruta, size_t tamano, const char* nombre_sala);
+
+#endif // SEGMENTOS_H
@@ -1,72 +1,265 @@
-#include "common.h"
+#include "servidor.h"
 #include <sys/stat.h> // Para mkdir
+#include <getopt.h>
+#include <sys/time.h> // Para setitimer
+#include <limits.h>   // Para PATH_MAX
 
-// Estructuras de Datos del Servidor 
+// Capacidades por defecto (ajustables al arrancar con -c y -s)
+#define CAPACIDAD_CLIENTES_DEFECTO 4096
+#define CAPACIDAD_SALAS_DEFECTO 512
+#define PENDIENTES_POR_CLIENTE_DEFECTO 64
+#define MAX_TRABAJADORES 64
+#define VENTANA_LOTE_DEFECTO_US 1000
+#define RANURAS_ANILLO_DEFECTO 1024
+#define MAX_RANURAS_ANILLO (1 << 20)
+#define INTERVALO_ESTADISTICAS_DEFECTO_S 10
+#define CAPACIDAD_HISTORIA_DEFECTO 256
+#define MAX_CAPACIDAD_HISTORIA (1 << 16)
+#define REPETIR_AL_UNIRSE_DEFECTO 20
+#define RAFAGA_CONTROL_DEFECTO 32
+#define ADMISION_PCT_DEFECTO 80
+#define ADMISION_TAREAS_DEFECTO 65536
+#define PERIODO_ADMISION_NS 1000000LL // La ocupación de la cola se consulta como mucho una vez por ms
+#define ESCALA_ADMISION 1024          // Resolución de la fracción de chat que se descarta
+#define BARRIDO_DEFECTO_S 5
+#define PLAZO_LATIDO_DEFECTO_S (3 * LATIDO_INTERVALO_S)
+#define GRACIA_SALA_DEFECTO_S 30
+#define RUTA_ESTADO_DEFECTO RUTA_PERSISTENCIA "estado.bin"
+#define MAGIA_ESTADO 0x54534543u  // "CEST": instantánea del reinicio en caliente
+#define VERSION_ESTADO 1
+
+// Estructuras de Datos del Servidor (las mantiene solo el despachador)
 typedef struct {
     int id_cola;
     char nombre_usuario[MAX_NOMBRE];
-    int indice_sala; // Índice a la sala en la que está el cliente (-1 si no está)
+    int indice_sala; // Manejador de la sala en la que está el cliente (-1 si no está)
+    int en_uso;      // El barrido recorre el almacén y salta los huecos libres
+    pid_t pid;       // Anunciado al unirse; 0 si el cliente no lo envía (p. ej. carga)
+    time_t ultimo_latido; // Segundos de CLOCK_MONOTONIC de la última señal de vida
+    cubeta_t limite;      // Mensajes por segundo del cliente (limitador.h)
+    int limitado;         // Ya se le avisó de la racha de mensajes limitados en curso
+    int saturado;         // Lo mismo con la racha de mensajes rechazados por admisión
+    uint64_t mensajes_limitados;
 } cliente_t;
 
+// Variables Globales del Servidor
+static almacen_t almacen_clientes;  // cliente_t indexados por manejador
+almacen_t almacen_salas;            // sala_t indexadas por manejador
+static tabla_hash_t indice_clientes; // id_cola -> manejador de cliente
+static tabla_hash_t indice_salas;    // nombre -> manejador de sala
+config_servidor_t config;
+estadisticas_despachador_t estadisticas_despachador;
+static volatile sig_atomic_t servidor_activo = 1;
+static volatile sig_atomic_t barrido_pendiente = 0;
+static volatile sig_atomic_t reinicio_en_caliente = 0; // SIGTERM/SIGUSR1: guardar estado y conservar la cola
+
+// Salas que se quedaron sin miembros, por orden de llegada (cola circular de max_salas)
 typedef struct {
-    char nombre[MAX_NOMBRE];
-    int indices_clientes[MAX_CLIENTES]; // Array de índices al array global de clientes
-    int num_clientes;
-} sala_t;
+    int indice_sala;
+    time_t vacia_desde;
+} sala_vacia_t;
+static sala_vacia_t* salas_vacias;
+static int primera_vacia = 0;
+static int num_salas_vacias = 0;
+static int* salas_por_liberar; // Las devuelve trabajadores_salas_eliminadas
+static limite_t limite_cliente;
+static limite_t limite_sala;
+#define MAX_LIMITADOS_INFORME 8 // Clientes más limitados que se añaden a /stats
 
-// Variables Globales del Servidor
-static cliente_t clientes[MAX_CLIENTES];
-static sala_t salas[MAX_SALAS];
-static int num_clientes_activos = 0;
-static int num_salas_activas = 0;
-static int id_cola_servidor = -1;
+#define CLIENTE(manejador) ((cliente_t*)almacen_obtener(&almacen_clientes, (manejador)))
+
+static time_t segundos_monotonicos(void) {
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    return ahora.tv_sec;
+}
 
 //  Prototipos de Funciones (Modularidad)
-void finalizar_servidor(int signum);
+void procesar_argumentos(int argc, char* argv[], config_servidor_t* config_servidor);
+void leer_limite(const char* texto, int* ritmo, int* rafaga);
+void iniciar_tablas(void);
+void manejar_senal_cierre(int signum);
+void finalizar_servidor(void);
 void gestionar_union_sala(mensaje_t* msg);
 void gestionar_abandonar_sala(mensaje_t* msg, int notificar_cliente);
 void gestionar_mensaje_sala(mensaje_t* msg);
+void gestionar_fragmento(const mensaje_t* msg, const trama_t* trama);
 void gestionar_listar_salas(mensaje_t* msg);
 void gestionar_listar_usuarios(mensaje_t* msg);
 void gestionar_cierre_cliente(mensaje_t* msg);
+void gestionar_estadisticas(mensaje_t* msg);
+void gestionar_historial(mensaje_t* msg);
+void gestionar_busqueda(mensaje_t* msg);
+void gestionar_latido(mensaje_t* msg);
+void barrer_sesiones(void);
+void apuntar_sala_vacia(int indice_sala);
+void cerrar_salas_vacias(void);
+void liberar_salas_eliminadas(void);
+int guardar_estado(void);
+void restaurar_estado(void);
+void manejar_senal_barrido(int signum);
 int buscar_o_crear_sala(const char* nombre_sala);
 int buscar_cliente_por_id_cola(int id_cola);
-void difundir_notificacion(int indice_sala, const char* texto, int id_cola_excluida);
+int encargar_a_sala(tipo_tarea_t tipo, int indice_sala, const mensaje_t* msg, int notificar);
+int cola_saturada(void);
+int admitir_chat(cliente_t* cliente, int trabajador, int id_cola_cliente);
+int admitir_fragmento(int trabajador);
+int mensaje_dentro_de_limites(cliente_t* cliente, sala_t* sala, int id_cola_cliente);
 void enviar_respuesta_a_cliente(int id_cola_cliente, tipo_mensaje_t tipo, const char* texto);
-void registrar_mensaje_en_log(const char* nombre_sala, const char* nombre_usuario, const char* texto);
 
 /**
  * @brief Función principal del servidor.
  */
-int main() {
+int main(int argc, char* argv[]) {
+    config.registro.lote_max = REGISTRO_LOTE_DEFECTO;
+    config.registro.intervalo_ms = REGISTRO_INTERVALO_DEFECTO_MS;
+    config.registro.fsync = REGISTRO_FSYNC_NUNCA;
+    config.registro.segmentos.max_segmento = SEGMENTOS_TAMANO_DEFECTO;
+    config.max_clientes = CAPACIDAD_CLIENTES_DEFECTO;
+    config.max_salas = CAPACIDAD_SALAS_DEFECTO;
+    config.max_pendientes = PENDIENTES_POR_CLIENTE_DEFECTO;
+    config.desborde = DESBORDE_DESCARTAR_ANTIGUO;
+    config.ventana_lote_us = VENTANA_LOTE_DEFECTO_US;
+    config.difusion = DIFUSION_COLAS;
+    config.ranuras_anillo = RANURAS_ANILLO_DEFECTO;
+    config.intervalo_estadisticas_s = INTERVALO_ESTADISTICAS_DEFECTO_S;
+    config.capacidad_historia = CAPACIDAD_HISTORIA_DEFECTO;
+    config.repetir_al_unirse = REPETIR_AL_UNIRSE_DEFECTO;
+    config.rafaga_control = RAFAGA_CONTROL_DEFECTO;
+    config.admision_pct = ADMISION_PCT_DEFECTO;
+    config.admision_tareas = ADMISION_TAREAS_DEFECTO;
+    config.barrido_s = BARRIDO_DEFECTO_S;
+    config.plazo_latido_s = PLAZO_LATIDO_DEFECTO_S;
+    config.gracia_sala_s = GRACIA_SALA_DEFECTO_S;
+    config.ruta_estado = RUTA_ESTADO_DEFECTO;
+    config.num_particiones = 1;
+    config.num_trabajadores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (config.num_trabajadores < 1) config.num_trabajadores = 1;
+    if (config.num_trabajadores > MAX_TRABAJADORES) config.num_trabajadores = MAX_TRABAJADORES;
+    procesar_argumentos(argc, argv, &config);
+    // Las particiones comparten RUTA_PERSISTENCIA (cada sala escribe solo en la suya),
+    // pero cada una guarda su propia instantánea y su propio índice
+    static char ruta_estado_particion[64];
+    if (config.num_particiones > 1 && strcmp(config.ruta_estado, RUTA_ESTADO_DEFECTO) == 0) {
+        snprintf(ruta_estado_particion, sizeof(ruta_estado_particion), RUTA_PERSISTENCIA "estado.%d.bin", config.particion);
+        config.ruta_estado = ruta_estado_particion;
+    }
+    config.registro.particion = config.particion;
+    config.registro.num_particiones = config.num_particiones;
+    limite_iniciar(&limite_cliente, config.limite_cliente, config.rafaga_cliente);
+    limite_iniciar(&limite_sala, config.limite_sala, config.rafaga_sala);
+    iniciar_tablas();
+
     printf("Iniciando servidor de chat...\n");
-    signal(SIGINT, finalizar_servidor); // Manejar Ctrl+C para limpieza
+
+    // Manejar Ctrl+C para limpieza. Sin SA_RESTART para que la espera del transporte vuelva con EINTR.
+    struct sigaction accion;
+    memset(&accion, 0, sizeof(accion));
+    accion.sa_handler = manejar_senal_cierre;
+    sigemptyset(&accion.sa_mask);
+    sigaction(SIGINT, &accion, NULL);
+    sigaction(SIGTERM, &accion, NULL);
+    sigaction(SIGUSR1, &accion, NULL);
+
+    // El barrido de sesiones lo marca SIGALRM; ni msgrcv ni epoll_wait se reinician, así que
+    // vuelven con EINTR aunque el resto de llamadas sí se reanuden (SA_RESTART)
+    if (config.barrido_s > 0) {
+        accion.sa_handler = manejar_senal_barrido;
+        accion.sa_flags = SA_RESTART;
+        sigaction(SIGALRM, &accion, NULL);
+    }
 
     // Crear directorio para persistencia
     mkdir(RUTA_PERSISTENCIA, 0777);
 
-    key_t clave_servidor = ftok(RUTA_CLAVE_SERVIDOR, ID_PROYECTO);
-    if (clave_servidor == -1) {
-        perror("ftok");
+    // Antes que el escritor de historial, que también anota en ella
+    if (config.ruta_traza != NULL && traza_abrir(config.ruta_traza) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    // El historial se escribe en un hilo aparte para que el disco no frene el chat
+    if (registro_iniciar(&config.registro) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (transporte_servidor_abrir(config.transporte, config.particion) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    if (config.ruta_captura != NULL && captura_abrir(config.ruta_captura) == -1) {
+        transporte_servidor_cerrar(0);
         exit(EXIT_FAILURE);
     }
 
-    id_cola_servidor = msgget(clave_servidor, IPC_CREAT | 0666);
-    if (id_cola_servidor == -1) {
-        perror("msgget");
+    // Cada sala pertenece a un trabajador; el hilo principal solo despacha
+    if (trabajadores_iniciar() == -1) {
+        finalizar_servidor();
         exit(EXIT_FAILURE);
     }
-    printf("Servidor escuchando en la cola con ID: %d\n", id_cola_servidor);
+    if (estadisticas_iniciar(config.ruta_estadisticas, config.intervalo_estadisticas_s) == -1) {
+        finalizar_servidor();
+        exit(EXIT_FAILURE);
+    }
+    // Tras un reinicio en caliente se retoman las sesiones y salas de la instantánea
+    restaurar_estado();
+    // El temporizador se arma después de crear los hilos auxiliares, que bloquean todas las señales
+    if (config.barrido_s > 0) {
+        struct itimerval periodo = { { config.barrido_s, 0 }, { config.barrido_s, 0 } };
+        setitimer(ITIMER_REAL, &periodo, NULL);
+    }
 
-    // Bucle principal para recibir y procesar mensajes
+    char donde[128];
+    transporte_servidor_describir(donde, sizeof(donde));
+    printf("Servidor escuchando en %s (%d trabajadores, difusión por %s)\n", donde,
+           config.num_trabajadores, config.difusion == DIFUSION_ANILLO ? "anillo" : "colas");
+    if (config.num_particiones > 1) {
+        printf(" Partición %d de %d: solo se atienden sus salas.\n", config.particion, config.num_particiones);
+    }
+
+    // Bucle principal (despachador) para recibir y repartir mensajes
+    trama_t trama_recibida;
     mensaje_t msg_recibido;
-    while (1) {
-        if (msgrcv(id_cola_servidor, &msg_recibido, TAMANO_MENSAJE, 0, 0) == -1) {
-            if (errno == EINTR) continue; // Interrumpido por señal, continuar
-            perror("msgrcv");
+    int control_seguidos = 0;
+    while (servidor_activo) {
+        if (barrido_pendiente) {
+            barrido_pendiente = 0;
+            barrer_sesiones();
+            cerrar_salas_vacias();
+            liberar_salas_eliminadas();
+        }
+
+        // El control va primero (el mtype más bajo), pero tras una ráfaga de control
+        // se da turno a un mensaje de chat para que no se quede sin servicio.
+        ssize_t recibido = -1;
+        if (control_seguidos >= config.rafaga_control) {
+            control_seguidos = 0;
+            recibido = transporte_recibir(&trama_recibida, PRIORIDAD_DATOS, 0);
+            if (recibido != -1) CONTADOR_SUMAR(estadisticas_despachador.chat_por_turno, 1);
+        }
+        if (recibido == -1) recibido = transporte_recibir(&trama_recibida, 0, 1);
+        if (recibido != -1) {
+            if (trama_recibida.mtype == PRIORIDAD_DATOS) control_seguidos = 0;
+            else control_seguidos++;
+        }
+        if (recibido == -1) {
+            if (errno == EINTR) continue; // Interrumpido por señal, se revisa servidor_activo
+            perror("transporte_recibir");
+            continue;
+        }
+        if (trama_leer(&trama_recibida, (size_t)recibido, &msg_recibido) == -1) {
+            CONTADOR_SUMAR(estadisticas_despachador.tramas_invalidas, 1);
+            fprintf(stderr, " Trama mal formada descartada (%zd bytes)\n", recibido);
             continue;
         }
 
+        // clock_gettime(CLOCK_MONOTONIC) va por el vDSO: medir no añade llamadas al sistema
+        struct timespec inicio, fin;
+        clock_gettime(CLOCK_MONOTONIC, &inicio);
+        captura_registrar(&trama_recibida, (size_t)recibido, &inicio);
+        if (msg_recibido.banderas & TRAMA_TRAZADA) {
+            msg_recibido.traza.marcas_ns[TRAZA_SERVIDOR_RECIBIDO] = (uint64_t)inicio.tv_sec * 1000000000ULL + (uint64_t)inicio.tv_nsec;
+        }
+        long tipo = msg_recibido.mtype;
+        CONTADOR_SUMAR(estadisticas_despachador.solicitudes[tipo > 0 && tipo < NUM_TIPOS_SOLICITUD ? tipo : 0], 1);
+
         switch (msg_recibido.mtype) {
             case TIPO_UNION_SALA:       gestionar_union_sala(&msg_recibido);       break;
             case TIPO_ABANDONAR_SALA:   gestionar_abandonar_sala(&msg_recibido, 1);break;
@@ -74,33 +267,326 @@ int main() {
             case TIPO_LISTAR_SALAS:     gestionar_listar_salas(&msg_recibido);     break;
             case TIPO_LISTAR_USUARIOS:  gestionar_listar_usuarios(&msg_recibido);  break;
             case TIPO_CIERRE_CLIENTE:   gestionar_cierre_cliente(&msg_recibido);   break;
+            case TIPO_ESTADISTICAS:     gestionar_estadisticas(&msg_recibido);     break;
+            case TIPO_HISTORIAL:        gestionar_historial(&msg_recibido);        break;
+            case TIPO_LATIDO:           gestionar_latido(&msg_recibido);           break;
+            case TIPO_BUSCAR:           gestionar_busqueda(&msg_recibido);         break;
+            case TIPO_FRAGMENTO:        gestionar_fragmento(&msg_recibido, &trama_recibida); break;
             default: fprintf(stderr, " Mensaje de tipo desconocido: %ld\n", msg_recibido.mtype);
         }
+        // Sin gracia (o sin barrido que la vigile), la sala se elimina en cuanto se vacía
+        if (num_salas_vacias > 0 && (config.gracia_sala_s == 0 || config.barrido_s == 0)) cerrar_salas_vacias();
+
+        clock_gettime(CLOCK_MONOTONIC, &fin);
+        histograma_registrar(&estadisticas_despachador.solicitud_ns,
+                             (uint64_t)((fin.tv_sec - inicio.tv_sec) * 1000000000LL + (fin.tv_nsec - inicio.tv_nsec)));
     }
+
+    finalizar_servidor();
     return 0;
 }
 
+
+/**
+ * @brief Lee las opciones de línea de comandos del servidor.
+ */
+void procesar_argumentos(int argc, char* argv[], config_servidor_t* config_servidor) {
+    static const struct option opciones[] = {
+        {"trabajadores",  required_argument, NULL, 'w'},
+        {"max-clientes",  required_argument, NULL, 'c'},
+        {"max-salas",     required_argument, NULL, 's'},
+        {"pendientes",    required_argument, NULL, 'p'},
+        {"desborde",      required_argument, NULL, 'd'},
+        {"transporte",    required_argument, NULL, 'u'},
+        {"ventana-lote",  required_argument, NULL, 'v'},
+        {"difusion",      required_argument, NULL, 'm'},
+        {"ranuras-anillo",required_argument, NULL, 'r'},
+        {"estadisticas",  required_argument, NULL, 't'},
+        {"estadisticas-intervalo", required_argument, NULL, 'T'},
+        {"historia",      required_argument, NULL, 'H'},
+        {"repetir",       required_argument, NULL, 'R'},
+        {"rafaga-control",required_argument, NULL, 'P'},
+        {"admision",      required_argument, NULL, 'A'},
+        {"admision-tareas", required_argument, NULL, 'Q'},
+        {"barrido",       required_argument, NULL, 'k'},
+        {"plazo-latido",  required_argument, NULL, 'K'},
+        {"gracia-sala",   required_argument, NULL, 'G'},
+        {"estado",        required_argument, NULL, 'E'},
+        {"limite-cliente",required_argument, NULL, 'l'},
+        {"limite-sala",   required_argument, NULL, 'L'},
+        {"captura",       required_argument, NULL, 'C'},
+        {"traza",         required_argument, NULL, 'X'},
+        {"particion",     required_argument, NULL, 'x'},
+        {"log-lote",      required_argument, NULL, 'b'},
+        {"log-intervalo", required_argument, NULL, 'i'},
+        {"log-fsync",     required_argument, NULL, 'f'},
+        {"log-segmento",  required_argument, NULL, 'g'},
+        {"log-edad",      required_argument, NULL, 'a'},
+        {"log-max",       required_argument, NULL, 'z'},
+        {"ayuda",         no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    int opcion;
+    while ((opcion = getopt_long(argc, argv, "w:c:s:p:d:u:v:m:r:t:T:H:R:P:A:Q:k:K:G:E:l:L:C:x:X:b:i:f:g:a:z:h", opciones, NULL)) != -1) {
+        switch (opcion) {
+            case 'w': config_servidor->num_trabajadores = atoi(optarg);      break;
+            case 'c': config_servidor->max_clientes = atoi(optarg);          break;
+            case 's': config_servidor->max_salas = atoi(optarg);             break;
+            case 'p': config_servidor->max_pendientes = atoi(optarg);        break;
+            case 'd':
+                if (strcmp(optarg, "antiguo") == 0)          config_servidor->desborde = DESBORDE_DESCARTAR_ANTIGUO;
+                else if (strcmp(optarg, "nuevo") == 0)       config_servidor->desborde = DESBORDE_DESCARTAR_NUEVO;
+                else if (strcmp(optarg, "desconectar") == 0) config_servidor->desborde = DESBORDE_DESCONECTAR;
+                else {
+                    fprintf(stderr, "Política de desborde desconocida: %s (use antiguo, nuevo o desconectar)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'u':
+                if (transporte_analizar(optarg, &config_servidor->transporte) == -1) {
+                    fprintf(stderr, "Transporte desconocido: %s (use sysv o unix)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'v': config_servidor->ventana_lote_us = atoi(optarg);       break;
+            case 'm':
+                if (strcmp(optarg, "colas") == 0)       config_servidor->difusion = DIFUSION_COLAS;
+                else if (strcmp(optarg, "anillo") == 0) config_servidor->difusion = DIFUSION_ANILLO;
+                else {
+                    fprintf(stderr, "Modo de difusión desconocido: %s (use colas o anillo)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r': config_servidor->ranuras_anillo = atoi(optarg);        break;
+            case 't': config_servidor->ruta_estadisticas = optarg;           break;
+            case 'T': config_servidor->intervalo_estadisticas_s = atoi(optarg); break;
+            case 'H': config_servidor->capacidad_historia = atoi(optarg);    break;
+            case 'R': config_servidor->repetir_al_unirse = atoi(optarg);     break;
+            case 'P': config_servidor->rafaga_control = atoi(optarg);        break;
+            case 'A': config_servidor->admision_pct = atoi(optarg);          break;
+            case 'Q': config_servidor->admision_tareas = atoi(optarg);       break;
+            case 'k': config_servidor->barrido_s = atoi(optarg);             break;
+            case 'K': config_servidor->plazo_latido_s = atoi(optarg);        break;
+            case 'G': config_servidor->gracia_sala_s = atoi(optarg);         break;
+            case 'E': config_servidor->ruta_estado = optarg;                 break;
+            case 'l': leer_limite(optarg, &config_servidor->limite_cliente, &config_servidor->rafaga_cliente); break;
+            case 'L': leer_limite(optarg, &config_servidor->limite_sala, &config_servidor->rafaga_sala);       break;
+            case 'C': config_servidor->ruta_captura = optarg;                break;
+            case 'X': config_servidor->ruta_traza = optarg;                  break;
+            case 'x':
+                if (sscanf(optarg, "%d/%d", &config_servidor->particion, &config_servidor->num_particiones) != 2) {
+                    fprintf(stderr, "Partición no válida: %s (use I/K, por ejemplo 0/4)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'b': config_servidor->registro.lote_max = atoi(optarg);     break;
+            case 'i': config_servidor->registro.intervalo_ms = atoi(optarg); break;
+            case 'f':
+                if (registro_parsear_fsync(optarg, &config_servidor->registro.fsync) == -1) {
+                    fprintf(stderr, "Política de fsync desconocida: %s (use nunca, lote o segundo)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g': config_servidor->registro.segmentos.max_segmento = (size_t)atol(optarg) * 1024; break;
+            case 'a': config_servidor->registro.segmentos.max_edad_s = atol(optarg) * 3600;         break;
+            case 'z': config_servidor->registro.segmentos.max_bytes_sala = (uint64_t)atoll(optarg) * 1024 * 1024; break;
+            case 'h':
+            default:
+                fprintf(stderr,
+                        "Uso: %s [opciones]\n"
+                        "  -w, --trabajadores N      Hilos entre los que se reparten las salas (defecto: núcleos)\n"
+                        "  -c, --max-clientes N      Sesiones simultáneas permitidas (defecto %d)\n"
+                        "  -s, --max-salas N         Salas simultáneas permitidas (defecto %d)\n"
+                        "  -p, --pendientes N        Envíos diferidos por cliente lento (defecto %d)\n"
+                        "  -d, --desborde MODO       antiguo | nuevo | desconectar (defecto antiguo)\n"
+                        "  -u, --transporte MODO     sysv | unix (sockets SOCK_SEQPACKET en " RUTA_SOCKET_SERVIDOR ") (defecto sysv)\n"
+                        "  -v, --ventana-lote US     Espera para agrupar notificaciones por cliente; 0 = sin espera (defecto %d)\n"
+                        "  -m, --difusion MODO       colas | anillo (memoria compartida por sala) (defecto colas)\n"
+                        "  -r, --ranuras-anillo N    Mensajes que guarda el anillo de cada sala (defecto %d)\n"
+                        "  -t, --estadisticas RUTA   Vuelca periódicamente el informe de /stats a RUTA\n"
+                        "  -T, --estadisticas-intervalo S  Segundos entre volcados (defecto %d)\n"
+                        "  -H, --historia N          Mensajes recientes en memoria por sala, para /history (defecto %d)\n"
+                        "  -R, --repetir N           Mensajes que recibe quien se une; 0 = ninguno (defecto %d)\n"
+                        "  -P, --rafaga-control N    Solicitudes de control seguidas antes de atender un mensaje (defecto %d)\n"
+                        "  -A, --admision PCT        Con la cola del servidor a más del PCT%%, adelanta a la mitad el descarte de chat; 0 = nunca (defecto %d)\n"
+                        "  -Q, --admision-tareas N   Descarta parte del chat desde N/2 tareas pendientes en su trabajador, todo desde N; 0 = nunca (defecto %d)\n"
+                        "  -k, --barrido S           Segundos entre barridos de sesiones caídas; 0 = sin barrido (defecto %d)\n"
+                        "  -K, --plazo-latido S      Silencio tras el que se cierra una sesión; 0 = solo pid y cola (defecto %d)\n"
+                        "  -G, --gracia-sala S       Tiempo que una sala vacía conserva su hueco; 0 = se elimina al vaciarse (defecto %d)\n"
+                        "  -E, --estado RUTA         Instantánea del reinicio en caliente (SIGTERM o SIGUSR1; defecto " RUTA_ESTADO_DEFECTO ")\n"
+                        "  -l, --limite-cliente N[:R] Mensajes por segundo de cada cliente, con ráfagas de R (defecto R = N); 0 = sin límite (defecto 0)\n"
+                        "  -L, --limite-sala N[:R]   Lo mismo para el total de cada sala (defecto 0)\n"
+                        "  -C, --captura RUTA        Anota todas las solicitudes recibidas en RUTA, para ./reproducir\n"
+                        "  -X, --traza RUTA          Escribe en RUTA las etapas de los mensajes trazados (JSON de Chrome)\n"
+                        "  -x, --particion I/K       Atiende solo las salas de la partición I de K (cola y socket propios) (defecto 0/1)\n"
+                        "  -b, --log-lote N          Registros que fuerzan el vaciado del historial (defecto %d)\n"
+                        "  -i, --log-intervalo MS    Espera máxima de un registro en memoria (defecto %d)\n"
+                        "  -f, --log-fsync MODO      nunca | lote | segundo (defecto nunca)\n"
+                        "  -g, --log-segmento KB     Tamaño a partir del cual se rota el segmento de una sala (defecto %d)\n"
+                        "  -a, --log-edad H          Borra los segmentos de más de H horas; 0 = nunca (defecto 0)\n"
+                        "  -z, --log-max MB          Espacio máximo del historial de cada sala; 0 = sin límite (defecto 0)\n",
+                        argv[0], CAPACIDAD_CLIENTES_DEFECTO, CAPACIDAD_SALAS_DEFECTO, PENDIENTES_POR_CLIENTE_DEFECTO, VENTANA_LOTE_DEFECTO_US,
+                        RANURAS_ANILLO_DEFECTO, INTERVALO_ESTADISTICAS_DEFECTO_S, CAPACIDAD_HISTORIA_DEFECTO, REPETIR_AL_UNIRSE_DEFECTO,
+                        RAFAGA_CONTROL_DEFECTO, ADMISION_PCT_DEFECTO, ADMISION_TAREAS_DEFECTO,
+                        BARRIDO_DEFECTO_S, PLAZO_LATIDO_DEFECTO_S, GRACIA_SALA_DEFECTO_S,
+                        REGISTRO_LOTE_DEFECTO, REGISTRO_INTERVALO_DEFECTO_MS, SEGMENTOS_TAMANO_DEFECTO / 1024);
+                exit(opcion == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (config_servidor->max_clientes <= 0 || config_servidor->max_salas <= 0 || config_servidor->max_pendientes <= 0 ||
+        config_servidor->ventana_lote_us < 0 || config_servidor->intervalo_estadisticas_s <= 0) {
+        fprintf(stderr, "Las capacidades deben ser mayores que cero.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->max_clientes > ALMACEN_MAX_ELEMENTOS || config_servidor->max_salas > ALMACEN_MAX_ELEMENTOS) {
+        fprintf(stderr, "Como mucho %d clientes y %d salas.\n", ALMACEN_MAX_ELEMENTOS, ALMACEN_MAX_ELEMENTOS);
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->ranuras_anillo < 1 || config_servidor->ranuras_anillo > MAX_RANURAS_ANILLO) {
+        fprintf(stderr, "Las ranuras del anillo deben estar entre 1 y %d.\n", MAX_RANURAS_ANILLO);
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->capacidad_historia < 1 || config_servidor->capacidad_historia > MAX_CAPACIDAD_HISTORIA) {
+        fprintf(stderr, "La capacidad de la historia debe estar entre 1 y %d.\n", MAX_CAPACIDAD_HISTORIA);
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->registro.segmentos.max_segmento < 4096 || config_servidor->registro.segmentos.max_edad_s < 0) {
+        fprintf(stderr, "Los segmentos deben ser de al menos 4 KB y la edad máxima no puede ser negativa.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->rafaga_control < 1 || config_servidor->admision_pct < 0 || config_servidor->admision_pct > 100 ||
+        config_servidor->admision_tareas < 0) {
+        fprintf(stderr, "La ráfaga de control debe ser mayor que cero y la admisión estar entre 0 y 100%%.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->barrido_s < 0 || config_servidor->plazo_latido_s < 0 ||
+        (config_servidor->plazo_latido_s > 0 && config_servidor->plazo_latido_s <= LATIDO_INTERVALO_S)) {
+        fprintf(stderr, "El barrido no puede ser negativo y el plazo de latido debe superar %d s.\n", LATIDO_INTERVALO_S);
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->limite_cliente < 0 || config_servidor->rafaga_cliente < 0 ||
+        config_servidor->limite_sala < 0 || config_servidor->rafaga_sala < 0) {
+        fprintf(stderr, "Los límites de mensajes no pueden ser negativos.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->gracia_sala_s < 0) {
+        fprintf(stderr, "La gracia de las salas vacías no puede ser negativa.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->repetir_al_unirse < 0) {
+        fprintf(stderr, "Los mensajes a repetir al unirse no pueden ser negativos.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->num_particiones < 1 || config_servidor->num_particiones > MAX_PARTICIONES ||
+        config_servidor->particion < 0 || config_servidor->particion >= config_servidor->num_particiones) {
+        fprintf(stderr, "La partición debe ser I/K con 0 <= I < K <= %d.\n", MAX_PARTICIONES);
+        exit(EXIT_FAILURE);
+    }
+    if (config_servidor->num_trabajadores < 1 || config_servidor->num_trabajadores > MAX_TRABAJADORES) {
+        fprintf(stderr, "El número de trabajadores debe estar entre 1 y %d.\n", MAX_TRABAJADORES);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * @brief Lee un límite "N" o "N:R" (mensajes por segundo y ráfaga). Sin ráfaga, se
+ * permite un segundo entero de mensajes seguidos.
+ */
+void leer_limite(const char* texto, int* ritmo, int* rafaga) {
+    *ritmo = atoi(texto);
+    const char* dos_puntos = strchr(texto, ':');
+    *rafaga = dos_puntos != NULL ? atoi(dos_puntos + 1) : *ritmo;
+}
+
+
+/**
+ * @brief Compara un id de cola con el cliente del manejador (para indice_clientes).
+ */
+static int coincide_cliente(int manejador, const void* clave, void* contexto) {
+    (void)contexto;
+    return CLIENTE(manejador)->id_cola == *(const int*)clave;
+}
+
+
+/**
+ * @brief Compara un nombre de sala con la sala del manejador (para indice_salas).
+ */
+static int coincide_sala(int manejador, const void* clave, void* contexto) {
+    (void)contexto;
+    return strcmp(SALA(manejador)->nombre, (const char*)clave) == 0;
+}
+
+
+/**
+ * @brief Prepara los almacenes y los índices hash con las capacidades configuradas.
+ * Los almacenes crecen por páginas bajo demanda hasta el límite fijado.
+ */
+void iniciar_tablas(void) {
+    if (almacen_iniciar(&almacen_clientes, sizeof(cliente_t), config.max_clientes) == -1 ||
+        almacen_iniciar(&almacen_salas, sizeof(sala_t), config.max_salas) == -1 ||
+        tabla_iniciar(&indice_clientes, 64, coincide_cliente, NULL) == -1 ||
+        tabla_iniciar(&indice_salas, 16, coincide_sala, NULL) == -1 ||
+        (salas_vacias = malloc((size_t)config.max_salas * sizeof(sala_vacia_t))) == NULL ||
+        (salas_por_liberar = malloc((size_t)config.max_salas * sizeof(int))) == NULL) {
+        perror("iniciar_tablas");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/**
+ * @brief Indica si un nombre de sala sirve como componente de ruta: el historial
+ * de la sala vive en historial/<sala>, así que no puede estar vacío, ser "." o
+ * ".." ni contener '/'.
+ */
+static int nombre_sala_valido(const char* nombre) {
+    if (nombre[0] == '\0' || strcmp(nombre, ".") == 0 || strcmp(nombre, "..") == 0) return 0;
+    return strchr(nombre, '/') == NULL;
+}
+
 /**
  * @brief Maneja la solicitud de un cliente para unirse a una sala.
  */
 void gestionar_union_sala(mensaje_t* msg) {
+    if (!nombre_sala_valido(msg->nombre_sala)) {
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR,
+                                   "Nombre de sala no válido: no puede estar vacío, ser \".\" o \"..\" ni contener '/'.");
+        return;
+    }
+
+    // El cliente calcula la partición con la misma función; si no coincide, se equivocó de servidor
+    int particion = particion_de_sala(msg->nombre_sala, config.num_particiones);
+    if (particion != config.particion) {
+        char error[MAX_TEXTO];
+        snprintf(error, sizeof(error), "La sala %s pertenece a la partición %d.", msg->nombre_sala, particion);
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, error);
+        return;
+    }
+
     int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
     if (indice_cliente == -1) { // Cliente nuevo
-        if (num_clientes_activos >= MAX_CLIENTES) {
+        indice_cliente = almacen_reservar(&almacen_clientes);
+        if (indice_cliente == -1) {
+            enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "El servidor está lleno.");
+            return;
+        }
+        cliente_t* nuevo = CLIENTE(indice_cliente);
+        nuevo->id_cola = msg->id_cola_cliente;
+        strncpy(nuevo->nombre_usuario, msg->nombre_usuario, MAX_NOMBRE - 1);
+        nuevo->indice_sala = -1;
+        nuevo->en_uso = 1;
+        if (tabla_insertar(&indice_clientes, tabla_hash_entero(nuevo->id_cola), indice_cliente) == -1) {
+            almacen_liberar(&almacen_clientes, indice_cliente);
             enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "El servidor está lleno.");
             return;
         }
-        indice_cliente = num_clientes_activos++;
-        clientes[indice_cliente].id_cola = msg->id_cola_cliente;
-        strncpy(clientes[indice_cliente].nombre_usuario, msg->nombre_usuario, MAX_NOMBRE);
-        clientes[indice_cliente].indice_sala = -1;
         printf("ℹ Nuevo cliente conectado: %s (ID Cola: %d)\n", msg->nombre_usuario, msg->id_cola_cliente);
     }
-    
-    // Si el cliente ya estaba en una sala, lo sacamos de la anterior
-    if (clientes[indice_cliente].indice_sala != -1) {
-        gestionar_abandonar_sala(msg, 0); 
-    }
+    cliente_t* cliente = CLIENTE(indice_cliente);
+    cliente->pid = (pid_t)atoi(msg->texto);
+    cliente->ultimo_latido = segundos_monotonicos();
 
     int indice_sala = buscar_o_crear_sala(msg->nombre_sala);
     if (indice_sala == -1) {
@@ -108,23 +594,19 @@ void gestionar_union_sala(mensaje_t* msg) {
         return;
     }
 
-    sala_t* sala = &salas[indice_sala];
-    if (sala->num_clientes >= MAX_CLIENTES) {
-        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "La sala está llena.");
-        return;
+    // Si el cliente ya estaba en una sala, lo sacamos de la anterior. Las dos tareas
+    // pueden ir a trabajadores distintos: cada sala conserva su propio orden de eventos.
+    if (cliente->indice_sala != -1) {
+        gestionar_abandonar_sala(msg, 0);
     }
-    
-    // Añadir cliente a la sala
-    sala->indices_clientes[sala->num_clientes++] = indice_cliente;
-    clientes[indice_cliente].indice_sala = indice_sala;
 
-    char texto_buffer[MAX_TEXTO];
-    snprintf(texto_buffer, sizeof(texto_buffer), "Te has unido a la sala '%s'.", msg->nombre_sala);
-    enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_EXITO, texto_buffer);
-    
-    snprintf(texto_buffer, sizeof(texto_buffer), "[SISTEMA] %s se ha unido a la sala.", msg->nombre_usuario);
-    difundir_notificacion(indice_sala, texto_buffer, msg->id_cola_cliente);
-    registrar_mensaje_en_log(sala->nombre, "SISTEMA", texto_buffer);
+    // Añadir cliente a la sala (la pertenencia real la actualiza el trabajador dueño), que
+    // entrega al cliente los identificadores con los que enviará su chat
+    cliente->indice_sala = indice_sala;
+    SALA(indice_sala)->num_clientes++;
+    msg->id_sesion = almacen_identificador(&almacen_clientes, indice_cliente);
+    msg->id_sala = almacen_identificador(&almacen_salas, indice_sala);
+    encargar_a_sala(TAREA_UNIRSE, indice_sala, msg, 0);
 
     printf(" Cliente %s se unió a la sala %s\n", msg->nombre_usuario, msg->nombre_sala);
 }
@@ -135,60 +617,269 @@ void gestionar_union_sala(mensaje_t* msg) {
  */
 void gestionar_abandonar_sala(mensaje_t* msg, int notificar_cliente) {
     int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
-    if (indice_cliente == -1 || clientes[indice_cliente].indice_sala == -1) return;
-
-    int indice_sala = clientes[indice_cliente].indice_sala;
-    sala_t* sala = &salas[indice_sala];
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->indice_sala == -1) return;
 
-    // Eliminar al cliente de la sala
-    for (int i = 0; i < sala->num_clientes; i++) {
-        if (sala->indices_clientes[i] == indice_cliente) {
-            
-            sala->indices_clientes[i] = sala->indices_clientes[sala->num_clientes - 1];
-            sala->num_clientes--;
-            break;
+    cliente_t* cliente = CLIENTE(indice_cliente);
+    int indice_sala = cliente->indice_sala;
+    sala_t* sala = SALA(indice_sala);
+    sala->num_clientes--;
+    cliente->indice_sala = -1;
+    if (sala->num_clientes == 0) {
+        // Una sala que se vacía varias veces dentro de la gracia ocupa una sola entrada
+        sala->vacia_desde = segundos_monotonicos();
+        if (!sala->en_espera_vacia) {
+            sala->en_espera_vacia = 1;
+            apuntar_sala_vacia(indice_sala);
         }
     }
-    clientes[indice_cliente].indice_sala = -1;
-
-    // Notificar al cliente (si es necesario) y a los demás
-    if (notificar_cliente) {
-        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_EXITO, "Has abandonado la sala.");
-    }
-    
-    char texto_buffer[MAX_TEXTO];
-    snprintf(texto_buffer, sizeof(texto_buffer), "[SISTEMA] %s ha abandonado la sala.", clientes[indice_cliente].nombre_usuario);
-    difundir_notificacion(indice_sala, texto_buffer, -1); // -1 para no excluir a nadie
-    registrar_mensaje_en_log(sala->nombre, "SISTEMA", texto_buffer);
 
-    printf("ℹ Cliente %s ha salido de la sala %s\n", clientes[indice_cliente].nombre_usuario, sala->nombre);
+    // El trabajador de la sala lo saca, notifica al cliente (si es necesario) y a los demás
+    encargar_a_sala(TAREA_ABANDONAR, indice_sala, msg, notificar_cliente);
 }
 
 
 /**
- * @brief Maneja un mensaje de chat y lo reenvía a la sala.
+ * @brief Maneja un mensaje de chat y lo reenvía a la sala. Remitente y sala se
+ * comprueban con sus identificadores, en O(1) y sin comparar nombres.
  */
 void gestionar_mensaje_sala(mensaje_t* msg) {
-    int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
-    if (indice_cliente == -1 || clientes[indice_cliente].indice_sala == -1) {
+    if (msg->id_sesion == 0) {
         enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "No estás en una sala.");
         return;
     }
+    // La cola también debe coincidir: un id de sesión no sirve desde otro cliente
+    int indice_cliente = almacen_resolver(&almacen_clientes, msg->id_sesion);
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->id_cola != msg->id_cola_cliente) {
+        CONTADOR_SUMAR(estadisticas_despachador.chat_caducado, 1);
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_CADUCADA,
+                                   "Tu sesión ya no es válida: vuelve a unirte a una sala.");
+        return;
+    }
+    // El control se atiende antes que el chat: un mensaje escrito antes de cambiar de sala no se cuela en la nueva
+    cliente_t* cliente = CLIENTE(indice_cliente);
+    int indice_sala = almacen_resolver(&almacen_salas, msg->id_sala);
+    if (indice_sala == -1 || indice_sala != cliente->indice_sala) {
+        CONTADOR_SUMAR(estadisticas_despachador.chat_caducado, 1);
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_CADUCADA, "Mensaje descartado: ya no estás en esa sala.");
+        return;
+    }
+    if (!mensaje_dentro_de_limites(cliente, SALA(indice_sala), msg->id_cola_cliente)) return;
+    memcpy(msg->nombre_usuario, cliente->nombre_usuario, MAX_NOMBRE);
+
+    // Control de admisión: con el trabajador desbordado, el chat se rechaza en lugar de acumularse
+    if (!admitir_chat(cliente, SALA(indice_sala)->trabajador, msg->id_cola_cliente)) return;
+    if (encargar_a_sala(TAREA_MENSAJE, indice_sala, msg, 0) == -1) {
+        CONTADOR_SUMAR(estadisticas_despachador.chat_rechazado, 1);
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR,
+                                   "Servidor sin memoria: mensaje no enviado.");
+    }
+}
+
+
+/**
+ * @brief Cancela una transferencia: el emisor deja de enviar sus trozos.
+ */
+static void rechazar_fragmento(int id_cola_cliente, const cabecera_fragmento_t* fragmento, const char* motivo) {
+    CONTADOR_SUMAR(estadisticas_despachador.fragmentos_rechazados, 1);
+    char texto[MAX_TEXTO];
+    snprintf(texto, sizeof(texto), "%u %s", fragmento->transferencia, motivo);
+    enviar_respuesta_a_cliente(id_cola_cliente, TIPO_FRAGMENTO_RECHAZADO, texto);
+}
+
+
+/**
+ * @brief Maneja un trozo de una transferencia: se comprueba como el chat y se
+ * encarga al trabajador de la sala la trama ya construida para los miembros,
+ * con la sesión del autor. No gasta fichas de los límites de mensajes: lo acota
+ * la ventana, que aquí se hace cumplir (un emisor con más de VENTANA_FRAGMENTOS
+ * trozos esperando en el trabajador ve cancelada su transferencia), y con la
+ * cola saturada se rechaza como el chat.
+ */
+void gestionar_fragmento(const mensaje_t* msg, const trama_t* trama) {
+    cabecera_fragmento_t fragmento;
+    const char* datos = fragmento_datos(trama, &fragmento);
+    int indice_cliente = msg->id_sesion != 0 ? almacen_resolver(&almacen_clientes, msg->id_sesion) : -1;
+    int indice_sala = almacen_resolver(&almacen_salas, msg->id_sala);
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->id_cola != msg->id_cola_cliente ||
+        indice_sala == -1 || indice_sala != CLIENTE(indice_cliente)->indice_sala) {
+        rechazar_fragmento(msg->id_cola_cliente, &fragmento, "ya no estás en esa sala");
+        return;
+    }
+    size_t longitud = trama->cabecera.longitud_texto;
+    // Sin sumar: un desplazamiento cerca de UINT64_MAX daría la vuelta y pasaría la comprobación
+    if (fragmento.total > MAX_TRANSFERENCIA || fragmento.desplazamiento > fragmento.total ||
+        longitud > fragmento.total - fragmento.desplazamiento) {
+        rechazar_fragmento(msg->id_cola_cliente, &fragmento, "transferencia demasiado grande");
+        return;
+    }
+
+    if (!admitir_fragmento(SALA(indice_sala)->trabajador)) {
+        rechazar_fragmento(msg->id_cola_cliente, &fragmento, "servidor saturado");
+        return;
+    }
+
+    tarea_t tarea;
+    memset(&tarea, 0, sizeof(tarea));
+    tarea.tipo = TAREA_FRAGMENTO;
+    tarea.indice_sala = indice_sala;
+    tarea.id_cola = msg->id_cola_cliente;
+    snprintf(tarea.texto, sizeof(tarea.texto), "%u %llu", fragmento.transferencia,
+             (unsigned long long)(fragmento.desplazamiento + longitud));
+    fragmento.id_sala = 0;
+    trama_t reenvio;
+    tarea.tamano_trama = trama_construir_fragmento(&reenvio, TIPO_FRAGMENTO_SALA, 0, &fragmento,
+                                                   CLIENTE(indice_cliente)->nombre_usuario, msg->nombre_sala, datos, longitud);
+    // Solo se copia lo usado: el trabajador la reenvía tal cual a cada miembro
+    tarea.trama = malloc(sizeof(long) + tarea.tamano_trama);
+    if (tarea.trama != NULL) memcpy(tarea.trama, &reenvio, sizeof(long) + tarea.tamano_trama);
+    if (tarea.trama == NULL || trabajadores_encolar(SALA(indice_sala)->trabajador, &tarea, VENTANA_FRAGMENTOS) == -1) {
+        int fuera_de_ventana = tarea.trama != NULL && errno == EAGAIN;
+        free(tarea.trama);
+        rechazar_fragmento(msg->id_cola_cliente, &fragmento,
+                           fuera_de_ventana ? "demasiados trozos sin confirmar" : "servidor sin memoria");
+        return;
+    }
+    CONTADOR_SUMAR(estadisticas_despachador.bytes_transferidos, longitud);
+}
+
+
+/**
+ * @brief Comprueba los límites de mensajes por segundo del autor y de la sala, y
+ * gasta una ficha de cada uno si caben los dos. Va antes de cualquier trabajo de
+ * difusión o de historial, así que un mensaje limitado solo cuesta esto.
+ * Al autor se le avisa una vez por racha de mensajes limitados, no por cada uno.
+ * @return 1 si el mensaje puede seguir, 0 si se descartó.
+ */
+int mensaje_dentro_de_limites(cliente_t* cliente, sala_t* sala, int id_cola_cliente) {
+    if (limite_cliente.intervalo_ns == 0 && limite_sala.intervalo_ns == 0) return 1;
+
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    int64_t ahora_ns = (int64_t)ahora.tv_sec * 1000000000LL + ahora.tv_nsec;
+    int cabe_cliente = cubeta_cabe(&cliente->limite, &limite_cliente, ahora_ns);
+    int cabe_sala = cubeta_cabe(&sala->limite, &limite_sala, ahora_ns);
+    if (cabe_cliente && cabe_sala) {
+        cubeta_gastar(&cliente->limite, &limite_cliente, ahora_ns);
+        cubeta_gastar(&sala->limite, &limite_sala, ahora_ns);
+        cliente->limitado = 0;
+        return 1;
+    }
+
+    cliente->mensajes_limitados++;
+    if (!cabe_cliente) CONTADOR_SUMAR(estadisticas_despachador.chat_limitado_cliente, 1);
+    else CONTADOR_SUMAR(estadisticas_despachador.chat_limitado_sala, 1);
+    if (!cliente->limitado) {
+        cliente->limitado = 1;
+        char aviso[MAX_TEXTO];
+        if (!cabe_cliente) {
+            snprintf(aviso, sizeof(aviso), "Vas demasiado rápido (máximo %d mensajes por segundo): "
+                     "se descartan tus mensajes hasta que bajes el ritmo.", config.limite_cliente);
+        } else {
+            snprintf(aviso, sizeof(aviso), "La sala %s va demasiado rápida (máximo %d mensajes por segundo): "
+                     "se descartan tus mensajes hasta que baje el ritmo.", sala->nombre, config.limite_sala);
+        }
+        enviar_respuesta_a_cliente(id_cola_cliente, TIPO_RESPUESTA_ERROR, aviso);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Indica si la entrada del servidor está saturada, con histéresis: lo está al
+ * pasar de -A y deja de estarlo al bajar de la mitad, para no alternar con cada
+ * muestra. La ocupación (IPC_STAT con colas) se consulta como mucho una vez por
+ * PERIODO_ADMISION_NS.
+ */
+int cola_saturada(void) {
+    static long long proxima_consulta_ns = 0;
+    static int saturada = 0;
+    if (config.admision_pct == 0) return 0;
+
+    struct timespec ahora;
+    clock_gettime(CLOCK_MONOTONIC, &ahora);
+    long long ahora_ns = (long long)ahora.tv_sec * 1000000000LL + ahora.tv_nsec;
+    if (ahora_ns >= proxima_consulta_ns) {
+        transporte_ocupacion_t ocupacion;
+        if (transporte_ocupacion(&ocupacion) == 0) {
+            if (ocupacion.porcentaje > config.admision_pct) saturada = 1;
+            else if (ocupacion.porcentaje <= config.admision_pct / 2) saturada = 0;
+        }
+        proxima_consulta_ns = ahora_ns + PERIODO_ADMISION_NS;
+    }
+    return saturada;
+}
+
+/**
+ * @brief Tramo de tareas pendientes en el que se descarta chat: desde la mitad de -Q
+ * hasta -Q. Con la entrada saturada, el tramo se reduce a la mitad (empieza antes):
+ * la cola llena por sí sola solo indica que el despachador va al límite, y rechazar
+ * ahí cuesta lo mismo que encargar.
+ */
+static void tramo_admision(int* desde, int* hasta) {
+    *hasta = config.admision_tareas;
+    if (cola_saturada()) *hasta /= 2;
+    if (*hasta < 1) *hasta = 1;
+    *desde = *hasta / 2;
+}
+
+/**
+ * @brief Control de admisión de un mensaje de chat según las tareas pendientes del
+ * trabajador de su sala. Dentro del tramo de tramo_admision se descarta una fracción
+ * que crece en proporción a lo pendiente; el reparto es determinista (se acumula la
+ * fracción y se descarta un mensaje cada vez que suma uno entero). Al autor se le
+ * avisa una vez por racha de mensajes rechazados, como con los límites.
+ * @return 1 si el mensaje puede seguir, 0 si se rechazó.
+ */
+int admitir_chat(cliente_t* cliente, int trabajador, int id_cola_cliente) {
+    static int acumulado = 0;
+    if (config.admision_tareas == 0) return 1;
+
+    int desde, hasta;
+    tramo_admision(&desde, &hasta);
+    int pendientes = trabajadores_pendientes(trabajador);
+    int admitido = 1;
+    if (pendientes >= hasta) {
+        admitido = 0;
+    } else if (pendientes > desde) {
+        acumulado += (int)((long long)(pendientes - desde) * ESCALA_ADMISION / (hasta - desde));
+        if (acumulado >= ESCALA_ADMISION) {
+            acumulado -= ESCALA_ADMISION;
+            admitido = 0;
+        }
+    }
+    if (admitido) {
+        cliente->saturado = 0;
+        return 1;
+    }
 
-    int indice_sala = clientes[indice_cliente].indice_sala;
-    char texto_buffer[MAX_TEXTO + MAX_NOMBRE + 5];
-    snprintf(texto_buffer, sizeof(texto_buffer), "[%s]: %s", msg->nombre_usuario, msg->texto);
+    CONTADOR_SUMAR(estadisticas_despachador.chat_rechazado, 1);
+    if (!cliente->saturado) {
+        cliente->saturado = 1;
+        enviar_respuesta_a_cliente(id_cola_cliente, TIPO_RESPUESTA_ERROR,
+                                   "Servidor saturado: se descartan mensajes hasta que se recupere, inténtalo en unos segundos.");
+    }
+    return 0;
+}
 
-    difundir_notificacion(indice_sala, texto_buffer, msg->id_cola_cliente);
-    registrar_mensaje_en_log(salas[indice_sala].nombre, msg->nombre_usuario, msg->texto);
+/**
+ * @brief Control de admisión de un trozo. Rechazarlo cancela la transferencia, así
+ * que no hay fracción: se corta en cuanto el chat empieza a descartarse.
+ * @return 1 si el trozo puede seguir, 0 si no.
+ */
+int admitir_fragmento(int trabajador) {
+    if (config.admision_tareas == 0) return 1;
+    int desde, hasta;
+    tramo_admision(&desde, &hasta);
+    return trabajadores_pendientes(trabajador) <= desde;
 }
 
 
 /**
  * @brief Envía la lista de salas disponibles al cliente.
+ * La resuelve el despachador con su registro de salas, sin consultar a los trabajadores.
  */
 void gestionar_listar_salas(mensaje_t* msg) {
-    
+
     char buffer[MAX_TEXTO * 2];
     char* ptr = buffer;
     size_t remaining_size = sizeof(buffer);
@@ -198,19 +889,53 @@ void gestionar_listar_salas(mensaje_t* msg) {
     ptr += written;
     remaining_size -= written;
 
-    if (num_salas_activas == 0) {
+    int listadas = 0;
+    for (int i = 0; i < almacen_salas.num_reservados; i++) {
+        if (!SALA(i)->en_uso) continue; // Hueco libre o sala ya eliminada
+        written = snprintf(ptr, remaining_size, " - %s (%d/%d)\n", SALA(i)->nombre, SALA(i)->num_clientes, config.max_clientes);
+
+
+        if ((size_t)written >= remaining_size) {
+            break;
+        }
+        ptr += written;
+        remaining_size -= written;
+        listadas++;
+    }
+    if (listadas == 0) {
         snprintf(ptr, remaining_size, " - No hay salas activas.\n");
-    } else {
-        for (int i = 0; i < num_salas_activas; i++) {
-            written = snprintf(ptr, remaining_size, " - %s (%d/%d)\n", salas[i].nombre, salas[i].num_clientes, MAX_CLIENTES);
-            
-            
-            if ((size_t)written >= remaining_size) {
-                break; 
-            }
-            ptr += written;
-            remaining_size -= written;
+    }
+    enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_EXITO, buffer);
+}
+
+
+/**
+ * @brief Responde a /stats con el informe de contadores del servidor.
+ */
+void gestionar_estadisticas(mensaje_t* msg) {
+    char buffer[MAX_DATOS_TRAMA];
+    size_t escrito = estadisticas_informe(buffer, sizeof(buffer));
+
+    // Los clientes más limitados: sus contadores solo los ve el despachador, no el volcado periódico
+    int limitados[MAX_LIMITADOS_INFORME];
+    int num_limitados = 0;
+    for (int i = 0; i < almacen_clientes.num_reservados; i++) {
+        if (!CLIENTE(i)->en_uso || CLIENTE(i)->mensajes_limitados == 0) continue;
+        int j = num_limitados < MAX_LIMITADOS_INFORME ? num_limitados++ : MAX_LIMITADOS_INFORME;
+        while (j > 0 && CLIENTE(limitados[j - 1])->mensajes_limitados < CLIENTE(i)->mensajes_limitados) {
+            if (j < MAX_LIMITADOS_INFORME) limitados[j] = limitados[j - 1];
+            j--;
         }
+        if (j < MAX_LIMITADOS_INFORME) limitados[j] = i;
+    }
+    for (int i = 0; i < num_limitados && escrito < sizeof(buffer); i++) {
+        int n = snprintf(buffer + escrito, sizeof(buffer) - escrito, "chat_limitado{usuario=\"%s\"} %llu\n",
+                         CLIENTE(limitados[i])->nombre_usuario, (unsigned long long)CLIENTE(limitados[i])->mensajes_limitados);
+        if (n < 0 || (size_t)n >= sizeof(buffer) - escrito) {
+            buffer[escrito] = '\0'; // No cabe entera: se deja fuera
+            break;
+        }
+        escrito += (size_t)n;
     }
     enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_EXITO, buffer);
 }
@@ -221,35 +946,42 @@ void gestionar_listar_salas(mensaje_t* msg) {
  */
 void gestionar_listar_usuarios(mensaje_t* msg) {
     int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
-    if (indice_cliente == -1 || clientes[indice_cliente].indice_sala == -1) {
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->indice_sala == -1) {
         enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "No estás en una sala.");
         return;
     }
-    
-    int indice_sala = clientes[indice_cliente].indice_sala;
-    sala_t* sala = &salas[indice_sala];
 
-    
-    char buffer[MAX_TEXTO * 2];
-    char* ptr = buffer;
-    size_t remaining_size = sizeof(buffer);
-    int written;
+    // Los nombres de los miembros los tiene el trabajador dueño de la sala
+    encargar_a_sala(TAREA_LISTAR_USUARIOS, CLIENTE(indice_cliente)->indice_sala, msg, 0);
+}
 
-    written = snprintf(ptr, remaining_size, "Usuarios en '%s':\n", sala->nombre);
-    ptr += written;
-    remaining_size -= written;
 
-    for (int i = 0; i < sala->num_clientes; i++) {
-        written = snprintf(ptr, remaining_size, " - %s\n", clientes[sala->indices_clientes[i]].nombre_usuario);
-        
-        
-        if ((size_t)written >= remaining_size) {
-            break; // Buffer lleno.
-        }
-        ptr += written;
-        remaining_size -= written;
+/**
+ * @brief Envía los últimos mensajes de la sala actual del cliente (texto = cuántos).
+ */
+void gestionar_historial(mensaje_t* msg) {
+    int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->indice_sala == -1) {
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "No estás en una sala.");
+        return;
     }
-    enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_EXITO, buffer);
+
+    // La historia la guarda el trabajador dueño de la sala
+    encargar_a_sala(TAREA_HISTORIAL, CLIENTE(indice_cliente)->indice_sala, msg, 0);
+}
+
+
+/**
+ * @brief Busca en el historial de todas las salas (o de una). La consulta la hace el
+ * trabajador de la sala del cliente, que es quien le responde; el despachador no lee disco.
+ */
+void gestionar_busqueda(mensaje_t* msg) {
+    int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->indice_sala == -1) {
+        enviar_respuesta_a_cliente(msg->id_cola_cliente, TIPO_RESPUESTA_ERROR, "Únete a una sala para buscar.");
+        return;
+    }
+    encargar_a_sala(TAREA_BUSCAR, CLIENTE(indice_cliente)->indice_sala, msg, 0);
 }
 
 
@@ -261,124 +993,435 @@ void gestionar_cierre_cliente(mensaje_t* msg) {
     if (indice_cliente == -1) return;
 
     // Si el cliente estaba en una sala, se gestiona su salida de la misma.
-    if (clientes[indice_cliente].indice_sala != -1) {
-        // Creamos un mensaje temporal para la función, ya que el original no es para abandonar.
-        mensaje_t msg_leave = *msg; 
-        strncpy(msg_leave.nombre_sala, salas[clientes[indice_cliente].indice_sala].nombre, MAX_NOMBRE);
-        gestionar_abandonar_sala(&msg_leave, 0); // 0 = No notificar al cliente que ya se está cerrando.
+    if (CLIENTE(indice_cliente)->indice_sala != -1) {
+        gestionar_abandonar_sala(msg, 0); // 0 = No notificar al cliente que ya se está cerrando.
     }
 
-    printf(" Cliente %s (ID Cola: %d) se ha desconectado.\n", clientes[indice_cliente].nombre_usuario, msg->id_cola_cliente);
+    printf(" Cliente %s (ID Cola: %d) se ha desconectado.", CLIENTE(indice_cliente)->nombre_usuario, msg->id_cola_cliente);
+    if (CLIENTE(indice_cliente)->mensajes_limitados > 0) {
+        printf(" Mensajes limitados: %llu.", (unsigned long long)CLIENTE(indice_cliente)->mensajes_limitados);
+    }
+    printf("\n");
 
-    
-    // Se mueve el último cliente a la posición del que se desconectó.
-    clientes[indice_cliente] = clientes[num_clientes_activos - 1];
-    num_clientes_activos--;
+    // El manejador vuelve a la lista libre; los demás clientes no se mueven.
+    CLIENTE(indice_cliente)->en_uso = 0;
+    tabla_eliminar(&indice_clientes, tabla_hash_entero(msg->id_cola_cliente), &msg->id_cola_cliente);
+    almacen_liberar(&almacen_clientes, indice_cliente);
 }
 
 
 /**
- * @brief Busca una sala por nombre, si no existe, la crea.
- * @return El índice de la sala o -1 si hubo un error.
+ * @brief Anota la señal de vida de un cliente. Los latidos de quien aún no tiene sesión se ignoran.
  */
-int buscar_o_crear_sala(const char* nombre_sala) {
-    for (int i = 0; i < num_salas_activas; i++) {
-        if (strcmp(salas[i].nombre, nombre_sala) == 0) {
-            return i;
-        }
+void gestionar_latido(mensaje_t* msg) {
+    int indice_cliente = buscar_cliente_por_id_cola(msg->id_cola_cliente);
+    if (indice_cliente == -1) return;
+    cliente_t* cliente = CLIENTE(indice_cliente);
+    cliente->ultimo_latido = segundos_monotonicos();
+    pid_t pid = (pid_t)atoi(msg->texto);
+    if (pid > 0) cliente->pid = pid;
+}
+
+
+/**
+ * @brief Decide si una sesión está muerta. Es barato: un msgctl(IPC_STAT) (o una consulta
+ * a la tabla de conexiones) y, si hay pid, un kill(pid, 0).
+ * @return El motivo, o NULL si la sesión sigue viva.
+ */
+static const char* motivo_sesion_caida(const cliente_t* cliente, time_t ahora) {
+    time_t ultima_lectura;
+    if (transporte_destino_estado(cliente->id_cola, &ultima_lectura) == -1) return "su cola ya no existe";
+    if (cliente->pid <= 0) return NULL; // Sin pid no hay latidos que esperar: solo cuenta la cola
+    if (kill(cliente->pid, 0) == -1 && errno == ESRCH) return "su proceso ya no existe";
+
+    // Un proceso zombi, detenido o un pid reutilizado siguen respondiendo a kill(): se exige
+    // además alguna señal de vida reciente, un latido o una lectura de su cola (msg_rtime)
+    if (config.plazo_latido_s > 0 && ahora - cliente->ultimo_latido > config.plazo_latido_s &&
+        time(NULL) - ultima_lectura > config.plazo_latido_s) {
+        return "no da señales de vida";
+    }
+    return NULL;
+}
+
+
+/**
+ * @brief Cierra las sesiones de los clientes que murieron sin despedirse y borra
+ * sus colas, para que sus huecos se reutilicen y nadie siga enviándoles.
+ */
+void barrer_sesiones(void) {
+    CONTADOR_SUMAR(estadisticas_despachador.barridos, 1);
+    time_t ahora = segundos_monotonicos();
+    for (int i = 0; i < almacen_clientes.num_reservados; i++) {
+        cliente_t* cliente = CLIENTE(i);
+        if (!cliente->en_uso) continue;
+        const char* motivo = motivo_sesion_caida(cliente, ahora);
+        if (motivo == NULL) continue;
+
+        printf(" Sesión de %s (ID Cola: %d) cerrada: %s.\n", cliente->nombre_usuario, cliente->id_cola, motivo);
+        CONTADOR_SUMAR(estadisticas_despachador.sesiones_caidas, 1);
+
+        // Igual que si el cliente hubiera enviado su cierre; la cola se borra después,
+        // así que el trabajador ya no encontrará dónde enviarle nada
+        mensaje_t msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.mtype = TIPO_CIERRE_CLIENTE;
+        msg.id_cola_cliente = cliente->id_cola;
+        strncpy(msg.nombre_usuario, cliente->nombre_usuario, MAX_NOMBRE - 1);
+        gestionar_cierre_cliente(&msg);
+        if (transporte_destino_cerrar(msg.id_cola_cliente) == 0) CONTADOR_SUMAR(estadisticas_despachador.colas_eliminadas, 1);
     }
-    if (num_salas_activas >= MAX_SALAS) return -1;
+}
 
-    int nuevo_indice = num_salas_activas++;
-    strncpy(salas[nuevo_indice].nombre, nombre_sala, MAX_NOMBRE);
-    salas[nuevo_indice].num_clientes = 0;
+
+/**
+ * @brief Busca una sala por nombre, si no existe, la crea y le asigna trabajador.
+ * @return El manejador de la sala o -1 si hubo un error.
+ */
+int buscar_o_crear_sala(const char* nombre_sala) {
+    unsigned int hash = tabla_hash_cadena(nombre_sala);
+    int indice_sala = tabla_buscar(&indice_salas, hash, nombre_sala);
+    if (indice_sala != -1) return indice_sala;
+
+    // Antes de reservar se recuperan los huecos que los trabajadores ya dejaron libres
+    liberar_salas_eliminadas();
+    int nuevo_indice = almacen_reservar(&almacen_salas);
+    if (nuevo_indice == -1) return -1;
+    sala_t* sala = SALA(nuevo_indice);
+    strncpy(sala->nombre, nombre_sala, MAX_NOMBRE - 1);
+    sala->trabajador = (int)(hash % (unsigned int)config.num_trabajadores);
+    if (tabla_insertar(&indice_salas, hash, nuevo_indice) == -1) {
+        almacen_liberar(&almacen_salas, nuevo_indice);
+        return -1;
+    }
+    sala->en_uso = 1;
+    CONTADOR_SUMAR(estadisticas_despachador.salas_creadas, 1);
     printf(" Nueva sala creada: %s\n", nombre_sala);
     return nuevo_indice;
 }
 
 
 /**
- * @brief Busca un cliente por su ID de cola.
- * @return El índice del cliente o -1 si no se encuentra.
+ * @brief Añade una sala recién vaciada al final de la cola de salas vacías.
  */
-int buscar_cliente_por_id_cola(int id_cola) {
-    for (int i = 0; i < num_clientes_activos; i++) {
-        if (clientes[i].id_cola == id_cola) return i;
+void apuntar_sala_vacia(int indice_sala) {
+    sala_vacia_t* entrada = &salas_vacias[(primera_vacia + num_salas_vacias) % config.max_salas];
+    entrada->indice_sala = indice_sala;
+    entrada->vacia_desde = SALA(indice_sala)->vacia_desde;
+    num_salas_vacias++;
+}
+
+
+/**
+ * @brief Elimina las salas que llevan vacías más de la gracia. La cola está ordenada
+ * por el momento en que se vaciaron, así que se recorre solo hasta la primera que no ha vencido.
+ * La sala deja de ser visible al momento; su trabajador la desmonta y luego se libera el hueco.
+ */
+void cerrar_salas_vacias(void) {
+    time_t ahora = segundos_monotonicos();
+    while (num_salas_vacias > 0) {
+        sala_vacia_t entrada = salas_vacias[primera_vacia];
+        sala_t* sala = SALA(entrada.indice_sala);
+        if (sala->num_clientes == 0 && sala->vacia_desde == entrada.vacia_desde &&
+            ahora - sala->vacia_desde < config.gracia_sala_s) {
+            break; // La primera aún no ha vencido: las siguientes tampoco
+        }
+        primera_vacia = (primera_vacia + 1) % config.max_salas;
+        num_salas_vacias--;
+
+        if (sala->num_clientes > 0) { // Alguien volvió a entrar
+            sala->en_espera_vacia = 0;
+            continue;
+        }
+        if (sala->vacia_desde != entrada.vacia_desde) { // Se volvió a vaciar más tarde: pasa al final
+            apuntar_sala_vacia(entrada.indice_sala);
+            continue;
+        }
+
+        printf(" Sala %s eliminada (vacía).\n", sala->nombre);
+        CONTADOR_SUMAR(estadisticas_despachador.salas_eliminadas, 1);
+        tabla_eliminar(&indice_salas, tabla_hash_cadena(sala->nombre), sala->nombre);
+        sala->en_uso = 0;
+        sala->en_espera_vacia = 0;
+
+        tarea_t tarea;
+        memset(&tarea, 0, sizeof(tarea));
+        tarea.tipo = TAREA_ELIMINAR_SALA;
+        tarea.indice_sala = entrada.indice_sala;
+        trabajadores_encolar(sala->trabajador, &tarea, 0);
     }
-    return -1;
 }
 
+
 /**
- * @brief Envía una notificación a todos los miembros de una sala.
+ * @brief Devuelve al almacén los huecos de las salas que sus trabajadores ya desmontaron.
+ * Sus identificadores cambian de generación, así que el chat dirigido a ellas caduca.
  */
-void difundir_notificacion(int indice_sala, const char* texto, int id_cola_excluida) {
-    mensaje_t msg_notif;
-    msg_notif.mtype = TIPO_NOTIFICACION;
-    strncpy(msg_notif.texto, texto, MAX_TEXTO);
+void liberar_salas_eliminadas(void) {
+    int n = trabajadores_salas_eliminadas(salas_por_liberar, config.max_salas);
+    for (int i = 0; i < n; i++) almacen_liberar(&almacen_salas, salas_por_liberar[i]);
+}
 
-    sala_t* sala = &salas[indice_sala];
-    for (int i = 0; i < sala->num_clientes; i++) {
-        int indice_dest = sala->indices_clientes[i];
-        if (clientes[indice_dest].id_cola != id_cola_excluida) {
-            if (msgsnd(clientes[indice_dest].id_cola, &msg_notif, TAMANO_MENSAJE, 0) == -1) {
-                if (errno != EIDRM) { 
-                    perror("difundir_notificacion msgsnd");
-                }
-            }
+
+/**
+ * @brief Busca un cliente por su ID de cola.
+ * @return El manejador del cliente o -1 si no se encuentra.
+ */
+int buscar_cliente_por_id_cola(int id_cola) {
+    return tabla_buscar(&indice_clientes, tabla_hash_entero(id_cola), &id_cola);
+}
+
+
+/**
+ * @brief Pasa una solicitud al trabajador dueño de la sala.
+ */
+int encargar_a_sala(tipo_tarea_t tipo, int indice_sala, const mensaje_t* msg, int notificar) {
+    tarea_t tarea;
+    tarea.tipo = tipo;
+    tarea.indice_sala = indice_sala;
+    tarea.id_cola = msg->id_cola_cliente;
+    tarea.notificar = notificar;
+    tarea.tipo_respuesta = 0;
+    tarea.id_sesion = msg->id_sesion;
+    tarea.id_sala = msg->id_sala;
+    tarea.secuencia = 0;
+    tarea.trama = NULL;
+    tarea.tamano_trama = 0;
+    tarea.traza = NULL;
+    strncpy(tarea.nombre_usuario, msg->nombre_usuario, MAX_NOMBRE - 1);
+    tarea.nombre_usuario[MAX_NOMBRE - 1] = '\0';
+    strncpy(tarea.texto, msg->texto, MAX_TEXTO - 1);
+    tarea.texto[MAX_TEXTO - 1] = '\0';
+    // Un mensaje trazado lleva sus marcas aparte: la tarea de los demás no crece
+    if (tipo == TAREA_MENSAJE && (msg->banderas & TRAMA_TRAZADA)) {
+        tarea.traza = malloc(sizeof(traza_t));
+        if (tarea.traza != NULL) {
+            *tarea.traza = msg->traza;
+            tarea.traza->marcas_ns[TRAZA_SERVIDOR_ENCARGADO] = traza_ahora_ns();
         }
     }
+    // Solo el chat está sujeto al límite de tareas pendientes: el control nunca se rechaza
+    if (trabajadores_encolar(SALA(indice_sala)->trabajador, &tarea, tipo == TAREA_MENSAJE ? config.admision_tareas : 0) == -1) {
+        free(tarea.traza);
+        return -1;
+    }
+    return 0;
 }
 
 
 /**
- * @brief Envía una respuesta directa a un cliente.
+ * @brief Envía una respuesta directa a un cliente sin bloquear al despachador.
+ * Si su cola está llena, la respuesta se difiere en el trabajador de su sala.
  */
 void enviar_respuesta_a_cliente(int id_cola_cliente, tipo_mensaje_t tipo, const char* texto) {
-    mensaje_t msg_resp;
-    msg_resp.mtype = tipo;
-    strncpy(msg_resp.texto, texto, MAX_TEXTO);
-    // Se añade el chequeo de EIDRM para no mostrar un error si el cliente ya se desconectó.
-    if (msgsnd(id_cola_cliente, &msg_resp, TAMANO_MENSAJE, 0) == -1 && errno != EIDRM) {
-        perror("enviar_respuesta msgsnd");
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, tipo, 0, NULL, NULL, texto);
+
+    if (transporte_enviar(id_cola_cliente, &trama, tamano) == 0) {
+        CONTADOR_SUMAR(estadisticas_despachador.respuestas, 1);
+        return;
+    }
+    if (errno != EAGAIN) {
+        CONTADOR_SUMAR(estadisticas_despachador.respuestas_fallidas, 1);
+        // Se añade el chequeo de EIDRM para no mostrar un error si el cliente ya se desconectó.
+        if (errno != EIDRM && errno != EINVAL) perror("enviar_respuesta");
+        return;
     }
+
+    int indice_cliente = buscar_cliente_por_id_cola(id_cola_cliente);
+    if (indice_cliente == -1 || CLIENTE(indice_cliente)->indice_sala == -1) { // Sin sala: se descarta
+        CONTADOR_SUMAR(estadisticas_despachador.respuestas_perdidas, 1);
+        return;
+    }
+    CONTADOR_SUMAR(estadisticas_despachador.respuestas_diferidas, 1);
+
+    tarea_t tarea;
+    memset(&tarea, 0, sizeof(tarea));
+    tarea.tipo = TAREA_RESPUESTA;
+    tarea.indice_sala = CLIENTE(indice_cliente)->indice_sala;
+    tarea.id_cola = id_cola_cliente;
+    tarea.tipo_respuesta = tipo;
+    strncpy(tarea.texto, texto, MAX_TEXTO - 1);
+    trabajadores_encolar(SALA(tarea.indice_sala)->trabajador, &tarea, 0);
+}
+
+
+/**
+ * @brief Manejador de SIGALRM: el bucle principal barre las sesiones en su próxima vuelta.
+ */
+void manejar_senal_barrido(int signum) {
+    (void)signum;
+    barrido_pendiente = 1;
+}
+
+
+/**
+ * @brief Manejador de SIGINT/SIGTERM/SIGUSR1: solo pide al bucle principal que termine.
+ * SIGINT (Ctrl+C) cierra del todo; las otras dos piden un reinicio en caliente.
+ */
+void manejar_senal_cierre(int signum) {
+    if (signum != SIGINT) reinicio_en_caliente = 1;
+    servidor_activo = 0;
+}
+
+
+/*
+ * Instantánea del reinicio en caliente: cabecera_estado_t y los almacenes de
+ * clientes y salas volcados tal cual (almacen_volcar), con sus manejadores y
+ * generaciones. La pertenencia sale del indice_sala de cada cliente, y la
+ * secuencia de cada sala va en su propia historia. Los índices hash y lo que
+ * poseen los trabajadores (miembros, anillos, historia en memoria) se rehacen al cargar.
+ */
+typedef struct {
+    uint32_t magia;
+    uint32_t version;
+    uint32_t tamano_cliente;   // Una instantánea de otra versión del servidor no se carga
+    uint32_t tamano_sala;
+    int64_t guardado;          // time() al escribirla, solo informativo
+} cabecera_estado_t;
+
+
+/**
+ * @brief Escribe la instantánea en un temporal y la renombra, para que un corte a
+ * medias no deje un archivo incompleto donde el próximo arranque lo buscaría.
+ * @return 0 si quedó en disco, -1 si no.
+ */
+int guardar_estado(void) {
+    char temporal[PATH_MAX];
+    snprintf(temporal, sizeof(temporal), "%s.tmp", config.ruta_estado);
+    FILE* archivo = fopen(temporal, "wb");
+    if (archivo == NULL) {
+        perror(temporal);
+        return -1;
+    }
+    cabecera_estado_t cabecera = { MAGIA_ESTADO, VERSION_ESTADO, sizeof(cliente_t), sizeof(sala_t), (int64_t)time(NULL) };
+    int resultado = fwrite(&cabecera, sizeof(cabecera), 1, archivo) == 1 &&
+                    almacen_volcar(&almacen_clientes, archivo) == 0 &&
+                    almacen_volcar(&almacen_salas, archivo) == 0 &&
+                    fflush(archivo) == 0 && fsync(fileno(archivo)) == 0 ? 0 : -1;
+    if (fclose(archivo) != 0) resultado = -1;
+    if (resultado == 0 && rename(temporal, config.ruta_estado) == -1) resultado = -1;
+    if (resultado == -1) {
+        perror("guardar_estado");
+        unlink(temporal);
+    }
+    return resultado;
+}
+
+
+// Orden de la cola de salas vacías: la que se vació antes, primero
+static int comparar_vacia_desde(const void* a, const void* b) {
+    time_t desde_a = SALA(*(const int*)a)->vacia_desde;
+    time_t desde_b = SALA(*(const int*)b)->vacia_desde;
+    return (desde_a > desde_b) - (desde_a < desde_b);
 }
 
 
 /**
- * @brief Guarda un mensaje en el archivo de log de la sala (Bonus).
+ * @brief Carga la instantánea si existe y la borra (solo sirve una vez). Rehace los
+ * índices, la cola de salas vacías y, a través de cada trabajador, la pertenencia.
+ * Si no encaja, el servidor arranca vacío y las sesiones que sobrevivan se cierran en el barrido.
  */
-void registrar_mensaje_en_log(const char* nombre_sala, const char* nombre_usuario, const char* texto) {
-    char ruta_archivo[200];
-    snprintf(ruta_archivo, sizeof(ruta_archivo), "%s%s.log", RUTA_PERSISTENCIA, nombre_sala);
-    
-    FILE* archivo_log = fopen(ruta_archivo, "a");
-    if (archivo_log == NULL) {
-        perror("fopen log");
+void restaurar_estado(void) {
+    FILE* archivo = fopen(config.ruta_estado, "rb");
+    if (archivo == NULL) return;
+    struct timespec inicio, fin;
+    clock_gettime(CLOCK_MONOTONIC, &inicio);
+
+    cabecera_estado_t cabecera;
+    int valida = fread(&cabecera, sizeof(cabecera), 1, archivo) == 1 && cabecera.magia == MAGIA_ESTADO &&
+                 cabecera.version == VERSION_ESTADO && cabecera.tamano_cliente == sizeof(cliente_t) &&
+                 cabecera.tamano_sala == sizeof(sala_t) &&
+                 almacen_cargar(&almacen_clientes, archivo) == 0;
+    if (valida && almacen_cargar(&almacen_salas, archivo) == -1) {
+        valida = 0;
+        almacen_liberar_todo(&almacen_clientes);
+        almacen_iniciar(&almacen_clientes, sizeof(cliente_t), config.max_clientes);
+    }
+    fclose(archivo);
+    unlink(config.ruta_estado);
+    if (!valida) {
+        fprintf(stderr, " La instantánea %s no es válida: se arranca sin estado.\n", config.ruta_estado);
         return;
     }
 
-    time_t ahora = time(NULL);
-    char marca_tiempo[20];
-    strftime(marca_tiempo, sizeof(marca_tiempo), "%Y-%m-%d %H:%M:%S", localtime(&ahora));
+    // Salas: lo que era del proceso anterior (punteros, anillo, historia) se descarta
+    time_t ahora = segundos_monotonicos();
+    int num_vacias = 0;
+    for (int i = 0; i < almacen_salas.num_reservados; i++) {
+        sala_t* sala = SALA(i);
+        if (!sala->en_uso) continue;
+        uint64_t secuencia = sala->historia.siguiente;
+        memset(&sala->miembros, 0, sizeof(sala->miembros));
+        sala->anillo = NULL;
+        memset(&sala->historia, 0, sizeof(sala->historia));
+        sala->historia.siguiente = secuencia; // Se entrega al trabajador con cada miembro
+        sala->trabajador = (int)(tabla_hash_cadena(sala->nombre) % (unsigned int)config.num_trabajadores);
+        sala->en_espera_vacia = 0;
+        tabla_insertar(&indice_salas, tabla_hash_cadena(sala->nombre), i);
+        if (sala->num_clientes == 0) {
+            sala->en_espera_vacia = 1;
+            salas_por_liberar[num_vacias++] = i;
+        }
+    }
+    qsort(salas_por_liberar, (size_t)num_vacias, sizeof(int), comparar_vacia_desde);
+    for (int i = 0; i < num_vacias; i++) apuntar_sala_vacia(salas_por_liberar[i]);
+
+    // Clientes: sus colas privadas siguen vivas; cada uno vuelve a su sala sin avisos
+    int restaurados = 0;
+    for (int i = 0; i < almacen_clientes.num_reservados; i++) {
+        cliente_t* cliente = CLIENTE(i);
+        if (!cliente->en_uso) continue;
+        cliente->ultimo_latido = ahora; // La pausa del reinicio no cuenta como silencio
+        tabla_insertar(&indice_clientes, tabla_hash_entero(cliente->id_cola), i);
+        restaurados++;
+        if (cliente->indice_sala == -1) continue;
+
+        tarea_t tarea;
+        memset(&tarea, 0, sizeof(tarea));
+        tarea.tipo = TAREA_RESTAURAR;
+        tarea.indice_sala = cliente->indice_sala;
+        tarea.id_cola = cliente->id_cola;
+        tarea.secuencia = SALA(cliente->indice_sala)->historia.siguiente;
+        memcpy(tarea.nombre_usuario, cliente->nombre_usuario, MAX_NOMBRE);
+        trabajadores_encolar(SALA(cliente->indice_sala)->trabajador, &tarea, 0);
+    }
 
-    fprintf(archivo_log, "[%s] %s: %s\n", marca_tiempo, nombre_usuario, texto);
-    fclose(archivo_log);
+    clock_gettime(CLOCK_MONOTONIC, &fin);
+    printf(" Estado restaurado: %d sesiones y %d salas en %.2f ms (instantánea de hace %lld s).\n", restaurados,
+           almacen_salas.num_en_uso, (double)(fin.tv_sec - inicio.tv_sec) * 1e3 + (double)(fin.tv_nsec - inicio.tv_nsec) / 1e6,
+           (long long)(time(NULL) - cabecera.guardado));
 }
 
 
 /**
- * @brief Limpia la cola de mensajes del servidor antes de salir.
+ * @brief Termina los trabajadores, vacía el historial pendiente y limpia la cola
+ * de mensajes del servidor antes de salir. En un reinicio en caliente guarda antes
+ * la instantánea y deja la cola (con lo que ya traiga) para el siguiente proceso.
  */
-void finalizar_servidor(int signum) {
-    
-    (void)signum; 
+void finalizar_servidor(void) {
     printf("\n Cerrando el servidor...\n");
-    if (id_cola_servidor != -1) {
-        if (msgctl(id_cola_servidor, IPC_RMID, NULL) == -1) {
-            perror("msgctl cleanup");
+    estadisticas_finalizar_volcado(); // Último volcado, mientras los contadores siguen vivos
+    trabajadores_finalizar();  // Terminan lo que ya tenían encolado
+    registro_finalizar();      // No se pierde ninguna línea encolada antes del cierre
+    if (config.ruta_captura != NULL) {
+        printf(" Captura cerrada: %llu solicitudes en %s.\n", (unsigned long long)captura_cerrar(), config.ruta_captura);
+    }
+    if (config.ruta_traza != NULL) {
+        printf(" Traza cerrada: %llu etapas en %s.\n", (unsigned long long)traza_cerrar(), config.ruta_traza);
+    }
+
+    int conservar = 0;
+    if (reinicio_en_caliente) {
+        if (config.transporte != TRANSPORTE_SYSV) {
+            fprintf(stderr, " El reinicio en caliente necesita -u sysv: las conexiones Unix no sobreviven al proceso.\n");
         } else {
-            printf(" Cola del servidor eliminada correctamente.\n");
+            liberar_salas_eliminadas(); // Las que los trabajadores acaban de desmontar
+            conservar = guardar_estado() == 0;
         }
     }
-    exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+    if (transporte_servidor_cerrar(conservar) == 0) {
+        if (conservar) printf(" Estado guardado en %s; la cola del servidor se conserva para el reinicio.\n", config.ruta_estado);
+        else printf(config.transporte == TRANSPORTE_SYSV ? " Cola del servidor eliminada correctamente.\n"
+                                                         : " Socket del servidor cerrado correctamente.\n");
+    }
+}
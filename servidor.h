@@ -0,0 +1,200 @@
+#ifndef SERVIDOR_H
+#define SERVIDOR_H
+
+#include "common.h"
+#include "registro.h"
+#include "tablas.h"
+#include "anillo.h"
+#include "estadisticas.h"
+#include "historia.h"
+#include "transporte.h"
+#include "busqueda.h"
+#include "limitador.h"
+#include "captura.h"
+#include "miembros.h"
+#include "traza.h"
+
+/*
+ * Declaraciones compartidas por los módulos del servidor.
+ *
+ * Reparto de trabajo: el hilo principal (despachador) recibe de la cola del
+ * servidor, mantiene las sesiones y el registro de salas, y reparte el trabajo
+ * de cada sala al hilo trabajador que la posee (trabajadores.c). Cada
+ * trabajador es el único que toca la pertenencia de sus salas, la difusión y
+ * los envíos diferidos de sus miembros, así que las salas no compiten entre sí.
+ */
+
+// Qué hacer cuando el buffer de envíos diferidos de un cliente está lleno
+typedef enum {
+    DESBORDE_DESCARTAR_ANTIGUO = 0,
+    DESBORDE_DESCARTAR_NUEVO,
+    DESBORDE_DESCONECTAR,
+} politica_desborde_t;
+
+// Cómo llegan las notificaciones de una sala a sus miembros
+typedef enum {
+    DIFUSION_COLAS = 0,   // Una copia por miembro en su cola privada
+    DIFUSION_ANILLO,      // Una sola copia en el anillo compartido de la sala (anillo.h)
+} modo_difusion_t;
+
+// Configuración del servidor leída de la línea de comandos
+typedef struct {
+    registro_config_t registro;
+    tipo_transporte_t transporte;   // Cola System V (defecto) o sockets Unix
+    int max_clientes;
+    int max_salas;
+    int max_pendientes;             // Tamaño del buffer de envíos diferidos por cliente
+    politica_desborde_t desborde;
+    int num_trabajadores;
+    int ventana_lote_us;            // Espera máxima para agrupar notificaciones por destinatario
+    modo_difusion_t difusion;
+    int ranuras_anillo;             // Mensajes que guarda el anillo de cada sala
+    const char* ruta_estadisticas;  // Volcado periódico del informe (NULL = desactivado)
+    int intervalo_estadisticas_s;
+    int capacidad_historia;         // Mensajes recientes que guarda en memoria cada sala
+    int repetir_al_unirse;          // Mensajes que se reenvían al unirse (0 = ninguno)
+    int rafaga_control;             // Solicitudes de control seguidas antes de dar turno al chat
+    int admision_pct;               // Ocupación de la cola del servidor que adelanta el descarte (0 = nunca)
+    int admision_tareas;            // Tareas pendientes desde las que se rechaza todo el chat (0 = nunca)
+    int barrido_s;                  // Segundos entre barridos de sesiones caídas (0 = sin barrido)
+    int plazo_latido_s;             // Silencio tras el que una sesión con pid se da por muerta
+    int gracia_sala_s;              // Tiempo que una sala vacía espera antes de eliminarse
+    int limite_cliente, rafaga_cliente; // Mensajes por segundo de cada cliente (0 = sin límite) y ráfaga
+    int limite_sala, rafaga_sala;       // Lo mismo para todos los miembros de una sala juntos
+    const char* ruta_estado;        // Instantánea del reinicio en caliente
+    const char* ruta_captura;       // Captura del tráfico de entrada (NULL = desactivada)
+    const char* ruta_traza;         // Etapas de los mensajes trazados, en JSON de Chrome (NULL = desactivado)
+    int particion, num_particiones; // Salas que atiende este proceso (common.h, particion_de_sala)
+} config_servidor_t;
+
+typedef struct {
+    // Registro de salas: lo escribe solo el despachador
+    char nombre[MAX_NOMBRE];
+    int trabajador;          // Hilo dueño de la sala
+    int num_clientes;        // Miembros según el despachador (para /list)
+    int en_uso;              // 0 desde que se decide eliminarla hasta que se libera su hueco
+    int en_espera_vacia;     // Figura en la cola de salas vacías del despachador
+    time_t vacia_desde;      // Segundos de CLOCK_MONOTONIC en que se quedó sin miembros
+    cubeta_t limite;         // Mensajes por segundo de toda la sala (limitador.h)
+
+    // Pertenencia: la escribe solo el hilo trabajador dueño
+    miembros_sala_t miembros; // Destinos y manejadores en el almacén de miembros del trabajador
+    anillo_escritor_t* anillo; // Modo anillo: se crea con el primer miembro
+    historia_t historia;     // Se carga con el primer miembro
+} sala_t;
+
+// Trabajo que el despachador encarga al trabajador dueño de una sala
+typedef enum {
+    TAREA_UNIRSE = 1,
+    TAREA_RESTAURAR,         // Reinicio en caliente: vuelve a añadir al miembro sin avisar a nadie
+    TAREA_ABANDONAR,
+    TAREA_MENSAJE,
+    TAREA_LISTAR_USUARIOS,
+    TAREA_HISTORIAL,
+    TAREA_BUSCAR,
+    TAREA_FRAGMENTO,         // Trozo de una transferencia: va a una cola aparte del trabajador
+    TAREA_RESPUESTA,         // Respuesta que no cupo en la cola del cliente: se difiere allí
+    TAREA_ELIMINAR_SALA,     // La sala quedó vacía: liberar sus recursos y devolver el hueco
+    TAREA_TERMINAR,
+} tipo_tarea_t;
+
+typedef struct {
+    tipo_tarea_t tipo;
+    int indice_sala;
+    int id_cola;             // Cola privada del cliente que origina la tarea
+    int notificar;           // TAREA_ABANDONAR: confirmar la salida al cliente
+    long tipo_respuesta;     // TAREA_RESPUESTA
+    uint32_t id_sesion;      // TAREA_UNIRSE: identificadores que se entregan al cliente
+    uint32_t id_sala;
+    uint64_t secuencia;      // TAREA_RESTAURAR: siguiente secuencia de la sala según la instantánea
+    trama_t* trama;          // TAREA_FRAGMENTO: trama para los miembros, ya construida (la libera el trabajador)
+    size_t tamano_trama;
+    traza_t* traza;          // TAREA_MENSAJE trazado: sus marcas (la libera el trabajador); NULL casi siempre
+    char nombre_usuario[MAX_NOMBRE];
+    char texto[MAX_TEXTO];   // TAREA_FRAGMENTO: la confirmación para el emisor
+} tarea_t;
+
+// Contadores del despachador (solo los escribe el hilo principal)
+#define NUM_TIPOS_SOLICITUD (TIPO_FRAGMENTO + 1)
+typedef struct {
+    uint64_t solicitudes[NUM_TIPOS_SOLICITUD]; // Por mtype; 0 cuenta los tipos desconocidos
+    uint64_t tramas_invalidas;
+    histograma_t solicitud_ns;                 // Tiempo de atención de cada solicitud
+    uint64_t respuestas;
+    uint64_t respuestas_diferidas;             // Cola llena: pasan al trabajador de la sala
+    uint64_t respuestas_perdidas;              // Cola llena y sin sala donde diferirlas
+    uint64_t respuestas_fallidas;              // msgsnd con otro error
+    uint64_t chat_por_turno;                   // Mensajes atendidos con control aún pendiente
+    uint64_t chat_rechazado;                   // Rechazados por el control de admisión
+    uint64_t chat_caducado;                    // Con un id de sesión o de sala ya no válido
+    uint64_t chat_limitado_cliente;            // Por encima del límite de su autor
+    uint64_t chat_limitado_sala;               // Por encima del límite de la sala
+    uint64_t fragmentos_rechazados;            // Sesión o sala caducadas, o transferencia demasiado grande
+    uint64_t bytes_transferidos;               // Datos de los fragmentos encargados a las salas
+    uint64_t barridos;                         // Barridos de sesiones caídas
+    uint64_t sesiones_caidas;                  // Sesiones cerradas por el barrido
+    uint64_t colas_eliminadas;                 // Colas abandonadas borradas con IPC_RMID
+    uint64_t salas_creadas;
+    uint64_t salas_eliminadas;                 // Vacías durante más de la gracia
+} estadisticas_despachador_t;
+
+// Contadores de un trabajador (solo los escribe ese hilo)
+typedef struct {
+    uint64_t tareas;
+    uint64_t difusiones;
+    histograma_t destinatarios;                // Miembros alcanzados por difusión
+    uint64_t envios;                           // msgsnd correctos a clientes
+    uint64_t envios_diferidos;                 // Cola del cliente llena (EAGAIN)
+    uint64_t envios_fallidos;                  // msgsnd con otro error
+    uint64_t envios_descartados;               // Perdidos por la política de desborde
+    uint64_t expulsiones;
+    uint64_t tramas_lote;                      // Tramas TIPO_NOTIFICACION_LOTE enviadas
+    histograma_t busqueda_ns;                  // /search: consulta del índice y lectura de los textos
+    uint64_t busqueda_sin_texto;               // Resultados cuyo segmento ya borró la retención
+    uint64_t fragmentos;                       // Trozos de transferencias repartidos
+    uint64_t fragmentos_retenidos;             // Vueltas en que un trozo esperó a un miembro con diferidos
+} estadisticas_trabajador_t;
+
+extern config_servidor_t config;
+extern estadisticas_despachador_t estadisticas_despachador;
+extern almacen_t almacen_salas;
+
+#define SALA(manejador) ((sala_t*)almacen_obtener(&almacen_salas, (manejador)))
+
+/**
+ * @brief Arranca config.num_trabajadores hilos trabajadores.
+ * @return 0 si todos arrancaron, -1 en caso de error.
+ */
+int trabajadores_iniciar(void);
+
+/**
+ * @brief Entrega una tarea al trabajador indicado. Nunca bloquea al despachador.
+ * @param limite Si es mayor que 0, la tarea se rechaza cuando el trabajador ya tiene
+ * tantas pendientes; en un TAREA_FRAGMENTO cuentan solo los trozos de la misma cola.
+ * @return 0 si se encoló, -1 si se rechazó por el límite (errno = EAGAIN) o no hubo memoria (ENOMEM).
+ */
+int trabajadores_encolar(int trabajador, const tarea_t* tarea, int limite);
+
+/**
+ * @brief Tareas (sin contar los trozos) que esperan en la cola del trabajador.
+ */
+int trabajadores_pendientes(int trabajador);
+
+/**
+ * @brief Recoge las salas cuyos recursos ya liberó su trabajador (TAREA_ELIMINAR_SALA).
+ * Solo la llama el despachador, que es quien libera sus huecos.
+ * @return Cuántos manejadores se copiaron en salas (como mucho max).
+ */
+int trabajadores_salas_eliminadas(int* salas, int max);
+
+/**
+ * @brief Pide a los trabajadores que terminen lo encolado y espera a que salgan.
+ */
+void trabajadores_finalizar(void);
+
+/**
+ * @brief Contadores de un trabajador, para leer con CONTADOR_LEER.
+ */
+const estadisticas_trabajador_t* trabajadores_estadisticas(int trabajador);
+
+#endif // SERVIDOR_H
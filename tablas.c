@@ -0,0 +1,233 @@
+#include "tablas.h"
+#include <stdlib.h>
+#include <string.h>
+
+int almacen_iniciar(almacen_t* almacen, size_t tamano_elemento, int limite) {
+    memset(almacen, 0, sizeof(*almacen));
+    almacen->tamano_elemento = tamano_elemento;
+    almacen->limite = limite;
+    if (limite > ALMACEN_MAX_ELEMENTOS) return -1;
+
+    // El directorio se dimensiona una sola vez para el límite: así nunca se mueve y otros
+    // hilos pueden leer elementos ya publicados mientras el dueño reserva páginas nuevas
+    almacen->capacidad_paginas = (limite + ALMACEN_TAMANO_PAGINA - 1) / ALMACEN_TAMANO_PAGINA;
+    almacen->paginas = calloc((size_t)almacen->capacidad_paginas, sizeof(char*));
+    return almacen->paginas == NULL ? -1 : 0;
+}
+
+void almacen_liberar_todo(almacen_t* almacen) {
+    for (int i = 0; i < almacen->num_paginas; i++) free(almacen->paginas[i]);
+    free(almacen->paginas);
+    free(almacen->libres);
+    free(almacen->generaciones);
+    memset(almacen, 0, sizeof(*almacen));
+}
+
+int almacen_reservar(almacen_t* almacen) {
+    if (almacen->num_en_uso >= almacen->limite) return -1;
+
+    int manejador;
+    if (almacen->num_libres > 0) {
+        manejador = almacen->libres[--almacen->num_libres];
+    } else {
+        manejador = almacen->num_reservados;
+        int pagina = manejador >> ALMACEN_BITS_PAGINA;
+        if (pagina >= almacen->num_paginas) {
+            // Página nueva; las existentes no se mueven. Primero crecen los arrays de
+            // huecos y después se reserva la página: num_paginas solo avanza si todo salió
+            // bien, así que un fallo deja el almacén como estaba (con los arrays más holgados)
+            if (pagina >= almacen->capacidad_paginas) return -1;
+            size_t huecos = (size_t)(pagina + 1) * ALMACEN_TAMANO_PAGINA;
+            int* libres = realloc(almacen->libres, huecos * sizeof(int));
+            if (libres == NULL) return -1;
+            almacen->libres = libres;
+            uint16_t* generaciones = realloc(almacen->generaciones, huecos * sizeof(uint16_t));
+            if (generaciones == NULL) return -1;
+            for (size_t i = huecos - ALMACEN_TAMANO_PAGINA; i < huecos; i++) generaciones[i] = 1;
+            almacen->generaciones = generaciones;
+
+            almacen->paginas[pagina] = malloc(ALMACEN_TAMANO_PAGINA * almacen->tamano_elemento);
+            if (almacen->paginas[pagina] == NULL) return -1;
+            almacen->num_paginas = pagina + 1;
+        }
+        almacen->num_reservados++;
+    }
+    almacen->num_en_uso++;
+    memset(almacen_obtener(almacen, manejador), 0, almacen->tamano_elemento);
+    return manejador;
+}
+
+void almacen_liberar(almacen_t* almacen, int manejador) {
+    // Los identificadores entregados de este hueco caducan; la generación 0 no se usa
+    uint16_t generacion = (uint16_t)((almacen->generaciones[manejador] + 1) & ALMACEN_MASCARA_GENERACION);
+    almacen->generaciones[manejador] = generacion ? generacion : 1;
+    almacen->libres[almacen->num_libres++] = manejador;
+    almacen->num_en_uso--;
+}
+
+int almacen_volcar(const almacen_t* almacen, FILE* archivo) {
+    int32_t cabecera[3] = { (int32_t)almacen->tamano_elemento, almacen->num_reservados, almacen->num_libres };
+    if (fwrite(cabecera, sizeof(cabecera), 1, archivo) != 1) return -1;
+    size_t n = (size_t)almacen->num_reservados;
+    if (n == 0) return 0;
+    if (fwrite(almacen->generaciones, sizeof(uint16_t), n, archivo) != n) return -1;
+    if (almacen->num_libres > 0 &&
+        fwrite(almacen->libres, sizeof(int), (size_t)almacen->num_libres, archivo) != (size_t)almacen->num_libres) {
+        return -1;
+    }
+    // Página a página: los elementos de cada una son contiguos
+    for (size_t inicio = 0; inicio < n; inicio += ALMACEN_TAMANO_PAGINA) {
+        size_t cuantos = n - inicio < ALMACEN_TAMANO_PAGINA ? n - inicio : ALMACEN_TAMANO_PAGINA;
+        if (fwrite(almacen->paginas[inicio >> ALMACEN_BITS_PAGINA], almacen->tamano_elemento, cuantos, archivo) != cuantos) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Cuerpo de almacen_cargar; si falla, quien llama vacía el almacén
+static int leer_almacen(almacen_t* almacen, FILE* archivo) {
+    int32_t cabecera[3];
+    if (fread(cabecera, sizeof(cabecera), 1, archivo) != 1 || (size_t)cabecera[0] != almacen->tamano_elemento ||
+        cabecera[1] < 0 || cabecera[1] > almacen->limite || cabecera[2] < 0 || cabecera[2] > cabecera[1]) {
+        return -1;
+    }
+    // Reservar en orden crea las páginas y deja los manejadores [0, n) como estaban
+    int n = cabecera[1];
+    for (int i = 0; i < n; i++) {
+        if (almacen_reservar(almacen) != i) return -1;
+    }
+    if (n == 0) return 0;
+    if (fread(almacen->generaciones, sizeof(uint16_t), (size_t)n, archivo) != (size_t)n) return -1;
+    if (cabecera[2] > 0 && fread(almacen->libres, sizeof(int), (size_t)cabecera[2], archivo) != (size_t)cabecera[2]) {
+        return -1;
+    }
+    for (int inicio = 0; inicio < n; inicio += ALMACEN_TAMANO_PAGINA) {
+        size_t cuantos = (size_t)(n - inicio < ALMACEN_TAMANO_PAGINA ? n - inicio : ALMACEN_TAMANO_PAGINA);
+        if (fread(almacen->paginas[inicio >> ALMACEN_BITS_PAGINA], almacen->tamano_elemento, cuantos, archivo) != cuantos) {
+            return -1;
+        }
+    }
+    for (int i = 0; i < cabecera[2]; i++) {
+        if (almacen->libres[i] < 0 || almacen->libres[i] >= n) return -1;
+    }
+    almacen->num_libres = cabecera[2];
+    almacen->num_en_uso = n - cabecera[2];
+    return 0;
+}
+
+int almacen_cargar(almacen_t* almacen, FILE* archivo) {
+    if (leer_almacen(almacen, archivo) == 0) return 0;
+    size_t tamano_elemento = almacen->tamano_elemento;
+    int limite = almacen->limite;
+    almacen_liberar_todo(almacen);
+    almacen_iniciar(almacen, tamano_elemento, limite);
+    return -1;
+}
+
+int tabla_iniciar(tabla_hash_t* tabla, size_t capacidad_inicial, tabla_coincide_fn coincide, void* contexto) {
+    size_t capacidad = 16;
+    while (capacidad < capacidad_inicial * 2) capacidad <<= 1;
+
+    tabla->ranuras = malloc(capacidad * sizeof(tabla_ranura_t));
+    if (tabla->ranuras == NULL) return -1;
+    for (size_t i = 0; i < capacidad; i++) tabla->ranuras[i].manejador = -1;
+    tabla->capacidad = capacidad;
+    tabla->ocupadas = 0;
+    tabla->coincide = coincide;
+    tabla->contexto = contexto;
+    return 0;
+}
+
+void tabla_liberar(tabla_hash_t* tabla) {
+    free(tabla->ranuras);
+    tabla->ranuras = NULL;
+    tabla->capacidad = 0;
+    tabla->ocupadas = 0;
+}
+
+int tabla_buscar(const tabla_hash_t* tabla, unsigned int hash, const void* clave) {
+    size_t mascara = tabla->capacidad - 1;
+    for (size_t i = hash & mascara; ; i = (i + 1) & mascara) {
+        const tabla_ranura_t* ranura = &tabla->ranuras[i];
+        if (ranura->manejador == -1) return -1;
+        if (ranura->hash == hash && tabla->coincide(ranura->manejador, clave, tabla->contexto)) {
+            return ranura->manejador;
+        }
+    }
+}
+
+/**
+ * @brief Coloca una entrada sin comprobar carga (la tabla siempre tiene huecos).
+ */
+static void colocar(tabla_ranura_t* ranuras, size_t capacidad, unsigned int hash, int manejador) {
+    size_t mascara = capacidad - 1;
+    size_t i = hash & mascara;
+    while (ranuras[i].manejador != -1) i = (i + 1) & mascara;
+    ranuras[i].hash = hash;
+    ranuras[i].manejador = manejador;
+}
+
+int tabla_insertar(tabla_hash_t* tabla, unsigned int hash, int manejador) {
+    if ((tabla->ocupadas + 1) * 10 > tabla->capacidad * 7) {
+        size_t nueva_capacidad = tabla->capacidad * 2;
+        tabla_ranura_t* nuevas = malloc(nueva_capacidad * sizeof(tabla_ranura_t));
+        if (nuevas == NULL) return -1;
+        for (size_t i = 0; i < nueva_capacidad; i++) nuevas[i].manejador = -1;
+        for (size_t i = 0; i < tabla->capacidad; i++) {
+            if (tabla->ranuras[i].manejador != -1) {
+                colocar(nuevas, nueva_capacidad, tabla->ranuras[i].hash, tabla->ranuras[i].manejador);
+            }
+        }
+        free(tabla->ranuras);
+        tabla->ranuras = nuevas;
+        tabla->capacidad = nueva_capacidad;
+    }
+    colocar(tabla->ranuras, tabla->capacidad, hash, manejador);
+    tabla->ocupadas++;
+    return 0;
+}
+
+void tabla_eliminar(tabla_hash_t* tabla, unsigned int hash, const void* clave) {
+    size_t mascara = tabla->capacidad - 1;
+    size_t i = hash & mascara;
+    while (1) {
+        tabla_ranura_t* ranura = &tabla->ranuras[i];
+        if (ranura->manejador == -1) return;
+        if (ranura->hash == hash && tabla->coincide(ranura->manejador, clave, tabla->contexto)) break;
+        i = (i + 1) & mascara;
+    }
+
+    // Borrado con desplazamiento hacia atrás: no deja lápidas en la tabla
+    size_t hueco = i;
+    for (size_t j = (i + 1) & mascara; tabla->ranuras[j].manejador != -1; j = (j + 1) & mascara) {
+        size_t ideal = tabla->ranuras[j].hash & mascara;
+        // La entrada j puede ocupar el hueco si su posición ideal no está entre el hueco y j
+        int puede_moverse = (hueco <= j) ? (ideal <= hueco || ideal > j) : (ideal <= hueco && ideal > j);
+        if (puede_moverse) {
+            tabla->ranuras[hueco] = tabla->ranuras[j];
+            hueco = j;
+        }
+    }
+    tabla->ranuras[hueco].manejador = -1;
+    tabla->ocupadas--;
+}
+
+unsigned int tabla_hash_cadena(const char* s) {
+    unsigned int h = 2166136261u; // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+unsigned int tabla_hash_entero(int valor) {
+    unsigned int x = (unsigned int)valor; // Mezclador de 32 bits (lowbias32)
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
@@ -0,0 +1,134 @@
+#ifndef TABLAS_H
+#define TABLAS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Estructuras de soporte del servidor:
+ *  - almacen_t: almacén paginado de elementos de tamaño fijo. Cada elemento se
+ *    identifica por un manejador entero estable: crecer nunca mueve los elementos
+ *    ya reservados y los huecos liberados se reutilizan mediante una lista libre.
+ *    Solo un hilo reserva y libera, pero cualquier hilo puede leer un elemento
+ *    cuyo manejador recibió a través de una sincronización (mutex, cola...).
+ *    Hacia fuera (p. ej. a los clientes) se entrega un identificador que añade
+ *    al manejador la generación del hueco, que avanza al liberarlo: un
+ *    identificador guardado de un elemento ya liberado deja de resolverse.
+ *  - tabla_hash_t: índice hash (direccionamiento abierto, sondeo lineal) que
+ *    asocia una clave a un manejador del almacén. La clave vive en el propio
+ *    elemento; la tabla solo guarda el hash y el manejador.
+ */
+
+#define ALMACEN_BITS_PAGINA 8
+#define ALMACEN_TAMANO_PAGINA (1 << ALMACEN_BITS_PAGINA)
+#define ALMACEN_BITS_INDICE 20   // Identificador: generación (12 bits) | manejador (20 bits)
+#define ALMACEN_MAX_ELEMENTOS (1 << ALMACEN_BITS_INDICE)
+#define ALMACEN_MASCARA_GENERACION 0xFFFu
+
+typedef struct {
+    char** paginas;          // Directorio de páginas de ALMACEN_TAMANO_PAGINA elementos
+    int num_paginas;
+    int capacidad_paginas;   // Tamaño fijo del directorio (cubre el límite)
+    size_t tamano_elemento;
+    int num_reservados;      // Marca de agua: manejadores [0, num_reservados) ya entregados alguna vez
+    int num_en_uso;
+    int limite;              // Máximo de elementos simultáneos (fijado al arrancar)
+    int* libres;             // Pila de manejadores liberados
+    int num_libres;
+    uint16_t* generaciones;  // Generación actual de cada hueco (1..ALMACEN_MASCARA_GENERACION)
+} almacen_t;
+
+// Compara la clave buscada con el elemento identificado por el manejador
+typedef int (*tabla_coincide_fn)(int manejador, const void* clave, void* contexto);
+
+typedef struct {
+    unsigned int hash;
+    int manejador;           // -1 si la ranura está vacía
+} tabla_ranura_t;
+
+typedef struct {
+    tabla_ranura_t* ranuras;
+    size_t capacidad;        // Siempre potencia de dos
+    size_t ocupadas;
+    tabla_coincide_fn coincide;
+    void* contexto;
+} tabla_hash_t;
+
+/**
+ * @return 0 si todo fue bien, -1 si no hay memoria o el límite supera ALMACEN_MAX_ELEMENTOS.
+ */
+int almacen_iniciar(almacen_t* almacen, size_t tamano_elemento, int limite);
+void almacen_liberar_todo(almacen_t* almacen);
+
+/**
+ * @brief Reserva un elemento (puesto a cero).
+ * @return Su manejador, o -1 si se alcanzó el límite o no hay memoria.
+ */
+int almacen_reservar(almacen_t* almacen);
+void almacen_liberar(almacen_t* almacen, int manejador);
+
+/**
+ * @brief Escribe el almacén tal cual (elementos, huecos libres y generaciones), para
+ * que almacen_cargar lo reconstruya con los mismos manejadores e identificadores.
+ * @return 0 si todo fue bien, -1 si falló la escritura.
+ */
+int almacen_volcar(const almacen_t* almacen, FILE* archivo);
+
+/**
+ * @brief Carga en un almacén recién iniciado lo escrito por almacen_volcar. Los
+ * elementos se copian byte a byte: los punteros que contengan debe rehacerlos quien llama.
+ * @return 0 si todo fue bien; -1 si el archivo no encaja (tamaño de elemento, límite)
+ * o está truncado, y entonces el almacén queda vacío.
+ */
+int almacen_cargar(almacen_t* almacen, FILE* archivo);
+
+/**
+ * @brief Dirección del elemento. Es estable mientras el manejador no se libere.
+ */
+static inline void* almacen_obtener(const almacen_t* almacen, int manejador) {
+    return almacen->paginas[manejador >> ALMACEN_BITS_PAGINA]
+         + (size_t)(manejador & (ALMACEN_TAMANO_PAGINA - 1)) * almacen->tamano_elemento;
+}
+
+/**
+ * @brief Identificador externo del elemento (nunca 0): su manejador y la generación del hueco.
+ */
+static inline uint32_t almacen_identificador(const almacen_t* almacen, int manejador) {
+    return ((uint32_t)almacen->generaciones[manejador] << ALMACEN_BITS_INDICE) | (uint32_t)manejador;
+}
+
+/**
+ * @brief Comprueba en O(1) un identificador recibido de fuera.
+ * @return El manejador si el elemento sigue siendo el mismo, -1 si se liberó o no es válido.
+ */
+static inline int almacen_resolver(const almacen_t* almacen, uint32_t identificador) {
+    int manejador = (int)(identificador & (ALMACEN_MAX_ELEMENTOS - 1));
+    if (manejador >= almacen->num_reservados) return -1;
+    return almacen->generaciones[manejador] == identificador >> ALMACEN_BITS_INDICE ? manejador : -1;
+}
+
+int tabla_iniciar(tabla_hash_t* tabla, size_t capacidad_inicial, tabla_coincide_fn coincide, void* contexto);
+void tabla_liberar(tabla_hash_t* tabla);
+
+/**
+ * @brief Busca una clave.
+ * @return El manejador asociado o -1 si no está.
+ */
+int tabla_buscar(const tabla_hash_t* tabla, unsigned int hash, const void* clave);
+
+/**
+ * @brief Inserta un manejador (la clave no debe existir). Crece si la carga supera el 70%.
+ * @return 0 si se insertó, -1 si no hay memoria.
+ */
+int tabla_insertar(tabla_hash_t* tabla, unsigned int hash, int manejador);
+
+/**
+ * @brief Elimina la entrada de la clave, si existe.
+ */
+void tabla_eliminar(tabla_hash_t* tabla, unsigned int hash, const void* clave);
+
+unsigned int tabla_hash_cadena(const char* s);
+unsigned int tabla_hash_entero(int valor);
+
+#endif // TABLAS_H
@@ -0,0 +1,1072 @@
+#include "servidor.h"
+#include <pthread.h>
+
+#define REINTENTO_PENDIENTES_NS 1000000L // Cada cuánto se reintentan los envíos diferidos (1 ms)
+#define TAREAS_POR_VUELTA 64             // Tareas que un trabajador recoge de una sola vez
+#define HISTORIAL_DEFECTO 20             // Mensajes de /history sin número
+#define MAX_HISTORIAL_PEDIDO 1000        // Tope de mensajes por petición de /history
+
+// Copia exacta (solo los bytes usados) de una trama que espera hueco en la cola del cliente
+typedef struct {
+    trama_t* trama;
+    size_t tamano;
+} envio_diferido_t;
+
+// Un cliente visto desde el trabajador que posee su sala actual. Delante va lo que
+// toca cada difusión; el nombre, que casi nunca se lee, vive aparte (trabajador_t.nombres)
+typedef struct {
+    int id_cola;
+    int expulsar;           // Lector lento o cola desaparecida: ya no se le envía nada
+
+    // Notificaciones agrupadas que aún no se han enviado (una trama TIPO_NOTIFICACION_LOTE)
+    int en_lote;            // Figura en miembros_con_lote
+    int lote_registros;
+    size_t lote_usado;      // Bytes de registros ya escritos en lote->datos
+    trama_t* lote;          // Se reserva la primera vez que hace falta
+    long long lote_limite_ns; // Momento (CLOCK_MONOTONIC) en que el lote debe salir
+
+    // Envíos diferidos: tramas que no cupieron en la cola o el socket del cliente (envío sin bloquear)
+    int num_pendientes;
+    int inicio_pendientes;
+    envio_diferido_t* pendientes; // Buffer circular, se reserva la primera vez que hace falta
+    int en_reintento;       // Figura en miembros_con_pendientes
+
+    int indice_sala;
+    int posicion_en_sala;   // Posición dentro de sala_t.miembros, para sacarlo en O(1)
+    unsigned long mensajes_diferidos;
+    unsigned long mensajes_descartados;
+} miembro_t;
+
+// Buffer circular de tareas; crece en lugar de bloquear al despachador
+typedef struct {
+    tarea_t* tareas;
+    int inicio;
+    int num;
+    int capacidad;
+} cola_tareas_t;
+
+typedef struct {
+    int id;
+    pthread_t hilo;
+
+    // Colas de tareas (las llena el despachador). Los trozos de transferencias van
+    // aparte para repartirlos de uno en uno entre las tandas de chat
+    pthread_mutex_t mutex;
+    pthread_cond_t hay_tareas;
+    cola_tareas_t tareas;
+    cola_tareas_t fragmentos;
+
+    // Estado privado del hilo
+    almacen_t miembros;
+    char (*nombres)[MAX_NOMBRE];      // Nombre de cada miembro, por manejador
+    tabla_hash_t indice_miembros;     // id_cola -> manejador de miembro
+    int* miembros_con_pendientes;
+    int num_miembros_con_pendientes;
+    int* miembros_a_expulsar;         // Por id_cola: el miembro puede irse antes de la expulsión
+    int num_miembros_a_expulsar;
+    int* miembros_con_lote;           // Miembros con notificaciones agrupadas sin enviar
+    int num_miembros_con_lote;
+    estadisticas_trabajador_t estadisticas; // Solo las escribe este hilo
+} trabajador_t;
+
+static trabajador_t* trabajadores = NULL;
+
+// Salas ya desmontadas que el despachador debe devolver al almacén (caben todas: max_salas)
+static pthread_mutex_t mutex_salas_eliminadas = PTHREAD_MUTEX_INITIALIZER;
+static int* salas_eliminadas = NULL;
+static int num_salas_eliminadas = 0;
+
+#define MIEMBRO(t, manejador) ((miembro_t*)almacen_obtener(&(t)->miembros, (manejador)))
+
+static void* bucle_trabajador(void* arg);
+static void ejecutar_tarea(trabajador_t* t, tarea_t* tarea);
+static void tarea_unirse(trabajador_t* t, const tarea_t* tarea);
+static void tarea_abandonar(trabajador_t* t, const tarea_t* tarea);
+static void tarea_listar_usuarios(trabajador_t* t, const tarea_t* tarea);
+static void tarea_historial(trabajador_t* t, const tarea_t* tarea);
+static void tarea_buscar(trabajador_t* t, const tarea_t* tarea);
+static void tarea_eliminar_sala(trabajador_t* t, const tarea_t* tarea);
+static void tarea_fragmento(trabajador_t* t, const tarea_t* tarea);
+static int enviar_historia(trabajador_t* t, int indice_miembro, const sala_t* sala, int n);
+static void difundir_notificacion(trabajador_t* t, int indice_sala, const char* texto, int id_cola_excluida);
+static void difundir_trazado(trabajador_t* t, int indice_sala, const char* texto, int id_cola_excluida,
+                             const traza_t* traza);
+static void responder_a_miembro(trabajador_t* t, int indice_miembro, tipo_mensaje_t tipo, const char* texto);
+static void enviar_anillo_a_miembro(trabajador_t* t, int indice_miembro, const sala_t* sala, int conectar);
+static void enviar_a_miembro(trabajador_t* t, int indice_miembro, const trama_t* trama, size_t tamano);
+static void diferir_mensaje(trabajador_t* t, int indice_miembro, const trama_t* trama, size_t tamano);
+static void liberar_pendientes(miembro_t* miembro);
+static void anadir_a_lote(trabajador_t* t, int indice_miembro, const char* texto, size_t longitud, long long ahora);
+static void vaciar_lote(trabajador_t* t, int indice_miembro);
+static long long vaciar_lotes_vencidos(trabajador_t* t, int forzar);
+static void quitar_de_lista(int* lista, int* num, int indice_miembro);
+static void reintentar_envios_pendientes(trabajador_t* t);
+static void expulsar_miembros_lentos(trabajador_t* t);
+static void registrar_mensaje_en_log(sala_t* sala, const char* nombre_usuario, const char* texto, uint64_t traza);
+
+/**
+ * @brief Instante actual de CLOCK_MONOTONIC en nanosegundos.
+ */
+static long long ahora_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief Cuenta un mensaje que el miembro no recibirá (desborde o falta de memoria).
+ */
+static void contar_descarte(trabajador_t* t, miembro_t* miembro) {
+    miembro->mensajes_descartados++;
+    CONTADOR_SUMAR(t->estadisticas.envios_descartados, 1);
+}
+
+/**
+ * @brief Compara un id de cola con el miembro del manejador (para indice_miembros).
+ */
+static int coincide_miembro(int manejador, const void* clave, void* contexto) {
+    trabajador_t* t = contexto;
+    return MIEMBRO(t, manejador)->id_cola == *(const int*)clave;
+}
+
+int trabajadores_iniciar(void) {
+    trabajadores = calloc((size_t)config.num_trabajadores, sizeof(trabajador_t));
+    salas_eliminadas = malloc((size_t)config.max_salas * sizeof(int));
+    if (trabajadores == NULL || salas_eliminadas == NULL) {
+        perror("calloc trabajadores");
+        return -1;
+    }
+
+    // Los trabajadores no atienden señales: Ctrl+C debe interrumpir la espera del despachador
+    sigset_t todas, anteriores;
+    sigfillset(&todas);
+    pthread_sigmask(SIG_BLOCK, &todas, &anteriores);
+
+    int resultado = 0;
+    for (int i = 0; i < config.num_trabajadores && resultado == 0; i++) {
+        trabajador_t* t = &trabajadores[i];
+        t->id = i;
+        pthread_mutex_init(&t->mutex, NULL);
+        pthread_condattr_t atributos;
+        pthread_condattr_init(&atributos);
+        pthread_condattr_setclock(&atributos, CLOCK_MONOTONIC);
+        pthread_cond_init(&t->hay_tareas, &atributos);
+        pthread_condattr_destroy(&atributos);
+
+        t->miembros_con_pendientes = malloc((size_t)config.max_clientes * sizeof(int));
+        t->miembros_a_expulsar = malloc((size_t)config.max_clientes * sizeof(int));
+        t->miembros_con_lote = malloc((size_t)config.max_clientes * sizeof(int));
+        t->nombres = malloc((size_t)config.max_clientes * MAX_NOMBRE);
+        if (almacen_iniciar(&t->miembros, sizeof(miembro_t), config.max_clientes) == -1 ||
+            tabla_iniciar(&t->indice_miembros, 64, coincide_miembro, t) == -1 ||
+            t->miembros_con_pendientes == NULL || t->miembros_a_expulsar == NULL || t->miembros_con_lote == NULL ||
+            t->nombres == NULL) {
+            perror("iniciar trabajador");
+            resultado = -1;
+            break;
+        }
+
+        int error = pthread_create(&t->hilo, NULL, bucle_trabajador, t);
+        if (error != 0) {
+            errno = error;
+            perror("pthread_create trabajador");
+            resultado = -1;
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &anteriores, NULL);
+    return resultado;
+}
+
+/**
+ * @brief Añade una tarea al final de la cola (con el mutex del trabajador tomado).
+ */
+static int cola_meter(cola_tareas_t* cola, const tarea_t* tarea) {
+    if (cola->num == cola->capacidad) {
+        // Se duplica la capacidad y se desenrolla el buffer circular
+        int nueva = cola->capacidad ? cola->capacidad * 2 : 256;
+        tarea_t* ampliado = malloc((size_t)nueva * sizeof(tarea_t));
+        if (ampliado == NULL) {
+            perror("malloc cola de tareas");
+            return -1;
+        }
+        for (int i = 0; i < cola->num; i++) {
+            ampliado[i] = cola->tareas[(cola->inicio + i) % cola->capacidad];
+        }
+        free(cola->tareas);
+        cola->tareas = ampliado;
+        cola->inicio = 0;
+        cola->capacidad = nueva;
+    }
+    cola->tareas[(cola->inicio + cola->num) % cola->capacidad] = *tarea;
+    cola->num++;
+    return 0;
+}
+
+/**
+ * @brief Saca la primera tarea de una cola no vacía.
+ */
+static tarea_t cola_sacar(cola_tareas_t* cola) {
+    tarea_t tarea = cola->tareas[cola->inicio];
+    cola->inicio = (cola->inicio + 1) % cola->capacidad;
+    cola->num--;
+    return tarea;
+}
+
+/**
+ * @brief Trozos en espera que envió el cliente de esa cola (con el mutex del trabajador tomado).
+ */
+static int fragmentos_de_cliente(const cola_tareas_t* cola, int id_cola) {
+    int n = 0;
+    for (int i = 0; i < cola->num; i++) {
+        if (cola->tareas[(cola->inicio + i) % cola->capacidad].id_cola == id_cola) n++;
+    }
+    return n;
+}
+
+int trabajadores_encolar(int trabajador, const tarea_t* tarea, int limite) {
+    trabajador_t* t = &trabajadores[trabajador];
+    int fragmento = tarea->tipo == TAREA_FRAGMENTO;
+    cola_tareas_t* cola = fragmento ? &t->fragmentos : &t->tareas;
+    pthread_mutex_lock(&t->mutex);
+    if (limite > 0 && (fragmento ? fragmentos_de_cliente(cola, tarea->id_cola) : cola->num) >= limite) {
+        pthread_mutex_unlock(&t->mutex);
+        errno = EAGAIN;
+        return -1;
+    }
+    if (cola_meter(cola, tarea) == -1) {
+        pthread_mutex_unlock(&t->mutex);
+        errno = ENOMEM;
+        return -1;
+    }
+    // Se avisa cada vez que una de las dos colas deja de estar vacía: con un trozo
+    // retenido en la otra, el trabajador duerme igual y el chat no debe esperar al reintento
+    if (cola->num == 1) pthread_cond_signal(&t->hay_tareas);
+    pthread_mutex_unlock(&t->mutex);
+    return 0;
+}
+
+int trabajadores_pendientes(int trabajador) {
+    trabajador_t* t = &trabajadores[trabajador];
+    pthread_mutex_lock(&t->mutex);
+    int pendientes = t->tareas.num;
+    pthread_mutex_unlock(&t->mutex);
+    return pendientes;
+}
+
+void trabajadores_finalizar(void) {
+    if (trabajadores == NULL) return;
+
+    tarea_t fin;
+    memset(&fin, 0, sizeof(fin));
+    fin.tipo = TAREA_TERMINAR;
+    for (int i = 0; i < config.num_trabajadores; i++) trabajadores_encolar(i, &fin, 0);
+    for (int i = 0; i < config.num_trabajadores; i++) {
+        trabajador_t* t = &trabajadores[i];
+        pthread_join(t->hilo, NULL);
+        for (int m = 0; m < t->miembros.num_reservados; m++) {
+            liberar_pendientes(MIEMBRO(t, m));
+            free(MIEMBRO(t, m)->lote);
+        }
+        almacen_liberar_todo(&t->miembros);
+        tabla_liberar(&t->indice_miembros);
+        free(t->miembros_con_pendientes);
+        free(t->miembros_a_expulsar);
+        free(t->miembros_con_lote);
+        free(t->nombres);
+        while (t->fragmentos.num > 0) free(cola_sacar(&t->fragmentos).trama);
+        free(t->fragmentos.tareas);
+        free(t->tareas.tareas);
+    }
+    free(trabajadores);
+    trabajadores = NULL;
+    free(salas_eliminadas);
+    salas_eliminadas = NULL;
+}
+
+int trabajadores_salas_eliminadas(int* salas, int max) {
+    pthread_mutex_lock(&mutex_salas_eliminadas);
+    int n = num_salas_eliminadas < max ? num_salas_eliminadas : max;
+    num_salas_eliminadas -= n;
+    memcpy(salas, salas_eliminadas + num_salas_eliminadas, (size_t)n * sizeof(int));
+    pthread_mutex_unlock(&mutex_salas_eliminadas);
+    return n;
+}
+
+const estadisticas_trabajador_t* trabajadores_estadisticas(int trabajador) {
+    return &trabajadores[trabajador].estadisticas;
+}
+
+/**
+ * @brief Indica si el primer trozo en espera puede repartirse ya: ninguno de los
+ * miembros de su sala tiene media cola de envíos diferidos. Así una
+ * transferencia avanza al ritmo del lector más lento y nunca le llena el buffer
+ * que también usa el chat (con el mutex del trabajador tomado). Solo retiene
+ * quien tiene algún diferido, aunque la cola sea de uno (-p 1): el reintento de
+ * esos diferidos es lo que vuelve a despertar al trabajador.
+ */
+static int fragmento_listo(trabajador_t* t) {
+    if (t->fragmentos.num == 0) return 0;
+    const miembros_sala_t* miembros = &SALA(t->fragmentos.tareas[t->fragmentos.inicio].indice_sala)->miembros;
+    int umbral = (config.max_pendientes + 1) / 2;
+    for (int i = 0; i < miembros->num; i++) {
+        int pendientes = MIEMBRO(t, miembros->manejadores[i])->num_pendientes;
+        if (pendientes > 0 && pendientes >= umbral) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Bucle de un trabajador: toma tareas en tandas, envía los lotes de
+ * notificaciones cuya ventana venció y, mientras tenga envíos diferidos, se
+ * despierta periódicamente para reintentarlos. Tras cada tanda reparte como
+ * mucho un trozo de transferencia, de modo que el chat nunca espera detrás de
+ * más de un trozo por vuelta.
+ */
+static void* bucle_trabajador(void* arg) {
+    trabajador_t* t = arg;
+    tarea_t recogidas[TAREAS_POR_VUELTA];
+    int terminar = 0;
+    long long proximo_lote_ns = 0; // 0 = no hay lotes abiertos
+
+    while (!terminar) {
+        pthread_mutex_lock(&t->mutex);
+        int listo = fragmento_listo(t);
+        if (t->tareas.num == 0 && !listo) {
+            // Se duerme hasta la próxima tarea, el próximo lote o el próximo reintento
+            long long limite_ns = proximo_lote_ns;
+            if (t->num_miembros_con_pendientes > 0) {
+                long long reintento_ns = ahora_ns() + REINTENTO_PENDIENTES_NS;
+                if (limite_ns == 0 || reintento_ns < limite_ns) limite_ns = reintento_ns;
+            }
+            if (limite_ns != 0) {
+                struct timespec limite = { (time_t)(limite_ns / 1000000000LL), (long)(limite_ns % 1000000000LL) };
+                pthread_cond_timedwait(&t->hay_tareas, &t->mutex, &limite);
+            } else {
+                // Un trozo retenido implica diferidos pendientes: nunca se llega aquí con él
+                while (t->tareas.num == 0 && t->fragmentos.num == 0) pthread_cond_wait(&t->hay_tareas, &t->mutex);
+            }
+            listo = fragmento_listo(t);
+        }
+        int n = 0;
+        while (t->tareas.num > 0 && n < TAREAS_POR_VUELTA) recogidas[n++] = cola_sacar(&t->tareas);
+        tarea_t fragmento;
+        if (listo) fragmento = cola_sacar(&t->fragmentos);
+        else if (t->fragmentos.num > 0) CONTADOR_SUMAR(t->estadisticas.fragmentos_retenidos, 1);
+        pthread_mutex_unlock(&t->mutex);
+
+        for (int i = 0; i < n; i++) {
+            if (recogidas[i].tipo == TAREA_TERMINAR) {
+                terminar = 1;
+                continue;
+            }
+            ejecutar_tarea(t, &recogidas[i]);
+        }
+        if (listo) ejecutar_tarea(t, &fragmento);
+        // Con ventana 0 todo lo agrupado en esta tanda sale ya; al terminar, también
+        proximo_lote_ns = vaciar_lotes_vencidos(t, config.ventana_lote_us == 0 || terminar);
+        if (t->num_miembros_con_pendientes > 0) reintentar_envios_pendientes(t);
+        expulsar_miembros_lentos(t);
+    }
+    return NULL;
+}
+
+static void ejecutar_tarea(trabajador_t* t, tarea_t* tarea) {
+    CONTADOR_SUMAR(t->estadisticas.tareas, 1);
+    switch (tarea->tipo) {
+        case TAREA_UNIRSE:          tarea_unirse(t, tarea);          break;
+        case TAREA_RESTAURAR:       tarea_unirse(t, tarea);          break;
+        case TAREA_ABANDONAR:       tarea_abandonar(t, tarea);       break;
+        case TAREA_LISTAR_USUARIOS: tarea_listar_usuarios(t, tarea); break;
+        case TAREA_HISTORIAL:       tarea_historial(t, tarea);       break;
+        case TAREA_BUSCAR:          tarea_buscar(t, tarea);          break;
+        case TAREA_FRAGMENTO:       tarea_fragmento(t, tarea);       break;
+        case TAREA_MENSAJE: {
+            char texto_buffer[MAX_TEXTO + MAX_NOMBRE + 5];
+            snprintf(texto_buffer, sizeof(texto_buffer), "[%s]: %s", tarea->nombre_usuario, tarea->texto);
+            if (tarea->traza == NULL) {
+                difundir_notificacion(t, tarea->indice_sala, texto_buffer, tarea->id_cola);
+                registrar_mensaje_en_log(SALA(tarea->indice_sala), tarea->nombre_usuario, tarea->texto, 0);
+                break;
+            }
+            tarea->traza->marcas_ns[TRAZA_TRABAJADOR] = (uint64_t)ahora_ns();
+            difundir_trazado(t, tarea->indice_sala, texto_buffer, tarea->id_cola, tarea->traza);
+            uint64_t repartido = (uint64_t)ahora_ns();
+            registrar_mensaje_en_log(SALA(tarea->indice_sala), tarea->nombre_usuario, tarea->texto, tarea->traza->id);
+            traza_etapas(tarea->traza, ETAPA_DIFUSION, repartido);
+            free(tarea->traza);
+            break;
+        }
+        case TAREA_RESPUESTA: {
+            int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+            if (indice_miembro != -1) responder_a_miembro(t, indice_miembro, (tipo_mensaje_t)tarea->tipo_respuesta, tarea->texto);
+            break;
+        }
+        case TAREA_ELIMINAR_SALA:   tarea_eliminar_sala(t, tarea);   break;
+        case TAREA_TERMINAR:
+            break;
+    }
+}
+
+/**
+ * @brief Añade al cliente a la sala, le confirma la unión y avisa al resto. Al
+ * restaurar una instantánea (TAREA_RESTAURAR) solo rehace la pertenencia.
+ */
+static void tarea_unirse(trabajador_t* t, const tarea_t* tarea) {
+    sala_t* sala = SALA(tarea->indice_sala);
+
+    int indice_miembro = almacen_reservar(&t->miembros);
+    if (indice_miembro == -1) return;
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    miembro->id_cola = tarea->id_cola;
+    memcpy(t->nombres[indice_miembro], tarea->nombre_usuario, MAX_NOMBRE);
+    miembro->indice_sala = tarea->indice_sala;
+    if (tabla_insertar(&t->indice_miembros, tabla_hash_entero(miembro->id_cola), indice_miembro) == -1) {
+        almacen_liberar(&t->miembros, indice_miembro);
+        return;
+    }
+    // Añadir cliente a la sala
+    miembro->posicion_en_sala = miembros_anadir(&sala->miembros, miembro->id_cola, indice_miembro);
+    if (miembro->posicion_en_sala == -1) {
+        perror("realloc miembros de sala");
+        tabla_eliminar(&t->indice_miembros, tabla_hash_entero(miembro->id_cola), &miembro->id_cola);
+        almacen_liberar(&t->miembros, indice_miembro);
+        return;
+    }
+
+    // La historia se carga con el primer miembro; sin memoria para el anillo, solo numera
+    if (!sala->historia.cargada) {
+        // Si la sala existió antes y se eliminó, su secuencia se retoma de lo que ya esté en
+        // disco; solo se espera al escritor si aún tiene entradas o el cierre de esta sala
+        registro_esperar_sala(sala->nombre);
+        char directorio[SEGMENTOS_MAX_RUTA];
+        segmentos_directorio_sala(directorio, sizeof(directorio), sala->nombre);
+        if (historia_iniciar(&sala->historia, directorio, config.capacidad_historia) == -1) perror("historia_iniciar");
+    }
+    // La instantánea manda si el disco se quedó atrás (p. ej. tras una escritura fallida)
+    if (sala->historia.siguiente < tarea->secuencia) {
+        sala->historia.siguiente = sala->historia.secuencia_fria = tarea->secuencia;
+    }
+
+    // Modo anillo: si no se puede crear el segmento, la sala sigue difundiendo por colas
+    if (config.difusion == DIFUSION_ANILLO && sala->anillo == NULL) {
+        sala->anillo = anillo_crear(config.ranuras_anillo);
+    }
+    if (sala->anillo != NULL) enviar_anillo_a_miembro(t, indice_miembro, sala, 1);
+    // El cliente conserva sus identificadores; solo el anillo (nuevo) tenía que saberlo
+    if (tarea->tipo == TAREA_RESTAURAR) return;
+
+    // Los identificadores llegan antes que la confirmación: con ella el cliente ya puede escribir
+    char texto_buffer[MAX_TEXTO];
+    snprintf(texto_buffer, sizeof(texto_buffer), "%u %u", tarea->id_sesion, tarea->id_sala);
+    responder_a_miembro(t, indice_miembro, TIPO_SESION_SALA, texto_buffer);
+    snprintf(texto_buffer, sizeof(texto_buffer), "Te has unido a la sala '%s'.", sala->nombre);
+    responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_EXITO, texto_buffer);
+    // Ponerse al día: lo último de la sala llega antes que cualquier mensaje nuevo
+    if (config.repetir_al_unirse > 0) enviar_historia(t, indice_miembro, sala, config.repetir_al_unirse);
+
+    snprintf(texto_buffer, sizeof(texto_buffer), "[SISTEMA] %s se ha unido a la sala.", tarea->nombre_usuario);
+    difundir_notificacion(t, tarea->indice_sala, texto_buffer, tarea->id_cola);
+    registrar_mensaje_en_log(sala, "SISTEMA", texto_buffer, 0);
+}
+
+/**
+ * @brief Saca al cliente de la sala y avisa al resto.
+ */
+static void tarea_abandonar(trabajador_t* t, const tarea_t* tarea) {
+    int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+    if (indice_miembro == -1) return;
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    sala_t* sala = SALA(miembro->indice_sala);
+
+    // Eliminar al cliente de la sala: el último ocupa su hueco y se actualiza su posición
+    int movido = miembros_quitar(&sala->miembros, miembro->posicion_en_sala);
+    if (movido != -1) MIEMBRO(t, movido)->posicion_en_sala = miembro->posicion_en_sala;
+
+    // Lo agrupado para él sale antes de la confirmación; luego el lote ya no hace falta
+    vaciar_lote(t, indice_miembro);
+    free(miembro->lote);
+    miembro->lote = NULL;
+
+    // Notificar al cliente (si es necesario) y a los demás
+    if (tarea->notificar) {
+        responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_EXITO, "Has abandonado la sala.");
+        if (sala->anillo != NULL) enviar_anillo_a_miembro(t, indice_miembro, sala, 0);
+        reintentar_envios_pendientes(t);
+    }
+
+    char texto_buffer[MAX_TEXTO];
+    snprintf(texto_buffer, sizeof(texto_buffer), "[SISTEMA] %s ha abandonado la sala.", t->nombres[indice_miembro]);
+    // Ya no es miembro; en modo anillo aún puede estar leyéndolo, así que se le excluye
+    difundir_notificacion(t, miembro->indice_sala, texto_buffer, miembro->id_cola);
+    registrar_mensaje_en_log(sala, "SISTEMA", texto_buffer, 0);
+
+    printf("ℹ Cliente %s ha salido de la sala %s (diferidos: %lu, descartados: %lu)\n",
+           t->nombres[indice_miembro], sala->nombre, miembro->mensajes_diferidos, miembro->mensajes_descartados);
+
+    // Lo que quede diferido era de esta sala: ya no tiene destinatario aquí
+    if (miembro->en_reintento) {
+        quitar_de_lista(t->miembros_con_pendientes, &t->num_miembros_con_pendientes, indice_miembro);
+    }
+    liberar_pendientes(miembro);
+    tabla_eliminar(&t->indice_miembros, tabla_hash_entero(miembro->id_cola), &miembro->id_cola);
+    almacen_liberar(&t->miembros, indice_miembro);
+}
+
+/**
+ * @brief Desmonta una sala vacía: anillo, historia, lista de miembros y su segmento
+ * de historial. Después su hueco vuelve al despachador, que es quien lo libera.
+ */
+static void tarea_eliminar_sala(trabajador_t* t, const tarea_t* tarea) {
+    sala_t* sala = SALA(tarea->indice_sala);
+    // Los trozos que aún esperan no pueden quedarse apuntando a un hueco que se reutilizará
+    pthread_mutex_lock(&t->mutex);
+    for (int i = t->fragmentos.num; i > 0; i--) {
+        tarea_t fragmento = cola_sacar(&t->fragmentos);
+        if (fragmento.indice_sala == tarea->indice_sala) free(fragmento.trama);
+        else cola_meter(&t->fragmentos, &fragmento); // Cabe: acaba de salir uno
+    }
+    pthread_mutex_unlock(&t->mutex);
+    // Los abandonos de sus miembros llegaron antes por esta misma cola de tareas
+    anillo_destruir(sala->anillo); // Marcado para borrado: desaparece con el último cliente
+    sala->anillo = NULL;
+    historia_liberar(&sala->historia);
+    miembros_liberar(&sala->miembros);
+    registro_cerrar_sala(sala->nombre);
+
+    pthread_mutex_lock(&mutex_salas_eliminadas);
+    salas_eliminadas[num_salas_eliminadas++] = tarea->indice_sala;
+    pthread_mutex_unlock(&mutex_salas_eliminadas);
+}
+
+/**
+ * @brief Reparte un trozo de transferencia al resto de la sala y confirma al
+ * emisor que ya salió, lo que le abre hueco en su ventana. Si el emisor ya no
+ * está en la sala, el trozo se descarta: su cliente canceló al cambiar de sala.
+ */
+static void tarea_fragmento(trabajador_t* t, const tarea_t* tarea) {
+    int indice_emisor = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+    if (indice_emisor != -1 && MIEMBRO(t, indice_emisor)->indice_sala == tarea->indice_sala) {
+        const miembros_sala_t* miembros = &SALA(tarea->indice_sala)->miembros;
+        CONTADOR_SUMAR(t->estadisticas.fragmentos, 1);
+        for (int i = 0; i < miembros->num; i++) {
+            if (miembros->destinos[i] != tarea->id_cola) {
+                enviar_a_miembro(t, miembros->manejadores[i], tarea->trama, tarea->tamano_trama);
+            }
+        }
+        responder_a_miembro(t, indice_emisor, TIPO_FRAGMENTO_CONFIRMADO, tarea->texto);
+    }
+    free(tarea->trama);
+}
+
+/**
+ * @brief Envía la lista de usuarios de la sala al cliente que la pidió.
+ */
+static void tarea_listar_usuarios(trabajador_t* t, const tarea_t* tarea) {
+    int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+    if (indice_miembro == -1) return;
+    sala_t* sala = SALA(tarea->indice_sala);
+
+    char buffer[MAX_TEXTO * 2];
+    char* ptr = buffer;
+    size_t remaining_size = sizeof(buffer);
+    int written;
+
+    written = snprintf(ptr, remaining_size, "Usuarios en '%s':\n", sala->nombre);
+    ptr += written;
+    remaining_size -= written;
+
+    for (int i = 0; i < sala->miembros.num; i++) {
+        written = snprintf(ptr, remaining_size, " - %s\n", t->nombres[sala->miembros.manejadores[i]]);
+
+
+        if ((size_t)written >= remaining_size) {
+            break; // Buffer lleno.
+        }
+        ptr += written;
+        remaining_size -= written;
+    }
+    responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_EXITO, buffer);
+}
+
+/**
+ * @brief Responde a /history con los últimos mensajes de la sala.
+ */
+static void tarea_historial(trabajador_t* t, const tarea_t* tarea) {
+    int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+    if (indice_miembro == -1) return;
+
+    int n = tarea->texto[0] != '\0' ? atoi(tarea->texto) : HISTORIAL_DEFECTO;
+    if (n <= 0) {
+        responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_ERROR, "Uso: /history [N], con N mayor que cero.");
+        return;
+    }
+    if (n > MAX_HISTORIAL_PEDIDO) n = MAX_HISTORIAL_PEDIDO;
+    if (enviar_historia(t, indice_miembro, SALA(tarea->indice_sala), n) == 0) {
+        responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_EXITO, "No hay mensajes en el historial de la sala.");
+    }
+}
+
+// Tramas TIPO_NOTIFICACION_LOTE que se van llenando al recorrer la historia
+typedef struct {
+    trabajador_t* t;
+    int indice_miembro;
+    trama_t trama;
+    size_t usado;
+} envio_historia_t;
+
+static void enviar_tramo_historia(envio_historia_t* envio) {
+    if (envio->usado == 0) return;
+    envio->trama.mtype = TIPO_NOTIFICACION_LOTE;
+    envio->trama.cabecera.tipo = TIPO_NOTIFICACION_LOTE;
+    envio->trama.cabecera.id_cola_cliente = 0;
+    envio->trama.cabecera.longitud_usuario = 0;
+    envio->trama.cabecera.longitud_sala = 0;
+    envio->trama.cabecera.banderas = 0;
+    envio->trama.cabecera.longitud_texto = (uint16_t)envio->usado;
+    CONTADOR_SUMAR(envio->t->estadisticas.tramas_lote, 1);
+    enviar_a_miembro(envio->t, envio->indice_miembro, &envio->trama, sizeof(cabecera_trama_t) + envio->usado);
+    envio->usado = 0;
+}
+
+static void anadir_a_tramo_historia(envio_historia_t* envio, const char* texto, size_t longitud) {
+    size_t necesario = sizeof(longitud_registro_lote_t) + longitud;
+    if (envio->usado + necesario > MAX_DATOS_TRAMA) enviar_tramo_historia(envio);
+    longitud_registro_lote_t cabecera = (longitud_registro_lote_t)longitud;
+    memcpy(envio->trama.datos + envio->usado, &cabecera, sizeof(cabecera));
+    memcpy(envio->trama.datos + envio->usado + sizeof(cabecera), texto, longitud);
+    envio->usado += necesario;
+}
+
+static void visitar_historia(uint64_t secuencia, const char* texto, size_t longitud, void* contexto) {
+    (void)secuencia;
+    anadir_a_tramo_historia(contexto, texto, longitud);
+}
+
+/**
+ * @brief Envía al miembro, en tramas de lote completas, los últimos n mensajes de la sala.
+ * @return Cuántos mensajes se enviaron.
+ */
+static int enviar_historia(trabajador_t* t, int indice_miembro, const sala_t* sala, int n) {
+    if (!sala->historia.cargada) return 0;
+    vaciar_lote(t, indice_miembro); // Lo ya agrupado para él va antes
+
+    envio_historia_t envio;
+    envio.t = t;
+    envio.indice_miembro = indice_miembro;
+    envio.usado = 0;
+    char texto[MAX_TEXTO];
+    int longitud = snprintf(texto, sizeof(texto), "[HISTORIAL] Últimos mensajes de '%s':", sala->nombre);
+    anadir_a_tramo_historia(&envio, texto, (size_t)longitud);
+
+    int enviados = historia_recorrer(&sala->historia, n, visitar_historia, &envio);
+    if (enviados == 0) return 0; // Solo estaba la cabecera, aún sin enviar
+
+    longitud = snprintf(texto, sizeof(texto), "[HISTORIAL] Fin (%d mensajes).", enviados);
+    anadir_a_tramo_historia(&envio, texto, (size_t)longitud);
+    enviar_tramo_historia(&envio);
+    return enviados;
+}
+
+// Un resultado de /search, leído de los segmentos de su sala
+typedef struct {
+    envio_historia_t* envio;
+    const char* sala;
+    int encontrado;
+} lectura_resultado_t;
+
+static void visitar_resultado(const registro_segmento_t* registro, const char* usuario, const char* texto,
+                              void* contexto) {
+    lectura_resultado_t* lectura = contexto;
+    char linea[MAX_NOMBRE + HISTORIA_MAX_TEXTO];
+    int prefijo = snprintf(linea, sizeof(linea), "#%s ", lectura->sala);
+    size_t longitud = historia_formatear(linea + prefijo, sizeof(linea) - (size_t)prefijo, (time_t)registro->marca,
+                                         usuario, registro->longitud_usuario, texto, registro->longitud_texto);
+    anadir_a_tramo_historia(lectura->envio, linea, (size_t)prefijo + longitud);
+    lectura->encontrado = 1;
+}
+
+/**
+ * @brief Responde a /search con una página de resultados, del más reciente al más
+ * antiguo, y el comando que pide la página siguiente si queda alguno.
+ */
+static void tarea_buscar(trabajador_t* t, const tarea_t* tarea) {
+    int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(tarea->id_cola), &tarea->id_cola);
+    if (indice_miembro == -1) return;
+    consulta_t consulta;
+    if (busqueda_analizar(tarea->texto, &consulta) == -1) {
+        responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_ERROR,
+                            "Uso: /search <términos> [#sala] [@usuario]; los términos tienen al menos 2 letras.");
+        return;
+    }
+    long long inicio = ahora_ns();
+    char descripcion[MAX_TEXTO];
+    busqueda_describir(&consulta, descripcion, sizeof(descripcion));
+
+    resultado_busqueda_t resultados[BUSQUEDA_POR_PAGINA];
+    int hay_mas;
+    int n = busqueda_consultar(&consulta, resultados, BUSQUEDA_POR_PAGINA, &hay_mas);
+    char texto[MAX_TEXTO + 64];
+    if (n == 0) {
+        snprintf(texto, sizeof(texto), "Sin resultados para '%s'.", descripcion);
+        responder_a_miembro(t, indice_miembro, TIPO_RESPUESTA_EXITO, texto);
+        histograma_registrar(&t->estadisticas.busqueda_ns, (uint64_t)(ahora_ns() - inicio));
+        return;
+    }
+
+    vaciar_lote(t, indice_miembro);
+    envio_historia_t envio;
+    envio.t = t;
+    envio.indice_miembro = indice_miembro;
+    envio.usado = 0;
+    int longitud = snprintf(texto, sizeof(texto), "[BUSQUEDA] '%s', más recientes primero:", descripcion);
+    anadir_a_tramo_historia(&envio, texto, (size_t)longitud);
+    for (int i = 0; i < n; i++) {
+        char directorio[SEGMENTOS_MAX_RUTA];
+        segmentos_directorio_sala(directorio, sizeof(directorio), resultados[i].sala);
+        lectura_resultado_t lectura = { &envio, resultados[i].sala, 0 };
+        segmentos_recorrer(directorio, resultados[i].secuencia, resultados[i].secuencia + 1, visitar_resultado, &lectura);
+        if (!lectura.encontrado) CONTADOR_SUMAR(t->estadisticas.busqueda_sin_texto, 1);
+    }
+    if (hay_mas) {
+        longitud = snprintf(texto, sizeof(texto), "[BUSQUEDA] Más antiguos: /search %s antes:%u", descripcion,
+                            resultados[n - 1].documento);
+    } else {
+        longitud = snprintf(texto, sizeof(texto), "[BUSQUEDA] Fin (%d resultados).", n);
+    }
+    anadir_a_tramo_historia(&envio, texto, (size_t)longitud < sizeof(texto) ? (size_t)longitud : sizeof(texto) - 1);
+    enviar_tramo_historia(&envio);
+    histograma_registrar(&t->estadisticas.busqueda_ns, (uint64_t)(ahora_ns() - inicio));
+}
+
+/**
+ * @brief Envía una notificación a todos los miembros de una sala.
+ */
+static void difundir_notificacion(trabajador_t* t, int indice_sala, const char* texto, int id_cola_excluida) {
+    size_t longitud = strnlen(texto, MAX_TEXTO + MAX_NOMBRE);
+    sala_t* sala = SALA(indice_sala);
+    CONTADOR_SUMAR(t->estadisticas.difusiones, 1);
+    histograma_registrar(&t->estadisticas.destinatarios, (uint64_t)sala->miembros.num);
+    if (sala->anillo != NULL) {
+        // Una sola copia para toda la sala; cada cliente omite lo que él mismo escribió
+        anillo_publicar(sala->anillo, texto, longitud, id_cola_excluida);
+        return;
+    }
+
+    // No se envía aquí: se añade al lote de cada destinatario, que sale al vencer su ventana.
+    // La exclusión se decide con los destinos seguidos, sin cargar la ficha de cada miembro
+    long long ahora = config.ventana_lote_us > 0 ? ahora_ns() : 0;
+    const miembros_sala_t* miembros = &sala->miembros;
+    for (int i = 0; i < miembros->num; i++) {
+        if (miembros->destinos[i] != id_cola_excluida) anadir_a_lote(t, miembros->manejadores[i], texto, longitud, ahora);
+    }
+}
+
+/**
+ * @brief Difunde un mensaje trazado. Por colas, cada destinatario recibe su propia
+ * trama, con la marca del envío que le toca, tras vaciar su lote para no adelantar
+ * a lo anterior. Por anillo no hay envío por miembro: la traza acaba en el servidor.
+ */
+static void difundir_trazado(trabajador_t* t, int indice_sala, const char* texto, int id_cola_excluida,
+                             const traza_t* traza) {
+    sala_t* sala = SALA(indice_sala);
+    if (sala->anillo != NULL) {
+        difundir_notificacion(t, indice_sala, texto, id_cola_excluida);
+        return;
+    }
+    CONTADOR_SUMAR(t->estadisticas.difusiones, 1);
+    histograma_registrar(&t->estadisticas.destinatarios, (uint64_t)sala->miembros.num);
+
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, TIPO_NOTIFICACION, 0, NULL, NULL, texto);
+    tamano = trama_trazar(&trama, tamano, traza);
+    const miembros_sala_t* miembros = &sala->miembros;
+    for (int i = 0; i < miembros->num; i++) {
+        if (miembros->destinos[i] == id_cola_excluida) continue;
+        vaciar_lote(t, miembros->manejadores[i]);
+        trama_marcar_traza(&trama, TRAZA_DIFUSION, (uint64_t)ahora_ns());
+        enviar_a_miembro(t, miembros->manejadores[i], &trama, tamano);
+    }
+}
+
+static void responder_a_miembro(trabajador_t* t, int indice_miembro, tipo_mensaje_t tipo, const char* texto) {
+    vaciar_lote(t, indice_miembro); // La respuesta no puede adelantar a notificaciones anteriores
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, tipo, 0, NULL, NULL, texto);
+    enviar_a_miembro(t, indice_miembro, &trama, tamano);
+}
+
+/**
+ * @brief Indica al miembro qué anillo leer (y desde dónde) o que suelte el que tiene.
+ */
+static void enviar_anillo_a_miembro(trabajador_t* t, int indice_miembro, const sala_t* sala, int conectar) {
+    vaciar_lote(t, indice_miembro);
+    // El cursor inicial es el siguiente mensaje: lo publicado antes de unirse no se muestra
+    char cursor[24];
+    snprintf(cursor, sizeof(cursor), "%llu", (unsigned long long)sala->anillo->publicados);
+    trama_t trama;
+    size_t tamano = trama_construir(&trama, TIPO_ANILLO_SALA, conectar ? sala->anillo->id_shm : -1, NULL, sala->nombre, cursor);
+    enviar_a_miembro(t, indice_miembro, &trama, tamano);
+}
+
+/**
+ * @brief Envía sin bloquear a un miembro. Si su cola está llena el mensaje
+ * se guarda en su buffer de diferidos, respetando el orden de lo ya pendiente.
+ */
+static void enviar_a_miembro(trabajador_t* t, int indice_miembro, const trama_t* trama, size_t tamano) {
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    if (miembro->expulsar) return;
+
+    if (miembro->num_pendientes == 0) {
+        if (transporte_enviar(miembro->id_cola, trama, tamano) == 0) {
+            CONTADOR_SUMAR(t->estadisticas.envios, 1);
+            return;
+        }
+        if (errno != EAGAIN) {
+            CONTADOR_SUMAR(t->estadisticas.envios_fallidos, 1);
+            // Su cola desapareció (cliente muerto): nada más hasta que el barrido cierre la sesión
+            if (errno == EIDRM || errno == EINVAL) miembro->expulsar = 1;
+            else perror("enviar_a_miembro");
+            return;
+        }
+        CONTADOR_SUMAR(t->estadisticas.envios_diferidos, 1);
+    }
+    diferir_mensaje(t, indice_miembro, trama, tamano);
+}
+
+/**
+ * @brief Guarda un mensaje en el buffer de diferidos aplicando la política de desborde.
+ */
+static void diferir_mensaje(trabajador_t* t, int indice_miembro, const trama_t* trama, size_t tamano) {
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    if (miembro->pendientes == NULL) {
+        miembro->pendientes = malloc((size_t)config.max_pendientes * sizeof(envio_diferido_t));
+        if (miembro->pendientes == NULL) {
+            contar_descarte(t, miembro);
+            return;
+        }
+    }
+
+    if (miembro->num_pendientes == config.max_pendientes) {
+        contar_descarte(t, miembro);
+        switch (config.desborde) {
+            case DESBORDE_DESCARTAR_ANTIGUO:
+                free(miembro->pendientes[miembro->inicio_pendientes].trama);
+                miembro->inicio_pendientes = (miembro->inicio_pendientes + 1) % config.max_pendientes;
+                miembro->num_pendientes--;
+                break;
+            case DESBORDE_DESCARTAR_NUEVO:
+                return;
+            case DESBORDE_DESCONECTAR:
+                // No se expulsa aquí: podríamos estar recorriendo la sala del miembro
+                miembro->expulsar = 1;
+                t->miembros_a_expulsar[t->num_miembros_a_expulsar++] = miembro->id_cola;
+                return;
+        }
+    }
+
+    // Se copia solo la parte usada de la trama
+    trama_t* copia = malloc(sizeof(long) + tamano);
+    if (copia == NULL) {
+        contar_descarte(t, miembro);
+        return;
+    }
+    memcpy(copia, trama, sizeof(long) + tamano);
+
+    int posicion = (miembro->inicio_pendientes + miembro->num_pendientes) % config.max_pendientes;
+    miembro->pendientes[posicion].trama = copia;
+    miembro->pendientes[posicion].tamano = tamano;
+    miembro->num_pendientes++;
+    miembro->mensajes_diferidos++;
+
+    if (!miembro->en_reintento) {
+        miembro->en_reintento = 1;
+        t->miembros_con_pendientes[t->num_miembros_con_pendientes++] = indice_miembro;
+    }
+}
+
+/**
+ * @brief Reintenta, sin bloquear y en orden, los envíos diferidos de cada miembro.
+ */
+static void reintentar_envios_pendientes(trabajador_t* t) {
+    int i = 0;
+    while (i < t->num_miembros_con_pendientes) {
+        miembro_t* miembro = MIEMBRO(t, t->miembros_con_pendientes[i]);
+        while (miembro->num_pendientes > 0) {
+            envio_diferido_t* envio = &miembro->pendientes[miembro->inicio_pendientes];
+            if (transporte_enviar(miembro->id_cola, envio->trama, envio->tamano) == -1) {
+                if (errno == EAGAIN) break;
+                CONTADOR_SUMAR(t->estadisticas.envios_fallidos, 1);
+                liberar_pendientes(miembro); // La cola ya no existe: no tiene sentido insistir
+                miembro->expulsar = 1;
+                break;
+            }
+            CONTADOR_SUMAR(t->estadisticas.envios, 1);
+            free(envio->trama);
+            miembro->inicio_pendientes = (miembro->inicio_pendientes + 1) % config.max_pendientes;
+            miembro->num_pendientes--;
+        }
+
+        if (miembro->num_pendientes == 0) {
+            miembro->inicio_pendientes = 0;
+            miembro->en_reintento = 0;
+            t->miembros_con_pendientes[i] = t->miembros_con_pendientes[--t->num_miembros_con_pendientes];
+        } else {
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief Añade una notificación al lote del miembro. Si no cabe, el lote sale antes.
+ */
+static void anadir_a_lote(trabajador_t* t, int indice_miembro, const char* texto, size_t longitud, long long ahora) {
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    if (miembro->expulsar) return;
+
+    size_t necesario = sizeof(longitud_registro_lote_t) + longitud;
+    if (miembro->lote != NULL && miembro->lote_usado + necesario > MAX_DATOS_TRAMA) {
+        vaciar_lote(t, indice_miembro);
+    }
+    if (miembro->lote == NULL) {
+        miembro->lote = malloc(sizeof(trama_t));
+        if (miembro->lote == NULL) {
+            contar_descarte(t, miembro);
+            return;
+        }
+    }
+
+    longitud_registro_lote_t cabecera = (longitud_registro_lote_t)longitud;
+    memcpy(miembro->lote->datos + miembro->lote_usado, &cabecera, sizeof(cabecera));
+    memcpy(miembro->lote->datos + miembro->lote_usado + sizeof(cabecera), texto, longitud);
+    miembro->lote_usado += necesario;
+    miembro->lote_registros++;
+
+    if (!miembro->en_lote) {
+        miembro->en_lote = 1;
+        miembro->lote_limite_ns = ahora + (long long)config.ventana_lote_us * 1000LL;
+        t->miembros_con_lote[t->num_miembros_con_lote++] = indice_miembro;
+    }
+}
+
+/**
+ * @brief Envía el lote del miembro: una trama simple si solo tiene un registro,
+ * una TIPO_NOTIFICACION_LOTE si tiene varios.
+ */
+static void vaciar_lote(trabajador_t* t, int indice_miembro) {
+    miembro_t* miembro = MIEMBRO(t, indice_miembro);
+    if (!miembro->en_lote) return;
+
+    trama_t* trama = miembro->lote;
+    if (miembro->lote_registros == 1) {
+        // Un solo registro: se desplaza el texto al principio y viaja sin sobrecoste
+        size_t longitud = miembro->lote_usado - sizeof(longitud_registro_lote_t);
+        memmove(trama->datos, trama->datos + sizeof(longitud_registro_lote_t), longitud);
+        trama->mtype = TIPO_NOTIFICACION;
+        trama->cabecera.longitud_texto = (uint16_t)longitud;
+    } else {
+        CONTADOR_SUMAR(t->estadisticas.tramas_lote, 1);
+        trama->mtype = TIPO_NOTIFICACION_LOTE;
+        trama->cabecera.longitud_texto = (uint16_t)miembro->lote_usado;
+    }
+    trama->cabecera.tipo = (uint16_t)trama->mtype;
+    trama->cabecera.id_cola_cliente = 0;
+    trama->cabecera.longitud_usuario = 0;
+    trama->cabecera.longitud_sala = 0;
+    trama->cabecera.banderas = 0;
+    size_t tamano = sizeof(cabecera_trama_t) + trama->cabecera.longitud_texto;
+
+    miembro->en_lote = 0;
+    miembro->lote_usado = 0;
+    miembro->lote_registros = 0;
+    quitar_de_lista(t->miembros_con_lote, &t->num_miembros_con_lote, indice_miembro);
+
+    enviar_a_miembro(t, indice_miembro, trama, tamano);
+}
+
+/**
+ * @brief Envía los lotes cuya ventana venció (todos si forzar).
+ * @return El límite más próximo de los lotes que siguen abiertos, o 0 si no queda ninguno.
+ */
+static long long vaciar_lotes_vencidos(trabajador_t* t, int forzar) {
+    if (t->num_miembros_con_lote == 0) return 0;
+    long long ahora = forzar ? 0 : ahora_ns();
+    long long proximo = 0;
+
+    int i = 0;
+    while (i < t->num_miembros_con_lote) {
+        int indice_miembro = t->miembros_con_lote[i];
+        miembro_t* miembro = MIEMBRO(t, indice_miembro);
+        if (forzar || miembro->lote_limite_ns <= ahora) {
+            vaciar_lote(t, indice_miembro); // Lo quita de la lista: no se avanza i
+        } else {
+            if (proximo == 0 || miembro->lote_limite_ns < proximo) proximo = miembro->lote_limite_ns;
+            i++;
+        }
+    }
+    return proximo;
+}
+
+/**
+ * @brief Quita un manejador de una lista desordenada (el último ocupa su hueco).
+ */
+static void quitar_de_lista(int* lista, int* num, int indice_miembro) {
+    for (int i = 0; i < *num; i++) {
+        if (lista[i] == indice_miembro) {
+            lista[i] = lista[--(*num)];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Libera las tramas diferidas de un miembro y su buffer.
+ */
+static void liberar_pendientes(miembro_t* miembro) {
+    if (miembro->pendientes != NULL) {
+        for (int i = 0; i < miembro->num_pendientes; i++) {
+            free(miembro->pendientes[(miembro->inicio_pendientes + i) % config.max_pendientes].trama);
+        }
+    }
+    free(miembro->pendientes);
+    miembro->pendientes = NULL;
+    miembro->inicio_pendientes = 0;
+    miembro->num_pendientes = 0;
+}
+
+/**
+ * @brief Pide al despachador la desconexión de los lectores lentos marcados por la
+ * política "desconectar", como si el propio cliente hubiera enviado su cierre.
+ */
+static void expulsar_miembros_lentos(trabajador_t* t) {
+    while (t->num_miembros_a_expulsar > 0) {
+        int id_cola = t->miembros_a_expulsar[t->num_miembros_a_expulsar - 1];
+        int indice_miembro = tabla_buscar(&t->indice_miembros, tabla_hash_entero(id_cola), &id_cola);
+        if (indice_miembro == -1) { // Ya se fue por su cuenta
+            t->num_miembros_a_expulsar--;
+            continue;
+        }
+        miembro_t* miembro = MIEMBRO(t, indice_miembro);
+        trama_t trama_cierre;
+        size_t tamano = trama_construir(&trama_cierre, TIPO_CIERRE_CLIENTE, miembro->id_cola, t->nombres[indice_miembro], NULL, NULL);
+        // Sin bloquear: si la cola del servidor está llena se reintenta en la próxima vuelta
+        if (transporte_inyectar(&trama_cierre, tamano) == -1) {
+            if (errno != EAGAIN) t->num_miembros_a_expulsar--;
+            break;
+        }
+        printf(" Cliente %s expulsado por no leer sus mensajes.\n", t->nombres[indice_miembro]);
+        CONTADOR_SUMAR(t->estadisticas.expulsiones, 1);
+        t->num_miembros_a_expulsar--;
+    }
+}
+
+/**
+ * @brief Guarda un mensaje en el historial de la sala (Bonus) y en su historia reciente.
+ * La escritura real la hace el hilo escritor por lotes (ver registro.c), con la
+ * secuencia que le asigna la historia.
+ */
+static void registrar_mensaje_en_log(sala_t* sala, const char* nombre_usuario, const char* texto, uint64_t traza) {
+    time_t ahora = time(NULL);
+    uint64_t secuencia = historia_anadir(&sala->historia, ahora, nombre_usuario, texto);
+    registro_encolar(sala->nombre, secuencia, ahora, nombre_usuario, texto, traza);
+}
@@ -0,0 +1,546 @@
+#include "transporte.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define MAX_EVENTOS_EPOLL 64
+#define MAX_INYECTADAS 64
+#define VUELTAS_SIN_SONDEO 16              // Con conexiones aún listas, cada cuántas lecturas se mira epoll
+#define MAX_CONEXIONES (1 << 16)           // El descriptor ocupa los 16 bits bajos del id
+#define BITS_DESCRIPTOR 16
+#define TAMANO_CABECERA_RED (sizeof(long)) // El mtype viaja delante de la trama
+
+// Conexión aceptada, indexada por su descriptor
+typedef struct {
+    int id;                  // Id vigente (0 = descriptor libre)
+    int generacion;          // Se incrementa cada vez que se cierra el descriptor
+    int en_listos;           // Tiene datos sin leer (figura en listos)
+    time_t ultima_actividad; // Última trama recibida
+} conexion_t;
+
+// Trama leída de un socket, a la espera de que el despachador la pida
+typedef struct {
+    size_t tamano;
+    trama_t trama;
+} trama_en_espera_t;
+
+typedef struct {
+    trama_en_espera_t* tramas;
+    int inicio;
+    int num;
+    uint64_t bytes;
+} espera_t;
+
+static tipo_transporte_t tipo_servidor = TRANSPORTE_SYSV;
+static struct sockaddr_un direccion_escucha; // Unix: socket de la partición del servidor
+
+// SysV
+static int id_cola_servidor = -1;
+
+// Unix: las estructuras de las conexiones solo las modifica el despachador
+static int fd_escucha = -1;
+static int fd_epoll = -1;
+static int fd_evento = -1;                 // Despierta epoll cuando otro hilo inyecta una solicitud
+static conexion_t* conexiones = NULL;
+static int capacidad_conexiones = 0;
+static pthread_rwlock_t cerrojo_conexiones = PTHREAD_RWLOCK_INITIALIZER; // Envíos frente a cierres
+static int* listos = NULL;                 // Disparo por flanco: se leen hasta EAGAIN, por turnos
+static int num_listos = 0;
+static espera_t espera_control, espera_datos;
+
+static pthread_mutex_t mutex_inyectadas = PTHREAD_MUTEX_INITIALIZER;
+static trama_en_espera_t* inyectadas = NULL;
+static int num_inyectadas = 0;
+
+int transporte_analizar(const char* nombre, tipo_transporte_t* tipo) {
+    if (strcmp(nombre, "sysv") == 0) *tipo = TRANSPORTE_SYSV;
+    else if (strcmp(nombre, "unix") == 0) *tipo = TRANSPORTE_UNIX;
+    else return -1;
+    return 0;
+}
+
+const char* transporte_nombre(tipo_transporte_t tipo) {
+    return tipo == TRANSPORTE_UNIX ? "unix" : "sysv";
+}
+
+/**
+ * @brief Socket de una partición: RUTA_SOCKET_SERVIDOR la 0, con ".N" detrás las demás.
+ */
+static void direccion_servidor(struct sockaddr_un* direccion, int particion) {
+    memset(direccion, 0, sizeof(*direccion));
+    direccion->sun_family = AF_UNIX;
+    if (particion == 0) snprintf(direccion->sun_path, sizeof(direccion->sun_path), "%s", RUTA_SOCKET_SERVIDOR);
+    else snprintf(direccion->sun_path, sizeof(direccion->sun_path), "%s.%d", RUTA_SOCKET_SERVIDOR, particion);
+}
+
+/**
+ * @brief Clave de la cola de una partición: la 0 es la de siempre.
+ */
+static key_t clave_servidor(int particion) {
+    return ftok(RUTA_CLAVE_SERVIDOR, ID_PROYECTO + particion);
+}
+
+
+// ---------------------------------------------------------------------------
+// Servidor Unix: conexiones y tramas en espera
+// ---------------------------------------------------------------------------
+
+static int espera_llena(const espera_t* espera) {
+    return espera->num == TRANSPORTE_TRAMAS_EN_ESPERA;
+}
+
+static void espera_meter(espera_t* espera, const trama_t* trama, size_t tamano) {
+    trama_en_espera_t* hueco = &espera->tramas[(espera->inicio + espera->num) % TRANSPORTE_TRAMAS_EN_ESPERA];
+    memcpy(&hueco->trama, trama, TAMANO_CABECERA_RED + tamano);
+    hueco->tamano = tamano;
+    espera->num++;
+    espera->bytes += tamano;
+}
+
+static ssize_t espera_sacar(espera_t* espera, trama_t* trama) {
+    if (espera->num == 0) return -1;
+    trama_en_espera_t* primera = &espera->tramas[espera->inicio];
+    memcpy(trama, &primera->trama, TAMANO_CABECERA_RED + primera->tamano);
+    espera->inicio = (espera->inicio + 1) % TRANSPORTE_TRAMAS_EN_ESPERA;
+    espera->num--;
+    espera->bytes -= primera->tamano;
+    return (ssize_t)primera->tamano;
+}
+
+static void marcar_listo(int fd) {
+    if (conexiones[fd].id == 0 || conexiones[fd].en_listos) return;
+    conexiones[fd].en_listos = 1;
+    listos[num_listos++] = fd;
+}
+
+static void quitar_de_listos(int fd) {
+    if (!conexiones[fd].en_listos) return;
+    conexiones[fd].en_listos = 0;
+    for (int i = 0; i < num_listos; i++) {
+        if (listos[i] == fd) {
+            listos[i] = listos[--num_listos];
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Cierra una conexión. Espera a que terminen los envíos en curso para que
+ * nadie escriba en el descriptor después de que otra conexión lo reutilice.
+ */
+static void cerrar_conexion(int fd) {
+    quitar_de_listos(fd);
+    pthread_rwlock_wrlock(&cerrojo_conexiones);
+    conexiones[fd].id = 0;
+    conexiones[fd].generacion++;
+    close(fd); // También lo saca del conjunto de epoll
+    pthread_rwlock_unlock(&cerrojo_conexiones);
+}
+
+/**
+ * @brief Acepta todas las conexiones pendientes (el socket de escucha es por flanco)
+ * y comunica a cada cliente su id.
+ */
+static void aceptar_conexiones(void) {
+    for (;;) {
+        int fd = accept4(fd_escucha, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept4");
+            return;
+        }
+        if (fd >= capacidad_conexiones) {
+            fprintf(stderr, " Conexión rechazada: no hay descriptores libres.\n");
+            close(fd);
+            continue;
+        }
+
+        conexion_t* conexion = &conexiones[fd];
+        // Generación en [1, 2^15): el id siempre es positivo y nunca 0
+        conexion->generacion = conexion->generacion % ((1 << (31 - BITS_DESCRIPTOR)) - 1) + 1;
+        int id = (conexion->generacion << BITS_DESCRIPTOR) | fd;
+        int32_t id_red = id;
+        struct epoll_event evento = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.fd = fd };
+        if (send(fd, &id_red, sizeof(id_red), MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t)sizeof(id_red) ||
+            epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd, &evento) == -1) {
+            close(fd);
+            continue;
+        }
+        conexion->id = id;
+        conexion->en_listos = 0;
+        conexion->ultima_actividad = time(NULL);
+    }
+}
+
+/**
+ * @brief Pasa a la espera de control las solicitudes inyectadas por otros hilos.
+ */
+static void recoger_inyectadas(void) {
+    if (__atomic_load_n(&num_inyectadas, __ATOMIC_RELAXED) == 0) return;
+    pthread_mutex_lock(&mutex_inyectadas);
+    int movidas = 0;
+    while (movidas < num_inyectadas && !espera_llena(&espera_control)) {
+        espera_meter(&espera_control, &inyectadas[movidas].trama, inyectadas[movidas].tamano);
+        movidas++;
+    }
+    memmove(inyectadas, inyectadas + movidas, (size_t)(num_inyectadas - movidas) * sizeof(trama_en_espera_t));
+    __atomic_store_n(&num_inyectadas, num_inyectadas - movidas, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex_inyectadas);
+}
+
+/**
+ * @brief Lee de las conexiones listas, una trama por conexión y vuelta para que
+ * nadie acapare al despachador, hasta que no quede nada o se llene una espera.
+ * Un cierre de la conexión se convierte en un TIPO_CIERRE_CLIENTE, como si el
+ * cliente se hubiera despedido.
+ */
+static void leer_conexiones(void) {
+    static trama_t trama;
+    recoger_inyectadas();
+    while (num_listos > 0 && !espera_llena(&espera_control) && !espera_llena(&espera_datos)) {
+        for (int i = 0; i < num_listos && !espera_llena(&espera_control) && !espera_llena(&espera_datos);) {
+            int fd = listos[i];
+            conexion_t* conexion = &conexiones[fd];
+            ssize_t leidos = recv(fd, &trama, sizeof(trama), MSG_DONTWAIT);
+            if (leidos == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                conexion->en_listos = 0;
+                listos[i] = listos[--num_listos]; // El hueco lo ocupa otro: no se avanza i
+                continue;
+            }
+            if (leidos == -1 && errno == EINTR) continue;
+            if (leidos <= 0) {
+                int id = conexion->id;
+                cerrar_conexion(fd);
+                size_t tamano = trama_construir(&trama, TIPO_CIERRE_CLIENTE, id, NULL, NULL, NULL);
+                espera_meter(&espera_control, &trama, tamano);
+                continue; // cerrar_conexion lo quitó de listos
+            }
+
+            size_t tamano = (size_t)leidos > TAMANO_CABECERA_RED ? (size_t)leidos - TAMANO_CABECERA_RED : 0;
+            if (tamano >= sizeof(cabecera_trama_t)) trama.cabecera.id_cola_cliente = conexion->id;
+            conexion->ultima_actividad = time(NULL);
+            espera_meter(trama.mtype == PRIORIDAD_DATOS ? &espera_datos : &espera_control, &trama, tamano);
+            i++;
+        }
+    }
+}
+
+/**
+ * @brief Atiende los eventos de epoll: conexiones nuevas, sockets con datos e inyecciones.
+ * @return 0, o -1 si epoll_wait falló (EINTR incluido).
+ */
+static int atender_eventos(int plazo_ms) {
+    struct epoll_event eventos[MAX_EVENTOS_EPOLL];
+    int n = epoll_wait(fd_epoll, eventos, MAX_EVENTOS_EPOLL, plazo_ms);
+    if (n == -1) return -1;
+    for (int i = 0; i < n; i++) {
+        int fd = eventos[i].data.fd;
+        if (fd == fd_escucha) {
+            aceptar_conexiones();
+        } else if (fd == fd_evento) {
+            uint64_t avisos;
+            if (read(fd_evento, &avisos, sizeof(avisos)) == -1 && errno != EAGAIN) perror("read eventfd");
+        } else {
+            marcar_listo(fd); // También con EPOLLRDHUP/EPOLLERR: recv lo detectará
+        }
+    }
+    return 0;
+}
+
+static ssize_t recibir_unix(trama_t* trama, long tipo, int bloquear) {
+    static int vueltas_sin_sondeo = 0;
+    for (;;) {
+        // Con la espera de control vacía se miran los sockets antes de dar paso al chat. Aunque
+        // queden conexiones listas se consulta epoll de vez en cuando: si no, un cliente que no
+        // deja de escribir ocultaría las conexiones nuevas y los datos de los demás
+        if (espera_control.num == 0) {
+            if (num_listos == 0 || ++vueltas_sin_sondeo >= VUELTAS_SIN_SONDEO) {
+                vueltas_sin_sondeo = 0;
+                if (atender_eventos(0) == -1) return -1;
+            }
+            leer_conexiones();
+        }
+        ssize_t tamano = -1;
+        if (tipo == 0) tamano = espera_sacar(&espera_control, trama);
+        if (tamano == -1 && (tipo == 0 || tipo == PRIORIDAD_DATOS)) tamano = espera_sacar(&espera_datos, trama);
+        if (tamano != -1) return tamano;
+        if (!bloquear) {
+            errno = ENOMSG;
+            return -1;
+        }
+        if (atender_eventos(-1) == -1) return -1;
+    }
+}
+
+static int abrir_unix(void) {
+    struct sockaddr_un direccion = direccion_escucha;
+
+    // Un socket que acepta conexiones es de otro servidor en marcha; si no, es un resto de una caída
+    int prueba = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (prueba != -1) {
+        int ocupado = connect(prueba, (struct sockaddr*)&direccion, sizeof(direccion)) == 0;
+        close(prueba);
+        if (ocupado) {
+            fprintf(stderr, "Ya hay un servidor escuchando en %s.\n", direccion.sun_path);
+            return -1;
+        }
+    }
+    unlink(direccion.sun_path);
+
+    struct rlimit limite;
+    capacidad_conexiones = MAX_CONEXIONES;
+    if (getrlimit(RLIMIT_NOFILE, &limite) == 0 && limite.rlim_cur < (rlim_t)capacidad_conexiones) {
+        capacidad_conexiones = (int)limite.rlim_cur;
+    }
+    conexiones = calloc((size_t)capacidad_conexiones, sizeof(conexion_t));
+    listos = malloc((size_t)capacidad_conexiones * sizeof(int));
+    espera_control.tramas = malloc(TRANSPORTE_TRAMAS_EN_ESPERA * sizeof(trama_en_espera_t));
+    espera_datos.tramas = malloc(TRANSPORTE_TRAMAS_EN_ESPERA * sizeof(trama_en_espera_t));
+    inyectadas = malloc(MAX_INYECTADAS * sizeof(trama_en_espera_t));
+    if (conexiones == NULL || listos == NULL || espera_control.tramas == NULL || espera_datos.tramas == NULL ||
+        inyectadas == NULL) {
+        perror("malloc transporte");
+        return -1;
+    }
+
+    fd_escucha = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_escucha == -1 || bind(fd_escucha, (struct sockaddr*)&direccion, sizeof(direccion)) == -1 ||
+        chmod(direccion.sun_path, 0666) == -1 || listen(fd_escucha, SOMAXCONN) == -1) {
+        perror(direccion.sun_path);
+        return -1;
+    }
+    fd_epoll = epoll_create1(EPOLL_CLOEXEC);
+    fd_evento = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event escucha = { .events = EPOLLIN | EPOLLET, .data.fd = fd_escucha };
+    struct epoll_event evento = { .events = EPOLLIN | EPOLLET, .data.fd = fd_evento };
+    if (fd_epoll == -1 || fd_evento == -1 || epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_escucha, &escucha) == -1 ||
+        epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_evento, &evento) == -1) {
+        perror("epoll");
+        return -1;
+    }
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Servidor: interfaz común
+// ---------------------------------------------------------------------------
+
+int transporte_servidor_abrir(tipo_transporte_t tipo, int particion) {
+    tipo_servidor = tipo;
+    direccion_servidor(&direccion_escucha, particion);
+    if (tipo == TRANSPORTE_UNIX) return abrir_unix();
+
+    key_t clave = clave_servidor(particion);
+    if (clave == -1) {
+        perror("ftok");
+        return -1;
+    }
+    id_cola_servidor = msgget(clave, IPC_CREAT | 0666);
+    if (id_cola_servidor == -1) {
+        perror("msgget");
+        return -1;
+    }
+    return 0;
+}
+
+int transporte_servidor_cerrar(int conservar) {
+    if (tipo_servidor == TRANSPORTE_SYSV) {
+        if (id_cola_servidor == -1) return -1;
+        // Conservada, la misma clave ftok la devuelve al próximo msgget
+        int resultado = conservar ? 0 : msgctl(id_cola_servidor, IPC_RMID, NULL);
+        if (resultado == -1) perror("msgctl cleanup");
+        id_cola_servidor = -1;
+        return resultado;
+    }
+
+    if (fd_escucha == -1) return -1;
+    for (int fd = 0; fd < capacidad_conexiones; fd++) {
+        if (conexiones[fd].id != 0) cerrar_conexion(fd);
+    }
+    close(fd_escucha);
+    fd_escucha = -1;
+    if (fd_epoll != -1) close(fd_epoll);
+    if (fd_evento != -1) close(fd_evento);
+    fd_epoll = fd_evento = -1;
+    return unlink(direccion_escucha.sun_path);
+}
+
+void transporte_servidor_describir(char* texto, size_t tamano) {
+    if (tipo_servidor == TRANSPORTE_UNIX) snprintf(texto, tamano, "el socket %s", direccion_escucha.sun_path);
+    else snprintf(texto, tamano, "la cola con ID: %d", id_cola_servidor);
+}
+
+ssize_t transporte_recibir(trama_t* trama, long tipo, int bloquear) {
+    if (tipo_servidor == TRANSPORTE_UNIX) return recibir_unix(trama, tipo, bloquear);
+    // MSG_NOERROR: una trama demasiado grande se recorta en lugar de atascar la cola.
+    // -LONG_MAX: una trama con un mtype desconocido también sale (y se rechaza) en vez de quedarse.
+    return msgrcv(id_cola_servidor, trama, MAX_TRAMA, tipo == 0 ? -LONG_MAX : tipo,
+                  MSG_NOERROR | (bloquear ? 0 : IPC_NOWAIT));
+}
+
+int transporte_enviar(int destino, const trama_t* trama, size_t tamano) {
+    if (tipo_servidor == TRANSPORTE_SYSV) return msgsnd(destino, trama, tamano, IPC_NOWAIT);
+
+    int fd = destino & ((1 << BITS_DESCRIPTOR) - 1);
+    if (destino <= 0 || fd >= capacidad_conexiones) {
+        errno = EIDRM;
+        return -1;
+    }
+    pthread_rwlock_rdlock(&cerrojo_conexiones);
+    ssize_t enviados = -1;
+    if (__atomic_load_n(&conexiones[fd].id, __ATOMIC_RELAXED) == destino) {
+        enviados = send(fd, trama, TAMANO_CABECERA_RED + tamano, MSG_DONTWAIT | MSG_NOSIGNAL);
+    } else {
+        errno = EIDRM;
+    }
+    pthread_rwlock_unlock(&cerrojo_conexiones);
+    if (enviados != -1) return 0;
+    if (errno == EWOULDBLOCK) errno = EAGAIN;
+    else if (errno != EAGAIN) errno = EIDRM; // EPIPE, ECONNRESET...: el cliente ya no está
+    return -1;
+}
+
+int transporte_inyectar(const trama_t* trama, size_t tamano) {
+    if (tipo_servidor == TRANSPORTE_SYSV) return msgsnd(id_cola_servidor, trama, tamano, IPC_NOWAIT);
+
+    pthread_mutex_lock(&mutex_inyectadas);
+    if (num_inyectadas == MAX_INYECTADAS) {
+        pthread_mutex_unlock(&mutex_inyectadas);
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(&inyectadas[num_inyectadas].trama, trama, TAMANO_CABECERA_RED + tamano);
+    inyectadas[num_inyectadas].tamano = tamano;
+    __atomic_store_n(&num_inyectadas, num_inyectadas + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&mutex_inyectadas);
+
+    uint64_t aviso = 1;
+    if (write(fd_evento, &aviso, sizeof(aviso)) == -1 && errno != EAGAIN) perror("write eventfd");
+    return 0;
+}
+
+int transporte_ocupacion(transporte_ocupacion_t* ocupacion) {
+    memset(ocupacion, 0, sizeof(*ocupacion));
+    if (tipo_servidor == TRANSPORTE_UNIX) {
+        // Lo que espera en los sockets no se ve; sí lo ya leído y sin despachar
+        int en_espera = espera_control.num + espera_datos.num;
+        ocupacion->mensajes = (uint64_t)en_espera;
+        ocupacion->bytes = espera_control.bytes + espera_datos.bytes;
+        ocupacion->capacidad_bytes = 2ULL * TRANSPORTE_TRAMAS_EN_ESPERA * MAX_TRAMA;
+        ocupacion->porcentaje = en_espera * 100 / (2 * TRANSPORTE_TRAMAS_EN_ESPERA);
+        return 0;
+    }
+
+    struct msqid_ds estado;
+    if (id_cola_servidor == -1 || msgctl(id_cola_servidor, IPC_STAT, &estado) == -1) return -1;
+    ocupacion->mensajes = estado.msg_qnum;
+    ocupacion->bytes = estado.__msg_cbytes;
+    ocupacion->capacidad_bytes = estado.msg_qbytes;
+    ocupacion->porcentaje = estado.msg_qbytes ? (int)(estado.__msg_cbytes * 100 / estado.msg_qbytes) : 0;
+    return 0;
+}
+
+int transporte_destino_estado(int destino, time_t* ultima_actividad) {
+    if (tipo_servidor == TRANSPORTE_SYSV) {
+        struct msqid_ds estado;
+        if (msgctl(destino, IPC_STAT, &estado) == -1) return errno == EINVAL || errno == EIDRM ? -1 : 0;
+        *ultima_actividad = estado.msg_rtime;
+        return 0;
+    }
+    int fd = destino & ((1 << BITS_DESCRIPTOR) - 1);
+    if (destino <= 0 || fd >= capacidad_conexiones || conexiones[fd].id != destino) return -1;
+    *ultima_actividad = conexiones[fd].ultima_actividad;
+    return 0;
+}
+
+int transporte_destino_cerrar(int destino) {
+    if (tipo_servidor == TRANSPORTE_SYSV) return msgctl(destino, IPC_RMID, NULL);
+    int fd = destino & ((1 << BITS_DESCRIPTOR) - 1);
+    if (destino <= 0 || fd >= capacidad_conexiones || conexiones[fd].id != destino) return -1;
+    cerrar_conexion(fd);
+    return 0;
+}
+
+
+// ---------------------------------------------------------------------------
+// Cliente
+// ---------------------------------------------------------------------------
+
+int transporte_conectar(transporte_cliente_t* cliente, tipo_transporte_t tipo, int particion) {
+    memset(cliente, 0, sizeof(*cliente));
+    cliente->tipo = tipo;
+    cliente->id_servidor = cliente->id_propio = cliente->fd = -1;
+
+    if (tipo == TRANSPORTE_SYSV) {
+        key_t clave = clave_servidor(particion);
+        if (clave == -1) return -1;
+        cliente->id_servidor = msgget(clave, 0);
+        if (cliente->id_servidor == -1) return -1;
+        cliente->id_propio = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+        return cliente->id_propio == -1 ? -1 : 0;
+    }
+
+    struct sockaddr_un direccion;
+    direccion_servidor(&direccion, particion);
+    cliente->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (cliente->fd == -1) return -1;
+    // Lo primero que envía el servidor es el id de la conexión
+    int32_t id_red;
+    if (connect(cliente->fd, (struct sockaddr*)&direccion, sizeof(direccion)) == -1 ||
+        recv(cliente->fd, &id_red, sizeof(id_red), 0) != (ssize_t)sizeof(id_red)) {
+        int error = errno ? errno : ECONNRESET;
+        close(cliente->fd);
+        cliente->fd = -1;
+        errno = error;
+        return -1;
+    }
+    cliente->id_propio = id_red;
+    return 0;
+}
+
+int transporte_cliente_enviar(transporte_cliente_t* cliente, const trama_t* trama, size_t tamano, int bloquear) {
+    if (cliente->tipo == TRANSPORTE_SYSV) return msgsnd(cliente->id_servidor, trama, tamano, bloquear ? 0 : IPC_NOWAIT);
+
+    if (send(cliente->fd, trama, TAMANO_CABECERA_RED + tamano, MSG_NOSIGNAL | (bloquear ? 0 : MSG_DONTWAIT)) != -1) return 0;
+    if (errno == EWOULDBLOCK) errno = EAGAIN;
+    else if (errno == EPIPE || errno == ECONNRESET) errno = EIDRM;
+    return -1;
+}
+
+ssize_t transporte_cliente_recibir(transporte_cliente_t* cliente, trama_t* trama, int bloquear) {
+    if (cliente->tipo == TRANSPORTE_SYSV) {
+        return msgrcv(cliente->id_propio, trama, MAX_TRAMA, 0, MSG_NOERROR | (bloquear ? 0 : IPC_NOWAIT));
+    }
+
+    ssize_t leidos = recv(cliente->fd, trama, sizeof(*trama), bloquear ? 0 : MSG_DONTWAIT);
+    if (leidos == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) errno = ENOMSG;
+        else if (errno != EINTR) errno = EIDRM;
+        return -1;
+    }
+    if (leidos == 0) { // El servidor cerró la conexión, o la cerramos nosotros
+        errno = EIDRM;
+        return -1;
+    }
+    return (size_t)leidos > TAMANO_CABECERA_RED ? leidos - (ssize_t)TAMANO_CABECERA_RED : 0;
+}
+
+void transporte_cliente_cerrar(transporte_cliente_t* cliente) {
+    if (cliente->tipo == TRANSPORTE_SYSV) {
+        // Destruye la cola y desbloquea msgrcv en el hilo receptor
+        if (cliente->id_propio != -1) msgctl(cliente->id_propio, IPC_RMID, NULL);
+    } else if (cliente->fd != -1) {
+        shutdown(cliente->fd, SHUT_RDWR);
+    }
+}
+
+void transporte_cliente_liberar(transporte_cliente_t* cliente) {
+    if (cliente->tipo == TRANSPORTE_UNIX && cliente->fd != -1) close(cliente->fd);
+    cliente->fd = -1;
+}
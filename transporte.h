@@ -0,0 +1,147 @@
+#ifndef TRANSPORTE_H
+#define TRANSPORTE_H
+
+#include "common.h"
+
+/*
+ * Transporte de tramas entre clientes y servidor, elegido al arrancar.
+ *
+ *  - TRANSPORTE_SYSV (por defecto): la cola System V del servidor, con clave
+ *    ftok(RUTA_CLAVE_SERVIDOR, ID_PROYECTO), y una cola privada por cliente.
+ *    El destino de una respuesta es el id de esa cola privada.
+ *  - TRANSPORTE_UNIX: sockets SOCK_SEQPACKET en RUTA_SOCKET_SERVIDOR, que
+ *    conservan los límites de cada trama. El despachador los atiende con un
+ *    bucle epoll por flanco (EPOLLET) y todas las escrituras son no
+ *    bloqueantes. El destino es un id de conexión que asigna el servidor al
+ *    aceptarla (descriptor + generación, para que un descriptor reutilizado no
+ *    reciba lo de otro) y que se comunica al cliente nada más conectar; el
+ *    servidor lo sobrescribe en cada trama recibida.
+ *
+ * Con varias particiones (common.h), la partición N escucha en la cola de clave
+ * ftok(RUTA_CLAVE_SERVIDOR, ID_PROYECTO + N) o en RUTA_SOCKET_SERVIDOR ".N"; la
+ * partición 0 usa la cola y el socket de siempre.
+ *
+ * En ambos casos la trama viaja entera (mtype incluido) y los tamaños son los
+ * de msgsnd/msgrcv: bytes tras el mtype. Los errores imitan a los de las colas
+ * para que el resto del código no distinga el transporte: EAGAIN si el destino
+ * está lleno, EIDRM si ya no existe, ENOMSG si no hay nada que recibir sin
+ * bloquear y EINTR si una señal interrumpió la espera.
+ */
+
+#define RUTA_SOCKET_SERVIDOR "/tmp/chat_servidor.sock"
+#define TRANSPORTE_TRAMAS_EN_ESPERA 128 // Tramas leídas de los sockets por prioridad, aún sin despachar
+
+typedef enum {
+    TRANSPORTE_SYSV = 0,
+    TRANSPORTE_UNIX,
+} tipo_transporte_t;
+
+// Ocupación de la entrada del servidor (para /stats y el control de admisión)
+typedef struct {
+    uint64_t mensajes;
+    uint64_t bytes;
+    uint64_t capacidad_bytes;
+    int porcentaje;          // Ocupación respecto del límite del transporte (0-100)
+} transporte_ocupacion_t;
+
+/**
+ * @brief Traduce "sysv" o "unix".
+ * @return 0 si el nombre es válido, -1 si no.
+ */
+int transporte_analizar(const char* nombre, tipo_transporte_t* tipo);
+const char* transporte_nombre(tipo_transporte_t tipo);
+
+// Lado servidor: solo el despachador recibe y cierra destinos; cualquier hilo envía
+
+/**
+ * @brief Crea la cola del servidor o el socket de escucha y su bucle epoll.
+ * @param particion 0 sin particiones.
+ * @return 0 si todo fue bien, -1 en caso de error (ya informado).
+ */
+int transporte_servidor_abrir(tipo_transporte_t tipo, int particion);
+
+/**
+ * @brief Borra la cola o cierra las conexiones y el socket de escucha.
+ * @param conservar Reinicio en caliente: la cola System V se deja viva, con lo que
+ * contenga, para el siguiente servidor. Las conexiones Unix se cierran siempre.
+ * @return 0 si se eliminó (o se conservó), -1 si no había nada abierto o falló.
+ */
+int transporte_servidor_cerrar(int conservar);
+
+/**
+ * @brief Describe dónde escucha el servidor ("la cola con ID: N" o la ruta del socket).
+ */
+void transporte_servidor_describir(char* texto, size_t tamano);
+
+/**
+ * @brief Recibe una solicitud. Con tipo 0 sale primero la de mtype más bajo (el
+ * control antes que el chat); con un tipo concreto, solo las de ese mtype.
+ * @return Bytes tras el mtype, o -1 (errno EINTR, o ENOMSG si !bloquear).
+ */
+ssize_t transporte_recibir(trama_t* trama, long tipo, int bloquear);
+
+/**
+ * @brief Envía sin bloquear a un cliente.
+ * @return 0 si se envió, -1 con errno EAGAIN (lleno), EIDRM (ya no existe) u otro.
+ */
+int transporte_enviar(int destino, const trama_t* trama, size_t tamano);
+
+/**
+ * @brief Deja una solicitud en la entrada del propio servidor, sin bloquear.
+ * @return 0 si se encoló, -1 con errno EAGAIN si no cabe.
+ */
+int transporte_inyectar(const trama_t* trama, size_t tamano);
+
+int transporte_ocupacion(transporte_ocupacion_t* ocupacion);
+
+/**
+ * @brief Comprueba si un destino sigue existiendo.
+ * @param ultima_actividad Última lectura de su cola (SysV) o última trama recibida de él (Unix).
+ * @return 0 si existe, -1 si ya no.
+ */
+int transporte_destino_estado(int destino, time_t* ultima_actividad);
+
+/**
+ * @brief Borra la cola de un cliente (IPC_RMID) o cierra su conexión.
+ * @return 0 si había algo que eliminar, -1 si no.
+ */
+int transporte_destino_cerrar(int destino);
+
+// Lado cliente: una conexión por cliente y partición (carga abre una por bot)
+typedef struct {
+    tipo_transporte_t tipo;
+    int id_servidor;         // SysV: cola del servidor
+    int id_propio;           // Id con el que el servidor lo conoce (cola privada o conexión)
+    int fd;                  // Unix: socket conectado
+} transporte_cliente_t;
+
+/**
+ * @brief Conecta con el servidor de una partición (0 sin particiones).
+ * No informa de los errores: quien llama decide.
+ * @return 0 si todo fue bien, -1 con errno si no hay servidor o falló algo.
+ */
+int transporte_conectar(transporte_cliente_t* cliente, tipo_transporte_t tipo, int particion);
+
+/**
+ * @brief Envía una solicitud al servidor.
+ * @return 0 si se envió, -1 con errno (EAGAIN si !bloquear y no cabe).
+ */
+int transporte_cliente_enviar(transporte_cliente_t* cliente, const trama_t* trama, size_t tamano, int bloquear);
+
+/**
+ * @brief Recibe una trama del servidor.
+ * @return Bytes tras el mtype, o -1 (errno ENOMSG si !bloquear, EIDRM si se cerró).
+ */
+ssize_t transporte_cliente_recibir(transporte_cliente_t* cliente, trama_t* trama, int bloquear);
+
+/**
+ * @brief Corta la conexión: el hilo bloqueado en transporte_cliente_recibir vuelve con EIDRM.
+ */
+void transporte_cliente_cerrar(transporte_cliente_t* cliente);
+
+/**
+ * @brief Libera el descriptor una vez que ningún hilo lo usa.
+ */
+void transporte_cliente_liberar(transporte_cliente_t* cliente);
+
+#endif // TRANSPORTE_H
@@ -0,0 +1,98 @@
+#include "traza.h"
+#include <pthread.h>
+#include <inttypes.h>
+
+// El archivo se abre antes de arrancar los hilos y se cierra cuando ya terminaron;
+// lo escriben los trabajadores y el escritor de historial a la vez
+static pthread_mutex_t mutex_traza = PTHREAD_MUTEX_INITIALIZER;
+static FILE* archivo_traza = NULL;
+static uint64_t eventos_escritos = 0;
+
+static const char* const nombres_etapa[NUM_ETAPAS_TRAZA] = {
+    "cola servidor", "despachador", "cola trabajador", "difusion", "entrega", "registro",
+};
+
+int traza_abrir(const char* ruta) {
+    archivo_traza = fopen(ruta, "w");
+    if (archivo_traza == NULL) {
+        perror("fopen traza");
+        return -1;
+    }
+    // Metadatos: cada etapa es un "hilo" con su nombre, en el orden del recorrido
+    int pid = (int)getpid();
+    fprintf(archivo_traza, "[\n");
+    for (int i = 0; i < NUM_ETAPAS_TRAZA; i++) {
+        fprintf(archivo_traza,
+                "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n"
+                "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"sort_index\":%d}}",
+                i == 0 ? "" : ",\n", pid, i, nombres_etapa[i], pid, i, i);
+    }
+    eventos_escritos = 0;
+    return 0;
+}
+
+int traza_activa(void) {
+    return archivo_traza != NULL;
+}
+
+const char* traza_nombre_etapa(etapa_traza_t etapa) {
+    return etapa >= 0 && etapa < NUM_ETAPAS_TRAZA ? nombres_etapa[etapa] : "?";
+}
+
+int traza_etapa(const traza_t* traza, etapa_traza_t etapa, uint64_t fin_ns, uint64_t* inicio, uint64_t* duracion) {
+    uint64_t desde, hasta;
+    if (etapa < ETAPA_DIFUSION) {
+        desde = traza->marcas_ns[etapa];
+        hasta = traza->marcas_ns[etapa + 1];
+    } else if (etapa == ETAPA_DIFUSION) {
+        // En el servidor el envío a cada miembro no tiene marca: termina al acabar el reparto
+        desde = traza->marcas_ns[TRAZA_TRABAJADOR];
+        hasta = traza->marcas_ns[TRAZA_DIFUSION] != 0 ? traza->marcas_ns[TRAZA_DIFUSION] : fin_ns;
+    } else if (etapa == ETAPA_ENTREGA) {
+        desde = traza->marcas_ns[TRAZA_DIFUSION];
+        hasta = fin_ns;
+    } else {
+        return -1;
+    }
+    if (desde == 0 || hasta == 0 || hasta < desde) return -1;
+    *inicio = desde;
+    *duracion = hasta - desde;
+    return 0;
+}
+
+void traza_evento(etapa_traza_t etapa, uint64_t id, uint64_t inicio_ns, uint64_t fin_ns) {
+    if (archivo_traza == NULL) return;
+    uint64_t duracion = fin_ns > inicio_ns ? fin_ns - inicio_ns : 0;
+    pthread_mutex_lock(&mutex_traza);
+    if (archivo_traza != NULL) {
+        // ts y dur van en microsegundos; con tres decimales no se pierde resolución
+        fprintf(archivo_traza,
+                ",\n{\"name\":\"%s\",\"cat\":\"chat\",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64 ".%03u,"
+                "\"pid\":%d,\"tid\":%d,\"args\":{\"traza\":\"%016" PRIx64 "\"}}",
+                traza_nombre_etapa(etapa), inicio_ns / 1000, (unsigned int)(inicio_ns % 1000),
+                duracion / 1000, (unsigned int)(duracion % 1000), (int)getpid(), (int)etapa, id);
+        eventos_escritos++;
+    }
+    pthread_mutex_unlock(&mutex_traza);
+}
+
+void traza_etapas(const traza_t* traza, etapa_traza_t ultima, uint64_t fin_ns) {
+    if (archivo_traza == NULL) return;
+    for (int etapa = ETAPA_COLA_SERVIDOR; etapa <= (int)ultima; etapa++) {
+        uint64_t inicio, duracion;
+        if (traza_etapa(traza, (etapa_traza_t)etapa, fin_ns, &inicio, &duracion) == 0) {
+            traza_evento((etapa_traza_t)etapa, traza->id, inicio, inicio + duracion);
+        }
+    }
+}
+
+uint64_t traza_cerrar(void) {
+    pthread_mutex_lock(&mutex_traza);
+    if (archivo_traza != NULL) {
+        fprintf(archivo_traza, "\n]\n");
+        if (fclose(archivo_traza) != 0) perror("fclose traza");
+        archivo_traza = NULL;
+    }
+    pthread_mutex_unlock(&mutex_traza);
+    return eventos_escritos;
+}
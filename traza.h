@@ -0,0 +1,83 @@
+#ifndef TRAZA_H
+#define TRAZA_H
+
+#include "common.h"
+
+/*
+ * Trazas de latencia de extremo a extremo (servidor -X, cliente -t y -m).
+ *
+ * El cliente marca como trazado uno de cada N mensajes de chat (TRAMA_TRAZADA):
+ * la trama lleva un traza_t con su identificador y las marcas de cada etapa
+ * (common.h), que rellenan el despachador, el trabajador y, por cada
+ * destinatario, el envío. Las marcas son de CLOCK_MONOTONIC, compartido por
+ * todos los procesos de la máquina, así que se restan sin ajustar relojes.
+ * Cada tramo entre dos marcas seguidas es una etapa; la última termina cuando
+ * el destinatario lo recibe y la del historial, cuando el escritor lo deja en
+ * su segmento.
+ *
+ * Cada proceso escribe las etapas que ve en su propio archivo, en el formato
+ * JSON de eventos de traza de Chrome (chrome://tracing, Perfetto): un evento
+ * "X" por etapa, con la etapa como hilo y el identificador en args. Con la
+ * traza cerrada, todo esto se reduce a comprobar una bandera por mensaje.
+ */
+
+typedef enum {
+    ETAPA_COLA_SERVIDOR = 0,   // Envío del autor -> despachador (cola o socket del servidor)
+    ETAPA_DESPACHADOR,         // Validación, límites y encargo a la sala
+    ETAPA_COLA_TRABAJADOR,     // Espera en la cola de tareas del trabajador
+    ETAPA_DIFUSION,            // Reparto a los miembros hasta el envío a cada uno
+    ETAPA_ENTREGA,             // Cola del destinatario hasta que su cliente lo lee
+    ETAPA_REGISTRO,            // Encolado en el historial -> escrito en el segmento
+    NUM_ETAPAS_TRAZA,
+} etapa_traza_t;
+
+/**
+ * @brief Instante actual de CLOCK_MONOTONIC en nanosegundos (el de las marcas).
+ */
+static inline uint64_t traza_ahora_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Crea (o vacía) el archivo de trazas y abre su array de eventos.
+ * @return 0 si todo fue bien, -1 en caso de error (ya informado).
+ */
+int traza_abrir(const char* ruta);
+
+/**
+ * @brief Indica si hay archivo de trazas abierto.
+ */
+int traza_activa(void);
+
+/**
+ * @brief Nombre legible de una etapa.
+ */
+const char* traza_nombre_etapa(etapa_traza_t etapa);
+
+/**
+ * @brief Duración de una etapa según las marcas (fin_ns cierra ETAPA_DIFUSION o
+ * ETAPA_ENTREGA, que no tienen marca final propia).
+ * @return 0 si tiene el inicio y el fin, -1 si falta alguno.
+ */
+int traza_etapa(const traza_t* traza, etapa_traza_t etapa, uint64_t fin_ns, uint64_t* inicio, uint64_t* duracion);
+
+/**
+ * @brief Escribe un evento de una etapa. Se puede llamar desde cualquier hilo;
+ * no hace nada si la traza está cerrada.
+ */
+void traza_evento(etapa_traza_t etapa, uint64_t id, uint64_t inicio_ns, uint64_t fin_ns);
+
+/**
+ * @brief Escribe las etapas de ETAPA_COLA_SERVIDOR a ultima que tengan sus marcas.
+ */
+void traza_etapas(const traza_t* traza, etapa_traza_t ultima, uint64_t fin_ns);
+
+/**
+ * @brief Cierra el array de eventos y el archivo.
+ * @return Eventos escritos.
+ */
+uint64_t traza_cerrar(void);
+
+#endif // TRAZA_H